@@ -16,6 +16,7 @@
 #endif
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <hiredis/hiredis.h>
 #include <syslog.h>
 
@@ -24,6 +25,21 @@
 //	this should be turned off in releases eventually
 #define ATOM_PRINT_LOGS
 
+// Most verbose log level that's compiled in. Logs above this are thrown
+//	out by ATOM_LOG_ENABLED without a call, so building with e.g.
+//	-DATOM_LOG_MAX_LEVEL=LOG_INFO removes the cost of debug logs entirely
+#ifndef ATOM_LOG_MAX_LEVEL
+#define ATOM_LOG_MAX_LEVEL LOG_DEBUG
+#endif
+
+// Environment variable with the most verbose log level to send at runtime
+#define ATOM_LOG_LEVEL_ENV "ATOM_LOG_LEVEL"
+
+// Whether a log at level would be sent. Check this before formatting
+//	anything expensive
+#define ATOM_LOG_ENABLED(level) \
+	(((level) <= ATOM_LOG_MAX_LEVEL) && atom_log_enabled(level))
+
 struct element;
 
 //
@@ -52,6 +68,15 @@ enum atom_error_t {
 
 #define ATOM_LOG_STREAM_NAME "log"
 
+// Registry of the elements and data streams in the system s.t. they can
+//	be found without scanning the keyspace. Both are sorted sets kept in
+//	lexical order, the streams as "element:stream", and the version is
+//	bumped on every change for anyone caching them. Each server keeps the
+//	registry of the streams that live on it
+#define ATOM_REGISTRY_ELEMENTS "registry:elements"
+#define ATOM_REGISTRY_STREAMS "registry:streams"
+#define ATOM_REGISTRY_VERSION "registry:version"
+
 #define ATOM_VERSION_KEY "version"
 #define ATOM_LANGUAGE_KEY "language"
 
@@ -82,6 +107,34 @@ enum cmd_keys_t {
 	CMD_N_KEYS,
 };
 
+//
+// Additional (optional) key in a command. Its presence tells the element
+//	that the caller isn't waiting on an ACK, only on the response
+//
+
+#define COMMAND_KEY_FAST_STR "fast"
+
+enum fast_cmd_keys_t {
+	CMD_KEY_FAST = CMD_N_KEYS,
+	FAST_CMD_N_KEYS,
+};
+
+//
+// Additional (optional) key in a command with the caller's deadline, see
+//	atom_time_ms(). The element drops the command without handling it
+//	if it gets to it after then
+//
+
+#define COMMAND_KEY_DEADLINE_STR "deadline"
+
+enum deadline_cmd_keys_t {
+	CMD_KEY_DEADLINE = FAST_CMD_N_KEYS,
+	CMD_MAX_N_KEYS,
+};
+
+// Deadline of a command that can take as long as it needs
+#define ATOM_NO_DEADLINE 0
+
 //
 // Keys shared in each response from the element
 //
@@ -154,8 +207,34 @@ struct atom_list_node {
 	struct atom_list_node *next;
 };
 
+// Adds/removes an element to/from the registry
+enum atom_error_t atom_registry_add_element(
+	redisContext *ctx,
+	const char *element);
+enum atom_error_t atom_registry_remove_element(
+	redisContext *ctx,
+	const char *element);
+
+// Adds/removes a data stream to/from the registry by its key, as made by
+//	atom_get_data_stream_str()
+enum atom_error_t atom_registry_add_stream(
+	redisContext *ctx,
+	const char *stream_key);
+enum atom_error_t atom_registry_remove_stream(
+	redisContext *ctx,
+	const char *stream_key);
+
+// Gets the version of the registry on the server. It changes whenever
+//	anything is added or removed, and is 0 if nothing ever has been
+enum atom_error_t atom_registry_get_version(
+	redisContext *ctx,
+	long long *version);
+
 // Calls the associated data_cb for each element that's present in the system.
-//	NOTE: duplicates may occur
+//	Elements come from the registry, in order. If nothing has ever been
+//	registered, e.g. the elements predate the registry, or the registry
+//	can't be read then falls back to scanning the keyspace, in which case
+//	duplicates may occur
 enum atom_error_t atom_get_all_elements_cb(
 	redisContext *ctx,
 	bool (*data_cb)(const char *element, void* user_data),
@@ -163,8 +242,8 @@ enum atom_error_t atom_get_all_elements_cb(
 
 // Calls the associated data_cb for all streams in the system. If element is
 //	NULL then will return all streams in the ststem, else just streams
-//	belonging to the passed element.
-//	NOTE: duplicates may occur
+//	belonging to the passed element. Same as above as far as the registry
+//	goes
 enum atom_error_t atom_get_all_data_streams_cb(
 	redisContext *ctx,
 	const char *element,
@@ -211,7 +290,27 @@ char *atom_get_data_stream_str(
 	const char *name,
 	char buffer[ATOM_NAME_MAXLEN]);
 
-// Logs a message to the standard log stream
+// Gets the time that deadlines are in, milliseconds since the epoch.
+//	Deadlines are passed between elements so this is the wall clock, and
+//	the hosts they run on need their clocks in sync
+int64_t atom_time_ms(void);
+
+// Gets the deadline that's timeout_ms from now
+int64_t atom_deadline_ms(
+	int timeout_ms);
+
+// Sets the most verbose level that will be logged. The default comes from
+//	ATOM_LOG_LEVEL_ENV and is LOG_DEBUG if that's not set
+enum atom_error_t atom_log_set_level(
+	int level);
+int atom_log_get_level(void);
+
+// Whether a log at this level would be sent
+bool atom_log_enabled(
+	int level);
+
+// Logs a message to the standard log stream. The log is queued and
+//	written by a background thread, so this never talks to redis
 enum atom_error_t atom_log(
 	redisContext *ctx,
 	struct element *element,
@@ -237,6 +336,9 @@ enum atom_error_t atom_logf(
 	const char *fmt,
 	...);
 
+// Waits for the logs queued so far to be written to the log stream
+enum atom_error_t atom_log_flush(void);
+
 #ifdef __cplusplus
  }
 #endif
@@ -0,0 +1,108 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @file codec.h
+//
+//  @brief Header for compressing the values in entries and commands
+//
+//  @copy 2018 Elementary Robotics. All rights reserved.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __ATOM_CODEC_H
+#define __ATOM_CODEC_H
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <hiredis/hiredis.h>
+
+#include "redis.h"
+
+// Key that notes the codec used in an entry, in the same way that "ser"
+//	notes the serialization. Its value is the name of the codec
+#define CODEC_KEY_STR "cmp"
+
+#define CODEC_NONE_STR "none"
+#define CODEC_LZ4_STR "lz4"
+#define CODEC_ZSTD_STR "zstd"
+
+// Values smaller than this aren't compressed by default since the
+//	savings aren't worth the time
+#define CODEC_DEFAULT_MIN_SIZE 1024
+
+// zstd compression level
+#define CODEC_ZSTD_LEVEL 3
+
+// Every value in an entry with the codec key that starts with the magic is
+//	framed. The magic is followed by a byte that says whether the value
+//	is compressed, and if it is then the little-endian 32-bit length of
+//	the original value and then the compressed data. Otherwise it's the
+//	original value, which only happens if it started with the magic
+#define CODEC_FRAME_MAGIC "\x89" "CMP"
+#define CODEC_FRAME_MAGIC_LEN 4
+#define CODEC_FRAME_STORED 0
+#define CODEC_FRAME_COMPRESSED 1
+#define CODEC_FRAME_STORED_LEN (CODEC_FRAME_MAGIC_LEN + 1)
+#define CODEC_FRAME_COMPRESSED_LEN (CODEC_FRAME_MAGIC_LEN + 1 + 4)
+
+// LZ4 is fast enough to not add much latency, zstd compresses better.
+//	Each is only available if atom was built with it, see
+//	ATOM_HAVE_LZ4 and ATOM_HAVE_ZSTD
+enum codec_type {
+	CODEC_NONE,
+	CODEC_LZ4,
+	CODEC_ZSTD,
+	CODEC_N_TYPES
+};
+
+// Values to XADD once compressed. Either points at the original items,
+//	if nothing needed compressing, or at a copy with the compressed values
+//	and the codec key added
+struct codec_encoded_items {
+	struct redis_xadd_info *items;
+	size_t n_items;
+	uint8_t **buffers;
+	size_t n_buffers;
+};
+
+// Gets the name of a codec and the codec with a name
+const char *codec_name(
+	enum codec_type codec);
+bool codec_from_name(
+	const char *name,
+	size_t len,
+	enum codec_type *codec);
+
+// Returns whether we were built with the codec
+bool codec_available(
+	enum codec_type codec);
+
+// Compresses the values of at least min_size bytes. If none of them are
+//	that big, or compressing didn't make them smaller, then the items are
+//	left as-is, as they are if one of them already has the codec key. If
+//	the codec isn't available then logs once and leaves them. The items
+//	must stay around until the encoded items are cleaned up
+void codec_encode_items(
+	enum codec_type codec,
+	size_t min_size,
+	struct redis_xadd_info *items,
+	size_t n_items,
+	struct codec_encoded_items *encoded);
+void codec_encoded_items_cleanup(
+	struct codec_encoded_items *encoded);
+
+// Decodes the values in the key/value array of an entry in place if it
+//	has the codec key naming a codec. The decoded values are owned by the
+//	reply and freed along with it. Returns false if a value couldn't be
+//	decoded
+bool codec_decode_reply(
+	redisReply *reply);
+
+#ifdef __cplusplus
+ }
+#endif
+
+#endif // __ATOM_CODEC_H
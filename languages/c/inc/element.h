@@ -44,7 +44,19 @@ struct element {
 		char last_id[STREAM_ID_BUFFLEN];
 		redisContext *ctx;
 		struct element_command *hash[ELEMENT_COMMAND_HASH_N_BINS];
+
+		// Consumer group info. group is NULL unless the element has
+		//	been set up with element_command_use_group
+		char *group;
+		char *consumer;
+		int claim_idle_ms;
 	} command;
+
+	// Codecs for the data of commands we send, see element_command_set_codec
+	struct element_command_codec *command_codecs;
+
+	// Whether we started metrics
+	bool metrics;
 };
 
 // Initializes an element of the given name.
@@ -17,10 +17,68 @@
 
 #include "atom.h"
 #include "redis.h"
+#include "codec.h"
+
+// How long to wait for the ACK of a command, in milliseconds, if the
+//	command's deadline isn't sooner
+#define ELEMENT_COMMAND_ACK_TIMEOUT 100000
 
 // Forward declaration of the element struct
 struct element;
 
+// One of the elements a command is sent to by element_command_send_multi.
+//	The caller fills in cmd_elem and the user_data to pass to the response
+//	callback, and the rest is filled in with how the command went.
+//	error_str is NULL or must be freed
+struct element_command_target {
+	const char *cmd_elem;
+	void *user_data;
+	enum atom_error_t err_code;
+	char *error_str;
+	char cmd_id[STREAM_ID_BUFFLEN];
+};
+
+// Codec used for the data of commands sent to an element. If cmd is NULL
+//	then it's used for all of the element's commands that don't have one
+//	of their own
+struct element_command_codec {
+	char *cmd_elem;
+	char *cmd;
+	enum codec_type codec;
+	size_t min_size;
+	struct element_command_codec *next;
+};
+
+// Compresses the data of commands sent to cmd_elem, or just its command
+//	cmd if non-NULL, with the codec if it's at least min_size bytes. Pass
+//	CODEC_NONE to stop compressing. The codec key tells the element to
+//	decompress the data before handing it to the command's handler.
+//	Responses aren't compressed. Not thread-safe with sending commands,
+//	so set the codecs up front
+void element_command_set_codec(
+	struct element *elem,
+	const char *cmd_elem,
+	const char *cmd,
+	enum codec_type codec,
+	size_t min_size);
+
+// Frees the element's command codecs
+void element_command_codecs_cleanup(
+	struct element *elem);
+
+// Writes a command with the given data to the element's command stream
+//	and returns without waiting for the ACK or response. The ID of the
+//	command is copied into cmd_id for matching against the ACK and
+//	response on the sending element's response stream.
+enum atom_error_t element_command_send_request(
+	redisContext *ctx,
+	struct element *elem,
+	const char *cmd_elem,
+	const char *cmd,
+	const uint8_t *data,
+	size_t data_len,
+	char cmd_id[STREAM_ID_BUFFLEN]);
+
 // Sends a command with the given data to the given stream. If
 //	block is true, will wait until the response is completed. If response_cb
 //	is also non-null then will call response_cb with the data in the response
@@ -40,6 +98,68 @@ enum atom_error_t element_command_send(
 	void *user_data,
 	char **error_str);
 
+// Same as above, but gives up once deadline_ms, see atom_time_ms(),
+//	passes no matter how long the element said the command would take.
+//	The deadline is sent along with the command s.t. the element doesn't
+//	bother with it if it's already too late. ATOM_NO_DEADLINE waits as
+//	long as the ACK and element say
+enum atom_error_t element_command_send_deadline(
+	redisContext *ctx,
+	struct element *elem,
+	const char *cmd_elem,
+	const char *cmd,
+	const uint8_t *data,
+	size_t data_len,
+	bool block,
+	int64_t deadline_ms,
+	bool (*response_cb)(
+		const uint8_t *response,
+		size_t response_len,
+		void *user_data),
+	void *user_data,
+	char **error_str);
+
+// Sends the same command with the same data to each of the targets and
+//	waits for all of the responses. The commands all go out at once and
+//	the responses are read as they come in, so it takes about as long as
+//	the slowest of them. response_cb is called with each response that has
+//	data along with the target's user_data. Each target gets its own error
+//	code, and the first of those that isn't ATOM_NO_ERROR is returned.
+//	deadline_ms is the same as for element_command_send_deadline
+enum atom_error_t element_command_send_multi(
+	redisContext *ctx,
+	struct element *elem,
+	struct element_command_target *targets,
+	size_t n_targets,
+	const char *cmd,
+	const uint8_t *data,
+	size_t data_len,
+	int64_t deadline_ms,
+	bool (*response_cb)(
+		const uint8_t *response,
+		size_t response_len,
+		void *user_data));
+
+// Sends a command that the element added with ELEMENT_COMMAND_FLAG_FAST
+//	and waits for the response. The element doesn't send an ACK so the
+//	whole command costs a single round trip. timeout_ms is the total time
+//	to wait for the response, from when the command is sent, and is sent
+//	along as the command's deadline.
+enum atom_error_t element_command_send_fast(
+	redisContext *ctx,
+	struct element *elem,
+	const char *cmd_elem,
+	const char *cmd,
+	const uint8_t *data,
+	size_t data_len,
+	int timeout_ms,
+	bool (*response_cb)(
+		const uint8_t *response,
+		size_t response_len,
+		void *user_data),
+	void *user_data,
+	char **error_str);
+
 #ifdef __cplusplus
  }
 #endif
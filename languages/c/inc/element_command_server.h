@@ -30,6 +30,36 @@ struct element;
 
 #define ELEMENT_COMMAND_LOOP_NO_TIMEOUT 0
 
+// How long a looping command loop waits after a failed read of the command
+//	stream before reading again. Doubles with each failure in a row, up to
+//	the max
+#define ELEMENT_COMMAND_LOOP_RETRY_MIN_MS 10
+#define ELEMENT_COMMAND_LOOP_RETRY_MAX_MS 1000
+
+// Passing this as the claim time to element_command_use_group turns off
+//	claiming commands from other consumers in the group
+#define ELEMENT_COMMAND_GROUP_NO_CLAIM 0
+
+// How long a command can sit unacknowledged with a consumer before
+//	another consumer in the group takes it over by default. This needs to
+//	be longer than the slowest command takes to run.
+#define ELEMENT_COMMAND_GROUP_DEFAULT_CLAIM_MS 30000
+
+// How often, at most, the command loop will look for commands to claim
+#define ELEMENT_COMMAND_GROUP_CLAIM_PERIOD_MS 1000
+
+// Max number of commands claimed at a time
+#define ELEMENT_COMMAND_GROUP_CLAIM_COUNT 16
+
+// Command flags
+//
+// Fast commands are expected to be handled quickly enough that there's no
+//	need to let the caller know they were received before they're done. The
+//	ACK is sent along with the response in a single round trip, or is
+//	skipped altogether if the caller asked for the command with
+//	element_command_send_fast.
+#define ELEMENT_COMMAND_FLAG_FAST (1 << 0)
+
 // Element command. Mapping between command name
 //	and a function pointer to call with the data when the
 //	command is passed to the element. Needs to be a linked list
@@ -47,10 +77,28 @@ struct element_command {
 		void **cleanup_ptr);
 	void (*cleanup)(void *cleanup_ptr);
 	int timeout;
+	int flags;
 	void *user_data;
 	struct element_command *next;
 };
 
+// A command that's been read off of the command stream and ACKed. Requests
+//	handed to a dispatch function own their data and must be passed to
+//	element_command_process and then element_command_request_free, in
+//	any thread, with any context. For fast commands ack_pending notes that
+//	the ACK still needs to go out along with the response. deadline_ms is
+//	when the caller gives up on the command, or ATOM_NO_DEADLINE.
+struct element_command_request {
+	char id[STREAM_ID_BUFFLEN];
+	char *req_elem;
+	struct element_command *cmd;
+	enum atom_error_t err_code;
+	uint8_t *data;
+	size_t data_len;
+	bool ack_pending;
+	int64_t deadline_ms;
+};
+
 // Adds a command to the element's set of implemented commands. The command
 //	has a name, a callback, and a timeout. The timeout is sent back to the
 //	caller in the ACK packet initially after receiving the command
@@ -73,16 +121,96 @@ bool element_command_add(
 	void *user_data,
 	int timeout);
 
+// Same as element_command_add, but with flags for the command. See
+//	ELEMENT_COMMAND_FLAG_*
+bool element_command_add_with_flags(
+	struct element *elem,
+	const char *command,
+	int (*cb)(
+		uint8_t *data,
+		size_t data_len,
+		uint8_t **response,
+		size_t *response_len,
+		char **error_str,
+		void *user_data,
+		void **cleanup_ptr),
+	void (*cleanup)(void *cleanup_ptr),
+	void *user_data,
+	int timeout,
+	int flags);
+
 // Runs the command monitoring loop. Will perform XREADs on the command
 //	stream and process all commands. If loop is false will only do the XREAD
 //	once. If timeout is nonzero will return if we don't get a command
-//	within timeout ms.
+//	within timeout ms. If a read of the command stream fails then a single
+//	read returns ATOM_REDIS_ERROR, while a loop reconnects and keeps going.
 enum atom_error_t element_command_loop(
 	redisContext *ctx,
 	struct element *elem,
 	bool loop,
 	int timeout);
 
+// Same as element_command_loop, but once a command has been read and ACKed
+//	it's passed to dispatch_fn instead of being handled inline. This allows
+//	the handlers to be run by a pool of workers while this loop keeps
+//	reading and ACKing commands. dispatch_fn takes ownership of the request.
+enum atom_error_t element_command_loop_dispatch(
+	redisContext *ctx,
+	struct element *elem,
+	bool loop,
+	int timeout,
+	void (*dispatch_fn)(
+		struct element_command_request *req,
+		void *user_data),
+	void *user_data);
+
+// Forward declaration of the data for reading the command stream
+struct element_command_reader_data;
+
+// Stream info for reading the element's command stream as part of some
+//	other XREAD, e.g. one sent on an async context along with data streams,
+//	instead of with element_command_loop. Commands read through it are
+//	ACKed, handled and responded to on the element's command context as
+//	they're read. Can't be used by elements in a command group.
+struct element_command_reader {
+	struct redis_stream_info info;
+	struct element_command_reader_data *data;
+};
+
+// Sets up and cleans up a command stream reader
+bool element_command_reader_init(
+	struct element *elem,
+	struct element_command_reader *reader);
+void element_command_reader_cleanup(
+	struct element_command_reader *reader);
+
+// Switches the element over to reading its command stream as a consumer in
+//	a consumer group s.t. several replicas of the element, each with their
+//	own consumer name, can share the commands sent to it. Each command is
+//	handled by only one replica and is acknowledged once its response has
+//	been sent. If claim_idle_ms is nonzero then commands left unacknowledged
+//	by another replica for that long, i.e. because it crashed, are claimed
+//	and handled by this one. If group is NULL the element name is used and
+//	if consumer is NULL then one is made from the hostname and pid. Must be
+//	called before the command loop is started.
+enum atom_error_t element_command_use_group(
+	redisContext *ctx,
+	struct element *elem,
+	const char *group,
+	const char *consumer,
+	int claim_idle_ms);
+
+// Runs the handler for a request and sends the response on the passed
+//	context. If the command isn't supported then just sends the error.
+enum atom_error_t element_command_process(
+	redisContext *ctx,
+	struct element *elem,
+	struct element_command_request *req);
+
+// Frees a request that was passed to a dispatch function
+void element_command_request_free(
+	struct element_command_request *req);
+
 #ifdef __cplusplus
  }
 #endif
@@ -25,7 +25,13 @@ struct element;
 
 // Struct that defines all information for processing a data stream:
 //	This struct is used both for the data loop and for getting the N
-//	most recent pieces of data.
+//	most recent pieces of data. If response_reply_cb is non-NULL then it's
+//	called instead of response_cb and is handed ownership of the entry's
+//	reply, which the kv items point into. It must free the reply with
+//	freeReplyObject() once it's done with the data, even if it fails.
+//	When reading in a loop, policy and min_interval_ns say which entries
+//	are passed on if several come in at once and dropped ones are counted
+//	in *items_dropped, see redis_read_policy.
 struct element_entry_read_info {
 	const char *element;
 	const char *stream;
@@ -37,11 +43,43 @@ struct element_entry_read_info {
 		const struct redis_xread_kv_item *kv_items,
 		int n_kv_items,
 		void *user_data);
+	bool (*response_reply_cb)(
+		const char *id,
+		redisReply *reply,
+		const struct redis_xread_kv_item *kv_items,
+		int n_kv_items,
+		void *user_data);
 	size_t items_to_read;
 	size_t items_read;
 	size_t xreads;
+	enum redis_read_policy policy;
+	uint64_t min_interval_ns;
+	size_t *items_dropped;
 };
 
+// Forward declaration of the per-stream callback data
+struct element_entry_read_cb_data;
+
+// Redis stream infos for a set of read infos. Lets the streams be read as
+//	part of some other XREAD, e.g. one sent on an async context, instead of
+//	with element_entry_read_loop. The stream infos call the read infos'
+//	callbacks for each entry.
+struct element_entry_read_streams {
+	struct redis_stream_info *stream_info;
+	struct element_entry_read_cb_data *cb_data;
+	size_t n_infos;
+};
+
+// Sets up and cleans up the stream infos for reading the read infos. The
+//	read infos must stay around until the streams are cleaned up
+void element_entry_read_streams_init(
+	redisContext *ctx,
+	struct element_entry_read_streams *streams,
+	struct element_entry_read_info *infos,
+	size_t n_infos);
+void element_entry_read_streams_cleanup(
+	struct element_entry_read_streams *streams);
+
 // Allows an element to listen for all data on streams
 enum atom_error_t element_entry_read_loop(
 	redisContext *ctx,
@@ -51,13 +89,44 @@ enum atom_error_t element_entry_read_loop(
 	bool loop_forever,
 	int timeout);
 
-// Allows an element to get the N most recent items on a stream
+// Allows an element to get the N most recent items on a stream, or all
+//	of them if there are fewer than N
 enum atom_error_t element_entry_read_n(
 	redisContext *ctx,
 	struct element *elem,
 	struct element_entry_read_info *info,
 	size_t n);
 
+// Reads a range of a stream a page at a time, calling the read info's
+//	callbacks with each entry. See redis_range for start and end. The
+//	read info must stay around until the range is cleaned up and the
+//	context can't be used for anything else in the meantime
+struct element_entry_range {
+	struct element_entry_read_info *info;
+	struct element_entry_read_cb_data *cb_data;
+	struct redis_range range;
+};
+void element_entry_range_init(
+	struct element_entry_range *range,
+	struct element_entry_read_info *info,
+	bool reverse,
+	const char *start,
+	const char *end,
+	size_t page_size,
+	size_t max_entries);
+
+// Reads the next page of the range. n_read is filled in with the number of
+//	entries in the page and is 0 once the range is done
+enum atom_error_t element_entry_range_next(
+	redisContext *ctx,
+	struct element *elem,
+	struct element_entry_range *range,
+	size_t *n_read);
+
+void element_entry_range_cleanup(
+	redisContext *ctx,
+	struct element_entry_range *range);
+
 // Reads at most N items that have happened since the passed
 //	last_seen_id
 #define ENTRY_READ_SINCE_BEGIN_BLOCKING_WITH_NEWEST_ID "$"
@@ -70,6 +139,44 @@ enum atom_error_t element_entry_read_since(
 	int timeout,
 	size_t maxcount);
 
+// A read of a stream that's set up once and then done any number of
+//	times, s.t. polling a stream doesn't make its name, kv index and
+//	stream info over again for every read. Each read since picks up after
+//	the last entry the one before it got. The read info must stay around
+//	until the read is cleaned up and a read is only done by one thread at
+//	a time. The read info's callbacks may be changed between reads
+struct element_entry_prepared_read {
+	struct element_entry_read_info *info;
+	struct element_entry_read_cb_data *cb_data;
+	struct redis_stream_info stream_info;
+	struct redis_range range;
+};
+
+// Sets up a prepared read of the read info's stream. Reads since start
+//	after last_id or, if it's NULL, after the time on ctx's server
+void element_entry_prepared_read_init(
+	redisContext *ctx,
+	struct element_entry_prepared_read *read,
+	struct element_entry_read_info *info,
+	const char *last_id);
+
+// Same as element_entry_read_n and element_entry_read_since, where
+//	reads since go on from the last ID seen
+enum atom_error_t element_entry_prepared_read_n(
+	redisContext *ctx,
+	struct element *elem,
+	struct element_entry_prepared_read *read,
+	size_t n);
+enum atom_error_t element_entry_prepared_read_since(
+	redisContext *ctx,
+	struct element *elem,
+	struct element_entry_prepared_read *read,
+	int timeout,
+	size_t maxcount);
+
+void element_entry_prepared_read_cleanup(
+	struct element_entry_prepared_read *read);
+
 #ifdef __cplusplus
  }
 #endif
@@ -17,6 +17,7 @@
 
 #include "atom.h"
 #include "redis.h"
+#include "codec.h"
 
 // Defaults for the data stream.
 #define ELEMENT_DATA_WRITE_DEFAULT_TIMESTAMP 0
@@ -25,19 +26,62 @@
 // Forward declaration of the element struct
 struct element;
 
+// How much of a stream is kept. By count it's the last maxlen entries,
+//	by time the entries from the last max_age_ms and by bytes as many
+//	entries as fit in max_bytes, going by the average size of the entries
+//	written so far. Trims are approximate. If deferred, writes don't trim
+//	the stream at all and it's up to the writer to trim it every so often
+//	with element_retention_trim_append, which keeps the XADDs cheap at the
+//	cost of the stream growing a bit in between
+enum element_retention_type {
+	ELEMENT_RETENTION_COUNT,
+	ELEMENT_RETENTION_TIME,
+	ELEMENT_RETENTION_BYTES,
+};
+
+struct element_retention {
+	enum element_retention_type type;
+	int maxlen;
+	int64_t max_age_ms;
+	size_t max_bytes;
+	bool deferred;
+	// Moving average of the size of the entries' keys and values, kept
+	//	up to date by the writes
+	uint64_t avg_entry_bytes;
+	// How far the server's clock is ahead of ours, from the IDs of the
+	//	entries written. Time windows go by it since IDs are the server's
+	//	time. Until clock_known is set they don't trim
+	int64_t clock_offset_ms;
+	bool clock_known;
+};
+
+// Floor on the length a byte budget trims a stream to s.t. it's never
+//	emptied out
+#define ELEMENT_RETENTION_MIN_MAXLEN 1
+
 // Element data stream struct. Will allocate the memory for the XADD infos
 //	and initialize the stream for the droplets. Infos will be
 //	allocated to hold some more info than the user requests
-//	s.t. we can throw a timestamp and/or other things on there
+//	s.t. we can throw a timestamp and/or other things on there. Values
+//	of at least codec_min_size bytes are compressed with the codec,
+//	which is CODEC_NONE unless changed after init
 struct element_entry_write_info {
 	struct redis_xadd_info *items;
 	size_t n_items;
 	char stream[STREAM_ID_BUFFLEN];
+	enum codec_type codec;
+	size_t codec_min_size;
+	// If non-NULL, how the stream is trimmed, which takes the place of
+	//	the maxlen passed to the writes. NULL unless set after init and
+	//	must outlive the info
+	struct element_retention *retention;
 };
 
 // Initializes a stream. Once this is done
 //	once, at startup, it will be quite lightweight
-//	to update and publish the droplet.
+//	to update and publish the droplet. The stream is registered using
+//	ctx, see atom_registry_add_stream(). Pass a NULL ctx if it has
+//	replies outstanding and register the stream once they're read
 struct element_entry_write_info *element_entry_write_init(
 	redisContext *ctx,
 	struct element *elem,
@@ -58,6 +102,56 @@ enum atom_error_t element_entry_write(
 	int timestamp,
 	int maxlen);
 
+// Pipelined version of element_entry_write. Fill out the stream's items and
+//	call element_entry_write_append for each entry, possibly across several
+//	streams, then call element_entry_write_flush with the number of appended
+//	entries to send them all in one round trip. ids and errs are optional
+//	arrays of at least n elements that will be filled out with the ID and
+//	error for each entry, in the order in which they were appended.
+enum atom_error_t element_entry_write_append(
+	redisContext *ctx,
+	struct element_entry_write_info *stream,
+	int timestamp,
+	int maxlen);
+enum atom_error_t element_entry_write_flush(
+	redisContext *ctx,
+	size_t n,
+	char (*ids)[STREAM_ID_BUFFLEN],
+	enum atom_error_t *errs);
+
+// Notes the size of an entry that was written with a retention policy
+void element_retention_note_entry(
+	struct element_retention *retention,
+	size_t entry_bytes);
+
+// Notes the ID of an entry that was written with a retention policy
+void element_retention_note_id(
+	struct element_retention *retention,
+	const char *id);
+
+// Returns whether a retention policy can be enforced yet. Time windows
+//	can't until an entry has been written
+bool element_retention_ready(
+	struct element_retention *retention);
+
+// Gets the trim that enforces a retention policy right now, whether or
+//	not it's deferred. No trim if the policy isn't ready
+void element_retention_get_trim(
+	struct element_retention *retention,
+	struct redis_trim *trim);
+
+// Pipelined trim of a stream to its retention policy, for deferred
+//	policies. Call element_retention_trim_append for each stream and then
+//	element_retention_trim_flush with the number of appended trims to send
+//	them all in one round trip. Policies that aren't ready can't be trimmed
+enum atom_error_t element_retention_trim_append(
+	redisContext *ctx,
+	const char *stream,
+	struct element_retention *retention);
+enum atom_error_t element_retention_trim_flush(
+	redisContext *ctx,
+	size_t n);
+
 #ifdef __cplusplus
  }
 #endif
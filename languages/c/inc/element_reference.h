@@ -0,0 +1,90 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @file element_reference.h
+//
+//  @brief Header for references. A reference is an expiring copy of a
+//			value kept in redis under its own key s.t. it can be handed to
+//			other elements without them having to keep up with the stream
+//			it came from.
+//
+//  @copy 2018 Elementary Robotics. All rights reserved.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __ATOM_ELEMENT_REFERENCE_H
+#define __ATOM_ELEMENT_REFERENCE_H
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+#include <stdbool.h>
+#include "atom.h"
+#include "redis.h"
+
+// Prefix for reference keys, which are reference:<element>:<uuid>
+#define ELEMENT_REFERENCE_PREFIX "reference:"
+
+// Default amount of time that a reference is kept around for. 0 means
+//	the reference is kept until it's deleted
+#define ELEMENT_REFERENCE_DEFAULT_TIMEOUT_MS 10000
+#define ELEMENT_REFERENCE_NO_TIMEOUT 0
+
+// Max number of references fetched or deleted by a single MGET or UNLINK.
+//	More than this are split across pipelined commands
+#define ELEMENT_REFERENCE_MAX_KEYS 64
+
+// Forward declaration of the element struct
+struct element;
+
+// Reference made from a key in a stream entry
+struct element_reference {
+	char *key;
+	char *ref;
+};
+
+// Makes a reference to each of the keys in an entry of another element's
+//	stream without the data leaving redis. If id is NULL or "" then uses
+//	the most recent entry. On success, refs is allocated and filled in
+//	with n_refs references and must be freed with element_reference_free.
+enum atom_error_t element_reference_create_from_stream(
+	redisContext *ctx,
+	struct element *elem,
+	const char *element,
+	const char *stream,
+	const char *id,
+	int timeout_ms,
+	struct element_reference **refs,
+	size_t *n_refs);
+
+// Frees the references made by element_reference_create_from_stream. Doesn't
+//	delete them from redis
+void element_reference_free(
+	struct element_reference *refs,
+	size_t n_refs);
+
+// Gets the values of references. The references are fetched with
+//	pipelined MGETs, and reply_cb is called with each MGET's reply and
+//	the index of the first reference in it. References that don't exist
+//	have NIL values. If reply_cb returns true then it's taking ownership
+//	of the reply and is responsible for freeing it.
+enum atom_error_t element_reference_get(
+	redisContext *ctx,
+	const char * const *refs,
+	size_t n_refs,
+	bool (*reply_cb)(redisReply *reply, size_t first, void *user_data),
+	void *user_data);
+
+// Deletes references. n_deleted, if non-NULL, is filled in with the number
+//	of references that still existed
+enum atom_error_t element_reference_delete(
+	redisContext *ctx,
+	const char * const *refs,
+	size_t n_refs,
+	size_t *n_deleted);
+
+#ifdef __cplusplus
+ }
+#endif
+
+#endif // __ATOM_ELEMENT_REFERENCE_H
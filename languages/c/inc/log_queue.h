@@ -0,0 +1,64 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @file log_queue.h
+//
+//  @brief Header for the queue that logs go through on their way to the
+//			log stream. Any thread can put a log on the queue without
+//			blocking or talking to redis, and a background thread writes
+//			them out in pipelined batches on its own connection.
+//
+//  @copy 2018 Elementary Robotics. All rights reserved.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __ATOM_LOG_QUEUE_H
+#define __ATOM_LOG_QUEUE_H
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Number of logs that can be waiting to be written. Must be a power of 2.
+//	Logs that come in while the queue is full are dropped
+#define LOG_QUEUE_LEN 512
+
+// Most logs written in a single pipeline
+#define LOG_QUEUE_BATCH 64
+
+// How long the writer sleeps when there's nothing to do and how long to
+//	wait before reconnecting if redis went away, in milliseconds
+#define LOG_QUEUE_IDLE_MS 100
+#define LOG_QUEUE_RECONNECT_MS 1000
+
+// How long atom_log_flush waits for the writer, in milliseconds
+#define LOG_QUEUE_FLUSH_TIMEOUT_MS 1000
+
+// Puts a log on the queue, starting the writer if it's not running. The
+//	element name and message are copied and truncated to fit. Returns
+//	false if the queue was full and the log was dropped. If the writer
+//	couldn't be started the log is written before returning instead,
+//	and false means that it couldn't be
+bool log_queue_push(
+	int level,
+	const char *element,
+	size_t element_len,
+	const char *msg,
+	size_t msg_len);
+
+// Waits up to timeout_ms for everything queued so far to be written.
+//	Returns false if it wasn't
+bool log_queue_flush(
+	int timeout_ms);
+
+// Number of logs dropped since we started
+uint64_t log_queue_dropped(void);
+
+#ifdef __cplusplus
+ }
+#endif
+
+#endif // __ATOM_LOG_QUEUE_H
@@ -0,0 +1,95 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @file metrics.h
+//
+//  @brief Header for the built-in metrics. Hot paths record timings and
+//			counts into per-thread histograms without taking any locks
+//			and a background thread periodically writes aggregates of them
+//			to the metrics redis with TS.MADD.
+//
+//  @copy 2018 Elementary Robotics. All rights reserved.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __ATOM_METRICS_H
+#define __ATOM_METRICS_H
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Metrics are only recorded if this environment variable is "TRUE", same
+//	as the other languages
+#define METRICS_ENABLE_ENV "ATOM_USE_METRICS"
+#define METRICS_ENABLE_VALUE "TRUE"
+
+// Where the metrics redis is. If the host isn't set then we use the socket
+#define METRICS_HOST_ENV "ATOM_METRICS_HOST"
+#define METRICS_PORT_ENV "ATOM_METRICS_PORT"
+#define METRICS_SOCKET_ENV "ATOM_METRICS_SOCKET"
+#define METRICS_DEFAULT_PORT 6380
+#define METRICS_DEFAULT_SOCKET "/shared/metrics.sock"
+
+// How often the aggregates are written and how long they're kept
+#define METRICS_FLUSH_INTERVAL_MS 1000
+#define METRICS_DEFAULT_RETENTION_MS 600000
+
+// Timings, recorded in nanoseconds and written in seconds
+enum metrics_timing_t {
+	METRICS_REDIS_XADD,
+	METRICS_REDIS_XREAD,
+	METRICS_COMMAND_ACK,
+	METRICS_COMMAND_RESPONSE,
+	METRICS_COMMAND_HANDLER,
+	METRICS_CONTEXT_WAIT,
+	METRICS_N_TIMINGS,
+};
+
+// Counters, written as the total for each interval
+enum metrics_counter_t {
+	METRICS_BYTES_OUT,
+	METRICS_BYTES_IN,
+	METRICS_N_COUNTERS,
+};
+
+// Starts the flusher for the element if metrics are enabled. Each call
+//	must be matched by a call to metrics_cleanup and only the first
+//	element's name is used. Returns whether metrics are enabled
+bool metrics_init(
+	const char *element);
+
+// Stops the flusher, writing out anything left, once the last element
+//	that called metrics_init is done with it
+void metrics_cleanup(void);
+
+// Returns whether metrics are being recorded
+bool metrics_enabled(void);
+
+// Times a section. metrics_timing_start returns 0 if metrics aren't
+//	enabled, in which case metrics_timing_end does nothing
+uint64_t metrics_timing_start(void);
+void metrics_timing_end(
+	enum metrics_timing_t timing,
+	uint64_t start);
+
+// Records a timing that was measured some other way
+void metrics_timing_add(
+	enum metrics_timing_t timing,
+	uint64_t ns);
+
+// Adds to a counter
+void metrics_count(
+	enum metrics_counter_t counter,
+	uint64_t n);
+
+// Writes out the aggregates now rather than waiting for the flusher
+void metrics_flush(void);
+
+#ifdef __cplusplus
+ }
+#endif
+
+#endif // __ATOM_METRICS_H
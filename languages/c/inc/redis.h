@@ -17,6 +17,7 @@
 
 #include <hiredis/hiredis.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 // Default address and port of the local redis server
 #define REDIS_DEFAULT_LOCAL_SOCKET "/shared/redis.sock"
@@ -33,15 +34,39 @@
 // Constant string length. Useful for keys/values
 #define CONST_STRLEN(x) (sizeof(x) - 1)
 
+// Which entries are passed on when more than one has come in on a stream
+//	since it was last read. REDIS_READ_ALL passes on all of them, in order.
+//	REDIS_READ_LATEST passes on only the newest. REDIS_READ_RATE also
+//	passes on only the newest, and only if it's been at least
+//	min_interval_ns since the last entry was passed on. Entries that
+//	aren't passed on are dropped without being parsed, and are added to
+//	*items_dropped if it's non-NULL. redis_init_stream_info sets
+//	REDIS_READ_ALL.
+enum redis_read_policy {
+	REDIS_READ_ALL,
+	REDIS_READ_LATEST,
+	REDIS_READ_RATE,
+};
+
 // Struct that contains all of the information about an XREAD stream
 //	being monitored. The user is expected to fill out the stream name
 //	and data_cb. data_cb should be a function that takes a redisReply
 //	where the reply is an array type of key, value pairs that have
 //	been received at a particular id. The stream info will also
 //	be updated to keep track of the last ID seen on the stream s.t. subsequent
-//	calls to the stream will block properly and get all of the data
+//	calls to the stream will block properly and get all of the data.
+//	If take_reply is set then data_cb takes ownership of the reply it's
+//	passed, which it must free with freeReplyObject() once done with, even
+//	if it fails. This lets the data be used after the XREAD has returned
+//	without copying it. redis_init_stream_info clears take_reply. The
+//	length and hash of the name are also filled in by redis_init_stream_info
+//	s.t. replies can be matched up with their streams quickly. The read
+//	policy says which of the entries that have come in since the last read
+//	are passed to data_cb, see redis_read_policy.
 struct redis_stream_info {
 	const char *name;
+	size_t name_len;
+	uint32_t name_hash;
 	bool (*data_cb)(
 		const char *id,
 		const struct redisReply *reply,
@@ -49,6 +74,11 @@ struct redis_stream_info {
 	char last_id[STREAM_ID_BUFFLEN];
 	void *user_data;
 	size_t items_read;
+	bool take_reply;
+	enum redis_read_policy policy;
+	uint64_t min_interval_ns;
+	uint64_t last_delivered_ns;
+	size_t *items_dropped;
 };
 
 // Struct that contains info for data to be written. Each piece of data
@@ -71,6 +101,37 @@ struct redis_xread_kv_item {
 	redisReply *reply;
 };
 
+// Index over a set of kv items s.t. each key in a reply can be matched up
+//	with its item in constant time instead of being compared against every
+//	item. Build it once for a set of items with redis_xread_kv_index_init
+//	and it can then be used for any number of replies. The items must
+//	outlive the index.
+struct redis_xread_kv_index {
+	struct redis_xread_kv_item *items;
+	size_t n_items;
+	uint32_t *hashes;
+	int *slots;
+	uint32_t mask;
+};
+
+// Replies that reads don't hand over to their callbacks are built in an
+//	arena kept by the thread that reads them, and are freed by resetting
+//	it. Callbacks passed such a reply mustn't keep it, or free or realloc
+//	anything in it. redis_reply_free frees any reply got by these
+//	functions, on the thread that got it, and redis_reply_set_str swaps
+//	a malloc'd string into a reply, which then frees it.
+void redis_reply_free(
+	redisReply *reply);
+void redis_reply_set_str(
+	redisReply *reply,
+	char *str,
+	size_t len);
+
+// Hash used for matching up names and keys in replies. FNV-1a.
+uint32_t redis_str_hash(
+	const char *str,
+	size_t len);
+
 // Initializes a stream info s.t. it's ready for pub-sub like blocking
 //	for xread. CTX may be NULL if last_id is provided. If last_id is NULL
 //	then ctx will be used to get the current time and use that as the
@@ -99,16 +160,175 @@ bool redis_xread(
 	int block,
 	size_t maxcount);
 
+// Split version of redis_xread for use with contexts that we don't read
+//	from directly, e.g. async ones. redis_xread_format formats the XREAD
+//	into cmd and returns its length, or -1 on error. The command must be
+//	freed with redisFreeCommand. redis_xread_handle_reply then calls the
+//	callbacks in the infos for the data in the reply, but doesn't free it.
+int redis_xread_format(
+	char **cmd,
+	struct redis_stream_info *infos,
+	int n_infos,
+	int block,
+	size_t maxcount);
+bool redis_xread_handle_reply(
+	struct redisReply *reply,
+	struct redis_stream_info *infos,
+	int n_infos);
+
+// Consumer group version of redis_xread. Reads entries that haven't been
+//	delivered to anyone in the group yet as the given consumer. Entries
+//	stay pending for the consumer until acknowledged with redis_xack.
+bool redis_xreadgroup(
+	redisContext *ctx,
+	const char *group,
+	const char *consumer,
+	struct redis_stream_info *infos,
+	int n_infos,
+	int block,
+	size_t maxcount);
+
+// Acknowledges an entry read through redis_xreadgroup
+bool redis_xack(
+	redisContext *ctx,
+	const char *stream_name,
+	const char *group,
+	const char *id);
+
+// Creates a consumer group on a stream, creating the stream if needed.
+//	Succeeds without changing anything if the group already exists.
+bool redis_xgroup_create(
+	redisContext *ctx,
+	const char *stream_name,
+	const char *group,
+	const char *start_id);
+
+// Removes a consumer from a group. NOTE: anything still pending for the
+//	consumer is dropped
+bool redis_xgroup_delconsumer(
+	redisContext *ctx,
+	const char *stream_name,
+	const char *group,
+	const char *consumer);
+
+// Returns how many entries, up to max_count, are pending for the consumer
+//	in the group, or -1 on error
+int redis_xpending(
+	redisContext *ctx,
+	const char *stream_name,
+	const char *group,
+	const char *consumer,
+	size_t max_count);
+
+// Claims up to count entries that have been pending in the group for at
+//	least min_idle_ms, starting at cursor, and calls the callback for each.
+//	cursor is updated for the next call and is "0-0" once the whole
+//	pending list has been scanned.
+#define REDIS_XAUTOCLAIM_BEGIN_CURSOR "0-0"
+bool redis_xautoclaim(
+	redisContext *ctx,
+	const char *stream_name,
+	const char *group,
+	const char *consumer,
+	int min_idle_ms,
+	char cursor[STREAM_ID_BUFFLEN],
+	size_t count,
+	bool (*data_cb)(
+		const char *id,
+		const struct redisReply *reply,
+		void *user_data),
+	void *user_data);
+
 // Analyzes the key, value array returned in XREAD
 bool redis_xread_parse_kv(
 	const redisReply *reply,
 	struct redis_xread_kv_item *items,
 	size_t n_items);
 
+// Builds an index over the kv items, and frees it. Must be rebuilt if the
+//	items' keys change
+void redis_xread_kv_index_init(
+	struct redis_xread_kv_index *index,
+	struct redis_xread_kv_item *items,
+	size_t n_items);
+void redis_xread_kv_index_cleanup(
+	struct redis_xread_kv_index *index);
+
+// Same as redis_xread_parse_kv, but uses an index over the items s.t. the
+//	reply is parsed in a single pass
+bool redis_xread_parse_kv_indexed(
+	const redisReply *reply,
+	const struct redis_xread_kv_index *index);
+
+// Reads a range of a stream a page at a time with XRANGE, or XREVRANGE if
+//	reverse is set. The request for the next page is sent as soon as a page
+//	comes in s.t. it's on its way while the current page is handled, and
+//	the pages after it aren't requested until it's read. The context can't
+//	be used for anything else until the range is cleaned up.
+#define REDIS_RANGE_OLDEST "-"
+#define REDIS_RANGE_NEWEST "+"
+#define REDIS_RANGE_DEFAULT_PAGE_SIZE 100
+#define REDIS_RANGE_NO_LIMIT 0
+struct redis_range {
+	char *stream_name;
+	bool reverse;
+	char next_id[STREAM_ID_BUFFLEN + 1];
+	char end_id[STREAM_ID_BUFFLEN + 1];
+	size_t page_size;
+	size_t requested;
+	size_t remaining;
+	bool limited;
+	bool pending;
+	bool done;
+};
+
+// Sets up a range. start and end are IDs, inclusive unless prefixed with
+//	'(', and are in the order the range is read. NULL for either means the
+//	end of the stream. At most max_entries are read unless it's
+//	REDIS_RANGE_NO_LIMIT.
+void redis_range_init(
+	struct redis_range *range,
+	const char *stream_name,
+	bool reverse,
+	const char *start,
+	const char *end,
+	size_t page_size,
+	size_t max_entries);
+
+// Starts a range over on the same stream with a new start, end and limit,
+//	as if it had just been set up. If a page is still on its way then it's
+//	waited for on ctx, which may only be NULL if there isn't one.
+void redis_range_restart(
+	redisContext *ctx,
+	struct redis_range *range,
+	bool reverse,
+	const char *start,
+	const char *end,
+	size_t page_size,
+	size_t max_entries);
+
+// Gets the next page of the range, calling data_cb with each entry in it.
+//	n_read is filled in with the number of entries in the page and is 0
+//	once there are no more. If take_reply is set then data_cb takes
+//	ownership of each reply like in redis_xrevrange_take_reply
+bool redis_range_next(
+	redisContext *ctx,
+	struct redis_range *range,
+	bool (*data_cb)(const char *id, const struct redisReply *reply, void *data),
+	void *user_data,
+	bool take_reply,
+	size_t *n_read);
+
+// Cleans up a range, waiting on any page that's still on its way
+void redis_range_cleanup(
+	redisContext *ctx,
+	struct redis_range *range);
+
 // Performs an xrevrange call to redis in order to get the N most recent
-//	elements on the stream. Similar to XREAD will loop over the streams
-//	and call the callback passed. Takes a redis_stream_info like XREAD
-//	but the last_seen_id field is ignored.
+//	elements on the stream, or all of them if there are fewer than N.
+//	Similar to XREAD will loop over the streams and call the callback
+//	passed. Takes a redis_stream_info like XREAD but the last_seen_id
+//	field is ignored.
 bool redis_xrevrange(
 	redisContext *ctx,
 	const char *stream_name,
@@ -116,6 +336,15 @@ bool redis_xrevrange(
 	size_t n,
 	void *user_data);
 
+// Same as redis_xrevrange, but data_cb takes ownership of each reply it's
+//	passed and must free it with freeReplyObject(), even if it fails
+bool redis_xrevrange_take_reply(
+	redisContext *ctx,
+	const char *stream_name,
+	bool (*data_cb)(const char *id, const struct redisReply *reply, void *data),
+	size_t n,
+	void *user_data);
+
 // Adds data to ,a stream with a given max length.
 #define REDIS_XADD_NO_MAXLEN (-1)
 bool redis_xadd(
@@ -127,6 +356,100 @@ bool redis_xadd(
 	bool approx_maxlen,
 	char ret_id[STREAM_ID_BUFFLEN]);
 
+// How a stream is trimmed. By MAXLEN it's kept to at most threshold
+//	entries and by MINID to the entries whose IDs are at least threshold,
+//	which is in milliseconds since the epoch, i.e. those added since then.
+//	Approximate trims only drop whole nodes of the stream, which is much
+//	cheaper, and so may keep a few more entries than asked for. MINID
+//	needs redis 6.2
+enum redis_trim_type {
+	REDIS_TRIM_NONE,
+	REDIS_TRIM_MAXLEN,
+	REDIS_TRIM_MINID,
+};
+
+struct redis_trim {
+	enum redis_trim_type type;
+	bool approx;
+	long long threshold;
+};
+
+// Fills in a trim to maxlen entries. REDIS_XADD_NO_MAXLEN doesn't trim
+void redis_trim_init_maxlen(
+	struct redis_trim *trim,
+	int maxlen,
+	bool approx);
+
+// Same as redis_xadd, but trims the stream as described by trim
+bool redis_xadd_trim(
+	redisContext *ctx,
+	const char *stream_name,
+	struct redis_xadd_info *infos,
+	size_t info_len,
+	const struct redis_trim *trim,
+	char ret_id[STREAM_ID_BUFFLEN]);
+
+// Arguments of an XADD before the (key, value) pairs at most, i.e. the
+//	XADD, stream name, MAXLEN or MINID, ~, threshold and ID
+#define REDIS_XADD_N_HEADER_ARGS 6
+#define REDIS_XADD_MAXLEN_BUFFLEN 32
+
+// For writers that build the XADD once and then only change the values.
+//	redis_xadd_argv_header fills in the arguments before the (key, value)
+//	pairs and returns how many there are. maxlen_buffer must outlive the
+//	argv. redis_xadd_argv sends an XADD built that way
+int redis_xadd_argv_header(
+	const char *stream_name,
+	int maxlen,
+	bool approx_maxlen,
+	const char *argv[REDIS_XADD_N_HEADER_ARGS],
+	size_t argvlen[REDIS_XADD_N_HEADER_ARGS],
+	char maxlen_buffer[REDIS_XADD_MAXLEN_BUFFLEN]);
+int redis_xadd_argv_header_trim(
+	const char *stream_name,
+	const struct redis_trim *trim,
+	const char *argv[REDIS_XADD_N_HEADER_ARGS],
+	size_t argvlen[REDIS_XADD_N_HEADER_ARGS],
+	char trim_buffer[REDIS_XADD_MAXLEN_BUFFLEN]);
+bool redis_xadd_argv(
+	redisContext *ctx,
+	int argc,
+	const char **argv,
+	const size_t *argvlen,
+	char ret_id[STREAM_ID_BUFFLEN]);
+
+// Pipelined version of redis_xadd. Appends the XADD to the context's
+//	output buffer without waiting for the reply. Each successful append
+//	must be matched with a call to redis_xadd_get_reply, in order, which
+//	will flush the buffer and return the ID for the corresponding XADD.
+bool redis_xadd_append(
+	redisContext *ctx,
+	const char *stream_name,
+	struct redis_xadd_info *infos,
+	size_t info_len,
+	int maxlen,
+	bool approx_maxlen);
+bool redis_xadd_append_trim(
+	redisContext *ctx,
+	const char *stream_name,
+	struct redis_xadd_info *infos,
+	size_t info_len,
+	const struct redis_trim *trim);
+bool redis_xadd_get_reply(
+	redisContext *ctx,
+	char ret_id[STREAM_ID_BUFFLEN]);
+
+// Pipelined XTRIM of a stream, for trimming off of the write path. Same
+//	as the pipelined XADD as far as matching up the replies goes.
+//	n_trimmed, if non-NULL, gets the number of entries that were trimmed
+bool redis_xtrim_append(
+	redisContext *ctx,
+	const char *stream_name,
+	const struct redis_trim *trim);
+bool redis_xtrim_get_reply(
+	redisContext *ctx,
+	long long *n_trimmed);
+
 // Calls the callback with each key that matches the
 //	pattern. NOTE: the scanning API currently can be prone
 //	to duplicates. Returns the number of times the callback
@@ -146,6 +469,34 @@ bool redis_remove_key(
 	const char *key,
 	bool unlink);
 
+// Adds (or removes) a member of a registry, a sorted set kept in lexical
+//	order, and increments the registry's version so that anyone caching
+//	it knows to read it again
+bool redis_registry_update(
+	redisContext *ctx,
+	const char *key,
+	const char *version_key,
+	const char *member,
+	size_t member_len,
+	bool add);
+
+// Calls the callback for each member of a registry between the
+//	ZRANGEBYLEX bounds min and max, in lexical order. Returns the number
+//	of members or -1 if the registry couldn't be read
+int redis_registry_get(
+	redisContext *ctx,
+	const char *key,
+	const char *min,
+	const char *max,
+	bool (*data_cb)(const char *member, void *user_data),
+	void *user_data);
+
+// Gets an integer stored at a key. A key that doesn't exist is 0
+bool redis_get_integer(
+	redisContext *ctx,
+	const char *key,
+	long long *value);
+
 // Prints out a redis reply recursively. To print out a top-level
 //	reply, call with (0, 0, reply).
 void redis_print_reply(
@@ -160,6 +511,11 @@ void redis_print_xread_kv_items(
 
 // Gets a redis context
 redisContext *redis_context_init(void);
+redisContext *redis_context_init_remote(
+	const char *addr,
+	int port);
+redisContext *redis_context_init_local(
+	const char *socket);
 
 // Frees a redis context
 void redis_context_cleanup(redisContext *ctx);
@@ -0,0 +1,106 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @file redis_topology.h
+//
+//  @brief Header for spreading data streams across redis servers. The
+//			element's own nucleus keeps the commands, responses, logs and
+//			the list of elements while the data streams are sharded across
+//			a set of other servers or a redis cluster.
+//
+//  @copy 2018 Elementary Robotics. All rights reserved.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __ATOM_REDIS_TOPOLOGY_H
+#define __ATOM_REDIS_TOPOLOGY_H
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <hiredis/hiredis.h>
+
+// Environment variable with the topology to use if none is passed
+#define REDIS_TOPOLOGY_ENV "ATOM_REDIS_TOPOLOGY"
+
+// Prefixes for the topology spec. "local" keeps everything on the nucleus,
+//	"remote:" is followed by a comma-separated list of servers that the
+//	data streams are sharded across by element name and "cluster:" is
+//	followed by a comma-separated list of cluster nodes to find the rest
+//	of the cluster from. Servers are either host:port or the path to a
+//	unix socket.
+#define REDIS_TOPOLOGY_LOCAL_STR "local"
+#define REDIS_TOPOLOGY_REMOTE_PREFIX "remote:"
+#define REDIS_TOPOLOGY_CLUSTER_PREFIX "cluster:"
+
+// Number of hash slots in a redis cluster
+#define REDIS_CLUSTER_N_SLOTS 16384
+
+// Returned as the shard of a stream that lives on the nucleus
+#define REDIS_TOPOLOGY_NUCLEUS SIZE_MAX
+
+enum redis_topology_type {
+	REDIS_TOPOLOGY_LOCAL,
+	REDIS_TOPOLOGY_REMOTE,
+	REDIS_TOPOLOGY_CLUSTER,
+};
+
+// A server that data streams live on
+struct redis_shard {
+	char *host;
+	int port;
+	char *socket;
+};
+
+// Where the data streams live. For a cluster, slots maps each hash slot
+//	to the shard that serves it
+struct redis_topology {
+	enum redis_topology_type type;
+	struct redis_shard *shards;
+	size_t n_shards;
+	size_t *slots;
+};
+
+// CRC16 used by redis cluster, and the hash slot of a key. If the key has
+//	a non-empty {hash tag} then only the tag is hashed
+uint16_t redis_crc16(
+	const char *buf,
+	size_t len);
+uint16_t redis_key_slot(
+	const char *key,
+	size_t len);
+
+// Sets up the topology from a spec, see above. If spec is NULL then uses
+//	REDIS_TOPOLOGY_ENV, and if that isn't set then everything is local.
+//	For a cluster, asks the first node that answers for the slots. Returns
+//	false, with the topology local, if the spec is invalid or we couldn't
+//	reach the cluster.
+bool redis_topology_init(
+	struct redis_topology *topology,
+	const char *spec);
+
+// Frees everything in the topology
+void redis_topology_cleanup(
+	struct redis_topology *topology);
+
+// Gets the shard that a data stream lives on. Streams are sharded by the
+//	hash slot of the element name across remote servers s.t. all of an
+//	element's streams are on the same server. In a cluster the key's own
+//	slot decides. Returns REDIS_TOPOLOGY_NUCLEUS if the topology is local
+size_t redis_topology_get_shard(
+	const struct redis_topology *topology,
+	const char *element,
+	const char *key);
+
+// Connects to a shard
+redisContext *redis_topology_connect(
+	const struct redis_topology *topology,
+	size_t shard);
+
+#ifdef __cplusplus
+ }
+#endif
+
+#endif // __ATOM_REDIS_TOPOLOGY_H
@@ -17,13 +17,22 @@
 #include <assert.h>
 #include <unistd.h>
 #include <limits.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <time.h>
 
 #include "redis.h"
 #include "atom.h"
 #include "element.h"
+#include "log_queue.h"
 
 #define ATOM_LOG_DEFAULT_ELEMENT_NAME "none"
 
+// Most verbose level we're logging at runtime, read from the environment
+//	the first time it's needed
+static _Atomic int atom_log_level = LOG_DEBUG;
+static pthread_once_t atom_log_level_once = PTHREAD_ONCE_INIT;
+
 // User data callback to send to the redis helper for finding elements
 struct atom_get_element_cb_info {
 	bool (*user_cb)(const char *key, void *user_data);
@@ -37,6 +46,117 @@ struct atom_get_data_stream_cb_info {
 	size_t offset;
 };
 
+// Sorted list being built from found elements/streams, along with the
+//	last node in it
+struct atom_list_builder {
+	struct atom_list_node **head;
+	struct atom_list_node *last;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Adds an element to the registry
+//
+////////////////////////////////////////////////////////////////////////////////
+enum atom_error_t atom_registry_add_element(
+	redisContext *ctx,
+	const char *element)
+{
+	return redis_registry_update(ctx, ATOM_REGISTRY_ELEMENTS,
+		ATOM_REGISTRY_VERSION, element, strlen(element), true) ?
+			ATOM_NO_ERROR : ATOM_REDIS_ERROR;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Removes an element from the registry
+//
+////////////////////////////////////////////////////////////////////////////////
+enum atom_error_t atom_registry_remove_element(
+	redisContext *ctx,
+	const char *element)
+{
+	return redis_registry_update(ctx, ATOM_REGISTRY_ELEMENTS,
+		ATOM_REGISTRY_VERSION, element, strlen(element), false) ?
+			ATOM_NO_ERROR : ATOM_REDIS_ERROR;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Adds a data stream to the registry. The member is the key
+//			without the data stream prefix, i.e. element:stream
+//
+////////////////////////////////////////////////////////////////////////////////
+enum atom_error_t atom_registry_add_stream(
+	redisContext *ctx,
+	const char *stream_key)
+{
+	const char *member = &stream_key[CONST_STRLEN(ATOM_DATA_STREAM_PREFIX)];
+
+	return redis_registry_update(ctx, ATOM_REGISTRY_STREAMS,
+		ATOM_REGISTRY_VERSION, member, strlen(member), true) ?
+			ATOM_NO_ERROR : ATOM_REDIS_ERROR;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Removes a data stream from the registry
+//
+////////////////////////////////////////////////////////////////////////////////
+enum atom_error_t atom_registry_remove_stream(
+	redisContext *ctx,
+	const char *stream_key)
+{
+	const char *member = &stream_key[CONST_STRLEN(ATOM_DATA_STREAM_PREFIX)];
+
+	return redis_registry_update(ctx, ATOM_REGISTRY_STREAMS,
+		ATOM_REGISTRY_VERSION, member, strlen(member), false) ?
+			ATOM_NO_ERROR : ATOM_REDIS_ERROR;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Gets the version of the registry
+//
+////////////////////////////////////////////////////////////////////////////////
+enum atom_error_t atom_registry_get_version(
+	redisContext *ctx,
+	long long *version)
+{
+	return redis_get_integer(ctx, ATOM_REGISTRY_VERSION, version) ?
+		ATOM_NO_ERROR : ATOM_REDIS_ERROR;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Reads members of a registry, returning false if we need to fall
+//			back to scanning. That's if the registry can't be read, which
+//			is the case on the nodes of a cluster that don't own it, or if
+//			it's empty and nothing has ever been registered on the server
+//
+////////////////////////////////////////////////////////////////////////////////
+static bool atom_registry_get(
+	redisContext *ctx,
+	const char *key,
+	const char *min,
+	const char *max,
+	bool (*data_cb)(const char *member, void *user_data),
+	void *user_data)
+{
+	long long version;
+	int n;
+
+	n = redis_registry_get(ctx, key, min, max, data_cb, user_data);
+	if (n < 0) {
+		return false;
+	}
+	if (n == 0) {
+		return redis_get_integer(ctx, ATOM_REGISTRY_VERSION, &version) &&
+			(version != 0);
+	}
+	return true;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 //  @brief Data callback for when we get a key that matches the element
@@ -78,7 +198,15 @@ enum atom_error_t atom_get_all_elements_cb(
 	info.user_cb = data_cb;
 	info.user_data = user_data;
 
-	// Want to get all matching keys for the element command stream prefix.
+	// Try the registry first
+	if (atom_registry_get(ctx, ATOM_REGISTRY_ELEMENTS, "-", "+",
+		data_cb, user_data))
+	{
+		err = ATOM_NO_ERROR;
+		goto done;
+	}
+
+	// Otherwise get all matching keys for the element command stream prefix.
 	//
 	if (redis_get_matching_keys(ctx,
 		ATOM_COMMAND_STREAM_PREFIX "*",
@@ -132,6 +260,8 @@ enum atom_error_t atom_get_all_data_streams_cb(
 {
 	struct atom_get_data_stream_cb_info info;
 	char stream_prefix_buffer[128];
+	char registry_min[ATOM_NAME_MAXLEN + 2];
+	char registry_max[ATOM_NAME_MAXLEN + 2];
 	enum atom_error_t err = ATOM_INTERNAL_ERROR;
 
 	// Set up the callback info s.t. when our cb is called we can pass
@@ -139,6 +269,25 @@ enum atom_error_t atom_get_all_data_streams_cb(
 	info.user_cb = data_cb;
 	info.user_data = user_data;
 
+	// Try the registry first. An element's streams are the members from
+	//	"element:" up to but not including "element;", ';' being the
+	//	character after ':'
+	if (element != NULL) {
+		snprintf(registry_min, sizeof(registry_min), "[%s:", element);
+		snprintf(registry_max, sizeof(registry_max), "(%s;", element);
+		info.offset = strlen(element) + 1;
+	} else {
+		strcpy(registry_min, "-");
+		strcpy(registry_max, "+");
+		info.offset = 0;
+	}
+	if (atom_registry_get(ctx, ATOM_REGISTRY_STREAMS, registry_min,
+		registry_max, atom_get_data_stream_cb, &info))
+	{
+		err = ATOM_NO_ERROR;
+		goto done;
+	}
+
 	// Make the stream pattern
 	if (element != NULL) {
 		info.offset = snprintf(stream_prefix_buffer, sizeof(stream_prefix_buffer),
@@ -178,12 +327,22 @@ static bool atom_add_to_list(
 	const char *item,
 	void *user_data)
 {
+	struct atom_list_builder *builder;
 	struct atom_list_node **list;
 	struct atom_list_node *new_node;
 	int ret;
 
-	// Assign the user data to the list
-	list = (struct atom_list_node **)user_data;
+	builder = (struct atom_list_builder *)user_data;
+
+	// Items from the registry come in order, so check if this one just
+	//	goes on the end before walking the list
+	if ((builder->last != NULL) &&
+		(strcmp(builder->last->name, item) < 0))
+	{
+		list = &builder->last->next;
+	} else {
+		list = builder->head;
+	}
 
 	// Want to see if the item is in the list or if we've gone
 	//	past the point in the list at which we should add the item
@@ -215,6 +374,10 @@ static bool atom_add_to_list(
 	new_node->next = *list;
 	*list = new_node;
 
+	if (new_node->next == NULL) {
+		builder->last = new_node;
+	}
+
 	return true;
 }
 
@@ -248,11 +411,13 @@ enum atom_error_t atom_get_all_elements(
 	redisContext *ctx,
 	struct atom_list_node **result)
 {
+	struct atom_list_builder builder = { .head = result, .last = NULL };
+
 	*result = NULL;
 	return atom_get_all_elements_cb(
 		ctx,
 		atom_add_to_list,
-		result);
+		&builder);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -265,12 +430,14 @@ enum atom_error_t atom_get_all_data_streams(
 	const char *element,
 	struct atom_list_node **result)
 {
+	struct atom_list_builder builder = { .head = result, .last = NULL };
+
 	*result = NULL;
 	return atom_get_all_data_streams_cb(
 		ctx,
 		element,
 		atom_add_to_list,
-		result);
+		&builder);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -375,6 +542,30 @@ char *atom_get_command_stream_str(
 	return ret;
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Gets the wall-clock time in milliseconds
+//
+////////////////////////////////////////////////////////////////////////////////
+int64_t atom_time_ms(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_REALTIME, &now);
+	return ((int64_t)now.tv_sec * 1000) + (now.tv_nsec / 1000000);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Gets the deadline timeout_ms from now
+//
+////////////////////////////////////////////////////////////////////////////////
+int64_t atom_deadline_ms(
+	int timeout_ms)
+{
+	return atom_time_ms() + timeout_ms;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 //  @brief Gets data stream. If buffer is non-NULL
@@ -430,13 +621,81 @@ char *atom_get_data_stream_str(
 	return ret;
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Reads the runtime log level from the environment. Only called once
+//
+////////////////////////////////////////////////////////////////////////////////
+static void atom_log_level_init(void)
+{
+	const char *env = getenv(ATOM_LOG_LEVEL_ENV);
+	char *end;
+	long level;
+
+	if (env == NULL) {
+		return;
+	}
+
+	level = strtol(env, &end, 10);
+	if ((end == env) || (*end != '\0') ||
+		(level < LOG_EMERG) || (level > LOG_DEBUG))
+	{
+		fprintf(stderr, "Invalid %s %s, logging everything\n",
+			ATOM_LOG_LEVEL_ENV, env);
+		return;
+	}
+
+	atomic_store_explicit(&atom_log_level, level, memory_order_relaxed);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Sets the most verbose level that will be logged
+//
+////////////////////////////////////////////////////////////////////////////////
+enum atom_error_t atom_log_set_level(
+	int level)
+{
+	if ((level < LOG_EMERG) || (level > LOG_DEBUG)) {
+		return ATOM_COMMAND_INVALID_DATA;
+	}
+
+	pthread_once(&atom_log_level_once, atom_log_level_init);
+	atomic_store_explicit(&atom_log_level, level, memory_order_relaxed);
+	return ATOM_NO_ERROR;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Gets the most verbose level that will be logged
+//
+////////////////////////////////////////////////////////////////////////////////
+int atom_log_get_level(void)
+{
+	pthread_once(&atom_log_level_once, atom_log_level_init);
+	return atomic_load_explicit(&atom_log_level, memory_order_relaxed);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Returns whether a log at this level would be sent
+//
+////////////////////////////////////////////////////////////////////////////////
+bool atom_log_enabled(
+	int level)
+{
+	return (level <= ATOM_LOG_MAX_LEVEL) && (level <= atom_log_get_level());
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 //  @brief Logs a message to the global log stream.
-//			- ctx can be NULL, but this is not recommended if it can be avoided
-//			as it's a performance hit to make the context.
+//			- the log is put on a queue and written out by a background
+//			thread with its own connection, so ctx is unused and kept
+//			only s.t. existing callers don't change
 //			- element can be NULL as well, and if so the default element
 //			name will be logged
+//			- logs below the log level are thrown out
 //
 ////////////////////////////////////////////////////////////////////////////////
 enum atom_error_t atom_log(
@@ -446,14 +705,9 @@ enum atom_error_t atom_log(
 	const char *msg,
 	size_t msg_len)
 {
-	// Hostname, only need to get it once
-	static char hostname[HOST_NAME_MAX + 1];
-	static size_t hostname_len = 0;
-
-	struct redis_xadd_info infos[LOG_N_KEYS];
-	char level_str[2];
+	const char *element_name;
+	size_t element_name_len;
 	enum atom_error_t err = ATOM_INTERNAL_ERROR;
-	bool made_context = false;
 	FILE *f;
 
 	// Check the level
@@ -462,80 +716,34 @@ enum atom_error_t atom_log(
 		goto done;
 	}
 
-	// If we haven't gotten the hostname, we need to do so
-	if (hostname_len == 0) {
-		assert(gethostname(hostname, sizeof(hostname)) == 0);
-		hostname[HOST_NAME_MAX] = '\0';
-		hostname_len = strnlen(hostname, HOST_NAME_MAX);
-	}
-
-	// If we weren't passed a context then we'll make one
-	if (ctx == NULL) {
-		ctx = redis_context_init();
-		assert(ctx != NULL);
-		made_context = true;
+	// And throw it out if we're not logging at this level
+	if (!atom_log_enabled(level)) {
+		err = ATOM_NO_ERROR;
+		goto done;
 	}
 
-	// Make the level string
-	level_str[0] = '0' + level;
-	level_str[1] = '\0';
-
-	// Fill in the infos
-	infos[LOG_KEY_LEVEL].key = LOG_KEY_LEVEL_STR;
-	infos[LOG_KEY_LEVEL].key_len = sizeof(LOG_KEY_LEVEL_STR) - 1;
-	infos[LOG_KEY_LEVEL].data = (const uint8_t*)level_str;
-	infos[LOG_KEY_LEVEL].data_len = 1;
-
-	infos[LOG_KEY_ELEMENT].key = LOG_KEY_ELEMENT_STR;
-	infos[LOG_KEY_ELEMENT].key_len = sizeof(LOG_KEY_ELEMENT_STR) - 1;
-
 	if (element != NULL) {
-		infos[LOG_KEY_ELEMENT].data = (const uint8_t*)element->name.str;
-		infos[LOG_KEY_ELEMENT].data_len = element->name.len;
+		element_name = element->name.str;
+		element_name_len = element->name.len;
 	} else {
-		infos[LOG_KEY_ELEMENT].data = (const uint8_t*)ATOM_LOG_DEFAULT_ELEMENT_NAME;
-		infos[LOG_KEY_ELEMENT].data_len = sizeof(ATOM_LOG_DEFAULT_ELEMENT_NAME) - 1;
-	}
-
-	infos[LOG_KEY_MESSAGE].key = LOG_KEY_MESSAGE_STR;
-	infos[LOG_KEY_MESSAGE].key_len = sizeof(LOG_KEY_MESSAGE_STR) - 1;
-	infos[LOG_KEY_MESSAGE].data = (const uint8_t*)msg;
-	infos[LOG_KEY_MESSAGE].data_len = msg_len;
-
-	infos[LOG_KEY_HOST].key = LOG_KEY_HOST_STR;
-	infos[LOG_KEY_HOST].key_len = sizeof(LOG_KEY_HOST_STR) - 1;
-	infos[LOG_KEY_HOST].data = (const uint8_t*)hostname;
-	infos[LOG_KEY_HOST].data_len = hostname_len;
-
-	if (!redis_xadd(
-		ctx,
-		ATOM_LOG_STREAM_NAME,
-		infos,
-		LOG_N_KEYS,
-		ATOM_DEFAULT_MAXLEN,
-		true,
-		NULL))
-	{
-		err = ATOM_REDIS_ERROR;
-		goto done;
-	}
-
-	// If we made our context then we need to free it
-	if (made_context) {
-		redis_context_cleanup(ctx);
+		element_name = ATOM_LOG_DEFAULT_ELEMENT_NAME;
+		element_name_len = CONST_STRLEN(ATOM_LOG_DEFAULT_ELEMENT_NAME);
 	}
 
 	// And if we're printing logs to stdout we should do so
 	#ifdef ATOM_PRINT_LOGS
 		f = (level <= LOG_ERR) ? stderr : stdout;
-		fprintf(f, "Level: %d, Host: %s, Element: %s, Msg: %s\n",
+		fprintf(f, "Level: %d, Element: %s, Msg: %.*s\n",
 			level,
-			hostname,
-			(element != NULL) ?
-				element->name.str : ATOM_LOG_DEFAULT_ELEMENT_NAME,
+			element_name,
+			(int)msg_len,
 			msg);
 	#endif
 
+	// If the writer can't keep up the log is dropped and counted rather
+	//	than making the caller wait, see log_queue_dropped()
+	log_queue_push(level, element_name, element_name_len, msg, msg_len);
+
 	err = ATOM_NO_ERROR;
 
 done:
@@ -555,10 +763,24 @@ enum atom_error_t atom_vlogf(
 	va_list args)
 {
     char log_buffer[ATOM_LOG_MAXLEN];
-    size_t len;
+    int len;
+
+    // Don't bother formatting a log we're going to throw out
+    if ((level >= LOG_EMERG) && (level <= LOG_DEBUG) &&
+    	!atom_log_enabled(level))
+    {
+    	return ATOM_NO_ERROR;
+    }
 
-    // Use the variadic version of snprintf
+    // Use the variadic version of snprintf. It returns the length it
+    //	wanted, not what it wrote
     len = vsnprintf(log_buffer, sizeof(log_buffer), fmt, args);
+    if (len < 0) {
+    	return ATOM_INTERNAL_ERROR;
+    }
+    if ((size_t)len >= sizeof(log_buffer)) {
+    	len = sizeof(log_buffer) - 1;
+    }
 
    	return atom_log(ctx, element, level, log_buffer, len);
 }
@@ -583,3 +805,14 @@ enum atom_error_t atom_logf(
     // Call the variadic version
     return atom_vlogf(ctx, element, level, fmt, args);
 }
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Waits for the logs queued so far to be written to the log stream
+//
+////////////////////////////////////////////////////////////////////////////////
+enum atom_error_t atom_log_flush(void)
+{
+	return log_queue_flush(LOG_QUEUE_FLUSH_TIMEOUT_MS) ?
+		ATOM_NO_ERROR : ATOM_REDIS_ERROR;
+}
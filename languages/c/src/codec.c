@@ -0,0 +1,457 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @file codec.c
+//
+//  @brief Implements compressing the values in entries and commands
+//
+//  @copy 2018 Elementary Robotics. All rights reserved.
+//
+////////////////////////////////////////////////////////////////////////////////
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <hiredis/hiredis.h>
+
+#ifdef ATOM_HAVE_LZ4
+#include <lz4.h>
+#endif
+
+#ifdef ATOM_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "redis.h"
+#include "codec.h"
+
+// Names of the codecs, in the order of the enum
+static const char *codec_names[CODEC_N_TYPES] = {
+	CODEC_NONE_STR,
+	CODEC_LZ4_STR,
+	CODEC_ZSTD_STR,
+};
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Gets the name of a codec
+//
+////////////////////////////////////////////////////////////////////////////////
+const char *codec_name(
+	enum codec_type codec)
+{
+	return (codec < CODEC_N_TYPES) ? codec_names[codec] : NULL;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Gets a codec from its name. Returns false if there's no such codec
+//
+////////////////////////////////////////////////////////////////////////////////
+bool codec_from_name(
+	const char *name,
+	size_t len,
+	enum codec_type *codec)
+{
+	int i;
+
+	for (i = 0; i < CODEC_N_TYPES; ++i) {
+		if ((strlen(codec_names[i]) == len) &&
+			(strncmp(codec_names[i], name, len) == 0))
+		{
+			*codec = (enum codec_type)i;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Returns whether we were built with support for the codec
+//
+////////////////////////////////////////////////////////////////////////////////
+bool codec_available(
+	enum codec_type codec)
+{
+	switch (codec) {
+		case CODEC_NONE:
+			return true;
+#ifdef ATOM_HAVE_LZ4
+		case CODEC_LZ4:
+			return true;
+#endif
+#ifdef ATOM_HAVE_ZSTD
+		case CODEC_ZSTD:
+			return true;
+#endif
+		default:
+			return false;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Compresses a value into a newly allocated frame. Returns NULL
+//			if the value couldn't be compressed or didn't get any smaller
+//
+////////////////////////////////////////////////////////////////////////////////
+static uint8_t *codec_compress(
+	enum codec_type codec,
+	const uint8_t *data,
+	size_t data_len,
+	size_t *frame_len)
+{
+	uint8_t *frame = NULL;
+	size_t bound = 0, compressed_len = 0;
+
+	if (data_len > UINT32_MAX) {
+		return NULL;
+	}
+
+	switch (codec) {
+#ifdef ATOM_HAVE_LZ4
+		case CODEC_LZ4:
+			if (data_len > LZ4_MAX_INPUT_SIZE) {
+				return NULL;
+			}
+			bound = LZ4_compressBound((int)data_len);
+			break;
+#endif
+#ifdef ATOM_HAVE_ZSTD
+		case CODEC_ZSTD:
+			bound = ZSTD_compressBound(data_len);
+			break;
+#endif
+		default:
+			return NULL;
+	}
+
+	frame = malloc(CODEC_FRAME_COMPRESSED_LEN + bound);
+	assert(frame != NULL);
+
+	switch (codec) {
+#ifdef ATOM_HAVE_LZ4
+		case CODEC_LZ4: {
+			int ret = LZ4_compress_default(
+				(const char *)data,
+				(char *)frame + CODEC_FRAME_COMPRESSED_LEN,
+				(int)data_len,
+				(int)bound);
+			if (ret <= 0) {
+				goto fail;
+			}
+			compressed_len = ret;
+			break;
+		}
+#endif
+#ifdef ATOM_HAVE_ZSTD
+		case CODEC_ZSTD: {
+			size_t ret = ZSTD_compress(
+				frame + CODEC_FRAME_COMPRESSED_LEN,
+				bound,
+				data,
+				data_len,
+				CODEC_ZSTD_LEVEL);
+			if (ZSTD_isError(ret)) {
+				goto fail;
+			}
+			compressed_len = ret;
+			break;
+		}
+#endif
+		default:
+			goto fail;
+	}
+
+	// Not worth it if we didn't save anything
+	if (CODEC_FRAME_COMPRESSED_LEN + compressed_len >= data_len) {
+		goto fail;
+	}
+
+	memcpy(frame, CODEC_FRAME_MAGIC, CODEC_FRAME_MAGIC_LEN);
+	frame[CODEC_FRAME_MAGIC_LEN] = CODEC_FRAME_COMPRESSED;
+	frame[CODEC_FRAME_MAGIC_LEN + 1] = data_len & 0xFF;
+	frame[CODEC_FRAME_MAGIC_LEN + 2] = (data_len >> 8) & 0xFF;
+	frame[CODEC_FRAME_MAGIC_LEN + 3] = (data_len >> 16) & 0xFF;
+	frame[CODEC_FRAME_MAGIC_LEN + 4] = (data_len >> 24) & 0xFF;
+
+	*frame_len = CODEC_FRAME_COMPRESSED_LEN + compressed_len;
+	return frame;
+
+fail:
+	free(frame);
+	return NULL;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Decompresses a frame into a newly allocated, NULL-terminated
+//			buffer. Returns NULL if the frame is invalid
+//
+////////////////////////////////////////////////////////////////////////////////
+static char *codec_decompress(
+	enum codec_type codec,
+	const uint8_t *frame,
+	size_t frame_len,
+	size_t *data_len)
+{
+	char *data;
+	const uint8_t *compressed = frame + CODEC_FRAME_COMPRESSED_LEN;
+	size_t compressed_len = frame_len - CODEC_FRAME_COMPRESSED_LEN;
+	size_t len =
+		(size_t)frame[CODEC_FRAME_MAGIC_LEN + 1] |
+		((size_t)frame[CODEC_FRAME_MAGIC_LEN + 2] << 8) |
+		((size_t)frame[CODEC_FRAME_MAGIC_LEN + 3] << 16) |
+		((size_t)frame[CODEC_FRAME_MAGIC_LEN + 4] << 24);
+
+	data = malloc(len + 1);
+	assert(data != NULL);
+
+	switch (codec) {
+#ifdef ATOM_HAVE_LZ4
+		case CODEC_LZ4:
+			if ((len > LZ4_MAX_INPUT_SIZE) ||
+				(compressed_len > LZ4_MAX_INPUT_SIZE) ||
+				(LZ4_decompress_safe((const char *)compressed, data,
+					(int)compressed_len, (int)len) != (int)len))
+			{
+				goto fail;
+			}
+			break;
+#endif
+#ifdef ATOM_HAVE_ZSTD
+		case CODEC_ZSTD:
+			if (ZSTD_decompress(data, len, compressed, compressed_len) != len) {
+				goto fail;
+			}
+			break;
+#endif
+		default:
+			(void)compressed;
+			(void)compressed_len;
+			goto fail;
+	}
+
+	data[len] = '\0';
+	*data_len = len;
+	return data;
+
+fail:
+	free(data);
+	return NULL;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Compresses the values that are big enough. If any of them were
+//			compressed then the values that weren't and start with the
+//			frame magic are framed as stored s.t. they can't be mistaken
+//			for compressed values, and the codec key is added. Entries
+//			that already have a codec key aren't compressed.
+//
+////////////////////////////////////////////////////////////////////////////////
+void codec_encode_items(
+	enum codec_type codec,
+	size_t min_size,
+	struct redis_xadd_info *items,
+	size_t n_items,
+	struct codec_encoded_items *encoded)
+{
+	static bool warned = false;
+	struct redis_xadd_info *out;
+	uint8_t *frame;
+	size_t i, frame_len;
+	bool compressed = false;
+
+	encoded->items = items;
+	encoded->n_items = n_items;
+	encoded->buffers = NULL;
+	encoded->n_buffers = 0;
+
+	if (codec == CODEC_NONE) {
+		return;
+	}
+
+	if (!codec_available(codec)) {
+		if (!warned) {
+			fprintf(stderr, "Codec %s not built in, not compressing\n",
+				codec_name(codec) ? codec_name(codec) : "?");
+			warned = true;
+		}
+		return;
+	}
+
+	// Nothing to do unless something is big enough. Entries with a codec
+	//	key of their own are sent as they are since readers would take it
+	//	for ours
+	for (i = 0; i < n_items; ++i) {
+		if ((items[i].key_len == CONST_STRLEN(CODEC_KEY_STR)) &&
+			(memcmp(items[i].key, CODEC_KEY_STR,
+				CONST_STRLEN(CODEC_KEY_STR)) == 0))
+		{
+			return;
+		}
+	}
+	for (i = 0; i < n_items; ++i) {
+		if (items[i].data_len >= min_size) {
+			break;
+		}
+	}
+	if (i == n_items) {
+		return;
+	}
+
+	out = malloc((n_items + 1) * sizeof(struct redis_xadd_info));
+	assert(out != NULL);
+	encoded->buffers = malloc(n_items * sizeof(uint8_t *));
+	assert(encoded->buffers != NULL);
+
+	for (i = 0; i < n_items; ++i) {
+		out[i] = items[i];
+		if ((items[i].data_len >= min_size) &&
+			((frame = codec_compress(codec, items[i].data,
+				items[i].data_len, &frame_len)) != NULL))
+		{
+			out[i].data = frame;
+			out[i].data_len = frame_len;
+			encoded->buffers[encoded->n_buffers++] = frame;
+			compressed = true;
+		}
+	}
+
+	// If nothing got smaller then send the items as they are
+	if (!compressed) {
+		free(out);
+		free(encoded->buffers);
+		encoded->buffers = NULL;
+		return;
+	}
+
+	for (i = 0; i < n_items; ++i) {
+		if ((out[i].data == items[i].data) &&
+			(out[i].data_len >= CODEC_FRAME_MAGIC_LEN) &&
+			(memcmp(out[i].data, CODEC_FRAME_MAGIC, CODEC_FRAME_MAGIC_LEN) == 0))
+		{
+			frame = malloc(CODEC_FRAME_STORED_LEN + out[i].data_len);
+			assert(frame != NULL);
+			memcpy(frame, CODEC_FRAME_MAGIC, CODEC_FRAME_MAGIC_LEN);
+			frame[CODEC_FRAME_MAGIC_LEN] = CODEC_FRAME_STORED;
+			memcpy(frame + CODEC_FRAME_STORED_LEN, out[i].data, out[i].data_len);
+			out[i].data = frame;
+			out[i].data_len += CODEC_FRAME_STORED_LEN;
+			encoded->buffers[encoded->n_buffers++] = frame;
+		}
+	}
+
+	out[n_items].key = CODEC_KEY_STR;
+	out[n_items].key_len = CONST_STRLEN(CODEC_KEY_STR);
+	out[n_items].data = (const uint8_t *)codec_name(codec);
+	out[n_items].data_len = strlen(codec_name(codec));
+
+	encoded->items = out;
+	encoded->n_items = n_items + 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Frees the compressed values
+//
+////////////////////////////////////////////////////////////////////////////////
+void codec_encoded_items_cleanup(
+	struct codec_encoded_items *encoded)
+{
+	size_t i;
+
+	if (encoded->buffers == NULL) {
+		return;
+	}
+
+	for (i = 0; i < encoded->n_buffers; ++i) {
+		free(encoded->buffers[i]);
+	}
+	free(encoded->buffers);
+	free(encoded->items);
+	encoded->buffers = NULL;
+	encoded->items = NULL;
+	encoded->n_items = 0;
+	encoded->n_buffers = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Decodes the values of an entry in place. Compressed values
+//			replace the reply's string with redis_reply_set_str s.t. they
+//			are freed along with the reply, whether or not it was built
+//			in a reply arena. Stored values just have their frame header
+//			removed.
+//
+////////////////////////////////////////////////////////////////////////////////
+bool codec_decode_reply(
+	redisReply *reply)
+{
+	size_t idx, len;
+	redisReply *value;
+	enum codec_type codec;
+	char *data;
+	bool found = false;
+
+	if ((reply == NULL) || (reply->type != REDIS_REPLY_ARRAY)) {
+		return true;
+	}
+
+	// Find the codec key. Most entries won't have one
+	for (idx = 0; idx + 1 < reply->elements; idx += 2) {
+		if ((reply->element[idx]->type == REDIS_REPLY_STRING) &&
+			(reply->element[idx]->len == CONST_STRLEN(CODEC_KEY_STR)) &&
+			(memcmp(reply->element[idx]->str, CODEC_KEY_STR,
+				CONST_STRLEN(CODEC_KEY_STR)) == 0))
+		{
+			found = true;
+			break;
+		}
+	}
+	if (!found) {
+		return true;
+	}
+
+	// The key is only reserved in some languages, so an entry can have one
+	//	of its own. Anything that isn't the name of a codec is just data
+	value = reply->element[idx + 1];
+	if ((value->type != REDIS_REPLY_STRING) ||
+		!codec_from_name(value->str, value->len, &codec) ||
+		(codec == CODEC_NONE))
+	{
+		return true;
+	}
+
+	for (idx = 1; idx < reply->elements; idx += 2) {
+		value = reply->element[idx];
+		if ((value->type != REDIS_REPLY_STRING) ||
+			(value->len < CODEC_FRAME_STORED_LEN) ||
+			(memcmp(value->str, CODEC_FRAME_MAGIC, CODEC_FRAME_MAGIC_LEN) != 0))
+		{
+			continue;
+		}
+
+		if (value->str[CODEC_FRAME_MAGIC_LEN] == CODEC_FRAME_STORED) {
+			memmove(value->str, value->str + CODEC_FRAME_STORED_LEN,
+				value->len - CODEC_FRAME_STORED_LEN + 1);
+			value->len -= CODEC_FRAME_STORED_LEN;
+			continue;
+		}
+
+		if ((value->str[CODEC_FRAME_MAGIC_LEN] != CODEC_FRAME_COMPRESSED) ||
+			(value->len < CODEC_FRAME_COMPRESSED_LEN) ||
+			((data = codec_decompress(codec, (const uint8_t *)value->str,
+				value->len, &len)) == NULL))
+		{
+			fprintf(stderr, "Failed to decode %s value\n", codec_name(codec));
+			return false;
+		}
+
+		redis_reply_set_str(value, data, len);
+	}
+
+	return true;
+}
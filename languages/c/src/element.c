@@ -19,6 +19,7 @@
 #include "redis.h"
 #include "atom.h"
 #include "element.h"
+#include "metrics.h"
 
 ////////////////////////////////////////////////////////////////////////////////
 //
@@ -59,6 +60,13 @@ struct element *element_init(
 	//	all of the bins to empty
 	memset(elem->command.hash, 0, sizeof(elem->command.hash));
 
+	// By default we read the whole command stream ourselves
+	elem->command.group = NULL;
+	elem->command.consumer = NULL;
+	elem->command.claim_idle_ms = ELEMENT_COMMAND_GROUP_NO_CLAIM;
+	elem->command_codecs = NULL;
+	elem->metrics = false;
+
 	// Finally, make the redis context for the element to send responses
 	//	to commands on. This is done since the context for receiving the command
 	//	is in use
@@ -106,6 +114,16 @@ struct element *element_init(
 		goto err_cleanup;
 	}
 
+	// Register s.t. we can be found without a scan. We still work if
+	//	this fails, other elements might just not see us
+	if (atom_registry_add_element(ctx, name) != ATOM_NO_ERROR) {
+		atom_logf(ctx, elem, LOG_WARNING,
+			"Failed to add element to the registry");
+	}
+
+	// Start recording metrics, if they're enabled
+	elem->metrics = metrics_init(name);
+
 	// If we got here, then we're good. Skip the error cleanup
 	goto done;
 
@@ -166,23 +184,59 @@ void element_cleanup(
 {
 	if (elem != NULL) {
 
+		// Give our logs a chance to make it out before we go
+		atom_log_flush();
+
+		// Leave the registry, unless we're one of a group of replicas
+		//	that are all registered under the same name
+		if ((elem->name.str != NULL) && (elem->command.group == NULL) &&
+			(elem->command.stream != NULL))
+		{
+			atom_registry_remove_element(ctx, elem->name.str);
+		}
+
 		// Clean up the name
 		if (elem->name.str != NULL) {
 			free(elem->name.str);
 		}
 
+		// If we're one of a group of replicas then the streams are shared
+		//	and need to outlive us. We only remove our consumer, and only
+		//	if we don't have anything pending that another replica
+		//	should pick up
+		if (elem->command.group != NULL) {
+			if (redis_xpending(ctx, elem->command.stream,
+				elem->command.group, elem->command.consumer, 1) == 0)
+			{
+				redis_xgroup_delconsumer(ctx, elem->command.stream,
+					elem->command.group, elem->command.consumer);
+			}
+		}
+
 		// Clean up the response stream
 		if (elem->response.stream != NULL) {
-			redis_remove_key(ctx, elem->response.stream, true);
+			if (elem->command.group == NULL) {
+				redis_remove_key(ctx, elem->response.stream, true);
+			}
 			free(elem->response.stream);
 		}
 
 		// Clean up the command stream
 		if (elem->command.stream != NULL) {
-			redis_remove_key(ctx, elem->command.stream, true);
+			if (elem->command.group == NULL) {
+				redis_remove_key(ctx, elem->command.stream, true);
+			}
 			free(elem->command.stream);
 		}
 
+		// Clean up the group info
+		if (elem->command.group != NULL) {
+			free(elem->command.group);
+		}
+		if (elem->command.consumer != NULL) {
+			free(elem->command.consumer);
+		}
+
 		// Clean up the response context
 		if (elem->command.ctx != NULL) {
 			redis_context_cleanup(elem->command.ctx);
@@ -191,6 +245,13 @@ void element_cleanup(
 		// Clean up the hashtable
 		element_free_command_hash(elem->command.hash);
 
+		// And the codecs for commands we send
+		element_command_codecs_cleanup(elem);
+
+		if (elem->metrics) {
+			metrics_cleanup();
+		}
+
 		// And free the element itself
 		free(elem);
 	}
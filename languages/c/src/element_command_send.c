@@ -15,12 +15,16 @@
 #include <assert.h>
 #include <malloc.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <time.h>
+#include <limits.h>
 
 #include "redis.h"
 #include "atom.h"
 #include "element.h"
-
-#define ELEMENT_COMMAND_ACK_TIMEOUT 100000
+#include "metrics.h"
+#include "codec.h"
 
 // How long to wait for a response if the command is not supported
 #define ELEMENT_NO_COMMAND_TIMEOUT_MS 1000
@@ -28,6 +32,12 @@
 // Maximum length of the command stream before redis trims it
 #define ELEMENT_COMMAND_STREAM_MAXLEN 10
 
+// Value sent with the fast key. Only its presence matters
+#define ELEMENT_COMMAND_FAST_VALUE "1"
+
+// Length of the buffer for the deadline sent with a command
+#define ELEMENT_COMMAND_DEADLINE_BUFFLEN 32
+
 // Struct for handling a response on the command stream. Will be passed
 //	to the XREAD as the user data.
 struct element_response_stream_data {
@@ -60,6 +70,41 @@ struct element_command_response_data {
 	void *user_data;
 };
 
+// Keys of anything that can come back on the response stream. Used when
+//	waiting on the ACKs and responses of many commands at once
+enum element_command_multi_keys_t {
+	MULTI_KEY_ELEMENT,
+	MULTI_KEY_ID,
+	MULTI_KEY_TIMEOUT,
+	MULTI_KEY_CMD,
+	MULTI_KEY_ERR_CODE,
+	MULTI_KEY_ERR_STR,
+	MULTI_KEY_DATA,
+	MULTI_N_KEYS,
+};
+
+// Where each of the commands sent by element_command_send_multi is at. The
+//	deadline is for the ACK until it's found, then for the response
+struct element_command_multi_state {
+	bool sent;
+	bool acked;
+	bool done;
+	int64_t deadline_ms;
+	struct element_command_response_data response;
+};
+
+// Data for reading the response stream in element_command_send_multi
+struct element_command_multi_data {
+	struct element *elem;
+	struct element_command_target *targets;
+	struct element_command_multi_state *states;
+	size_t n_targets;
+	size_t n_pending;
+	int64_t call_deadline_ms;
+	uint64_t sent;
+	struct redis_xread_kv_item kv_items[MULTI_N_KEYS];
+};
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 //  @brief Callback for all XREADS from the element's response stream
@@ -359,6 +404,263 @@ static void element_command_init_response_data(
 	response_items[RESPONSE_KEY_DATA].key_len = CONST_STRLEN(RESPONSE_KEY_DATA_STR);
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Returns the current monotonic time in milliseconds
+//
+////////////////////////////////////////////////////////////////////////////////
+static int64_t element_command_send_time_ms(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return ((int64_t)now.tv_sec * 1000) + (now.tv_nsec / 1000000);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Returns the sooner of two deadlines
+//
+////////////////////////////////////////////////////////////////////////////////
+static int64_t element_command_deadline_min(
+	int64_t a,
+	int64_t b)
+{
+	return (a < b) ? a : b;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Does one XREAD of the response stream, blocking for however long
+//			is left until the monotonic deadline. Returns false if the
+//			deadline has passed or nothing came in before it did
+//
+////////////////////////////////////////////////////////////////////////////////
+static bool element_command_read_until(
+	redisContext *ctx,
+	struct redis_stream_info *stream_info,
+	int64_t deadline_ms)
+{
+	int64_t remaining_ms;
+
+	// A block of 0 would wait forever, so stop once there's under 1 ms left
+	remaining_ms = deadline_ms - element_command_send_time_ms();
+	if (remaining_ms < 1) {
+		return false;
+	}
+	if (remaining_ms > INT_MAX) {
+		remaining_ms = INT_MAX;
+	}
+
+	return redis_xread(ctx, stream_info, 1, (int)remaining_ms, 1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Sets the codec for commands sent to an element, replacing any
+//			codec already set for the same element and command
+//
+////////////////////////////////////////////////////////////////////////////////
+void element_command_set_codec(
+	struct element *elem,
+	const char *cmd_elem,
+	const char *cmd,
+	enum codec_type codec,
+	size_t min_size)
+{
+	struct element_command_codec *iter;
+
+	for (iter = elem->command_codecs; iter != NULL; iter = iter->next) {
+		if ((strcmp(iter->cmd_elem, cmd_elem) == 0) &&
+			(((iter->cmd == NULL) && (cmd == NULL)) ||
+				((iter->cmd != NULL) && (cmd != NULL) &&
+					(strcmp(iter->cmd, cmd) == 0))))
+		{
+			break;
+		}
+	}
+
+	if (iter == NULL) {
+		iter = malloc(sizeof(struct element_command_codec));
+		assert(iter != NULL);
+		iter->cmd_elem = strdup(cmd_elem);
+		assert(iter->cmd_elem != NULL);
+		iter->cmd = (cmd != NULL) ? strdup(cmd) : NULL;
+		iter->next = elem->command_codecs;
+		elem->command_codecs = iter;
+	}
+
+	iter->codec = codec;
+	iter->min_size = min_size;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Frees the command codecs
+//
+////////////////////////////////////////////////////////////////////////////////
+void element_command_codecs_cleanup(
+	struct element *elem)
+{
+	struct element_command_codec *iter, *next;
+
+	for (iter = elem->command_codecs; iter != NULL; iter = next) {
+		next = iter->next;
+		free(iter->cmd_elem);
+		free(iter->cmd);
+		free(iter);
+	}
+	elem->command_codecs = NULL;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Finds the codec for a command. A codec for the command itself
+//			wins over one for all of the element's commands
+//
+////////////////////////////////////////////////////////////////////////////////
+static const struct element_command_codec *element_command_get_codec(
+	struct element *elem,
+	const char *cmd_elem,
+	const char *cmd)
+{
+	struct element_command_codec *iter;
+	const struct element_command_codec *ret = NULL;
+
+	for (iter = elem->command_codecs; iter != NULL; iter = iter->next) {
+		if (strcmp(iter->cmd_elem, cmd_elem) != 0) {
+			continue;
+		}
+		if (iter->cmd == NULL) {
+			ret = iter;
+		} else if (strcmp(iter->cmd, cmd) == 0) {
+			return iter;
+		}
+	}
+
+	return ret;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Builds the items of a command to another element, compressed if
+//			need be, and gets the name of the element's command stream.
+//			If fast is set the command is marked s.t. the element knows
+//			not to send an ACK. The encoded items point into cmd_data and
+//			deadline_buffer, and must be cleaned up.
+//
+////////////////////////////////////////////////////////////////////////////////
+static void element_command_encode_request(
+	struct element *elem,
+	const char *cmd_elem,
+	const char *cmd,
+	const uint8_t *data,
+	size_t data_len,
+	bool fast,
+	int64_t deadline_ms,
+	struct redis_xadd_info cmd_data[CMD_MAX_N_KEYS],
+	char deadline_buffer[ELEMENT_COMMAND_DEADLINE_BUFFLEN],
+	char cmd_elem_stream[ATOM_NAME_MAXLEN],
+	struct codec_encoded_items *encoded)
+{
+	size_t n_items = CMD_N_KEYS;
+	const struct element_command_codec *codec;
+
+	// Want to set up the data for the command
+	element_command_init_data(
+		cmd_data, elem->name.str, elem->name.len, cmd, data, data_len);
+
+	// And note that it's fast if need be
+	if (fast) {
+		cmd_data[n_items].key = COMMAND_KEY_FAST_STR;
+		cmd_data[n_items].key_len = CONST_STRLEN(COMMAND_KEY_FAST_STR);
+		cmd_data[n_items].data = (uint8_t*)ELEMENT_COMMAND_FAST_VALUE;
+		cmd_data[n_items].data_len = CONST_STRLEN(
+			ELEMENT_COMMAND_FAST_VALUE);
+		n_items++;
+	}
+
+	// And when we'll have given up on it, if ever
+	if (deadline_ms != ATOM_NO_DEADLINE) {
+		cmd_data[n_items].key = COMMAND_KEY_DEADLINE_STR;
+		cmd_data[n_items].key_len = CONST_STRLEN(COMMAND_KEY_DEADLINE_STR);
+		cmd_data[n_items].data = (uint8_t*)deadline_buffer;
+		cmd_data[n_items].data_len = snprintf(deadline_buffer,
+			ELEMENT_COMMAND_DEADLINE_BUFFLEN, "%" PRId64, deadline_ms);
+		n_items++;
+	}
+
+	// Get the name of the element stream we want to write to
+	atom_get_command_stream_str(cmd_elem, cmd_elem_stream);
+
+	// Compress the data if we've been asked to
+	codec = element_command_get_codec(elem, cmd_elem, cmd);
+	codec_encode_items(
+		(codec != NULL) ? codec->codec : CODEC_NONE,
+		(codec != NULL) ? codec->min_size : 0,
+		cmd_data, n_items, encoded);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Writes a command to another element's command stream
+//
+////////////////////////////////////////////////////////////////////////////////
+static enum atom_error_t element_command_write_request(
+	redisContext *ctx,
+	struct element *elem,
+	const char *cmd_elem,
+	const char *cmd,
+	const uint8_t *data,
+	size_t data_len,
+	bool fast,
+	int64_t deadline_ms,
+	char cmd_id[STREAM_ID_BUFFLEN])
+{
+	struct redis_xadd_info cmd_data[CMD_MAX_N_KEYS];
+	char cmd_elem_stream[ATOM_NAME_MAXLEN];
+	char deadline_buffer[ELEMENT_COMMAND_DEADLINE_BUFFLEN];
+	struct codec_encoded_items encoded;
+	enum atom_error_t ret = ATOM_NO_ERROR;
+
+	element_command_encode_request(elem, cmd_elem, cmd, data, data_len,
+		fast, deadline_ms, cmd_data, deadline_buffer, cmd_elem_stream,
+		&encoded);
+
+	// Now, call the XADD to send the data over to the element
+	if (!redis_xadd(ctx, cmd_elem_stream, encoded.items, encoded.n_items,
+		ELEMENT_COMMAND_STREAM_MAXLEN, ATOM_DEFAULT_APPROX_MAXLEN, cmd_id))
+	{
+		atom_logf(ctx, elem, LOG_ERR, "Failed to XADD command data to stream");
+		ret = ATOM_REDIS_ERROR;
+	}
+
+	codec_encoded_items_cleanup(&encoded);
+	return ret;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Writes a command to another element's command stream without
+//			waiting for the ACK or response. The ID of the command is
+//			copied into cmd_id s.t. the caller can match the ACK and
+//			response that come back on our response stream.
+//
+////////////////////////////////////////////////////////////////////////////////
+enum atom_error_t element_command_send_request(
+	redisContext *ctx,
+	struct element *elem,
+	const char *cmd_elem,
+	const char *cmd,
+	const uint8_t *data,
+	size_t data_len,
+	char cmd_id[STREAM_ID_BUFFLEN])
+{
+	return element_command_write_request(
+		ctx, elem, cmd_elem, cmd, data, data_len, false, ATOM_NO_DEADLINE,
+		cmd_id);
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 //  @brief Sends a command to another element. If block=TRUE
@@ -381,11 +683,39 @@ enum atom_error_t element_command_send(
 		void *user_data),
 	void *user_data,
 	char **error_str)
+{
+	return element_command_send_deadline(ctx, elem, cmd_elem, cmd, data,
+		data_len, block, ATOM_NO_DEADLINE, response_cb, user_data, error_str);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Sends a command to another element, giving up at the deadline.
+//			Each phase also has its own deadline, ELEMENT_COMMAND_ACK_TIMEOUT
+//			for the ACK and the timeout in the ACK for the response, and the
+//			time left until the sooner of the two is worked out again before
+//			each XREAD s.t. other traffic on the response stream doesn't
+//			keep pushing it back.
+//
+////////////////////////////////////////////////////////////////////////////////
+enum atom_error_t element_command_send_deadline(
+	redisContext *ctx,
+	struct element *elem,
+	const char *cmd_elem,
+	const char *cmd,
+	const uint8_t *data,
+	size_t data_len,
+	bool block,
+	int64_t deadline_ms,
+	bool (*response_cb)(
+		const uint8_t *response,
+		size_t response_len,
+		void *user_data),
+	void *user_data,
+	char **error_str)
 {
 	int ret;
 	struct redis_stream_info stream_info;
-	struct redis_xadd_info cmd_data[CMD_N_KEYS];
-	char cmd_elem_stream[ATOM_NAME_MAXLEN];
 	char cmd_id[STREAM_ID_BUFFLEN];
 
 	struct element_response_stream_data stream_data;
@@ -395,6 +725,8 @@ enum atom_error_t element_command_send(
 
 	struct element_command_response_data response_data;
 	struct redis_xread_kv_item response_items[RESPONSE_N_KEYS];
+	int64_t now_ms, call_deadline_ms, phase_deadline_ms;
+	uint64_t sent;
 
 	// Initialize the error code and error string
 	ret = ATOM_INTERNAL_ERROR;
@@ -402,22 +734,29 @@ enum atom_error_t element_command_send(
 		*error_str = NULL;
 	}
 
-	// Want to set up the data for the command
-	element_command_init_data(
-		cmd_data, elem->name.str, elem->name.len, cmd, data, data_len);
-
-	// Get the name of the element stream we want to write to
-	atom_get_command_stream_str(cmd_elem, cmd_elem_stream);
+	// We wait on the monotonic clock, so move the deadline over to it.
+	//	If it's already passed then there's no point in sending anything
+	now_ms = element_command_send_time_ms();
+	call_deadline_ms = INT64_MAX;
+	if (deadline_ms != ATOM_NO_DEADLINE) {
+		call_deadline_ms = now_ms + (deadline_ms - atom_time_ms());
+		if (call_deadline_ms <= now_ms) {
+			ret = ATOM_COMMAND_NO_ACK;
+			atom_logf(ctx, elem, LOG_ERR,
+				"Deadline passed before sending command");
+			goto done;
+		}
+	}
 
-	// Now, call the XADD to send the data over to the element. We want to
-	//	note the command ID since we'll expect it back in the ACK and response
-	if (!redis_xadd(ctx, cmd_elem_stream, cmd_data, CMD_N_KEYS,
-		ELEMENT_COMMAND_STREAM_MAXLEN, ATOM_DEFAULT_APPROX_MAXLEN, cmd_id))
-	{
-		atom_logf(ctx, elem, LOG_ERR, "Failed to XADD command data to stream");
-		ret = ATOM_REDIS_ERROR;
+	// Send the command over to the element. We want to note the command
+	//	ID since we'll expect it back in the ACK and response
+	sent = metrics_timing_start();
+	ret = element_command_write_request(
+		ctx, elem, cmd_elem, cmd, data, data_len, false, deadline_ms, cmd_id);
+	if (ret != ATOM_NO_ERROR) {
 		goto done;
 	}
+	ret = ATOM_INTERNAL_ERROR;
 
 	// Need to set up the ack. This will initialize our user data
 	//	and set up the keys we're looking for in the ack
@@ -428,22 +767,20 @@ enum atom_error_t element_command_send(
 		ACK_N_KEYS, element_command_ack_callback, &ack_data);
 
 	// Now, we're ready to call the XREAD. We want to do this until either
-	//	the ACK is found or we've timed out. Note that this re-does the
-	//	timeout each time we get a message which is not ideal.
+	//	the ACK is found or we've timed out. The ACK should come quickly
+	//	so we only wait a default amount of time for it
+	phase_deadline_ms = element_command_deadline_min(
+		now_ms + ELEMENT_COMMAND_ACK_TIMEOUT, call_deadline_ms);
 	while (!ack_data.found_ack) {
-		// XREAD with a default timeout since the ACK should come quickly
-		if (!redis_xread(
-			ctx,
-			&stream_info,
-			1,
-			ELEMENT_COMMAND_ACK_TIMEOUT,
-			1))
+		if (!element_command_read_until(
+			ctx, &stream_info, phase_deadline_ms))
 		{
 			ret = ATOM_COMMAND_NO_ACK;
 			atom_logf(ctx, elem, LOG_ERR, "Failed to get ACK");
 			goto done;
 		}
 	}
+	metrics_timing_end(METRICS_COMMAND_ACK, sent);
 
 	// Now, if we're not blocking then we're all done! We can just return
 	//	out noting the success. Else we need to again do an XREAD on the
@@ -464,22 +801,25 @@ enum atom_error_t element_command_send(
 		&response_data);
 
 	// Now, we're ready to call the XREAD. Want to do this until either
-	//	the response is found or we've timed out. Note that this re-does the
-	//	timeout each time we get a message which is not ideal.
+	//	the response is found or we've timed out, per the timeout
+	//	returned from the ACK. A timeout of 0 waits as long as it takes,
+	//	as a BLOCK of 0 would
+	phase_deadline_ms = call_deadline_ms;
+	if (ack_data.timeout > 0) {
+		phase_deadline_ms = element_command_deadline_min(
+			element_command_send_time_ms() + ack_data.timeout,
+			call_deadline_ms);
+	}
 	while (!response_data.found_response) {
-		// XREAD with the timeout returned from the ACK
-		if (!redis_xread(
-			ctx,
-			&stream_info,
-			1,
-			ack_data.timeout,
-			1))
+		if (!element_command_read_until(
+			ctx, &stream_info, phase_deadline_ms))
 		{
 			ret = ATOM_COMMAND_NO_RESPONSE;
 			atom_logf(ctx, elem, LOG_ERR, "Failed to get response");
 			goto done;
 		}
 	}
+	metrics_timing_end(METRICS_COMMAND_RESPONSE, sent);
 
 	// If we got here then we got the response. We can set our status
 	//	to that returned by the response
@@ -495,3 +835,377 @@ enum atom_error_t element_command_send(
 done:
 	return ret;
 }
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Sends a fast command to another element and waits for the
+//			response. There's no ACK phase, we wait on the response alone
+//			until the absolute deadline timeout_ms from now passes.
+//
+////////////////////////////////////////////////////////////////////////////////
+enum atom_error_t element_command_send_fast(
+	redisContext *ctx,
+	struct element *elem,
+	const char *cmd_elem,
+	const char *cmd,
+	const uint8_t *data,
+	size_t data_len,
+	int timeout_ms,
+	bool (*response_cb)(
+		const uint8_t *response,
+		size_t response_len,
+		void *user_data),
+	void *user_data,
+	char **error_str)
+{
+	int ret;
+	struct redis_stream_info stream_info;
+	char cmd_id[STREAM_ID_BUFFLEN];
+	struct element_response_stream_data stream_data;
+	struct element_command_response_data response_data;
+	struct redis_xread_kv_item response_items[RESPONSE_N_KEYS];
+	int64_t deadline_ms;
+	uint64_t sent;
+
+	// Initialize the error code and error string
+	if (error_str != NULL) {
+		*error_str = NULL;
+	}
+
+	// The deadline covers the whole command, so note it before sending
+	deadline_ms = element_command_send_time_ms() + timeout_ms;
+	sent = metrics_timing_start();
+
+	// Send the command over to the element, marked as fast, along with
+	//	when we'll give up on it
+	ret = element_command_write_request(
+		ctx, elem, cmd_elem, cmd, data, data_len, true,
+		atom_deadline_ms(timeout_ms), cmd_id);
+	if (ret != ATOM_NO_ERROR) {
+		goto done;
+	}
+
+	// Set up for the response. An ACK for the command, if one shows up,
+	//	won't have the response keys and will be skipped over
+	element_command_init_response_data(
+		&response_data, response_items, response_cb, user_data);
+	element_response_stream_init_data(
+		&stream_info, &stream_data, elem, cmd_elem, cmd_id, response_items,
+		RESPONSE_N_KEYS, element_command_response_callback,
+		&response_data);
+
+	// Read until we get the response or we're past the deadline
+	while (!response_data.found_response) {
+		if (!element_command_read_until(ctx, &stream_info, deadline_ms)) {
+			ret = ATOM_COMMAND_NO_RESPONSE;
+			atom_logf(ctx, elem, LOG_ERR, "Failed to get response");
+			goto done;
+		}
+	}
+	metrics_timing_end(METRICS_COMMAND_RESPONSE, sent);
+
+	// Got the response, return its status
+	ret = response_data.error_code;
+	if (response_data.error_str != NULL) {
+		if (error_str != NULL) {
+			*error_str = response_data.error_str;
+		} else {
+			free(response_data.error_str);
+		}
+	}
+
+done:
+	return ret;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Callback for the response stream when waiting on the commands
+//			sent by element_command_send_multi. Each entry is either the
+//			ACK or the response of one of the commands, or something we
+//			aren't waiting on anymore
+//
+////////////////////////////////////////////////////////////////////////////////
+static bool element_command_multi_callback(
+	const char *id,
+	const struct redisReply *reply,
+	void *user_data)
+{
+	struct element_command_multi_data *data;
+	struct redis_xread_kv_item *items;
+	struct redis_xread_kv_item response_items[RESPONSE_N_KEYS];
+	struct element_command_target *target = NULL;
+	struct element_command_multi_state *state = NULL;
+	int timeout;
+	size_t i;
+
+	data = (struct element_command_multi_data *)user_data;
+	items = data->kv_items;
+
+	strncpy(data->elem->response.last_id, id,
+		sizeof(data->elem->response.last_id));
+
+	if (!redis_xread_parse_kv(reply, items, MULTI_N_KEYS)) {
+		atom_logf(NULL, NULL, LOG_ERR, "Failed to parse reply!");
+		return true;
+	}
+
+	if (!items[MULTI_KEY_ELEMENT].found ||
+		(items[MULTI_KEY_ELEMENT].reply->type != REDIS_REPLY_STRING) ||
+		!items[MULTI_KEY_ID].found ||
+		(items[MULTI_KEY_ID].reply->type != REDIS_REPLY_STRING))
+	{
+		return true;
+	}
+
+	// Find the command it's for
+	for (i = 0; i < data->n_targets; ++i) {
+		if (!data->states[i].done &&
+			!strcmp(data->targets[i].cmd_id, items[MULTI_KEY_ID].reply->str) &&
+			!strcmp(data->targets[i].cmd_elem,
+				items[MULTI_KEY_ELEMENT].reply->str))
+		{
+			target = &data->targets[i];
+			state = &data->states[i];
+			break;
+		}
+	}
+	if (target == NULL) {
+		return true;
+	}
+
+	// Responses have an error code. Line the keys up the way the
+	//	response callback expects them
+	if (items[MULTI_KEY_ERR_CODE].found) {
+		response_items[STREAM_KEY_ELEMENT] = items[MULTI_KEY_ELEMENT];
+		response_items[STREAM_KEY_ID] = items[MULTI_KEY_ID];
+		response_items[RESPONSE_KEY_CMD] = items[MULTI_KEY_CMD];
+		response_items[RESPONSE_KEY_ERR_CODE] = items[MULTI_KEY_ERR_CODE];
+		response_items[RESPONSE_KEY_ERR_STR] = items[MULTI_KEY_ERR_STR];
+		response_items[RESPONSE_KEY_DATA] = items[MULTI_KEY_DATA];
+		element_command_response_callback(response_items, &state->response);
+		if (state->response.found_response) {
+			metrics_timing_end(METRICS_COMMAND_RESPONSE, data->sent);
+			target->err_code = state->response.error_code;
+			target->error_str = state->response.error_str;
+			state->done = true;
+			data->n_pending--;
+		}
+
+	// ACKs have the timeout for the response
+	} else if (items[MULTI_KEY_TIMEOUT].found && !state->acked &&
+		(items[MULTI_KEY_TIMEOUT].reply->type == REDIS_REPLY_STRING))
+	{
+		metrics_timing_end(METRICS_COMMAND_ACK, data->sent);
+		state->acked = true;
+		timeout = atoi(items[MULTI_KEY_TIMEOUT].reply->str);
+		state->deadline_ms = data->call_deadline_ms;
+		if (timeout > 0) {
+			state->deadline_ms = element_command_deadline_min(
+				element_command_send_time_ms() + timeout,
+				data->call_deadline_ms);
+		}
+	}
+
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Notes the error for all of the commands still pending that are
+//			past their deadline, or all of them if force is set
+//
+////////////////////////////////////////////////////////////////////////////////
+static void element_command_multi_expire(
+	struct element_command_multi_data *data,
+	bool force,
+	enum atom_error_t force_err)
+{
+	int64_t now_ms = element_command_send_time_ms();
+	size_t i;
+
+	for (i = 0; i < data->n_targets; ++i) {
+		if (data->states[i].done ||
+			(!force && (data->states[i].deadline_ms > now_ms)))
+		{
+			continue;
+		}
+
+		if (force) {
+			data->targets[i].err_code = force_err;
+		} else if (data->states[i].acked) {
+			data->targets[i].err_code = ATOM_COMMAND_NO_RESPONSE;
+			atom_logf(NULL, data->elem, LOG_ERR,
+				"Failed to get response from %s", data->targets[i].cmd_elem);
+		} else {
+			data->targets[i].err_code = ATOM_COMMAND_NO_ACK;
+			atom_logf(NULL, data->elem, LOG_ERR,
+				"Failed to get ACK from %s", data->targets[i].cmd_elem);
+		}
+		data->states[i].done = true;
+		data->n_pending--;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Sends the same command to many elements. The XADDs are all
+//			pipelined, and then the ACKs and responses are read off of our
+//			response stream as they come in, all of them with each XREAD,
+//			until each command has its response or has passed its deadline.
+//			The whole thing costs about a round trip and the slowest
+//			handler rather than a couple of round trips and a handler
+//			for each element.
+//
+////////////////////////////////////////////////////////////////////////////////
+enum atom_error_t element_command_send_multi(
+	redisContext *ctx,
+	struct element *elem,
+	struct element_command_target *targets,
+	size_t n_targets,
+	const char *cmd,
+	const uint8_t *data,
+	size_t data_len,
+	int64_t deadline_ms,
+	bool (*response_cb)(
+		const uint8_t *response,
+		size_t response_len,
+		void *user_data))
+{
+	enum atom_error_t ret = ATOM_NO_ERROR;
+	struct element_command_multi_data multi;
+	struct redis_stream_info stream_info;
+	struct redis_xadd_info cmd_data[CMD_MAX_N_KEYS];
+	char cmd_elem_stream[ATOM_NAME_MAXLEN];
+	char deadline_buffer[ELEMENT_COMMAND_DEADLINE_BUFFLEN];
+	struct redis_xread_kv_item response_items[RESPONSE_N_KEYS];
+	struct codec_encoded_items encoded;
+	int64_t now_ms, soonest_ms, remaining_ms;
+	size_t i;
+
+	for (i = 0; i < n_targets; ++i) {
+		targets[i].err_code = ATOM_INTERNAL_ERROR;
+		targets[i].error_str = NULL;
+		targets[i].cmd_id[0] = '\0';
+	}
+	if (n_targets == 0) {
+		return ATOM_NO_ERROR;
+	}
+
+	memset(&multi, 0, sizeof(multi));
+	multi.elem = elem;
+	multi.targets = targets;
+	multi.n_targets = n_targets;
+	multi.states = calloc(n_targets, sizeof(struct element_command_multi_state));
+	assert(multi.states != NULL);
+
+	// Same as for a single command, the deadline moves over to the
+	//	monotonic clock
+	now_ms = element_command_send_time_ms();
+	multi.call_deadline_ms = INT64_MAX;
+	if (deadline_ms != ATOM_NO_DEADLINE) {
+		multi.call_deadline_ms = now_ms + (deadline_ms - atom_time_ms());
+		if (multi.call_deadline_ms <= now_ms) {
+			atom_logf(ctx, elem, LOG_ERR,
+				"Deadline passed before sending command");
+			multi.n_pending = n_targets;
+			element_command_multi_expire(&multi, true, ATOM_COMMAND_NO_ACK);
+			goto done;
+		}
+	}
+
+	// Queue up all of the commands and then send them at once
+	multi.sent = metrics_timing_start();
+	for (i = 0; i < n_targets; ++i) {
+		element_command_encode_request(elem, targets[i].cmd_elem, cmd, data,
+			data_len, false, deadline_ms, cmd_data, deadline_buffer,
+			cmd_elem_stream, &encoded);
+		multi.states[i].sent = redis_xadd_append(ctx, cmd_elem_stream,
+			encoded.items, encoded.n_items, ELEMENT_COMMAND_STREAM_MAXLEN,
+			ATOM_DEFAULT_APPROX_MAXLEN);
+		codec_encoded_items_cleanup(&encoded);
+	}
+
+	// Get the IDs of the commands. Anything that didn't go through is done
+	for (i = 0; i < n_targets; ++i) {
+		if (!multi.states[i].sent ||
+			!redis_xadd_get_reply(ctx, targets[i].cmd_id))
+		{
+			atom_logf(ctx, elem, LOG_ERR,
+				"Failed to XADD command data to %s", targets[i].cmd_elem);
+			targets[i].err_code = ATOM_REDIS_ERROR;
+			multi.states[i].done = true;
+			continue;
+		}
+
+		element_command_init_response_data(&multi.states[i].response,
+			response_items, response_cb, targets[i].user_data);
+		multi.states[i].deadline_ms = element_command_deadline_min(
+			now_ms + ELEMENT_COMMAND_ACK_TIMEOUT, multi.call_deadline_ms);
+		multi.n_pending++;
+	}
+
+	// Set up for everything that can come back on the response stream
+	multi.kv_items[MULTI_KEY_ELEMENT].key = STREAM_KEY_ELEMENT_STR;
+	multi.kv_items[MULTI_KEY_ELEMENT].key_len = CONST_STRLEN(STREAM_KEY_ELEMENT_STR);
+	multi.kv_items[MULTI_KEY_ID].key = STREAM_KEY_ID_STR;
+	multi.kv_items[MULTI_KEY_ID].key_len = CONST_STRLEN(STREAM_KEY_ID_STR);
+	multi.kv_items[MULTI_KEY_TIMEOUT].key = ACK_KEY_TIMEOUT_STR;
+	multi.kv_items[MULTI_KEY_TIMEOUT].key_len = CONST_STRLEN(ACK_KEY_TIMEOUT_STR);
+	multi.kv_items[MULTI_KEY_CMD].key = RESPONSE_KEY_CMD_STR;
+	multi.kv_items[MULTI_KEY_CMD].key_len = CONST_STRLEN(RESPONSE_KEY_CMD_STR);
+	multi.kv_items[MULTI_KEY_ERR_CODE].key = RESPONSE_KEY_ERR_CODE_STR;
+	multi.kv_items[MULTI_KEY_ERR_CODE].key_len = CONST_STRLEN(RESPONSE_KEY_ERR_CODE_STR);
+	multi.kv_items[MULTI_KEY_ERR_STR].key = RESPONSE_KEY_ERR_STR_STR;
+	multi.kv_items[MULTI_KEY_ERR_STR].key_len = CONST_STRLEN(RESPONSE_KEY_ERR_STR_STR);
+	multi.kv_items[MULTI_KEY_DATA].key = RESPONSE_KEY_DATA_STR;
+	multi.kv_items[MULTI_KEY_DATA].key_len = CONST_STRLEN(RESPONSE_KEY_DATA_STR);
+
+	redis_init_stream_info(
+		NULL,
+		&stream_info,
+		elem->response.stream,
+		element_command_multi_callback,
+		elem->response.last_id,
+		&multi);
+
+	// Read whatever's come in until we've heard back about everything,
+	//	blocking until the soonest deadline of the commands still pending
+	while (multi.n_pending > 0) {
+		soonest_ms = INT64_MAX;
+		for (i = 0; i < n_targets; ++i) {
+			if (!multi.states[i].done) {
+				soonest_ms = element_command_deadline_min(
+					soonest_ms, multi.states[i].deadline_ms);
+			}
+		}
+
+		remaining_ms = soonest_ms - element_command_send_time_ms();
+		if (remaining_ms >= 1) {
+			if (remaining_ms > INT_MAX) {
+				remaining_ms = INT_MAX;
+			}
+			if (!redis_xread(ctx, &stream_info, 1, (int)remaining_ms,
+				REDIS_XREAD_NOMAXCOUNT))
+			{
+				atom_logf(ctx, elem, LOG_ERR, "Failed to read responses");
+				element_command_multi_expire(&multi, true, ATOM_REDIS_ERROR);
+				break;
+			}
+		}
+
+		element_command_multi_expire(&multi, false, ATOM_NO_ERROR);
+	}
+
+done:
+	// Return the first error, if any
+	for (i = 0; i < n_targets; ++i) {
+		if (targets[i].err_code != ATOM_NO_ERROR) {
+			ret = targets[i].err_code;
+			break;
+		}
+	}
+
+	free(multi.states);
+	return ret;
+}
@@ -15,10 +15,15 @@
 #include <assert.h>
 #include <malloc.h>
 #include <stdlib.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <time.h>
 
 #include "redis.h"
 #include "atom.h"
 #include "element.h"
+#include "metrics.h"
+#include "codec.h"
 
 // This value is returned to the caller when the command they
 //	request is not supported. It tells them how long to wait for our
@@ -31,7 +36,17 @@ struct element_command_cb_data {
 	struct element *elem;
 	struct redis_xread_kv_item *kv_items;
 	size_t n_kv_items;
-	enum atom_error_t err_code;
+	void (*dispatch_fn)(
+		struct element_command_request *req,
+		void *user_data);
+	void *dispatch_data;
+	size_t n_read;
+};
+
+// Data for reading the command stream outside of the command loop
+struct element_command_reader_data {
+	struct element_command_cb_data cb_data;
+	struct redis_xread_kv_item kv_items[CMD_MAX_N_KEYS];
 };
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -115,22 +130,20 @@ static void element_command_init_shared_data(
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-//  @brief Sends an ACK to the requesting element letting them know that we
-//			received their command
+//  @brief Fills in the XADD info for an ACK. The timeout is printed into
+//			the buffer passed. Returns the number of items filled in.
 //
 ////////////////////////////////////////////////////////////////////////////////
-static bool element_command_send_ack(
-	redisContext *ctx,
+static size_t element_command_build_ack(
 	struct element *elem,
 	const char *id,
 	const char *req_elem,
-	int timeout)
+	int timeout,
+	struct redis_xadd_info ack_info[ACK_N_KEYS],
+	char timeout_buffer[32],
+	char req_elem_stream[ATOM_NAME_MAXLEN])
 {
-	struct redis_xadd_info ack_info[ACK_N_KEYS];
-	bool ret_val = false;
-	char timeout_buffer[32];
 	size_t timeout_len;
-	char req_elem_stream[ATOM_NAME_MAXLEN];
 
 	// Need to set up the XADD info to send back
 	element_command_init_shared_data(
@@ -139,14 +152,38 @@ static bool element_command_send_ack(
 	// And fill in the ACK-specific data
 	ack_info[ACK_KEY_TIMEOUT].key = ACK_KEY_TIMEOUT_STR;
 	ack_info[ACK_KEY_TIMEOUT].key_len = CONST_STRLEN(ACK_KEY_TIMEOUT_STR);
-	timeout_len = snprintf(
-		timeout_buffer, sizeof(timeout_buffer), "%d", timeout);
+	timeout_len = snprintf(timeout_buffer, 32, "%d", timeout);
 	ack_info[ACK_KEY_TIMEOUT].data = (uint8_t*)timeout_buffer;
 	ack_info[ACK_KEY_TIMEOUT].data_len = timeout_len;
 
+	return ACK_N_KEYS;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Sends an ACK to the requesting element letting them know that we
+//			received their command
+//
+////////////////////////////////////////////////////////////////////////////////
+static bool element_command_send_ack(
+	redisContext *ctx,
+	struct element *elem,
+	const char *id,
+	const char *req_elem,
+	int timeout)
+{
+	struct redis_xadd_info ack_info[ACK_N_KEYS];
+	bool ret_val = false;
+	char timeout_buffer[32];
+	char req_elem_stream[ATOM_NAME_MAXLEN];
+	size_t n_items;
+
+	n_items = element_command_build_ack(
+		elem, id, req_elem, timeout, ack_info, timeout_buffer, req_elem_stream);
+
 	// And want to call the XADD to send the info back to the caller
 	if (!redis_xadd(
-		ctx, req_elem_stream, ack_info, ACK_N_KEYS,
+		ctx, req_elem_stream, ack_info, n_items,
 		ATOM_DEFAULT_MAXLEN, ATOM_DEFAULT_APPROX_MAXLEN, NULL))
 	{
 		atom_logf(ctx, elem, LOG_ERR, "Failed to send ACK");
@@ -162,11 +199,11 @@ done:
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-//  @brief Sends the response to the caller
+//  @brief Fills in the XADD info for a response. The error code is printed
+//			into the buffer passed. Returns the number of items filled in.
 //
 ////////////////////////////////////////////////////////////////////////////////
-static bool element_command_send_response(
-	redisContext *ctx,
+static size_t element_command_build_response(
 	struct element *elem,
 	const char *id,
 	const char *req_elem,
@@ -174,12 +211,11 @@ static bool element_command_send_response(
 	uint8_t *response,
 	size_t response_len,
 	enum atom_error_t error_code,
-	char *error_str)
+	char *error_str,
+	struct redis_xadd_info response_info[RESPONSE_N_KEYS],
+	char err_code_buffer[32],
+	char req_elem_stream[ATOM_NAME_MAXLEN])
 {
-	struct redis_xadd_info response_info[RESPONSE_N_KEYS];
-	bool ret_val = false;
-	char req_elem_stream[ATOM_NAME_MAXLEN];
-	char err_code_buffer[32];
 	size_t err_code_len;
 	int response_idx = STREAM_N_KEYS;
 
@@ -191,8 +227,7 @@ static bool element_command_send_response(
 	response_info[response_idx].key = RESPONSE_KEY_ERR_CODE_STR;
 	response_info[response_idx].key_len = CONST_STRLEN(
 		RESPONSE_KEY_ERR_CODE_STR);
-	err_code_len = snprintf(
-		err_code_buffer, sizeof(err_code_buffer), "%d", error_code);
+	err_code_len = snprintf(err_code_buffer, 32, "%d", error_code);
 	response_info[response_idx].data = (uint8_t*)err_code_buffer;
 	response_info[response_idx].data_len = err_code_len;
 	++response_idx;
@@ -226,12 +261,83 @@ static bool element_command_send_response(
 		++response_idx;
 	}
 
-	// And want to call the XADD to send the info back to the caller
-	if (!redis_xadd(
-		ctx, req_elem_stream, response_info, response_idx,
-		ATOM_DEFAULT_MAXLEN, ATOM_DEFAULT_APPROX_MAXLEN, NULL))
+	return response_idx;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Sends the response to the caller. If send_ack is set then the
+//			ACK is sent along with it, pipelined s.t. both go out in a
+//			single round trip to redis.
+//
+////////////////////////////////////////////////////////////////////////////////
+static bool element_command_send_response(
+	redisContext *ctx,
+	struct element *elem,
+	const char *id,
+	const char *req_elem,
+	struct element_command *cmd,
+	uint8_t *response,
+	size_t response_len,
+	enum atom_error_t error_code,
+	char *error_str,
+	bool send_ack)
+{
+	struct redis_xadd_info response_info[RESPONSE_N_KEYS];
+	struct redis_xadd_info ack_info[ACK_N_KEYS];
+	bool ret_val = false;
+	char req_elem_stream[ATOM_NAME_MAXLEN];
+	char err_code_buffer[32];
+	char timeout_buffer[32];
+	size_t n_response_items, n_ack_items;
+	bool ack_ok;
+
+	n_response_items = element_command_build_response(
+		elem, id, req_elem, cmd, response, response_len, error_code,
+		error_str, response_info, err_code_buffer, req_elem_stream);
+
+	// If we're just sending the response then want to call the XADD to
+	//	send the info back to the caller
+	if (!send_ack) {
+		if (!redis_xadd(
+			ctx, req_elem_stream, response_info, n_response_items,
+			ATOM_DEFAULT_MAXLEN, ATOM_DEFAULT_APPROX_MAXLEN, NULL))
+		{
+			atom_logf(ctx, elem, LOG_ERR, "Failed to send response");
+			goto done;
+		}
+
+		ret_val = true;
+		goto done;
+	}
+
+	// Otherwise queue up the ACK and then the response s.t. the caller
+	//	sees them in the usual order
+	n_ack_items = element_command_build_ack(
+		elem, id, req_elem, (cmd != NULL) ? cmd->timeout : 0, ack_info,
+		timeout_buffer, req_elem_stream);
+
+	if (!redis_xadd_append(
+		ctx, req_elem_stream, ack_info, n_ack_items,
+		ATOM_DEFAULT_MAXLEN, ATOM_DEFAULT_APPROX_MAXLEN))
+	{
+		atom_logf(ctx, elem, LOG_ERR, "Failed to queue ACK");
+		goto done;
+	}
+	if (!redis_xadd_append(
+		ctx, req_elem_stream, response_info, n_response_items,
+		ATOM_DEFAULT_MAXLEN, ATOM_DEFAULT_APPROX_MAXLEN))
 	{
-		atom_logf(ctx, elem, LOG_ERR, "Failed to send response");
+		atom_logf(ctx, elem, LOG_ERR, "Failed to queue response");
+		redis_xadd_get_reply(ctx, NULL);
+		goto done;
+	}
+
+	// Need to get both replies no matter what s.t. the context is left
+	//	in a good state
+	ack_ok = redis_xadd_get_reply(ctx, NULL);
+	if (!redis_xadd_get_reply(ctx, NULL) || !ack_ok) {
+		atom_logf(ctx, elem, LOG_ERR, "Failed to send ACK and response");
 		goto done;
 	}
 
@@ -242,12 +348,180 @@ done:
 	return ret_val;
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Returns whether the caller's deadline for a request has passed,
+//			in which case they've given up on it
+//
+////////////////////////////////////////////////////////////////////////////////
+static bool element_command_request_expired(
+	const struct element_command_request *req)
+{
+	return (req->deadline_ms != ATOM_NO_DEADLINE) &&
+		(atom_time_ms() >= req->deadline_ms);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Runs the handler for a command request, if we support the
+//			command, and sends the response back to the caller on the
+//			context passed. If the caller's deadline has passed by now,
+//			e.g. since the request was waiting on a worker, it's dropped
+//			without running the handler. Does not free the request.
+//
+////////////////////////////////////////////////////////////////////////////////
+enum atom_error_t element_command_process(
+	redisContext *ctx,
+	struct element *elem,
+	struct element_command_request *req)
+{
+	enum atom_error_t ret = ATOM_INTERNAL_ERROR;
+	struct element_command *cmd = req->cmd;
+	int cb_ret;
+	uint8_t *response = NULL;
+	size_t response_len = 0;
+	char *error_str = NULL;
+	void *cleanup_ptr = NULL;
+	uint64_t start;
+
+	// No one's waiting on the response anymore, so don't bother
+	if (element_command_request_expired(req)) {
+		atom_logf(ctx, elem, LOG_WARNING,
+			"Dropping command %s past its deadline", req->id);
+		goto ack;
+	}
+
+	// If we have the command then we want to try to call the user callback.
+	//	Otherwise the error was noted when the request was read
+	if (cmd != NULL) {
+
+		start = metrics_timing_start();
+		cb_ret = cmd->cb(
+			req->data,
+			req->data_len,
+			&response,
+			&response_len,
+			&error_str,
+			cmd->user_data,
+			&cleanup_ptr);
+		metrics_timing_end(METRICS_COMMAND_HANDLER, start);
+
+		// If the return is an error, we want to append it atop the internal
+		//	element errors
+		if (cb_ret != 0) {
+			req->err_code = ATOM_USER_ERRORS_BEGIN + cb_ret;
+		} else {
+			req->err_code = ATOM_NO_ERROR;
+		}
+	}
+
+	// Now we want to send the response out to the caller
+	if (!element_command_send_response(
+		ctx,
+		elem,
+		req->id,
+		req->req_elem,
+		cmd,
+		response,
+		response_len,
+		req->err_code,
+		error_str,
+		req->ack_pending))
+	{
+		atom_logf(ctx, elem, LOG_ERR,
+			"Failed to send response to caller");
+		ret = ATOM_REDIS_ERROR;
+		goto done;
+	}
+
+ack:
+	// If we're part of a group then the command is done with and no
+	//	one else should pick it up
+	if ((elem->command.group != NULL) && !redis_xack(
+		ctx, elem->command.stream, elem->command.group, req->id))
+	{
+		atom_logf(ctx, elem, LOG_ERR,
+			"Failed to acknowledge command %s", req->id);
+		ret = ATOM_REDIS_ERROR;
+		goto done;
+	}
+
+	// Note the success
+	ret = ATOM_NO_ERROR;
+
+done:
+	if (cleanup_ptr != NULL) {
+		if (cmd->cleanup != NULL) {
+			cmd->cleanup(cleanup_ptr);
+		} else {
+			atom_logf(ctx, elem, LOG_ERR,
+				"Cleanup ptr non-null but no cleanup fn!");
+		}
+	} else {
+		if (response != NULL) {
+			free(response);
+		}
+		if (error_str != NULL) {
+			free(error_str);
+		}
+	}
+	return ret;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Makes a copy of a request that owns its data s.t. it can outlive
+//			the XREAD that it came from
+//
+////////////////////////////////////////////////////////////////////////////////
+static struct element_command_request *element_command_request_dup(
+	const struct element_command_request *req)
+{
+	struct element_command_request *copy;
+
+	copy = malloc(sizeof(struct element_command_request));
+	assert(copy != NULL);
+
+	memcpy(copy, req, sizeof(struct element_command_request));
+
+	copy->req_elem = strdup(req->req_elem);
+	assert(copy->req_elem != NULL);
+
+	if (req->data != NULL) {
+		copy->data = malloc(req->data_len);
+		assert(copy->data != NULL);
+		memcpy(copy->data, req->data, req->data_len);
+	}
+
+	return copy;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Frees a request that was passed to a dispatch function
+//
+////////////////////////////////////////////////////////////////////////////////
+void element_command_request_free(
+	struct element_command_request *req)
+{
+	if (req != NULL) {
+		if (req->req_elem != NULL) {
+			free(req->req_elem);
+		}
+		if (req->data != NULL) {
+			free(req->data);
+		}
+		free(req);
+	}
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 //  @brief Element callback from XREAD for when we get a command. Will check
 //			to make sure that all of the necessary command fields
 //			are present in the command request and also that we support
-//			the passed command
+//			the passed command. Sends the ACK and then either processes
+//			the command inline or hands it off to the dispatch function.
 //
 ////////////////////////////////////////////////////////////////////////////////
 static bool element_cmd_rep_xread_cb(
@@ -257,26 +531,26 @@ static bool element_cmd_rep_xread_cb(
 {
 	bool ret_val = false;
 	struct element_command_cb_data *data;
-	struct element_command *cmd;
-	int ret, timeout;
-	uint8_t *response = NULL;
-	size_t response_len = 0;
-	char *error_str = NULL;
-	void *cleanup_ptr = NULL;
+	struct element_command_request req;
+	int timeout;
 
 	// Want to cast the user data to our expected data struct
 	data = (struct element_command_cb_data *)user_data;
+	data->n_read++;
 
 	// Update the most recent ID that we've seen for the command
 	//	tracking buffer
 	strncpy(data->elem->command.last_id, id,
 		sizeof(data->elem->command.last_id));
 
-	// Now, we want to parse out the reply array using our kv items
-	if (!redis_xread_parse_kv(reply, data->kv_items, data->n_kv_items)) {
+	// Now, we want to decompress the data if the caller compressed it and
+	//	parse out the reply array using our kv items
+	if (!codec_decode_reply((redisReply *)reply) ||
+		!redis_xread_parse_kv(reply, data->kv_items, data->n_kv_items))
+	{
 		atom_logf(data->elem->command.ctx, data->elem, LOG_ERR,
 			"Failed to parse reply!");
-		goto done;
+		goto drop;
 	}
 
 	// The only other thing needed to not have a complete failure
@@ -285,110 +559,212 @@ static bool element_cmd_rep_xread_cb(
 	if (!data->kv_items[CMD_KEY_ELEMENT].found) {
 		atom_logf(data->elem->command.ctx, data->elem, LOG_ERR,
 			"Didn't get element in message!");
-		goto done;
+		goto drop;
+	}
+
+	// Fill in the request. This points into the reply for now
+	strncpy(req.id, id, sizeof(req.id));
+	req.req_elem = data->kv_items[CMD_KEY_ELEMENT].reply->str;
+	req.data = data->kv_items[CMD_KEY_DATA].found ?
+		(uint8_t*)data->kv_items[CMD_KEY_DATA].reply->str : NULL;
+	req.data_len = data->kv_items[CMD_KEY_DATA].found ?
+		data->kv_items[CMD_KEY_DATA].reply->len : 0;
+	req.deadline_ms = data->kv_items[CMD_KEY_DEADLINE].found ?
+		strtoll(data->kv_items[CMD_KEY_DEADLINE].reply->str, NULL, 10) :
+		ATOM_NO_DEADLINE;
+
+	// If the caller has already given up on the command then shed it
+	//	rather than doing work no one will see. They're not waiting on
+	//	an ACK either
+	if (element_command_request_expired(&req)) {
+		atom_logf(data->elem->command.ctx, data->elem, LOG_WARNING,
+			"Dropping command %s past its deadline", id);
+		ret_val = true;
+		goto drop;
 	}
 
 	// Want to try to get the command s.t. we can get the timeout
 	//	length to send back to the caller in the ACK
-	cmd = data->kv_items[CMD_KEY_CMD].found ?
+	req.cmd = data->kv_items[CMD_KEY_CMD].found ?
 		element_command_get(
 			data->elem, data->kv_items[CMD_KEY_CMD].reply->str) :
 		NULL;
-	timeout = (cmd != NULL) ? cmd->timeout : ELEMENT_NO_COMMAND_TIMEOUT_MS;
+	timeout = (req.cmd != NULL) ?
+		req.cmd->timeout : ELEMENT_NO_COMMAND_TIMEOUT_MS;
 
-	// At this point we know that we got a message and have a caller
-	//	to respond back to, so we need to send an ACK
-	if (!element_command_send_ack(
-		data->elem->command.ctx,
-		data->elem,
-		id,
-		data->kv_items[CMD_KEY_ELEMENT].reply->str,
-		timeout))
-	{
-		atom_logf(data->elem->command.ctx, data->elem, LOG_ERR,
-			"Failed to send ACK to caller");
-		goto done;
-	}
-
-	// Now, if we're missing the command it's either because the user
+	// If we're missing the command it's either because the user
 	//	didn't supply one or we don't support the requested command.
-	//	Find the proper error and then send the user a response.
-	if (cmd == NULL) {
+	//	Note the proper error to send back in the response.
+	if (req.cmd == NULL) {
 		if (data->kv_items[CMD_KEY_CMD].found) {
 			atom_logf(data->elem->command.ctx, data->elem, LOG_ERR,
 				"Unsupported command!");
-			data->err_code = ATOM_COMMAND_UNSUPPORTED;
+			req.err_code = ATOM_COMMAND_UNSUPPORTED;
 		} else {
 			atom_logf(data->elem->command.ctx, data->elem, LOG_ERR,
 				"Missing command!");
-			data->err_code = ATOM_COMMAND_INVALID_DATA;
+			req.err_code = ATOM_COMMAND_INVALID_DATA;
 		}
-
-	// Otherwise we want to try to call the user callback for the command
 	} else {
+		req.err_code = ATOM_INTERNAL_ERROR;
+	}
 
-		// Initialize the response
-		response = NULL;
-		response_len = 0;
-		error_str = NULL;
-
-		ret = cmd->cb(
-			data->kv_items[CMD_KEY_DATA].found ?
-				(uint8_t*)data->kv_items[CMD_KEY_DATA].reply->str : NULL,
-			data->kv_items[CMD_KEY_DATA].found ?
-				data->kv_items[CMD_KEY_DATA].reply->len : 0,
-			&response,
-			&response_len,
-			&error_str,
-			cmd->user_data,
-			&cleanup_ptr);
-
-		// If the return is an error, we want to append it atop the internal
-		//	element errors
-		if (ret != 0) {
-			data->err_code = ATOM_USER_ERRORS_BEGIN + ret;
-		} else {
-			data->err_code = ATOM_NO_ERROR;
-		}
+	// Fast commands don't get an ACK on their own. Callers that know
+	//	the command is fast don't wait for one at all, and anyone else
+	//	gets it pipelined along with the response
+	req.ack_pending = false;
+	if ((req.cmd != NULL) && (req.cmd->flags & ELEMENT_COMMAND_FLAG_FAST)) {
+		req.ack_pending = !data->kv_items[CMD_KEY_FAST].found;
+		goto send;
 	}
 
-	// Now we want to send the response out to the caller
-	if (!element_command_send_response(
+	// At this point we know that we got a message and have a caller
+	//	to respond back to, so we need to send an ACK
+	if (!element_command_send_ack(
 		data->elem->command.ctx,
 		data->elem,
 		id,
-		data->kv_items[CMD_KEY_ELEMENT].reply->str,
-		cmd,
-		response,
-		response_len,
-		data->err_code,
-		error_str))
+		req.req_elem,
+		timeout))
 	{
 		atom_logf(data->elem->command.ctx, data->elem, LOG_ERR,
-			"Failed to send response to caller");
+			"Failed to send ACK to caller");
+		goto done;
+	}
+
+send:
+	// Now either hand off the command or run it ourselves
+	if (data->dispatch_fn != NULL) {
+		data->dispatch_fn(
+			element_command_request_dup(&req), data->dispatch_data);
+	} else if (element_command_process(
+		data->elem->command.ctx, data->elem, &req) != ATOM_NO_ERROR)
+	{
 		goto done;
 	}
 
 	// Note the success
 	ret_val = true;
+	goto done;
 
+drop:
+	// There's no one to respond to, but if we're part of a group we
+	//	still need to acknowledge the entry s.t. no one claims it
+	if (data->elem->command.group != NULL) {
+		redis_xack(data->elem->command.ctx, data->elem->command.stream,
+			data->elem->command.group, id);
+	}
 done:
-	if (cleanup_ptr != NULL) {
-		if (cmd->cleanup != NULL) {
-			cmd->cleanup(cleanup_ptr);
-		} else {
-			atom_logf(data->elem->command.ctx, data->elem, LOG_ERR,
-				"Cleanup ptr non-null but no cleanup fn!");
-		}
-	} else {
-		if (response != NULL) {
-			free(response);
-		}
-		if (error_str != NULL) {
-			free(error_str);
+	return ret_val;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Returns the current monotonic time in milliseconds
+//
+////////////////////////////////////////////////////////////////////////////////
+static int64_t element_command_time_ms(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return ((int64_t)now.tv_sec * 1000) + (now.tv_nsec / 1000000);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Switches the element over to reading its command stream as a
+//			consumer in a consumer group. Creates the group, starting
+//			from the most recent command, if it doesn't exist yet. Since
+//			it's normal for multiple replicas to race on this, an existing
+//			group is left where it is.
+//
+////////////////////////////////////////////////////////////////////////////////
+enum atom_error_t element_command_use_group(
+	redisContext *ctx,
+	struct element *elem,
+	const char *group,
+	const char *consumer,
+	int claim_idle_ms)
+{
+	enum atom_error_t ret = ATOM_INTERNAL_ERROR;
+	char hostname[ATOM_NAME_MAXLEN];
+	char consumer_buffer[ATOM_NAME_MAXLEN + 32];
+
+	if (elem->command.group != NULL) {
+		atom_logf(ctx, elem, LOG_ERR, "Command group already set");
+		goto done;
+	}
+
+	if (claim_idle_ms < 0) {
+		atom_logf(ctx, elem, LOG_ERR, "Invalid claim time");
+		goto done;
+	}
+
+	if (group == NULL) {
+		group = elem->name.str;
+	}
+
+	// Each replica needs its own consumer name, so if the caller didn't
+	//	pick one use something that's unique to this process
+	if (consumer == NULL) {
+		if (gethostname(hostname, sizeof(hostname)) != 0) {
+			atom_logf(ctx, elem, LOG_ERR, "Failed to get hostname");
+			goto done;
 		}
+		hostname[sizeof(hostname) - 1] = '\0';
+		snprintf(consumer_buffer, sizeof(consumer_buffer), "%s-%d",
+			hostname, (int)getpid());
+		consumer = consumer_buffer;
 	}
-	return ret_val;
+
+	// Start the group after the info we put on the command stream when
+	//	the element was made, as we won't have read anything before that
+	//	either
+	if (!redis_xgroup_create(ctx, elem->command.stream, group,
+		elem->command.last_id))
+	{
+		atom_logf(ctx, elem, LOG_ERR, "Failed to create command group");
+		ret = ATOM_REDIS_ERROR;
+		goto done;
+	}
+
+	elem->command.group = strdup(group);
+	assert(elem->command.group != NULL);
+	elem->command.consumer = strdup(consumer);
+	assert(elem->command.consumer != NULL);
+	elem->command.claim_idle_ms = claim_idle_ms;
+
+	ret = ATOM_NO_ERROR;
+
+done:
+	return ret;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Claims and handles commands that another consumer in the group
+//			has been sitting on for too long. Walks the group's pending
+//			entries a chunk at a time, picking up where the last call
+//			left off.
+//
+////////////////////////////////////////////////////////////////////////////////
+static bool element_command_claim(
+	redisContext *ctx,
+	struct element *elem,
+	struct element_command_cb_data *cmd_data,
+	char cursor[STREAM_ID_BUFFLEN])
+{
+	return redis_xautoclaim(
+		ctx,
+		elem->command.stream,
+		elem->command.group,
+		elem->command.consumer,
+		elem->command.claim_idle_ms,
+		cursor,
+		ELEMENT_COMMAND_GROUP_CLAIM_COUNT,
+		element_cmd_rep_xread_cb,
+		cmd_data);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -407,11 +783,25 @@ enum atom_error_t element_command_loop(
 	bool loop,
 	int timeout)
 {
-	struct redis_stream_info stream_info;
-	struct element_command_cb_data cmd_data;
-	struct redis_xread_kv_item cmd_kv_items[CMD_N_KEYS];
-	enum atom_error_t ret = ATOM_INTERNAL_ERROR;
+	return element_command_loop_dispatch(
+		ctx, elem, loop, timeout, NULL, NULL);
+}
 
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Sets up the callback data and kv items for reading the command
+//			stream
+//
+////////////////////////////////////////////////////////////////////////////////
+static void element_command_cb_data_init(
+	struct element_command_cb_data *cmd_data,
+	struct redis_xread_kv_item cmd_kv_items[CMD_MAX_N_KEYS],
+	struct element *elem,
+	void (*dispatch_fn)(
+		struct element_command_request *req,
+		void *user_data),
+	void *user_data)
+{
 	// Set up the kv items
 	cmd_kv_items[CMD_KEY_ELEMENT].key = COMMAND_KEY_ELEMENT_STR;
 	cmd_kv_items[CMD_KEY_ELEMENT].key_len = CONST_STRLEN(COMMAND_KEY_ELEMENT_STR);
@@ -419,12 +809,106 @@ enum atom_error_t element_command_loop(
 	cmd_kv_items[CMD_KEY_CMD].key_len = CONST_STRLEN(COMMAND_KEY_COMMAND_STR);
 	cmd_kv_items[CMD_KEY_DATA].key = COMMAND_KEY_DATA_STR;
 	cmd_kv_items[CMD_KEY_DATA].key_len = CONST_STRLEN(COMMAND_KEY_DATA_STR);
+	cmd_kv_items[CMD_KEY_FAST].key = COMMAND_KEY_FAST_STR;
+	cmd_kv_items[CMD_KEY_FAST].key_len = CONST_STRLEN(COMMAND_KEY_FAST_STR);
+	cmd_kv_items[CMD_KEY_DEADLINE].key = COMMAND_KEY_DEADLINE_STR;
+	cmd_kv_items[CMD_KEY_DEADLINE].key_len = CONST_STRLEN(COMMAND_KEY_DEADLINE_STR);
+
+	// Set up the command data
+	cmd_data->elem = elem;
+	cmd_data->kv_items = cmd_kv_items;
+	cmd_data->n_kv_items = CMD_MAX_N_KEYS;
+	cmd_data->dispatch_fn = dispatch_fn;
+	cmd_data->dispatch_data = user_data;
+	cmd_data->n_read = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Sets up a reader for the command stream s.t. it can be read as
+//			part of some other XREAD. Commands are handled inline on the
+//			element's command context.
+//
+////////////////////////////////////////////////////////////////////////////////
+bool element_command_reader_init(
+	struct element *elem,
+	struct element_command_reader *reader)
+{
+	// Groups need an XREADGROUP of their own
+	if (elem->command.group != NULL) {
+		atom_logf(elem->command.ctx, elem, LOG_ERR,
+			"Can't read the command stream of a group with other streams");
+		return false;
+	}
+
+	reader->data = malloc(sizeof(struct element_command_reader_data));
+	assert(reader->data != NULL);
+
+	element_command_cb_data_init(
+		&reader->data->cb_data, reader->data->kv_items, elem, NULL, NULL);
+
+	if (!redis_init_stream_info(
+		elem->command.ctx,
+		&reader->info,
+		elem->command.stream,
+		element_cmd_rep_xread_cb,
+		elem->command.last_id,
+		&reader->data->cb_data))
+	{
+		atom_logf(elem->command.ctx, elem, LOG_ERR,
+			"Failed to initialize stream info");
+		free(reader->data);
+		reader->data = NULL;
+		return false;
+	}
+
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Frees a command stream reader
+//
+////////////////////////////////////////////////////////////////////////////////
+void element_command_reader_cleanup(
+	struct element_command_reader *reader)
+{
+	free(reader->data);
+	reader->data = NULL;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Runs the element command monitoring loop, but rather than running
+//			the command handlers inline hands each command off to the
+//			dispatch function once it's been ACKed. If dispatch_fn is NULL
+//			then commands are handled inline.
+//
+////////////////////////////////////////////////////////////////////////////////
+enum atom_error_t element_command_loop_dispatch(
+	redisContext *ctx,
+	struct element *elem,
+	bool loop,
+	int timeout,
+	void (*dispatch_fn)(
+		struct element_command_request *req,
+		void *user_data),
+	void *user_data)
+{
+	struct redis_stream_info stream_info;
+	struct element_command_cb_data cmd_data;
+	struct redis_xread_kv_item cmd_kv_items[CMD_MAX_N_KEYS];
+	enum atom_error_t ret = ATOM_INTERNAL_ERROR;
+	char claim_cursor[STREAM_ID_BUFFLEN] = REDIS_XAUTOCLAIM_BEGIN_CURSOR;
+	bool claiming;
+	int64_t start_ms, now_ms, last_claim_ms;
+	int block;
+	int backoff_ms = ELEMENT_COMMAND_LOOP_RETRY_MIN_MS;
+	bool success;
 
 	// Set up the command data
-	cmd_data.elem = elem;
-	cmd_data.kv_items = cmd_kv_items;
-	cmd_data.n_kv_items = CMD_N_KEYS;
-	cmd_data.err_code = ATOM_INTERNAL_ERROR;
+	element_command_cb_data_init(
+		&cmd_data, cmd_kv_items, elem, dispatch_fn, user_data);
 
 	// Want to set up the XREAD. Should be a pretty straightforward
 	//	setup of the stream info
@@ -440,26 +924,91 @@ enum atom_error_t element_command_loop(
 		goto done;
 	}
 
+	// If we're in a group and claiming other consumers' commands then we
+	//	can't block for longer than the claim period, else we'd never
+	//	get around to claiming while no new commands are coming in
+	claiming = (elem->command.group != NULL) &&
+		(elem->command.claim_idle_ms != ELEMENT_COMMAND_GROUP_NO_CLAIM);
+	start_ms = element_command_time_ms();
+	last_claim_ms = start_ms - ELEMENT_COMMAND_GROUP_CLAIM_PERIOD_MS;
+
 	// Now that we've initialized the stream info, we want to go ahead and
 	//	call the XREAD! Pretty simple.
 	while (true) {
 
-		// Do the xread
-		if (!redis_xread(
-			ctx,
-			&stream_info,
-			1,
-			timeout,
-			REDIS_XREAD_NOMAXCOUNT))
+		block = timeout;
+		if (claiming) {
+			now_ms = element_command_time_ms();
+			if (now_ms - last_claim_ms >= ELEMENT_COMMAND_GROUP_CLAIM_PERIOD_MS) {
+				if (!element_command_claim(ctx, elem, &cmd_data, claim_cursor)) {
+					atom_logf(ctx, elem, LOG_ERR, "Failed to claim commands");
+				}
+				last_claim_ms = now_ms;
+			}
+			if ((block == ELEMENT_COMMAND_LOOP_NO_TIMEOUT) ||
+				(block > ELEMENT_COMMAND_GROUP_CLAIM_PERIOD_MS))
+			{
+				block = ELEMENT_COMMAND_GROUP_CLAIM_PERIOD_MS;
+			}
+		}
+
+		// Do the xread, or xreadgroup if we share the stream
+		if (cmd_data.n_read == 0) {
+			if (elem->command.group != NULL) {
+				success = redis_xreadgroup(
+					ctx,
+					elem->command.group,
+					elem->command.consumer,
+					&stream_info,
+					1,
+					block,
+					REDIS_XREAD_NOMAXCOUNT);
+			} else {
+				success = redis_xread(
+					ctx,
+					&stream_info,
+					1,
+					block,
+					REDIS_XREAD_NOMAXCOUNT);
+			}
+			// Timeouts count as successful reads, so this is a real error.
+			//	A single read hands it back to the caller. Otherwise we
+			//	reconnect if need be and keep serving after a backoff
+			//	that grows while the reads keep failing
+			if (!success) {
+				atom_logf(ctx, elem, LOG_ERR, "Failed to read command stream");
+				if (!loop) {
+					ret = ATOM_REDIS_ERROR;
+					goto done;
+				}
+				if (ctx->err) {
+					redisReconnect(ctx);
+				}
+				usleep(backoff_ms * 1000);
+				backoff_ms *= 2;
+				if (backoff_ms > ELEMENT_COMMAND_LOOP_RETRY_MAX_MS) {
+					backoff_ms = ELEMENT_COMMAND_LOOP_RETRY_MAX_MS;
+				}
+				continue;
+			}
+			backoff_ms = ELEMENT_COMMAND_LOOP_RETRY_MIN_MS;
+		}
+
+		// If we only shortened the block for the sake of claiming and
+		//	haven't gotten anything yet then this doesn't count as a read
+		if (claiming && (cmd_data.n_read == 0) &&
+			((timeout == ELEMENT_COMMAND_LOOP_NO_TIMEOUT) ||
+			 (element_command_time_ms() - start_ms < timeout)))
 		{
-			atom_logf(ctx, elem, LOG_ERR, "Redis issue/timeout");
-			ret = ATOM_REDIS_ERROR;
+			continue;
 		}
 
 		// And if we shouldn't be looping then break out
 		if (!loop) {
 			break;
 		}
+		cmd_data.n_read = 0;
+		start_ms = element_command_time_ms();
 	}
 
 	// Note the lack of error
@@ -497,6 +1046,32 @@ bool element_command_add(
 	void (*cleanup)(void *cleanup_ptr),
 	void *user_data,
 	int timeout)
+{
+	return element_command_add_with_flags(
+		elem, command, cb, cleanup, user_data, timeout, 0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Adds a command to an element with the ELEMENT_COMMAND_FLAG_*
+//			flags passed. Same as element_command_add otherwise.
+//
+////////////////////////////////////////////////////////////////////////////////
+bool element_command_add_with_flags(
+	struct element *elem,
+	const char *command,
+	int (*cb)(
+		uint8_t *data,
+		size_t data_len,
+		uint8_t **response,
+		size_t *response_len,
+		char **error_str,
+		void *user_data,
+		void **cleanup_ptr),
+	void (*cleanup)(void *cleanup_ptr),
+	void *user_data,
+	int timeout,
+	int flags)
 {
 	struct element_command *cmd = NULL;
 	uint32_t hash;
@@ -514,6 +1089,7 @@ bool element_command_add(
 	cmd->cb = cb;
 	cmd->cleanup = cleanup;
 	cmd->timeout = timeout;
+	cmd->flags = flags;
 	cmd->user_data = user_data;
 
 	// Get the hash for the element
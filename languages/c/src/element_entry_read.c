@@ -19,6 +19,27 @@
 #include "redis.h"
 #include "atom.h"
 #include "element.h"
+#include "codec.h"
+
+// Data for each stream we're reading. The kv index is built once when we
+//	start reading s.t. each entry can be parsed in a single pass
+struct element_entry_read_cb_data {
+	struct element_entry_read_info *info;
+	struct redis_xread_kv_index kv_index;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Sets up the callback data for a read info
+//
+////////////////////////////////////////////////////////////////////////////////
+static void element_entry_read_cb_data_init(
+	struct element_entry_read_cb_data *data,
+	struct element_entry_read_info *info)
+{
+	data->info = info;
+	redis_xread_kv_index_init(&data->kv_index, info->kv_items, info->n_kv_items);
+}
 
 ////////////////////////////////////////////////////////////////////////////////
 //
@@ -33,19 +54,38 @@ static bool element_entry_read_cb(
 	void *user_data)
 {
 	bool ret_val = false;
+	struct element_entry_read_cb_data *data;
 	struct element_entry_read_info *info;
 
 	// Cast the user data
-	info = (struct element_entry_read_info *)user_data;
-
-	// Now, we want to parse the reply into the kv items
-	if (!redis_xread_parse_kv(reply, info->kv_items, info->n_kv_items)) {
+	data = (struct element_entry_read_cb_data *)user_data;
+	info = data->info;
+
+	// Decompress the values if need be and then parse the reply into
+	//	the kv items
+	if (!codec_decode_reply((redisReply *)reply) ||
+		!redis_xread_parse_kv_indexed(reply, &data->kv_index))
+	{
 		atom_logf(NULL, NULL, LOG_ERR, "Failed to parse reply!");
+		if (info->response_reply_cb != NULL) {
+			freeReplyObject((redisReply *)reply);
+		}
 		goto done;
 	}
 
-	// Send the kv items along to the user response
-	if (!info->response_cb(id, info->kv_items, info->n_kv_items, info->user_data)) {
+	// Send the kv items along to the user response. If the user wants to
+	//	hang onto the reply then hand it over as well
+	if (info->response_reply_cb != NULL) {
+		if (!info->response_reply_cb(id, (redisReply *)reply,
+			info->kv_items, info->n_kv_items, info->user_data))
+		{
+			atom_logf(NULL, NULL, LOG_ERR,
+				"Failed to call user response callback with reply");
+			goto done;
+		}
+	} else if (!info->response_cb(
+		id, info->kv_items, info->n_kv_items, info->user_data))
+	{
 		atom_logf(NULL, NULL, LOG_ERR,
 			"Failed to call user response callback with kv items");
 		goto done;
@@ -60,36 +100,28 @@ done:
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-//  @brief Allows the element to listen for data on a set of streams.
-//			Each info specifies the stream to listen on as well as the expected
-//			keys for each stream. The given data callback will then be called
-//			with the redis_xread_kv_items indicating whether each item
-//			was found and if so pointing to the base redisReply for the
-//			item in the response
+//  @brief Sets up the redis stream infos for reading the data streams
+//			described by the read infos. The read infos must stay around
+//			until the streams are cleaned up.
 //
 ////////////////////////////////////////////////////////////////////////////////
-enum atom_error_t element_entry_read_loop(
+void element_entry_read_streams_init(
 	redisContext *ctx,
-	struct element *elem,
+	struct element_entry_read_streams *streams,
 	struct element_entry_read_info *infos,
-	size_t n_infos,
-	bool loop_forever,
-	int timeout)
+	size_t n_infos)
 {
-	int ret;
-	struct redis_stream_info *stream_info = NULL;
 	int i;
 	char *stream_name;
-	bool done;
-
-	// Initialize the return to an internal error
-	ret = ATOM_INTERNAL_ERROR;
 
 	// Need to allocate the stream info where we have one info
 	//	for each stream we want to listen to
-	stream_info = malloc(n_infos * sizeof(struct redis_stream_info));
-	assert(stream_info != NULL);
-	memset(stream_info, 0, n_infos * sizeof(struct redis_stream_info));
+	streams->n_infos = n_infos;
+	streams->stream_info = malloc(n_infos * sizeof(struct redis_stream_info));
+	assert(streams->stream_info != NULL);
+	memset(streams->stream_info, 0, n_infos * sizeof(struct redis_stream_info));
+	streams->cb_data = malloc(n_infos * sizeof(struct element_entry_read_cb_data));
+	assert(streams->cb_data != NULL);
 
 	// Now we want to loop over the stream infos and initialize them
 	//	with their respective data
@@ -101,18 +133,77 @@ enum atom_error_t element_entry_read_loop(
 		assert(stream_name != NULL);
 
 		// And initialize the stream info for the stream
+		element_entry_read_cb_data_init(&streams->cb_data[i], &infos[i]);
 		redis_init_stream_info(
 			ctx,
-			&stream_info[i],
+			&streams->stream_info[i],
 			stream_name,
 			element_entry_read_cb,
 			NULL,
-			&infos[i]);
+			&streams->cb_data[i]);
+		streams->stream_info[i].take_reply =
+			(infos[i].response_reply_cb != NULL);
+		streams->stream_info[i].policy = infos[i].policy;
+		streams->stream_info[i].min_interval_ns = infos[i].min_interval_ns;
+		streams->stream_info[i].items_dropped = infos[i].items_dropped;
 
 		// Note that we haven't read any items yet
 		infos[i].items_read = 0;
 		infos[i].xreads = 0;
 	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Frees everything set up by element_entry_read_streams_init
+//
+////////////////////////////////////////////////////////////////////////////////
+void element_entry_read_streams_cleanup(
+	struct element_entry_read_streams *streams)
+{
+	int i;
+
+	for (i = 0; i < streams->n_infos; ++i) {
+		free((char*)streams->stream_info[i].name);
+		redis_xread_kv_index_cleanup(&streams->cb_data[i].kv_index);
+	}
+	free(streams->stream_info);
+	free(streams->cb_data);
+	streams->stream_info = NULL;
+	streams->cb_data = NULL;
+	streams->n_infos = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Allows the element to listen for data on a set of streams.
+//			Each info specifies the stream to listen on as well as the expected
+//			keys for each stream. The given data callback will then be called
+//			with the redis_xread_kv_items indicating whether each item
+//			was found and if so pointing to the base redisReply for the
+//			item in the response
+//
+////////////////////////////////////////////////////////////////////////////////
+enum atom_error_t element_entry_read_loop(
+	redisContext *ctx,
+	struct element *elem,
+	struct element_entry_read_info *infos,
+	size_t n_infos,
+	bool loop_forever,
+	int timeout)
+{
+	int ret;
+	struct element_entry_read_streams streams;
+	struct redis_stream_info *stream_info;
+	int i;
+	bool done;
+
+	// Initialize the return to an internal error
+	ret = ATOM_INTERNAL_ERROR;
+
+	// Set up the streams we're reading
+	element_entry_read_streams_init(ctx, &streams, infos, n_infos);
+	stream_info = streams.stream_info;
 
 	// If we want to loop forever
 	if (loop_forever) {
@@ -173,13 +264,82 @@ enum atom_error_t element_entry_read_loop(
 	ret = ATOM_NO_ERROR;
 
 done:
-	for (i = 0; i < n_infos; ++i) {
-		free((char*)stream_info[i].name);
-	}
-	free(stream_info);
+	element_entry_read_streams_cleanup(&streams);
 	return ret;
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Sets up a range of a stream to be read a page at a time
+//
+////////////////////////////////////////////////////////////////////////////////
+void element_entry_range_init(
+	struct element_entry_range *range,
+	struct element_entry_read_info *info,
+	bool reverse,
+	const char *start,
+	const char *end,
+	size_t page_size,
+	size_t max_entries)
+{
+	char stream_name[ATOM_NAME_MAXLEN];
+
+	range->info = info;
+	range->cb_data = malloc(sizeof(struct element_entry_read_cb_data));
+	assert(range->cb_data != NULL);
+	element_entry_read_cb_data_init(range->cb_data, info);
+
+	atom_get_data_stream_str(info->element, info->stream, stream_name);
+	redis_range_init(&range->range, stream_name, reverse, start, end,
+		page_size, max_entries);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Reads the next page of a range, calling the read info's
+//			callbacks with each entry
+//
+////////////////////////////////////////////////////////////////////////////////
+enum atom_error_t element_entry_range_next(
+	redisContext *ctx,
+	struct element *elem,
+	struct element_entry_range *range,
+	size_t *n_read)
+{
+	if (!redis_range_next(
+		ctx,
+		&range->range,
+		element_entry_read_cb,
+		range->cb_data,
+		range->info->response_reply_cb != NULL,
+		n_read))
+	{
+		// The next page may still be on its way on ctx, so don't log on it
+		atom_logf(NULL, elem, LOG_ERR, "Failed to read range");
+		return ATOM_REDIS_ERROR;
+	}
+
+	range->info->items_read += *n_read;
+	return ATOM_NO_ERROR;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Cleans up a range
+//
+////////////////////////////////////////////////////////////////////////////////
+void element_entry_range_cleanup(
+	redisContext *ctx,
+	struct element_entry_range *range)
+{
+	redis_range_cleanup(ctx, &range->range);
+	if (range->cb_data != NULL) {
+		redis_xread_kv_index_cleanup(&range->cb_data->kv_index);
+		free(range->cb_data);
+		range->cb_data = NULL;
+	}
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 //  @brief Get the N most recent items on a stream
@@ -193,12 +353,19 @@ enum atom_error_t element_entry_read_n(
 {
 	int ret = ATOM_INTERNAL_ERROR;
 	char stream_name[ATOM_NAME_MAXLEN];
+	struct element_entry_read_cb_data cb_data;
 
 	// Get the stream name
 	atom_get_data_stream_str(info->element, info->stream, stream_name);
+	element_entry_read_cb_data_init(&cb_data, info);
 
 	// Want to initialize the stream info
-	if (!redis_xrevrange(ctx, stream_name, element_entry_read_cb, n, info)) {
+	if (!((info->response_reply_cb != NULL) ?
+		redis_xrevrange_take_reply(
+			ctx, stream_name, element_entry_read_cb, n, &cb_data) :
+		redis_xrevrange(
+			ctx, stream_name, element_entry_read_cb, n, &cb_data)))
+	{
 		atom_logf(ctx, elem, LOG_ERR, "Failed to call XREVRANGE");
 		ret = ATOM_REDIS_ERROR;
 		goto done;
@@ -208,6 +375,7 @@ enum atom_error_t element_entry_read_n(
 	ret = ATOM_NO_ERROR;
 
 done:
+	redis_xread_kv_index_cleanup(&cb_data.kv_index);
 	return ret;
 }
 
@@ -232,6 +400,7 @@ enum atom_error_t element_entry_read_since(
 	int ret;
 	struct redis_stream_info stream_info;
 	char stream_name[ATOM_NAME_MAXLEN];
+	struct element_entry_read_cb_data cb_data;
 
 	// Initialize the return to an internal error
 	ret = ATOM_INTERNAL_ERROR;
@@ -240,13 +409,15 @@ enum atom_error_t element_entry_read_since(
 	atom_get_data_stream_str(info->element, info->stream, stream_name);
 
 	// And initialize the stream info for the stream
+	element_entry_read_cb_data_init(&cb_data, info);
 	redis_init_stream_info(
 		ctx,
 		&stream_info,
 		stream_name,
 		element_entry_read_cb,
 		(last_id != NULL) ? last_id : "$",
-		info);
+		&cb_data);
+	stream_info.take_reply = (info->response_reply_cb != NULL);
 
 	// Do the XREAD
 	if (!redis_xread(ctx, &stream_info, 1, timeout, maxcount)) {
@@ -259,5 +430,121 @@ enum atom_error_t element_entry_read_since(
 	ret = ATOM_NO_ERROR;
 
 done:
+	redis_xread_kv_index_cleanup(&cb_data.kv_index);
 	return ret;
 }
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Sets up a read that can be done over and over. Everything that
+//			element_entry_read_n and element_entry_read_since make for each
+//			read is made here once
+//
+////////////////////////////////////////////////////////////////////////////////
+void element_entry_prepared_read_init(
+	redisContext *ctx,
+	struct element_entry_prepared_read *read,
+	struct element_entry_read_info *info,
+	const char *last_id)
+{
+	char *stream_name;
+
+	read->info = info;
+	read->cb_data = malloc(sizeof(struct element_entry_read_cb_data));
+	assert(read->cb_data != NULL);
+	element_entry_read_cb_data_init(read->cb_data, info);
+
+	// Get the full stream name for the data stream. The stream info
+	//	holds onto it until we're cleaned up
+	stream_name = atom_get_data_stream_str(info->element, info->stream, NULL);
+	assert(stream_name != NULL);
+
+	redis_init_stream_info(
+		ctx,
+		&read->stream_info,
+		stream_name,
+		element_entry_read_cb,
+		last_id,
+		read->cb_data);
+	redis_range_init(&read->range, stream_name, true, NULL, NULL, 1, 1);
+
+	info->items_read = 0;
+	info->xreads = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Gets the N most recent items on the stream of a prepared read.
+//			They're read as a single page, so nothing is left on its way
+//			on ctx once we're done
+//
+////////////////////////////////////////////////////////////////////////////////
+enum atom_error_t element_entry_prepared_read_n(
+	redisContext *ctx,
+	struct element *elem,
+	struct element_entry_prepared_read *read,
+	size_t n)
+{
+	size_t n_read;
+
+	redis_range_restart(ctx, &read->range, true, NULL, NULL, n, n);
+	if (!redis_range_next(
+		ctx,
+		&read->range,
+		element_entry_read_cb,
+		read->cb_data,
+		read->info->response_reply_cb != NULL,
+		&n_read))
+	{
+		atom_logf(ctx, elem, LOG_ERR, "Failed to call XREVRANGE");
+		return ATOM_REDIS_ERROR;
+	}
+
+	read->info->items_read += n_read;
+	return ATOM_NO_ERROR;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Reads at most maxcount items from the stream of a prepared read
+//			since the last one it read
+//
+////////////////////////////////////////////////////////////////////////////////
+enum atom_error_t element_entry_prepared_read_since(
+	redisContext *ctx,
+	struct element *elem,
+	struct element_entry_prepared_read *read,
+	int timeout,
+	size_t maxcount)
+{
+	read->stream_info.take_reply = (read->info->response_reply_cb != NULL);
+	read->stream_info.items_read = 0;
+
+	if (!redis_xread(ctx, &read->stream_info, 1, timeout, maxcount)) {
+		atom_logf(ctx, elem, LOG_ERR, "Redis issue/timeout");
+		return ATOM_REDIS_ERROR;
+	}
+
+	read->info->items_read += read->stream_info.items_read;
+	read->info->xreads += 1;
+	return ATOM_NO_ERROR;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Cleans up a prepared read
+//
+////////////////////////////////////////////////////////////////////////////////
+void element_entry_prepared_read_cleanup(
+	struct element_entry_prepared_read *read)
+{
+	// Reads are a single page, so there's never one still on its way
+	redis_range_cleanup(NULL, &read->range);
+	free((char*)read->stream_info.name);
+	read->stream_info.name = NULL;
+	if (read->cb_data != NULL) {
+		redis_xread_kv_index_cleanup(&read->cb_data->kv_index);
+		free(read->cb_data);
+		read->cb_data = NULL;
+	}
+}
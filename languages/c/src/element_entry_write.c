@@ -19,11 +19,13 @@
 #include "redis.h"
 #include "atom.h"
 #include "element.h"
+#include "codec.h"
 
 ////////////////////////////////////////////////////////////////////////////////
 //
 //  @brief Initializes a data write info. Will allocate the memory for the
-//			info and get the name of the stream
+//			info and get the name of the stream. The stream is added to the
+//			registry on the server ctx is connected to, unless ctx is NULL
 //
 ////////////////////////////////////////////////////////////////////////////////
 struct element_entry_write_info *element_entry_write_init(
@@ -50,6 +52,20 @@ struct element_entry_write_info *element_entry_write_init(
 	// Note the number of droplet items
 	info->n_items = n_items;
 
+	// Don't compress unless asked to
+	info->codec = CODEC_NONE;
+	info->codec_min_size = CODEC_DEFAULT_MIN_SIZE;
+
+	// Trim to the maxlen of each write unless asked otherwise
+	info->retention = NULL;
+
+	// Register the stream s.t. it can be found without a scan. This is
+	//	best-effort since e.g. in a cluster the registry might be on
+	//	another node, in which case the stream is found by scanning
+	if (ctx != NULL) {
+		atom_registry_add_stream(ctx, info->stream);
+	}
+
 	// Return the info
 	return info;
 }
@@ -70,8 +86,9 @@ void element_entry_write_cleanup(
 			free(info->items);
 		}
 
-		// Remove the stream key
+		// Remove the stream key and take it out of the registry
 		redis_remove_key(ctx, info->stream, true);
+		atom_registry_remove_stream(ctx, info->stream);
 
 		// Free the info itself
 		free(info);
@@ -81,19 +98,18 @@ void element_entry_write_cleanup(
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-//  @brief Writes a piece of data to the system. Must write on a stream
-//			info that's been initialized.
+//  @brief Adds the timestamp to the end of the info's items if it's not
+//			the default. Returns the number of items to write. The timestamp
+//			buffer must outlive the use of the items.
 //
 ////////////////////////////////////////////////////////////////////////////////
-enum atom_error_t element_entry_write(
-	redisContext *ctx,
+static size_t element_entry_write_add_timestamp(
 	struct element_entry_write_info *info,
 	int timestamp,
-	int maxlen)
+	char *timestamp_buffer,
+	size_t timestamp_buffer_size)
 {
-	enum atom_error_t ret = ATOM_INTERNAL_ERROR;
 	size_t n_items;
-	char timestamp_buffer[64];
 	size_t timestamp_buffer_len;
 
 	// Initialize the number of infos to that of the stream itself
@@ -105,7 +121,7 @@ enum atom_error_t element_entry_write(
 
 		// Make the string
 		timestamp_buffer_len = snprintf(
-			timestamp_buffer, sizeof(timestamp_buffer), "%d", timestamp);
+			timestamp_buffer, timestamp_buffer_size, "%d", timestamp);
 
 		// Add it to the droplet items
 		// Initialize the timestamp key and key len
@@ -122,26 +138,355 @@ enum atom_error_t element_entry_write(
 		++n_items;
 	}
 
+	return n_items;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Notes the size of an entry for a byte budget. Keeps a moving
+//			average with a weight of 1/2^ELEMENT_RETENTION_AVG_SHIFT on the
+//			new entry. Writers and trimmers may be on different threads,
+//			and losing an update now and then is fine for an average
+//
+////////////////////////////////////////////////////////////////////////////////
+#define ELEMENT_RETENTION_AVG_SHIFT 3
+
+void element_retention_note_entry(
+	struct element_retention *retention,
+	size_t entry_bytes)
+{
+	uint64_t avg;
+
+	avg = __atomic_load_n(&retention->avg_entry_bytes, __ATOMIC_RELAXED);
+	if (avg == 0) {
+		avg = entry_bytes;
+	} else {
+		avg += ((int64_t)entry_bytes - (int64_t)avg) >>
+			ELEMENT_RETENTION_AVG_SHIFT;
+	}
+	__atomic_store_n(&retention->avg_entry_bytes, avg, __ATOMIC_RELAXED);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Notes the offset of the server's clock from ours. The ID's time
+//			is when the server added the entry, which was just now, and
+//			being off by the round trip doesn't matter for a time window
+//
+////////////////////////////////////////////////////////////////////////////////
+void element_retention_note_id(
+	struct element_retention *retention,
+	const char *id)
+{
+	int64_t id_ms;
+	char *end;
+
+	if (retention->type != ELEMENT_RETENTION_TIME) {
+		return;
+	}
+
+	id_ms = strtoll(id, &end, 10);
+	if ((end == id) || (*end != '-')) {
+		return;
+	}
+
+	__atomic_store_n(&retention->clock_offset_ms, id_ms - atom_time_ms(),
+		__ATOMIC_RELAXED);
+	__atomic_store_n(&retention->clock_known, true, __ATOMIC_RELEASE);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Checks whether we know enough to trim
+//
+////////////////////////////////////////////////////////////////////////////////
+bool element_retention_ready(
+	struct element_retention *retention)
+{
+	return (retention->type != ELEMENT_RETENTION_TIME) ||
+		__atomic_load_n(&retention->clock_known, __ATOMIC_ACQUIRE);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Gets the trim for a retention policy. Time windows trim by the
+//			ID, which is the server's time when the entry was added, and
+//			byte budgets by how many average entries fit in the budget
+//
+////////////////////////////////////////////////////////////////////////////////
+void element_retention_get_trim(
+	struct element_retention *retention,
+	struct redis_trim *trim)
+{
+	uint64_t avg;
+	long long maxlen;
+
+	trim->approx = ATOM_DEFAULT_APPROX_MAXLEN;
+
+	switch (retention->type) {
+		case ELEMENT_RETENTION_TIME:
+			if (!element_retention_ready(retention)) {
+				trim->type = REDIS_TRIM_NONE;
+				break;
+			}
+			trim->type = REDIS_TRIM_MINID;
+			trim->threshold = atom_time_ms() - retention->max_age_ms +
+				__atomic_load_n(&retention->clock_offset_ms, __ATOMIC_RELAXED);
+			break;
+		case ELEMENT_RETENTION_BYTES:
+			avg = __atomic_load_n(
+				&retention->avg_entry_bytes, __ATOMIC_RELAXED);
+			trim->type = REDIS_TRIM_MAXLEN;
+			maxlen = (avg > 0) ? (long long)(retention->max_bytes / avg) :
+				ELEMENT_DATA_WRITE_DEFAULT_MAXLEN;
+			trim->threshold = (maxlen > ELEMENT_RETENTION_MIN_MAXLEN) ?
+				maxlen : ELEMENT_RETENTION_MIN_MAXLEN;
+			break;
+		case ELEMENT_RETENTION_COUNT:
+		default:
+			redis_trim_init_maxlen(trim, retention->maxlen,
+				ATOM_DEFAULT_APPROX_MAXLEN);
+			break;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Gets the trim for a write of the encoded items, noting their
+//			size if the stream has a retention policy
+//
+////////////////////////////////////////////////////////////////////////////////
+static void element_entry_write_get_trim(
+	struct element_entry_write_info *info,
+	const struct codec_encoded_items *encoded,
+	int maxlen,
+	struct redis_trim *trim)
+{
+	size_t entry_bytes = 0;
+	size_t i;
+
+	if (info->retention == NULL) {
+		redis_trim_init_maxlen(trim, maxlen, ATOM_DEFAULT_APPROX_MAXLEN);
+		return;
+	}
+
+	if (info->retention->type == ELEMENT_RETENTION_BYTES) {
+		for (i = 0; i < encoded->n_items; ++i) {
+			entry_bytes += encoded->items[i].key_len +
+				encoded->items[i].data_len;
+		}
+		element_retention_note_entry(info->retention, entry_bytes);
+	}
+
+	if (info->retention->deferred) {
+		trim->type = REDIS_TRIM_NONE;
+	} else {
+		element_retention_get_trim(info->retention, trim);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Writes a piece of data to the system. Must write on a stream
+//			info that's been initialized.
+//
+////////////////////////////////////////////////////////////////////////////////
+enum atom_error_t element_entry_write(
+	redisContext *ctx,
+	struct element_entry_write_info *info,
+	int timestamp,
+	int maxlen)
+{
+	enum atom_error_t ret = ATOM_INTERNAL_ERROR;
+	size_t n_items;
+	char timestamp_buffer[64];
+	struct codec_encoded_items encoded;
+	struct redis_trim trim;
+	char id[STREAM_ID_BUFFLEN];
+
+	// Add the timestamp if we have one
+	n_items = element_entry_write_add_timestamp(
+		info, timestamp, timestamp_buffer, sizeof(timestamp_buffer));
+
+	// Compress what's big enough
+	codec_encode_items(
+		info->codec, info->codec_min_size, info->items, n_items, &encoded);
+
+	element_entry_write_get_trim(info, &encoded, maxlen, &trim);
+
 	// And we want to XADD the data to the stream to create it. This will
 	//	also put the ID of the item in the stream that we added with our
 	//	info into our last id
-	if (!redis_xadd(
+	if (!redis_xadd_trim(
 		ctx,
 		info->stream,
-		info->items,
-		n_items,
-		maxlen,
-		ATOM_DEFAULT_APPROX_MAXLEN,
-		NULL))
+		encoded.items,
+		encoded.n_items,
+		&trim,
+		id))
 	{
 		atom_logf(ctx, NULL, LOG_ERR, "Failed to XADD data to stream");
 		ret = ATOM_REDIS_ERROR;
 		goto done;
 	}
 
+	if (info->retention != NULL) {
+		element_retention_note_id(info->retention, id);
+	}
+
 	// Note the success
 	ret = ATOM_NO_ERROR;
 
 done:
+	codec_encoded_items_cleanup(&encoded);
+	return ret;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Appends a write of the info's current data to the context's
+//			output buffer without waiting for redis to reply. The data is
+//			copied into the output buffer so the info's items may be
+//			refilled for the next entry as soon as this returns. Once all
+//			of the entries in a batch are appended, call
+//			element_entry_write_flush to send them and collect the IDs.
+//
+////////////////////////////////////////////////////////////////////////////////
+enum atom_error_t element_entry_write_append(
+	redisContext *ctx,
+	struct element_entry_write_info *info,
+	int timestamp,
+	int maxlen)
+{
+	enum atom_error_t ret = ATOM_NO_ERROR;
+	size_t n_items;
+	char timestamp_buffer[64];
+	struct codec_encoded_items encoded;
+	struct redis_trim trim;
+
+	// Add the timestamp if we have one
+	n_items = element_entry_write_add_timestamp(
+		info, timestamp, timestamp_buffer, sizeof(timestamp_buffer));
+
+	// Compress what's big enough. The appended command has its own copy
+	//	of the data s.t. the compressed values can be freed right away
+	codec_encode_items(
+		info->codec, info->codec_min_size, info->items, n_items, &encoded);
+
+	element_entry_write_get_trim(info, &encoded, maxlen, &trim);
+
+	// And append the XADD
+	if (!redis_xadd_append_trim(
+		ctx,
+		info->stream,
+		encoded.items,
+		encoded.n_items,
+		&trim))
+	{
+		atom_logf(ctx, NULL, LOG_ERR, "Failed to append XADD to stream");
+		ret = ATOM_REDIS_ERROR;
+	}
+
+	codec_encoded_items_cleanup(&encoded);
+	return ret;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Sends all of the writes appended with element_entry_write_append
+//			in a single round trip and collects the n replies in order.
+//			If ids is non-NULL the ID for each entry is copied into it and
+//			if errs is non-NULL the per-entry error is noted there. All n
+//			replies are always consumed s.t. the context stays in sync; if
+//			the connection breaks then the remaining entries are marked as
+//			failed. Returns ATOM_NO_ERROR only if all of the writes succeeded.
+//
+////////////////////////////////////////////////////////////////////////////////
+enum atom_error_t element_entry_write_flush(
+	redisContext *ctx,
+	size_t n,
+	char (*ids)[STREAM_ID_BUFFLEN],
+	enum atom_error_t *errs)
+{
+	enum atom_error_t ret = ATOM_NO_ERROR;
+	enum atom_error_t err;
+	size_t i;
+
+	for (i = 0; i < n; ++i) {
+
+		// Once the connection is broken we won't get any more replies
+		if (ctx->err) {
+			err = ATOM_REDIS_ERROR;
+		} else if (!redis_xadd_get_reply(ctx, (ids != NULL) ? ids[i] : NULL)) {
+			err = ATOM_REDIS_ERROR;
+		} else {
+			err = ATOM_NO_ERROR;
+		}
+
+		if ((err != ATOM_NO_ERROR) && (ids != NULL)) {
+			ids[i][0] = '\0';
+		}
+		if (errs != NULL) {
+			errs[i] = err;
+		}
+		if (err != ATOM_NO_ERROR) {
+			ret = err;
+		}
+	}
+
+	if (ret != ATOM_NO_ERROR) {
+		atom_logf(NULL, NULL, LOG_ERR, "Failed to write batch to redis");
+	}
+
+	return ret;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Appends a trim of the stream to its retention policy to the
+//			context's output buffer without waiting for redis to reply
+//
+////////////////////////////////////////////////////////////////////////////////
+enum atom_error_t element_retention_trim_append(
+	redisContext *ctx,
+	const char *stream,
+	struct element_retention *retention)
+{
+	struct redis_trim trim;
+
+	element_retention_get_trim(retention, &trim);
+
+	if (!redis_xtrim_append(ctx, stream, &trim)) {
+		atom_logf(ctx, NULL, LOG_ERR, "Failed to append XTRIM to stream");
+		return ATOM_REDIS_ERROR;
+	}
+
+	return ATOM_NO_ERROR;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Sends all of the trims appended with element_retention_trim_append
+//			and collects the n replies. Same as element_entry_write_flush
+//			as far as keeping the context in sync goes
+//
+////////////////////////////////////////////////////////////////////////////////
+enum atom_error_t element_retention_trim_flush(
+	redisContext *ctx,
+	size_t n)
+{
+	enum atom_error_t ret = ATOM_NO_ERROR;
+	size_t i;
+
+	for (i = 0; i < n; ++i) {
+		if (ctx->err || !redis_xtrim_get_reply(ctx, NULL)) {
+			ret = ATOM_REDIS_ERROR;
+		}
+	}
+
+	if (ret != ATOM_NO_ERROR) {
+		atom_logf(NULL, NULL, LOG_ERR, "Failed to trim streams");
+	}
+
 	return ret;
 }
@@ -0,0 +1,489 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @file element_reference.c
+//
+//  @brief Implements references for an element
+//
+//  @copy 2018 Elementary Robotics. All rights reserved.
+//
+////////////////////////////////////////////////////////////////////////////////
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <hiredis/hiredis.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <string.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "redis.h"
+#include "atom.h"
+#include "element.h"
+#include "element_reference.h"
+
+#define ELEMENT_REFERENCE_SCRIPT_LOAD_N_ARGS 3
+#define ELEMENT_REFERENCE_SCRIPT_STR "SCRIPT"
+#define ELEMENT_REFERENCE_SCRIPT_LOAD_STR "LOAD"
+
+#define ELEMENT_REFERENCE_EVALSHA_N_ARGS 7
+#define ELEMENT_REFERENCE_EVALSHA_STR "EVALSHA"
+#define ELEMENT_REFERENCE_EVALSHA_NO_KEYS_STR "0"
+#define ELEMENT_REFERENCE_NOSCRIPT_STR "NOSCRIPT"
+
+#define ELEMENT_REFERENCE_MGET_STR "MGET"
+#define ELEMENT_REFERENCE_UNLINK_STR "UNLINK"
+
+#define ELEMENT_REFERENCE_SHA_BUFFLEN 41
+#define ELEMENT_REFERENCE_UUID_BUFFLEN 37
+#define ELEMENT_REFERENCE_TIMEOUT_BUFFLEN 32
+
+// Same script as lua-scripts/stream_reference.lua, which the other
+//	languages load. Keep the two in sync.
+//
+//  Args:
+//      1: Name of stream
+//      2: Stream entry ID -- leave blank "" for most recent
+//      3: Reference ID
+//      4: Reference timeout_ms -- 0 for no timeout
+static const char element_reference_script[] =
+	"local data = \"\"\n"
+	"if (ARGV[2] == \"\") then\n"
+	"    data = redis.call('xrevrange',ARGV[1],'+','-','COUNT','1')\n"
+	"else\n"
+	"    data = redis.call('xrange',ARGV[1],ARGV[2],ARGV[2])\n"
+	"end\n"
+	"local ref = \"\"\n"
+	"local ser = \"\"\n"
+	"local keys = {}\n"
+	"for key,val in pairs(data[1][2]) do\n"
+	"    if (key % 2 == 1) and (string.match(val, \"ser\")) then\n"
+	"        ser = data[1][2][key + 1]\n"
+	"        table.remove(data[1][2], key + 1)\n"
+	"        table.remove(data[1][2], key)\n"
+	"    end\n"
+	"end\n"
+	"for key,val in pairs(data[1][2]) do\n"
+	"    if (key % 2 == 0) then\n"
+	"        if (ARGV[4] == '0') then\n"
+	"            redis.call('set',ref,val)\n"
+	"        else\n"
+	"            redis.call('set',ref,val,'px',ARGV[4])\n"
+	"        end\n"
+	"        table.insert(keys,ref)\n"
+	"    else\n"
+	"        ref = ARGV[3] .. \":ser:\" .. ser .. \":\" .. val\n"
+	"    end\n"
+	"end\n"
+	"return keys\n";
+
+// SHA of the script once we've loaded it. Shared across all contexts
+//	since they're all talking to the same redis
+static char element_reference_sha[ELEMENT_REFERENCE_SHA_BUFFLEN];
+static bool element_reference_sha_loaded = false;
+static pthread_mutex_t element_reference_sha_lock = PTHREAD_MUTEX_INITIALIZER;
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Loads the script into redis and notes its SHA. Called the first
+//			time we make a reference and again if redis has lost the
+//			script, i.e. it was restarted or the scripts were flushed.
+//			sha is filled in with a copy of the SHA
+//
+////////////////////////////////////////////////////////////////////////////////
+static bool element_reference_load_script(
+	redisContext *ctx,
+	bool reload,
+	char sha[ELEMENT_REFERENCE_SHA_BUFFLEN])
+{
+	redisReply *reply;
+	const char *argv[ELEMENT_REFERENCE_SCRIPT_LOAD_N_ARGS];
+	size_t argvlen[ELEMENT_REFERENCE_SCRIPT_LOAD_N_ARGS];
+	bool ret = false;
+
+	pthread_mutex_lock(&element_reference_sha_lock);
+
+	if (element_reference_sha_loaded && !reload) {
+		memcpy(sha, element_reference_sha, ELEMENT_REFERENCE_SHA_BUFFLEN);
+		ret = true;
+		goto unlock;
+	}
+
+	argv[0] = ELEMENT_REFERENCE_SCRIPT_STR;
+	argvlen[0] = CONST_STRLEN(ELEMENT_REFERENCE_SCRIPT_STR);
+	argv[1] = ELEMENT_REFERENCE_SCRIPT_LOAD_STR;
+	argvlen[1] = CONST_STRLEN(ELEMENT_REFERENCE_SCRIPT_LOAD_STR);
+	argv[2] = element_reference_script;
+	argvlen[2] = CONST_STRLEN(element_reference_script);
+
+	reply = redisCommandArgv(
+		ctx, ELEMENT_REFERENCE_SCRIPT_LOAD_N_ARGS, argv, argvlen);
+	if (reply == NULL) {
+		fprintf(stderr, "Failed to get SCRIPT LOAD reply\n");
+		goto unlock;
+	}
+
+	if ((reply->type != REDIS_REPLY_STRING) ||
+		(reply->len != ELEMENT_REFERENCE_SHA_BUFFLEN - 1))
+	{
+		fprintf(stderr, "Invalid SCRIPT LOAD reply\n");
+		goto free_reply;
+	}
+
+	memcpy(element_reference_sha, reply->str, reply->len);
+	element_reference_sha[reply->len] = '\0';
+	element_reference_sha_loaded = true;
+	memcpy(sha, element_reference_sha, ELEMENT_REFERENCE_SHA_BUFFLEN);
+	ret = true;
+
+free_reply:
+	freeReplyObject(reply);
+unlock:
+	pthread_mutex_unlock(&element_reference_sha_lock);
+	return ret;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Makes a random (version 4) UUID
+//
+////////////////////////////////////////////////////////////////////////////////
+static bool element_reference_make_uuid(
+	char buffer[ELEMENT_REFERENCE_UUID_BUFFLEN])
+{
+	uint8_t b[16];
+	ssize_t n;
+	int fd;
+
+	fd = open("/dev/urandom", O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		return false;
+	}
+	n = read(fd, b, sizeof(b));
+	close(fd);
+	if (n != sizeof(b)) {
+		return false;
+	}
+
+	b[6] = (b[6] & 0x0f) | 0x40;
+	b[8] = (b[8] & 0x3f) | 0x80;
+
+	snprintf(buffer, ELEMENT_REFERENCE_UUID_BUFFLEN,
+		"%02x%02x%02x%02x-%02x%02x-%02x%02x-%02x%02x-"
+		"%02x%02x%02x%02x%02x%02x",
+		b[0], b[1], b[2], b[3], b[4], b[5], b[6], b[7],
+		b[8], b[9], b[10], b[11], b[12], b[13], b[14], b[15]);
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Makes references from a stream entry by calling the script. The
+//			script is called by its SHA so only the SHA goes over the wire,
+//			and if redis doesn't have it anymore we load it and try again
+//
+////////////////////////////////////////////////////////////////////////////////
+enum atom_error_t element_reference_create_from_stream(
+	redisContext *ctx,
+	struct element *elem,
+	const char *element,
+	const char *stream,
+	const char *id,
+	int timeout_ms,
+	struct element_reference **refs,
+	size_t *n_refs)
+{
+	enum atom_error_t ret = ATOM_INTERNAL_ERROR;
+	redisReply *reply = NULL;
+	const char *argv[ELEMENT_REFERENCE_EVALSHA_N_ARGS];
+	size_t argvlen[ELEMENT_REFERENCE_EVALSHA_N_ARGS];
+	char sha[ELEMENT_REFERENCE_SHA_BUFFLEN];
+	char stream_buffer[ATOM_NAME_MAXLEN];
+	char uuid[ELEMENT_REFERENCE_UUID_BUFFLEN];
+	char timeout_buffer[ELEMENT_REFERENCE_TIMEOUT_BUFFLEN];
+	char *ref_id = NULL;
+	struct element_reference *ret_refs = NULL;
+	const char *key;
+	size_t i;
+	int attempt;
+
+	*refs = NULL;
+	*n_refs = 0;
+
+	if ((atom_get_data_stream_str(element, stream, stream_buffer) == NULL) ||
+		(timeout_ms < 0))
+	{
+		atom_logf(ctx, elem, LOG_ERR, "Invalid reference stream or timeout");
+		goto done;
+	}
+
+	if (!element_reference_make_uuid(uuid)) {
+		atom_logf(ctx, elem, LOG_ERR, "Failed to make reference ID");
+		goto done;
+	}
+	if (asprintf(&ref_id, ELEMENT_REFERENCE_PREFIX "%s:%s",
+		elem->name.str, uuid) < 0)
+	{
+		ref_id = NULL;
+		goto done;
+	}
+	snprintf(timeout_buffer, sizeof(timeout_buffer), "%d", timeout_ms);
+
+	argv[0] = ELEMENT_REFERENCE_EVALSHA_STR;
+	argvlen[0] = CONST_STRLEN(ELEMENT_REFERENCE_EVALSHA_STR);
+	argv[1] = sha;
+	argvlen[1] = ELEMENT_REFERENCE_SHA_BUFFLEN - 1;
+	argv[2] = ELEMENT_REFERENCE_EVALSHA_NO_KEYS_STR;
+	argvlen[2] = CONST_STRLEN(ELEMENT_REFERENCE_EVALSHA_NO_KEYS_STR);
+	argv[3] = stream_buffer;
+	argvlen[3] = strlen(stream_buffer);
+	argv[4] = (id != NULL) ? id : "";
+	argvlen[4] = strlen(argv[4]);
+	argv[5] = ref_id;
+	argvlen[5] = strlen(ref_id);
+	argv[6] = timeout_buffer;
+	argvlen[6] = strlen(timeout_buffer);
+
+	// Try with the SHA we have and, if redis has lost the script, reload
+	//	it once and try again
+	for (attempt = 0; attempt < 2; ++attempt) {
+		if (!element_reference_load_script(ctx, attempt > 0, sha)) {
+			atom_logf(ctx, elem, LOG_ERR, "Failed to load reference script");
+			ret = ATOM_REDIS_ERROR;
+			goto done;
+		}
+
+		reply = redisCommandArgv(
+			ctx, ELEMENT_REFERENCE_EVALSHA_N_ARGS, argv, argvlen);
+		if (reply == NULL) {
+			atom_logf(ctx, elem, LOG_ERR, "Failed to get EVALSHA reply");
+			ret = ATOM_REDIS_ERROR;
+			goto done;
+		}
+
+		if ((reply->type != REDIS_REPLY_ERROR) ||
+			(strncmp(reply->str, ELEMENT_REFERENCE_NOSCRIPT_STR,
+				CONST_STRLEN(ELEMENT_REFERENCE_NOSCRIPT_STR)) != 0))
+		{
+			break;
+		}
+		freeReplyObject(reply);
+		reply = NULL;
+	}
+
+	// Scripts error out if there's no such entry
+	if ((reply == NULL) || (reply->type != REDIS_REPLY_ARRAY)) {
+		atom_logf(ctx, elem, LOG_ERR, "Failed to make reference from %s",
+			stream_buffer);
+		ret = ATOM_REDIS_ERROR;
+		goto done;
+	}
+
+	ret_refs = calloc(reply->elements, sizeof(struct element_reference));
+	assert((ret_refs != NULL) || (reply->elements == 0));
+
+	// References are <ref_id>:ser:<ser>:<key>, so the key is everything
+	//	after the last colon
+	for (i = 0; i < reply->elements; ++i) {
+		if (reply->element[i]->type != REDIS_REPLY_STRING) {
+			atom_logf(ctx, elem, LOG_ERR, "Invalid reference in reply");
+			element_reference_free(ret_refs, i);
+			ret_refs = NULL;
+			ret = ATOM_REDIS_ERROR;
+			goto done;
+		}
+
+		ret_refs[i].ref = strndup(
+			reply->element[i]->str, reply->element[i]->len);
+		assert(ret_refs[i].ref != NULL);
+		key = strrchr(ret_refs[i].ref, ':');
+		ret_refs[i].key = strdup((key != NULL) ? key + 1 : ret_refs[i].ref);
+		assert(ret_refs[i].key != NULL);
+	}
+
+	*refs = ret_refs;
+	*n_refs = reply->elements;
+	ret = ATOM_NO_ERROR;
+
+done:
+	if (reply != NULL) {
+		freeReplyObject(reply);
+	}
+	if (ref_id != NULL) {
+		free(ref_id);
+	}
+	return ret;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Frees references
+//
+////////////////////////////////////////////////////////////////////////////////
+void element_reference_free(
+	struct element_reference *refs,
+	size_t n_refs)
+{
+	size_t i;
+
+	if (refs == NULL) {
+		return;
+	}
+
+	for (i = 0; i < n_refs; ++i) {
+		free(refs[i].key);
+		free(refs[i].ref);
+	}
+	free(refs);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Appends one command per ELEMENT_REFERENCE_MAX_KEYS references,
+//			each of the form <cmd> <ref> ... Returns the number of
+//			commands appended
+//
+////////////////////////////////////////////////////////////////////////////////
+static size_t element_reference_append_keys(
+	redisContext *ctx,
+	const char *cmd,
+	const char * const *refs,
+	size_t n_refs)
+{
+	const char *argv[ELEMENT_REFERENCE_MAX_KEYS + 1];
+	size_t argvlen[ELEMENT_REFERENCE_MAX_KEYS + 1];
+	size_t n_cmds = 0;
+	size_t i, j, n;
+
+	argv[0] = cmd;
+	argvlen[0] = strlen(cmd);
+
+	for (i = 0; i < n_refs; i += ELEMENT_REFERENCE_MAX_KEYS) {
+		n = n_refs - i;
+		if (n > ELEMENT_REFERENCE_MAX_KEYS) {
+			n = ELEMENT_REFERENCE_MAX_KEYS;
+		}
+
+		for (j = 0; j < n; ++j) {
+			argv[j + 1] = refs[i + j];
+			argvlen[j + 1] = strlen(refs[i + j]);
+		}
+
+		if (redisAppendCommandArgv(ctx, n + 1, argv, argvlen) != REDIS_OK) {
+			fprintf(stderr, "Failed to append %s\n", cmd);
+			break;
+		}
+		++n_cmds;
+	}
+
+	return n_cmds;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Gets references with pipelined MGETs. All of the replies that
+//			were appended are read even if one is bad s.t. the context is
+//			left with nothing outstanding
+//
+////////////////////////////////////////////////////////////////////////////////
+enum atom_error_t element_reference_get(
+	redisContext *ctx,
+	const char * const *refs,
+	size_t n_refs,
+	bool (*reply_cb)(redisReply *reply, size_t first, void *user_data),
+	void *user_data)
+{
+	enum atom_error_t ret = ATOM_NO_ERROR;
+	redisReply *reply;
+	size_t n_cmds;
+	size_t i, n;
+
+	if (n_refs == 0) {
+		return ATOM_NO_ERROR;
+	}
+
+	n_cmds = element_reference_append_keys(
+		ctx, ELEMENT_REFERENCE_MGET_STR, refs, n_refs);
+	if (n_cmds * ELEMENT_REFERENCE_MAX_KEYS < n_refs) {
+		ret = ATOM_REDIS_ERROR;
+	}
+
+	for (i = 0; i < n_cmds; ++i) {
+		if ((redisGetReply(ctx, (void**)&reply) != REDIS_OK) ||
+			(reply == NULL))
+		{
+			fprintf(stderr, "Failed to get MGET reply\n");
+			return ATOM_REDIS_ERROR;
+		}
+
+		n = n_refs - (i * ELEMENT_REFERENCE_MAX_KEYS);
+		if (n > ELEMENT_REFERENCE_MAX_KEYS) {
+			n = ELEMENT_REFERENCE_MAX_KEYS;
+		}
+
+		if ((reply->type != REDIS_REPLY_ARRAY) || (reply->elements != n)) {
+			fprintf(stderr, "Invalid MGET reply\n");
+			ret = ATOM_REDIS_ERROR;
+			freeReplyObject(reply);
+			continue;
+		}
+
+		if ((reply_cb == NULL) ||
+			!reply_cb(reply, i * ELEMENT_REFERENCE_MAX_KEYS, user_data))
+		{
+			freeReplyObject(reply);
+		}
+	}
+
+	return ret;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Deletes references with pipelined UNLINKs
+//
+////////////////////////////////////////////////////////////////////////////////
+enum atom_error_t element_reference_delete(
+	redisContext *ctx,
+	const char * const *refs,
+	size_t n_refs,
+	size_t *n_deleted)
+{
+	enum atom_error_t ret = ATOM_NO_ERROR;
+	redisReply *reply;
+	size_t n_cmds;
+	size_t i;
+	size_t deleted = 0;
+
+	if (n_refs > 0) {
+		n_cmds = element_reference_append_keys(
+			ctx, ELEMENT_REFERENCE_UNLINK_STR, refs, n_refs);
+		if (n_cmds * ELEMENT_REFERENCE_MAX_KEYS < n_refs) {
+			ret = ATOM_REDIS_ERROR;
+		}
+
+		for (i = 0; i < n_cmds; ++i) {
+			if ((redisGetReply(ctx, (void**)&reply) != REDIS_OK) ||
+				(reply == NULL))
+			{
+				fprintf(stderr, "Failed to get UNLINK reply\n");
+				ret = ATOM_REDIS_ERROR;
+				break;
+			}
+
+			if (reply->type == REDIS_REPLY_INTEGER) {
+				deleted += reply->integer;
+			} else {
+				fprintf(stderr, "Invalid UNLINK reply\n");
+				ret = ATOM_REDIS_ERROR;
+			}
+			freeReplyObject(reply);
+		}
+	}
+
+	if (n_deleted != NULL) {
+		*n_deleted = deleted;
+	}
+	return ret;
+}
@@ -0,0 +1,462 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @file log_queue.c
+//
+//  @brief Implements the queue that logs go through on their way to the
+//			log stream. The queue is a bounded multi-producer ring where
+//			each slot has a sequence number that says whether it's free
+//			or full for the current lap, s.t. producers only contend on
+//			the head and never wait on the writer.
+//
+//  @copy 2018 Elementary Robotics. All rights reserved.
+//
+////////////////////////////////////////////////////////////////////////////////
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <hiredis/hiredis.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <limits.h>
+
+#include "atom.h"
+#include "redis.h"
+#include "log_queue.h"
+
+#define LOG_QUEUE_MASK (LOG_QUEUE_LEN - 1)
+
+// A log waiting to be written. seq is the position the slot is free for
+//	and one more than that once it's been filled
+struct log_queue_slot {
+	_Atomic size_t seq;
+	int level;
+	size_t element_len;
+	size_t msg_len;
+	char element[ATOM_NAME_MAXLEN];
+	char msg[ATOM_LOG_MAXLEN];
+};
+
+static struct {
+	struct log_queue_slot slots[LOG_QUEUE_LEN];
+
+	// Next position to fill and, only moved by the writer, the next
+	//	position to write
+	_Atomic size_t head;
+	_Atomic size_t tail;
+	_Atomic uint64_t dropped;
+
+	pthread_once_t once;
+	pthread_t thread;
+	pthread_mutex_t lock;
+
+	// If the writer couldn't be started logs are written as they come
+	//	in on sync_ctx, under lock
+	bool sync;
+	redisContext *sync_ctx;
+	pthread_cond_t pushed;
+	pthread_cond_t written;
+
+	char hostname[HOST_NAME_MAX + 1];
+	size_t hostname_len;
+} log_queue = {
+	.once = PTHREAD_ONCE_INIT,
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.pushed = PTHREAD_COND_INITIALIZER,
+	.written = PTHREAD_COND_INITIALIZER,
+};
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Gets the absolute time timeout_ms from now for a timed wait
+//
+////////////////////////////////////////////////////////////////////////////////
+static void log_queue_deadline(
+	struct timespec *deadline,
+	int timeout_ms)
+{
+	clock_gettime(CLOCK_REALTIME, deadline);
+	deadline->tv_nsec += (timeout_ms % 1000) * 1000000L;
+	deadline->tv_sec += timeout_ms / 1000 + deadline->tv_nsec / 1000000000L;
+	deadline->tv_nsec %= 1000000000L;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Fills in the keys and values of a log's XADD. level_str has to
+//			be kept around until the XADD's been sent
+//
+////////////////////////////////////////////////////////////////////////////////
+static void log_queue_fill_infos(
+	struct redis_xadd_info infos[LOG_N_KEYS],
+	char level_str[2],
+	int level,
+	const char *element,
+	size_t element_len,
+	const char *msg,
+	size_t msg_len)
+{
+	level_str[0] = '0' + level;
+	level_str[1] = '\0';
+
+	infos[LOG_KEY_LEVEL].key = LOG_KEY_LEVEL_STR;
+	infos[LOG_KEY_LEVEL].key_len = CONST_STRLEN(LOG_KEY_LEVEL_STR);
+	infos[LOG_KEY_LEVEL].data = (const uint8_t*)level_str;
+	infos[LOG_KEY_LEVEL].data_len = 1;
+
+	infos[LOG_KEY_ELEMENT].key = LOG_KEY_ELEMENT_STR;
+	infos[LOG_KEY_ELEMENT].key_len = CONST_STRLEN(LOG_KEY_ELEMENT_STR);
+	infos[LOG_KEY_ELEMENT].data = (const uint8_t*)element;
+	infos[LOG_KEY_ELEMENT].data_len = element_len;
+
+	infos[LOG_KEY_MESSAGE].key = LOG_KEY_MESSAGE_STR;
+	infos[LOG_KEY_MESSAGE].key_len = CONST_STRLEN(LOG_KEY_MESSAGE_STR);
+	infos[LOG_KEY_MESSAGE].data = (const uint8_t*)msg;
+	infos[LOG_KEY_MESSAGE].data_len = msg_len;
+
+	infos[LOG_KEY_HOST].key = LOG_KEY_HOST_STR;
+	infos[LOG_KEY_HOST].key_len = CONST_STRLEN(LOG_KEY_HOST_STR);
+	infos[LOG_KEY_HOST].data = (const uint8_t*)log_queue.hostname;
+	infos[LOG_KEY_HOST].data_len = log_queue.hostname_len;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Appends XADDs for the logs that are ready, up to a batch, and
+//			then collects the replies. The slots are only given back once
+//			redis has replied s.t. if the connection breaks the logs are
+//			sent again on the next one. Returns the number of logs written
+//			or -1 if the connection broke.
+//
+////////////////////////////////////////////////////////////////////////////////
+static int log_queue_write_batch(
+	redisContext *ctx)
+{
+	struct redis_xadd_info infos[LOG_N_KEYS];
+	struct log_queue_slot *slot;
+	char level_str[2];
+	size_t tail, n, i;
+
+	tail = atomic_load_explicit(&log_queue.tail, memory_order_relaxed);
+
+	for (n = 0; n < LOG_QUEUE_BATCH; ++n) {
+		slot = &log_queue.slots[(tail + n) & LOG_QUEUE_MASK];
+		if (atomic_load_explicit(&slot->seq, memory_order_acquire) !=
+			tail + n + 1)
+		{
+			break;
+		}
+
+		log_queue_fill_infos(infos, level_str, slot->level, slot->element,
+			slot->element_len, slot->msg, slot->msg_len);
+
+		// The arguments are copied into the output buffer
+		if (!redis_xadd_append(ctx, ATOM_LOG_STREAM_NAME, infos, LOG_N_KEYS,
+			ATOM_DEFAULT_MAXLEN, true))
+		{
+			break;
+		}
+	}
+
+	if (n == 0) {
+		return 0;
+	}
+
+	// A log that redis refused is dropped, but if the connection broke
+	//	we don't know what made it
+	for (i = 0; i < n; ++i) {
+		if (!redis_xadd_get_reply(ctx, NULL) && ctx->err) {
+			return -1;
+		}
+	}
+
+	for (i = 0; i < n; ++i) {
+		slot = &log_queue.slots[(tail + i) & LOG_QUEUE_MASK];
+		atomic_store_explicit(&slot->seq, tail + i + LOG_QUEUE_LEN,
+			memory_order_release);
+	}
+	atomic_store_explicit(&log_queue.tail, tail + n, memory_order_release);
+
+	pthread_mutex_lock(&log_queue.lock);
+	pthread_cond_broadcast(&log_queue.written);
+	pthread_mutex_unlock(&log_queue.lock);
+
+	return n;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Returns whether there's a log ready to be written
+//
+////////////////////////////////////////////////////////////////////////////////
+static bool log_queue_ready(void)
+{
+	size_t tail = atomic_load_explicit(&log_queue.tail, memory_order_relaxed);
+
+	return atomic_load_explicit(
+		&log_queue.slots[tail & LOG_QUEUE_MASK].seq,
+		memory_order_acquire) == tail + 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Writer thread. Writes batches while there are logs, otherwise
+//			sleeps until a producer wakes it or it's been LOG_QUEUE_IDLE_MS,
+//			in case the wakeup raced with us going to sleep
+//
+////////////////////////////////////////////////////////////////////////////////
+static void *log_queue_writer(
+	void *arg)
+{
+	redisContext *ctx = NULL;
+	struct timespec deadline;
+	int n;
+
+	while (true) {
+
+		if (ctx == NULL) {
+			ctx = redis_context_init();
+			if ((ctx == NULL) || ctx->err) {
+				if (ctx != NULL) {
+					redis_context_cleanup(ctx);
+					ctx = NULL;
+				}
+				usleep(LOG_QUEUE_RECONNECT_MS * 1000);
+				continue;
+			}
+		}
+
+		n = log_queue_write_batch(ctx);
+		if (n < 0) {
+			redis_context_cleanup(ctx);
+			ctx = NULL;
+			continue;
+		}
+		if (n > 0) {
+			continue;
+		}
+
+		log_queue_deadline(&deadline, LOG_QUEUE_IDLE_MS);
+		pthread_mutex_lock(&log_queue.lock);
+		if (!log_queue_ready()) {
+			pthread_cond_timedwait(&log_queue.pushed, &log_queue.lock, &deadline);
+		}
+		pthread_mutex_unlock(&log_queue.lock);
+	}
+
+	return NULL;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Writes out what's left when the process exits
+//
+////////////////////////////////////////////////////////////////////////////////
+static void log_queue_atexit(void)
+{
+	log_queue_flush(LOG_QUEUE_FLUSH_TIMEOUT_MS);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Sets up the slots, gets the hostname and starts the writer. Only
+//			called once. If the writer can't be started then logs are
+//			written synchronously instead
+//
+////////////////////////////////////////////////////////////////////////////////
+static void log_queue_init(void)
+{
+	size_t i;
+	int err;
+
+	for (i = 0; i < LOG_QUEUE_LEN; ++i) {
+		atomic_init(&log_queue.slots[i].seq, i);
+	}
+	atomic_init(&log_queue.head, 0);
+	atomic_init(&log_queue.tail, 0);
+	atomic_init(&log_queue.dropped, 0);
+
+	if (gethostname(log_queue.hostname, sizeof(log_queue.hostname)) != 0) {
+		snprintf(log_queue.hostname, sizeof(log_queue.hostname), "unknown");
+	}
+	log_queue.hostname[HOST_NAME_MAX] = '\0';
+	log_queue.hostname_len = strnlen(log_queue.hostname, HOST_NAME_MAX);
+
+	err = pthread_create(&log_queue.thread, NULL, log_queue_writer, NULL);
+	if (err != 0) {
+		fprintf(stderr, "Failed to start log writer: %s. Logging "
+			"synchronously\n", strerror(err));
+		log_queue.sync = true;
+		return;
+	}
+	pthread_detach(log_queue.thread);
+	atexit(log_queue_atexit);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Writes a log straight to the log stream when there's no writer.
+//			The connection is made on the first log and remade if it
+//			breaks. Returns false if the log couldn't be written
+//
+////////////////////////////////////////////////////////////////////////////////
+static bool log_queue_write_sync(
+	int level,
+	const char *element,
+	size_t element_len,
+	const char *msg,
+	size_t msg_len)
+{
+	struct redis_xadd_info infos[LOG_N_KEYS];
+	char level_str[2];
+	bool ret_val = false;
+
+	// Truncated the same as the logs that go through the queue
+	if (element_len > ATOM_NAME_MAXLEN) {
+		element_len = ATOM_NAME_MAXLEN;
+	}
+	if (msg_len > ATOM_LOG_MAXLEN) {
+		msg_len = ATOM_LOG_MAXLEN;
+	}
+	log_queue_fill_infos(infos, level_str, level, element, element_len,
+		msg, msg_len);
+
+	pthread_mutex_lock(&log_queue.lock);
+
+	if (log_queue.sync_ctx == NULL) {
+		log_queue.sync_ctx = redis_context_init();
+		if ((log_queue.sync_ctx != NULL) && log_queue.sync_ctx->err) {
+			redis_context_cleanup(log_queue.sync_ctx);
+			log_queue.sync_ctx = NULL;
+		}
+	}
+	if (log_queue.sync_ctx == NULL) {
+		goto done;
+	}
+
+	ret_val = redis_xadd(log_queue.sync_ctx, ATOM_LOG_STREAM_NAME, infos,
+		LOG_N_KEYS, ATOM_DEFAULT_MAXLEN, true, NULL);
+	if (!ret_val && log_queue.sync_ctx->err) {
+		redis_context_cleanup(log_queue.sync_ctx);
+		log_queue.sync_ctx = NULL;
+	}
+
+done:
+	pthread_mutex_unlock(&log_queue.lock);
+	if (!ret_val) {
+		atomic_fetch_add_explicit(&log_queue.dropped, 1, memory_order_relaxed);
+	}
+	return ret_val;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Claims the slot at the head and fills it in
+//
+////////////////////////////////////////////////////////////////////////////////
+bool log_queue_push(
+	int level,
+	const char *element,
+	size_t element_len,
+	const char *msg,
+	size_t msg_len)
+{
+	struct log_queue_slot *slot;
+	size_t pos, seq;
+
+	pthread_once(&log_queue.once, log_queue_init);
+	if (log_queue.sync) {
+		return log_queue_write_sync(level, element, element_len, msg, msg_len);
+	}
+
+	pos = atomic_load_explicit(&log_queue.head, memory_order_relaxed);
+	while (true) {
+		slot = &log_queue.slots[pos & LOG_QUEUE_MASK];
+		seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+
+		// Free for this lap, try to claim it. On failure pos is reloaded
+		if (seq == pos) {
+			if (atomic_compare_exchange_weak_explicit(&log_queue.head, &pos,
+				pos + 1, memory_order_relaxed, memory_order_relaxed))
+			{
+				break;
+			}
+
+		// Still full from the last lap, so the queue is full
+		} else if ((intptr_t)(seq - pos) < 0) {
+			atomic_fetch_add_explicit(&log_queue.dropped, 1, memory_order_relaxed);
+			return false;
+
+		// Someone else claimed it
+		} else {
+			pos = atomic_load_explicit(&log_queue.head, memory_order_relaxed);
+		}
+	}
+
+	slot->level = level;
+	slot->element_len = (element_len < sizeof(slot->element)) ?
+		element_len : sizeof(slot->element);
+	memcpy(slot->element, element, slot->element_len);
+	slot->msg_len = (msg_len < sizeof(slot->msg)) ? msg_len : sizeof(slot->msg);
+	memcpy(slot->msg, msg, slot->msg_len);
+	atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+
+	pthread_cond_signal(&log_queue.pushed);
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Waits for the writer to get through everything that's been
+//			queued so far
+//
+////////////////////////////////////////////////////////////////////////////////
+bool log_queue_flush(
+	int timeout_ms)
+{
+	struct timespec deadline;
+	size_t target;
+	bool ret_val = true;
+
+	pthread_once(&log_queue.once, log_queue_init);
+
+	// Logs written synchronously are already out
+	if (log_queue.sync) {
+		return true;
+	}
+
+	target = atomic_load_explicit(&log_queue.head, memory_order_acquire);
+	log_queue_deadline(&deadline, timeout_ms);
+
+	pthread_mutex_lock(&log_queue.lock);
+	pthread_cond_signal(&log_queue.pushed);
+	while ((intptr_t)(atomic_load_explicit(&log_queue.tail,
+		memory_order_acquire) - target) < 0)
+	{
+		if (pthread_cond_timedwait(&log_queue.written, &log_queue.lock,
+			&deadline) == ETIMEDOUT)
+		{
+			ret_val = false;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&log_queue.lock);
+
+	return ret_val;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Number of logs we've dropped since we started
+//
+////////////////////////////////////////////////////////////////////////////////
+uint64_t log_queue_dropped(void)
+{
+	return atomic_load_explicit(&log_queue.dropped, memory_order_relaxed);
+}
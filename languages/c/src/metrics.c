@@ -0,0 +1,705 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @file metrics.c
+//
+//  @brief Implements the built-in metrics
+//
+//  @copy 2018 Elementary Robotics. All rights reserved.
+//
+////////////////////////////////////////////////////////////////////////////////
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <hiredis/hiredis.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "atom.h"
+#include "redis.h"
+#include "metrics.h"
+
+// Histograms are HDR-style: values below METRICS_LINEAR_MAX get their own
+//	bucket, above that each power of two is split into METRICS_SUB_BUCKETS
+//	buckets s.t. the error is at most 1/METRICS_SUB_BUCKETS of the value
+#define METRICS_SUB_BITS 3
+#define METRICS_SUB_BUCKETS (1 << METRICS_SUB_BITS)
+#define METRICS_LINEAR_MAX (2 * METRICS_SUB_BUCKETS)
+#define METRICS_LINEAR_BITS (METRICS_SUB_BITS + 1)
+#define METRICS_N_BUCKETS \
+	(METRICS_LINEAR_MAX + (64 - METRICS_LINEAR_BITS) * METRICS_SUB_BUCKETS)
+
+// Each timing is written as these aggregates
+enum metrics_agg_t {
+	METRICS_AGG_COUNT,
+	METRICS_AGG_AVG,
+	METRICS_AGG_P50,
+	METRICS_AGG_P99,
+	METRICS_AGG_MAX,
+	METRICS_N_AGGS,
+};
+
+#define METRICS_N_KEYS (METRICS_N_TIMINGS * METRICS_N_AGGS + METRICS_N_COUNTERS)
+#define METRICS_MADD_MAX_ARGS (1 + 3 * METRICS_N_KEYS)
+#define METRICS_VALUE_BUFFLEN 32
+
+#define METRICS_MADD_CMD_STR "TS.MADD"
+#define METRICS_MADD_TIMESTAMP_STR "*"
+#define METRICS_CREATE_N_ARGS 27
+#define METRICS_CREATE_CMD_STR "TS.CREATE"
+#define METRICS_TYPE_PREFIX "atom:"
+#define METRICS_LEVEL_STR "TIMING"
+#define METRICS_DEVICE_ENV "ATOM_DEVICE_ID"
+#define METRICS_DEFAULT_DEVICE "default"
+
+static const char *const metrics_timing_strs[METRICS_N_TIMINGS] = {
+	[METRICS_REDIS_XADD] = "redis_xadd",
+	[METRICS_REDIS_XREAD] = "redis_xread",
+	[METRICS_COMMAND_ACK] = "command_ack",
+	[METRICS_COMMAND_RESPONSE] = "command_response",
+	[METRICS_COMMAND_HANDLER] = "command_handler",
+	[METRICS_CONTEXT_WAIT] = "context_wait",
+};
+
+static const char *const metrics_agg_strs[METRICS_N_AGGS] = {
+	[METRICS_AGG_COUNT] = "count",
+	[METRICS_AGG_AVG] = "avg",
+	[METRICS_AGG_P50] = "p50",
+	[METRICS_AGG_P99] = "p99",
+	[METRICS_AGG_MAX] = "max",
+};
+
+static const char *const metrics_counter_strs[METRICS_N_COUNTERS] = {
+	[METRICS_BYTES_OUT] = "out",
+	[METRICS_BYTES_IN] = "in",
+};
+#define METRICS_COUNTER_TYPE "bytes"
+
+// Histogram written by a single thread
+struct metrics_histogram {
+	_Atomic uint64_t count;
+	_Atomic uint64_t sum;
+	_Atomic uint64_t buckets[METRICS_N_BUCKETS];
+};
+
+// Everything recorded by a thread. Only the owning thread writes to it
+//	so there's no need for atomic read-modify-writes, relaxed loads and
+//	stores are enough for the flusher to see consistent values. Once the
+//	thread exits the block is handed to the next new thread, the totals
+//	carry on since we only report the differences between flushes
+struct metrics_thread {
+	struct metrics_histogram timings[METRICS_N_TIMINGS];
+	_Atomic uint64_t counters[METRICS_N_COUNTERS];
+	atomic_bool in_use;
+	struct metrics_thread *next;
+};
+
+// Sum over all threads at a flush
+struct metrics_totals {
+	struct {
+		uint64_t count;
+		uint64_t sum;
+		uint64_t buckets[METRICS_N_BUCKETS];
+	} timings[METRICS_N_TIMINGS];
+	uint64_t counters[METRICS_N_COUNTERS];
+};
+
+// Whether we're recording. Set once by the first metrics_init
+static atomic_bool metrics_on = false;
+
+// Per-thread blocks. Only added to, under the lock, and never freed
+static struct metrics_thread *_Atomic metrics_threads = NULL;
+static pthread_mutex_t metrics_threads_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t metrics_thread_key;
+static pthread_once_t metrics_thread_key_once = PTHREAD_ONCE_INIT;
+static __thread struct metrics_thread *metrics_self = NULL;
+
+// Flusher state
+static struct {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	pthread_mutex_t flush_lock;
+	pthread_t thread;
+	bool running;
+	bool stop;
+	int refs;
+	redisContext *ctx;
+	char *element;
+	char *keys[METRICS_N_KEYS];
+	struct metrics_totals prev;
+	struct metrics_totals cur;
+} metrics_flusher = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER,
+	.flush_lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Bumps a value only written by this thread
+//
+////////////////////////////////////////////////////////////////////////////////
+static inline void metrics_bump(
+	_Atomic uint64_t *v,
+	uint64_t n)
+{
+	atomic_store_explicit(v,
+		atomic_load_explicit(v, memory_order_relaxed) + n,
+		memory_order_relaxed);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Gets the bucket for a value and the value a bucket stands for,
+//			which is the middle of the range of values in it
+//
+////////////////////////////////////////////////////////////////////////////////
+static inline size_t metrics_bucket(
+	uint64_t v)
+{
+	int exp;
+
+	if (v < METRICS_LINEAR_MAX) {
+		return v;
+	}
+
+	exp = 63 - __builtin_clzll(v);
+	return METRICS_LINEAR_MAX +
+		(exp - METRICS_LINEAR_BITS) * METRICS_SUB_BUCKETS +
+		((v >> (exp - METRICS_SUB_BITS)) & (METRICS_SUB_BUCKETS - 1));
+}
+
+static uint64_t metrics_bucket_value(
+	size_t idx)
+{
+	int exp;
+	uint64_t sub;
+
+	if (idx < METRICS_LINEAR_MAX) {
+		return idx;
+	}
+
+	exp = (idx - METRICS_LINEAR_MAX) / METRICS_SUB_BUCKETS + METRICS_LINEAR_BITS;
+	sub = (idx - METRICS_LINEAR_MAX) % METRICS_SUB_BUCKETS;
+	return ((METRICS_SUB_BUCKETS + sub) << (exp - METRICS_SUB_BITS)) +
+		((1ULL << (exp - METRICS_SUB_BITS)) >> 1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Gives up a thread's block when it exits
+//
+////////////////////////////////////////////////////////////////////////////////
+static void metrics_thread_exit(
+	void *ptr)
+{
+	struct metrics_thread *t = (struct metrics_thread *)ptr;
+	atomic_store_explicit(&t->in_use, false, memory_order_release);
+}
+
+static void metrics_thread_key_init(void)
+{
+	pthread_key_create(&metrics_thread_key, metrics_thread_exit);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Gets this thread's block, taking one the first time the thread
+//			records anything. This is the only time we lock
+//
+////////////////////////////////////////////////////////////////////////////////
+static struct metrics_thread *metrics_thread_get(void)
+{
+	struct metrics_thread *t;
+	bool expected;
+
+	if (metrics_self != NULL) {
+		return metrics_self;
+	}
+
+	pthread_once(&metrics_thread_key_once, metrics_thread_key_init);
+
+	pthread_mutex_lock(&metrics_threads_lock);
+	for (t = metrics_threads; t != NULL; t = t->next) {
+		expected = false;
+		if (atomic_compare_exchange_strong(&t->in_use, &expected, true)) {
+			break;
+		}
+	}
+	if (t == NULL) {
+		t = calloc(1, sizeof(struct metrics_thread));
+		assert(t != NULL);
+		atomic_store(&t->in_use, true);
+		t->next = metrics_threads;
+		atomic_store_explicit(&metrics_threads, t, memory_order_release);
+	}
+	pthread_mutex_unlock(&metrics_threads_lock);
+
+	pthread_setspecific(metrics_thread_key, t);
+	metrics_self = t;
+	return t;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Recording functions
+//
+////////////////////////////////////////////////////////////////////////////////
+bool metrics_enabled(void)
+{
+	return atomic_load_explicit(&metrics_on, memory_order_relaxed);
+}
+
+static uint64_t metrics_now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+uint64_t metrics_timing_start(void)
+{
+	return metrics_enabled() ? metrics_now_ns() : 0;
+}
+
+void metrics_timing_end(
+	enum metrics_timing_t timing,
+	uint64_t start)
+{
+	if (start != 0) {
+		metrics_timing_add(timing, metrics_now_ns() - start);
+	}
+}
+
+void metrics_timing_add(
+	enum metrics_timing_t timing,
+	uint64_t ns)
+{
+	struct metrics_histogram *h;
+
+	if (!metrics_enabled()) {
+		return;
+	}
+
+	h = &metrics_thread_get()->timings[timing];
+	metrics_bump(&h->buckets[metrics_bucket(ns)], 1);
+	metrics_bump(&h->sum, ns);
+	metrics_bump(&h->count, 1);
+}
+
+void metrics_count(
+	enum metrics_counter_t counter,
+	uint64_t n)
+{
+	if (!metrics_enabled()) {
+		return;
+	}
+
+	metrics_bump(&metrics_thread_get()->counters[counter], n);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Connects to the metrics redis and makes the keys. Keys that are
+//			already there, i.e. from a previous run, are left as they are
+//
+////////////////////////////////////////////////////////////////////////////////
+static bool metrics_connect(void)
+{
+	redisReply *reply;
+	const char *argv[METRICS_CREATE_N_ARGS];
+	size_t argvlen[METRICS_CREATE_N_ARGS];
+	char retention[METRICS_VALUE_BUFFLEN];
+	char hostname[256];
+	char type[ATOM_NAME_MAXLEN];
+	const char *host = getenv(METRICS_HOST_ENV);
+	const char *port = getenv(METRICS_PORT_ENV);
+	const char *socket = getenv(METRICS_SOCKET_ENV);
+	const char *device = getenv(METRICS_DEVICE_ENV);
+	int argc;
+	int i, j;
+
+	if ((host != NULL) && (host[0] != '\0')) {
+		metrics_flusher.ctx = redis_context_init_remote(host,
+			(port != NULL) ? atoi(port) : METRICS_DEFAULT_PORT);
+	} else {
+		metrics_flusher.ctx = redis_context_init_local(
+			(socket != NULL) ? socket : METRICS_DEFAULT_SOCKET);
+	}
+	if ((metrics_flusher.ctx == NULL) || metrics_flusher.ctx->err) {
+		if (metrics_flusher.ctx != NULL) {
+			redis_context_cleanup(metrics_flusher.ctx);
+			metrics_flusher.ctx = NULL;
+		}
+		return false;
+	}
+
+	if (gethostname(hostname, sizeof(hostname)) != 0) {
+		snprintf(hostname, sizeof(hostname), "unknown");
+	}
+	hostname[sizeof(hostname) - 1] = '\0';
+	snprintf(retention, sizeof(retention), "%d", METRICS_DEFAULT_RETENTION_MS);
+
+	// Same labels as the other languages s.t. the dashboards pick them up
+	argv[0] = METRICS_CREATE_CMD_STR;
+	argv[2] = "RETENTION";
+	argv[3] = retention;
+	argv[4] = "DUPLICATE_POLICY";
+	argv[5] = "LAST";
+	argv[6] = "LABELS";
+	argv[7] = "agg";
+	argv[8] = "none";
+	argv[9] = "agg_type";
+	argv[10] = "none";
+	argv[11] = "element";
+	argv[12] = metrics_flusher.element;
+	argv[13] = "type";
+	argv[14] = type;
+	argv[15] = "container";
+	argv[16] = hostname;
+	argv[17] = "device";
+	argv[18] = (device != NULL) ? device : METRICS_DEFAULT_DEVICE;
+	argv[19] = "language";
+	argv[20] = ATOM_LANGUAGE;
+	argv[21] = "version";
+	argv[22] = ATOM_VERSION;
+	argv[23] = "level";
+	argv[24] = METRICS_LEVEL_STR;
+	argv[25] = "subtype0";
+	argc = METRICS_CREATE_N_ARGS;
+
+	for (i = 0; i < METRICS_N_KEYS; ++i) {
+		argv[1] = metrics_flusher.keys[i];
+		if (i < METRICS_N_TIMINGS * METRICS_N_AGGS) {
+			snprintf(type, sizeof(type), METRICS_TYPE_PREFIX "%s",
+				metrics_timing_strs[i / METRICS_N_AGGS]);
+			argv[26] = metrics_agg_strs[i % METRICS_N_AGGS];
+		} else {
+			snprintf(type, sizeof(type),
+				METRICS_TYPE_PREFIX METRICS_COUNTER_TYPE);
+			argv[26] = metrics_counter_strs[i - METRICS_N_TIMINGS * METRICS_N_AGGS];
+		}
+
+		for (j = 0; j < argc; ++j) {
+			argvlen[j] = strlen(argv[j]);
+		}
+
+		reply = redisCommandArgv(metrics_flusher.ctx, argc, argv, argvlen);
+		if (reply == NULL) {
+			redis_context_cleanup(metrics_flusher.ctx);
+			metrics_flusher.ctx = NULL;
+			return false;
+		}
+		freeReplyObject(reply);
+	}
+
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Gets the value at a quantile of the histogram
+//
+////////////////////////////////////////////////////////////////////////////////
+static uint64_t metrics_quantile(
+	const uint64_t *buckets,
+	uint64_t count,
+	double q)
+{
+	uint64_t target = (uint64_t)(q * count);
+	uint64_t seen = 0;
+	size_t i;
+
+	if (target >= count) {
+		target = count - 1;
+	}
+
+	for (i = 0; i < METRICS_N_BUCKETS; ++i) {
+		seen += buckets[i];
+		if (seen > target) {
+			return metrics_bucket_value(i);
+		}
+	}
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Sums up all of the threads, works out the aggregates for what's
+//			been recorded since the last flush and writes them all in a
+//			single TS.MADD
+//
+////////////////////////////////////////////////////////////////////////////////
+static void metrics_flush_locked(void)
+{
+	struct metrics_totals *cur = &metrics_flusher.cur;
+	struct metrics_totals *prev = &metrics_flusher.prev;
+	struct metrics_thread *t;
+	const char *argv[METRICS_MADD_MAX_ARGS];
+	size_t argvlen[METRICS_MADD_MAX_ARGS];
+	char values[METRICS_N_KEYS][METRICS_VALUE_BUFFLEN];
+	uint64_t buckets[METRICS_N_BUCKETS];
+	uint64_t count, sum, n_buckets, max;
+	redisReply *reply;
+	int argc = 1;
+	int key;
+	size_t i, j;
+
+	memset(cur, 0, sizeof(*cur));
+	for (t = atomic_load_explicit(&metrics_threads, memory_order_acquire);
+		t != NULL; t = t->next)
+	{
+		for (i = 0; i < METRICS_N_TIMINGS; ++i) {
+			cur->timings[i].count += atomic_load_explicit(
+				&t->timings[i].count, memory_order_relaxed);
+			cur->timings[i].sum += atomic_load_explicit(
+				&t->timings[i].sum, memory_order_relaxed);
+			for (j = 0; j < METRICS_N_BUCKETS; ++j) {
+				cur->timings[i].buckets[j] += atomic_load_explicit(
+					&t->timings[i].buckets[j], memory_order_relaxed);
+			}
+		}
+		for (i = 0; i < METRICS_N_COUNTERS; ++i) {
+			cur->counters[i] += atomic_load_explicit(
+				&t->counters[i], memory_order_relaxed);
+		}
+	}
+
+	argv[0] = METRICS_MADD_CMD_STR;
+
+	for (i = 0; i < METRICS_N_TIMINGS; ++i) {
+		count = cur->timings[i].count - prev->timings[i].count;
+		sum = cur->timings[i].sum - prev->timings[i].sum;
+
+		// Only the count is written when nothing happened
+		key = i * METRICS_N_AGGS;
+		snprintf(values[key], METRICS_VALUE_BUFFLEN, "%" PRIu64, count);
+		argv[argc++] = metrics_flusher.keys[key];
+		argv[argc++] = METRICS_MADD_TIMESTAMP_STR;
+		argv[argc++] = values[key];
+		if (count == 0) {
+			continue;
+		}
+
+		// Threads keep recording while we read, so the buckets may not
+		//	quite add up to the count. Quantiles go by the buckets
+		n_buckets = 0;
+		max = 0;
+		for (j = 0; j < METRICS_N_BUCKETS; ++j) {
+			buckets[j] = cur->timings[i].buckets[j] -
+				prev->timings[i].buckets[j];
+			n_buckets += buckets[j];
+			if (buckets[j] != 0) {
+				max = metrics_bucket_value(j);
+			}
+		}
+		if (n_buckets == 0) {
+			continue;
+		}
+
+		snprintf(values[key + METRICS_AGG_AVG], METRICS_VALUE_BUFFLEN,
+			"%.9f", (double)sum / count / 1e9);
+		snprintf(values[key + METRICS_AGG_P50], METRICS_VALUE_BUFFLEN,
+			"%.9f", metrics_quantile(buckets, n_buckets, 0.5) / 1e9);
+		snprintf(values[key + METRICS_AGG_P99], METRICS_VALUE_BUFFLEN,
+			"%.9f", metrics_quantile(buckets, n_buckets, 0.99) / 1e9);
+		snprintf(values[key + METRICS_AGG_MAX], METRICS_VALUE_BUFFLEN,
+			"%.9f", max / 1e9);
+		for (j = METRICS_AGG_AVG; j < METRICS_N_AGGS; ++j) {
+			argv[argc++] = metrics_flusher.keys[key + j];
+			argv[argc++] = METRICS_MADD_TIMESTAMP_STR;
+			argv[argc++] = values[key + j];
+		}
+	}
+
+	for (i = 0; i < METRICS_N_COUNTERS; ++i) {
+		key = METRICS_N_TIMINGS * METRICS_N_AGGS + i;
+		snprintf(values[key], METRICS_VALUE_BUFFLEN, "%" PRIu64,
+			cur->counters[i] - prev->counters[i]);
+		argv[argc++] = metrics_flusher.keys[key];
+		argv[argc++] = METRICS_MADD_TIMESTAMP_STR;
+		argv[argc++] = values[key];
+	}
+
+	memcpy(prev, cur, sizeof(*cur));
+
+	for (i = 0; i < argc; ++i) {
+		argvlen[i] = strlen(argv[i]);
+	}
+
+	reply = redisCommandArgv(metrics_flusher.ctx, argc, argv, argvlen);
+	if (reply == NULL) {
+		fprintf(stderr, "Failed to write metrics\n");
+		return;
+	}
+	freeReplyObject(reply);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Flushes if we're started, (re)connecting to the metrics redis
+//			if we need to
+//
+////////////////////////////////////////////////////////////////////////////////
+void metrics_flush(void)
+{
+	pthread_mutex_lock(&metrics_flusher.flush_lock);
+
+	if (metrics_flusher.element == NULL) {
+		pthread_mutex_unlock(&metrics_flusher.flush_lock);
+		return;
+	}
+
+	if ((metrics_flusher.ctx != NULL) && metrics_flusher.ctx->err) {
+		redis_context_cleanup(metrics_flusher.ctx);
+		metrics_flusher.ctx = NULL;
+	}
+	if ((metrics_flusher.ctx != NULL) || metrics_connect()) {
+		metrics_flush_locked();
+	}
+
+	pthread_mutex_unlock(&metrics_flusher.flush_lock);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Flusher thread. Flushes every interval until we're stopped and
+//			one last time on the way out
+//
+////////////////////////////////////////////////////////////////////////////////
+static void *metrics_flusher_thread(
+	void *arg)
+{
+	struct timespec deadline;
+	bool stop = false;
+
+	while (!stop) {
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_nsec += (METRICS_FLUSH_INTERVAL_MS % 1000) * 1000000L;
+		deadline.tv_sec += METRICS_FLUSH_INTERVAL_MS / 1000 +
+			deadline.tv_nsec / 1000000000L;
+		deadline.tv_nsec %= 1000000000L;
+
+		pthread_mutex_lock(&metrics_flusher.lock);
+		while (!metrics_flusher.stop &&
+			(pthread_cond_timedwait(&metrics_flusher.cond,
+				&metrics_flusher.lock, &deadline) != ETIMEDOUT));
+		stop = metrics_flusher.stop;
+		pthread_mutex_unlock(&metrics_flusher.lock);
+
+		metrics_flush();
+	}
+
+	return NULL;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Starts the flusher the first time it's called
+//
+////////////////////////////////////////////////////////////////////////////////
+bool metrics_init(
+	const char *element)
+{
+	const char *env = getenv(METRICS_ENABLE_ENV);
+	int key = 0;
+	int i, j;
+
+	if ((env == NULL) || (strcmp(env, METRICS_ENABLE_VALUE) != 0)) {
+		return false;
+	}
+
+	pthread_mutex_lock(&metrics_flusher.lock);
+
+	if (metrics_flusher.refs++ > 0) {
+		pthread_mutex_unlock(&metrics_flusher.lock);
+		return true;
+	}
+
+	// Keys are <element>:atom:<type>:<subtype>, like the other languages
+	for (i = 0; i < METRICS_N_TIMINGS; ++i) {
+		for (j = 0; j < METRICS_N_AGGS; ++j) {
+			if (asprintf(&metrics_flusher.keys[key++], "%s:"
+				METRICS_TYPE_PREFIX "%s:%s", element,
+				metrics_timing_strs[i], metrics_agg_strs[j]) < 0)
+			{
+				assert(false);
+			}
+		}
+	}
+	for (i = 0; i < METRICS_N_COUNTERS; ++i) {
+		if (asprintf(&metrics_flusher.keys[key++], "%s:"
+			METRICS_TYPE_PREFIX METRICS_COUNTER_TYPE ":%s", element,
+			metrics_counter_strs[i]) < 0)
+		{
+			assert(false);
+		}
+	}
+
+	metrics_flusher.element = strdup(element);
+	assert(metrics_flusher.element != NULL);
+	metrics_flusher.stop = false;
+	metrics_flusher.running = (pthread_create(&metrics_flusher.thread, NULL,
+		metrics_flusher_thread, NULL) == 0);
+	if (!metrics_flusher.running) {
+		free(metrics_flusher.element);
+		metrics_flusher.element = NULL;
+		fprintf(stderr, "Failed to start metrics flusher\n");
+		for (i = 0; i < METRICS_N_KEYS; ++i) {
+			free(metrics_flusher.keys[i]);
+			metrics_flusher.keys[i] = NULL;
+		}
+		metrics_flusher.refs = 0;
+	} else {
+		atomic_store(&metrics_on, true);
+	}
+
+	pthread_mutex_unlock(&metrics_flusher.lock);
+	return metrics_flusher.running;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Stops the flusher once nobody needs it. Recording stays on s.t.
+//			threads that are still running don't have to check; whatever
+//			they record is picked up if metrics are started again
+//
+////////////////////////////////////////////////////////////////////////////////
+void metrics_cleanup(void)
+{
+	int i;
+
+	pthread_mutex_lock(&metrics_flusher.lock);
+	if ((metrics_flusher.refs == 0) || (--metrics_flusher.refs > 0)) {
+		pthread_mutex_unlock(&metrics_flusher.lock);
+		return;
+	}
+
+	metrics_flusher.stop = true;
+	pthread_cond_signal(&metrics_flusher.cond);
+	pthread_mutex_unlock(&metrics_flusher.lock);
+	pthread_join(metrics_flusher.thread, NULL);
+	pthread_mutex_lock(&metrics_flusher.lock);
+	pthread_mutex_lock(&metrics_flusher.flush_lock);
+	metrics_flusher.running = false;
+
+	if (metrics_flusher.ctx != NULL) {
+		redis_context_cleanup(metrics_flusher.ctx);
+		metrics_flusher.ctx = NULL;
+	}
+
+	for (i = 0; i < METRICS_N_KEYS; ++i) {
+		free(metrics_flusher.keys[i]);
+		metrics_flusher.keys[i] = NULL;
+	}
+	free(metrics_flusher.element);
+	metrics_flusher.element = NULL;
+	pthread_mutex_unlock(&metrics_flusher.flush_lock);
+	pthread_mutex_unlock(&metrics_flusher.lock);
+}
@@ -13,8 +13,13 @@
 #include <pthread.h>
 #include <stdbool.h>
 #include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <stdint.h>
+#include <time.h>
 
 #include "redis.h"
+#include "metrics.h"
 
 // If this is 1 then will print out each redis command before sending
 //	it s.t. we can see what's going on in the system
@@ -22,19 +27,50 @@
 
 #define REDIS_CMD_BUFFER_LEN 1024
 
-#define REDIS_XADD_MAX_ARGS 64
 #define REDIS_XADD_CMD_STR "XADD"
 #define REDIS_XADD_ID_STR "*"
 #define REDIS_XADD_MAXLEN_STR "MAXLEN"
+#define REDIS_XADD_MINID_STR "MINID"
 #define REDIS_XADD_MAXLEN_APPROX_STR "~"
-#define REDIS_XADD_MAXLEN_BUFFLEN 32
 
-#define REDIS_XREAD_MAX_ARGS 64
+#define REDIS_XTRIM_CMD_STR "XTRIM"
+#define REDIS_XTRIM_MAX_ARGS 5
+
+// Most args of an XREAD or XREADGROUP before the stream names and IDs,
+//	i.e. XREADGROUP GROUP group consumer BLOCK n COUNT n STREAMS
+#define REDIS_XREAD_MAX_HEADER_ARGS 9
 #define REDIS_XREAD_CMD_STR "XREAD"
 #define REDIS_XREAD_BLOCK_STR "BLOCK"
 #define REDIS_XREAD_COUNT_STR "COUNT"
 #define REDIS_XREAD_STREAMS_STR "STREAMS"
 
+#define REDIS_XREADGROUP_CMD_STR "XREADGROUP"
+#define REDIS_XREADGROUP_GROUP_STR "GROUP"
+#define REDIS_XREADGROUP_NEW_ID_STR ">"
+
+#define REDIS_XACK_N_ARGS 4
+#define REDIS_XACK_CMD_STR "XACK"
+
+#define REDIS_XGROUP_CMD_STR "XGROUP"
+#define REDIS_XGROUP_CREATE_N_ARGS 6
+#define REDIS_XGROUP_CREATE_STR "CREATE"
+#define REDIS_XGROUP_MKSTREAM_STR "MKSTREAM"
+#define REDIS_XGROUP_BUSYGROUP_STR "BUSYGROUP"
+#define REDIS_XGROUP_DELCONSUMER_N_ARGS 5
+#define REDIS_XGROUP_DELCONSUMER_STR "DELCONSUMER"
+
+#define REDIS_XPENDING_N_ARGS 7
+#define REDIS_XPENDING_CMD_STR "XPENDING"
+
+#define REDIS_XAUTOCLAIM_N_ARGS 8
+#define REDIS_XAUTOCLAIM_CMD_STR "XAUTOCLAIM"
+
+#define REDIS_RANGE_N_ARGS 6
+#define REDIS_XRANGE_CMD_STR "XRANGE"
+#define REDIS_XREVRANGE_CMD_STR "XREVRANGE"
+#define REDIS_RANGE_COUNT_STR "COUNT"
+#define REDIS_RANGE_COUNT_BUFFLEN 32
+
 #define REDIS_SCAN_BEGIN_ITERATOR "0"
 #define REDIS_SCAN_ITERATOR_BUFFLEN 32
 #define REDIS_SCAN_N_ARGS 4
@@ -45,6 +81,34 @@
 #define REDIS_REMOVE_KEY_DEL_STR "DEL"
 #define REDIS_REMOVE_KEY_UNLINK_STR "UNLINK"
 
+#define REDIS_REGISTRY_ADD_N_ARGS 4
+#define REDIS_REGISTRY_ADD_CMD_STR "ZADD"
+#define REDIS_REGISTRY_ADD_SCORE_STR "0"
+#define REDIS_REGISTRY_REMOVE_N_ARGS 3
+#define REDIS_REGISTRY_REMOVE_CMD_STR "ZREM"
+#define REDIS_REGISTRY_VERSION_N_ARGS 2
+#define REDIS_REGISTRY_VERSION_CMD_STR "INCR"
+#define REDIS_REGISTRY_GET_N_ARGS 4
+#define REDIS_REGISTRY_GET_CMD_STR "ZRANGEBYLEX"
+#define REDIS_GET_N_ARGS 2
+#define REDIS_GET_CMD_STR "GET"
+
+#define REDIS_FNV_OFFSET_BASIS 2166136261u
+#define REDIS_FNV_PRIME 16777619u
+
+// Replies to reads are built in a per-thread arena of blocks of this size
+//	rather than with a malloc for every object in them. Anything bigger
+//	than a quarter of a block gets one of its own, and only the first few
+//	blocks are kept once a reply is freed s.t. one huge read doesn't hold
+//	onto its memory
+#define REDIS_REPLY_ARENA_BLOCK_SIZE (64 * 1024)
+#define REDIS_REPLY_ARENA_KEEP_BLOCKS 16
+#define REDIS_REPLY_ARENA_ALIGN 8
+
+// Commands whose number of args depends on what's passed are built in a
+//	per-thread argv that's grown as needed, starting at this many args
+#define REDIS_ARGV_MIN_SIZE 64
+
 // LUT for redis type strings
 const char *const redis_reply_type_strs[] = {
 	[0] = "undefined",
@@ -56,6 +120,552 @@ const char *const redis_reply_type_strs[] = {
 	[REDIS_REPLY_ERROR] = "error",
 };
 
+// Block of memory in a reply arena
+struct redis_reply_arena_block {
+	struct redis_reply_arena_block *next;
+	size_t size;
+	size_t used;
+	char data[];
+};
+
+// String swapped into a reply in the arena with redis_reply_set_str. It
+//	was allocated with malloc and is freed along with the reply
+struct redis_reply_arena_str {
+	struct redis_reply_arena_str *next;
+	char *str;
+};
+
+// Arena that a thread builds its replies in. Only one reply is built in it
+//	at a time, root, and freeing that reply resets the arena
+struct redis_reply_arena {
+	struct redis_reply_arena_block *blocks;
+	struct redis_reply_arena_block *current;
+	struct redis_reply_arena_block *large;
+	struct redis_reply_arena_str *strs;
+	redisReply *root;
+	bool in_use;
+};
+
+static pthread_key_t redis_reply_arena_key;
+static pthread_once_t redis_reply_arena_once = PTHREAD_ONCE_INIT;
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// 	@brief	Frees a list of arena blocks
+//
+////////////////////////////////////////////////////////////////////////////////
+static void redis_reply_arena_free_blocks(
+	struct redis_reply_arena_block *block)
+{
+	struct redis_reply_arena_block *next;
+
+	while (block != NULL) {
+		next = block->next;
+		free(block);
+		block = next;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// 	@brief	Frees what was built in the arena since it was last reset s.t.
+//			the next reply can be built over it
+//
+////////////////////////////////////////////////////////////////////////////////
+static void redis_reply_arena_reset(
+	struct redis_reply_arena *arena)
+{
+	struct redis_reply_arena_block *block;
+	struct redis_reply_arena_str *str, *next;
+	size_t n_blocks = 0;
+
+	for (str = arena->strs; str != NULL; str = next) {
+		next = str->next;
+		free(str->str);
+		free(str);
+	}
+	arena->strs = NULL;
+
+	redis_reply_arena_free_blocks(arena->large);
+	arena->large = NULL;
+
+	for (block = arena->blocks; block != NULL; block = block->next) {
+		block->used = 0;
+		if (++n_blocks == REDIS_REPLY_ARENA_KEEP_BLOCKS) {
+			redis_reply_arena_free_blocks(block->next);
+			block->next = NULL;
+		}
+	}
+
+	arena->current = arena->blocks;
+	arena->root = NULL;
+	arena->in_use = false;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// 	@brief	Frees a thread's arena when the thread exits
+//
+////////////////////////////////////////////////////////////////////////////////
+static void redis_reply_arena_destroy(
+	void *data)
+{
+	struct redis_reply_arena *arena = (struct redis_reply_arena *)data;
+
+	redis_reply_arena_reset(arena);
+	redis_reply_arena_free_blocks(arena->blocks);
+	free(arena);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// 	@brief	Makes the key that each thread's arena is kept under
+//
+////////////////////////////////////////////////////////////////////////////////
+static void redis_reply_arena_make_key(void)
+{
+	int ret = pthread_key_create(&redis_reply_arena_key,
+		redis_reply_arena_destroy);
+	assert(ret == 0);
+	(void)ret;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// 	@brief	Gets the calling thread's arena, or NULL if it hasn't made one
+//
+////////////////////////////////////////////////////////////////////////////////
+static struct redis_reply_arena *redis_reply_arena_peek(void)
+{
+	pthread_once(&redis_reply_arena_once, redis_reply_arena_make_key);
+	return (struct redis_reply_arena *)pthread_getspecific(
+		redis_reply_arena_key);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// 	@brief	Gets the calling thread's arena, making it if need be
+//
+////////////////////////////////////////////////////////////////////////////////
+static struct redis_reply_arena *redis_reply_arena_get(void)
+{
+	struct redis_reply_arena *arena = redis_reply_arena_peek();
+
+	if (arena == NULL) {
+		arena = calloc(1, sizeof(struct redis_reply_arena));
+		assert(arena != NULL);
+		pthread_setspecific(redis_reply_arena_key, arena);
+	}
+	return arena;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// 	@brief	Allocates size bytes in the arena. Returns NULL if we're out of
+//			memory, which hiredis turns into an error on the context
+//
+////////////////////////////////////////////////////////////////////////////////
+static void *redis_reply_arena_alloc(
+	struct redis_reply_arena *arena,
+	size_t size)
+{
+	struct redis_reply_arena_block *block;
+	void *ptr;
+
+	size = (size + REDIS_REPLY_ARENA_ALIGN - 1) &
+		~((size_t)REDIS_REPLY_ARENA_ALIGN - 1);
+
+	// Big values get a block of their own that's freed with the reply
+	if (size > REDIS_REPLY_ARENA_BLOCK_SIZE / 4) {
+		block = malloc(sizeof(struct redis_reply_arena_block) + size);
+		if (block == NULL) {
+			return NULL;
+		}
+		block->size = size;
+		block->used = size;
+		block->next = arena->large;
+		arena->large = block;
+		return block->data;
+	}
+
+	// Move on to the next block once this one's full, reusing the ones
+	//	from earlier replies before making more
+	block = arena->current;
+	if ((block == NULL) || (block->used + size > block->size)) {
+		if ((block != NULL) && (block->next != NULL)) {
+			block = block->next;
+		} else {
+			block = malloc(sizeof(struct redis_reply_arena_block) +
+				REDIS_REPLY_ARENA_BLOCK_SIZE);
+			if (block == NULL) {
+				return NULL;
+			}
+			block->size = REDIS_REPLY_ARENA_BLOCK_SIZE;
+			block->used = 0;
+			block->next = NULL;
+			if (arena->current == NULL) {
+				arena->blocks = block;
+			} else {
+				arena->current->next = block;
+			}
+		}
+		arena->current = block;
+	}
+
+	ptr = block->data + block->used;
+	block->used += size;
+	return ptr;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// 	@brief	Checks whether a pointer is in the arena's memory
+//
+////////////////////////////////////////////////////////////////////////////////
+static bool redis_reply_arena_contains(
+	const struct redis_reply_arena *arena,
+	const char *ptr)
+{
+	const struct redis_reply_arena_block *lists[2] = {
+		arena->blocks, arena->large };
+	const struct redis_reply_arena_block *block;
+	size_t i;
+
+	for (i = 0; i < sizeof(lists) / sizeof(lists[0]); ++i) {
+		for (block = lists[i]; block != NULL; block = block->next) {
+			if ((ptr >= block->data) && (ptr < block->data + block->size)) {
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// 	@brief	Makes a reply object of the type in the arena and puts it in
+//			its parent array. Same as hiredis' own, less the mallocs
+//
+////////////////////////////////////////////////////////////////////////////////
+static redisReply *redis_reply_arena_create_object(
+	const redisReadTask *task,
+	int type)
+{
+	struct redis_reply_arena *arena = redis_reply_arena_peek();
+	redisReply *reply, *parent;
+
+	reply = redis_reply_arena_alloc(arena, sizeof(redisReply));
+	if (reply == NULL) {
+		return NULL;
+	}
+	memset(reply, 0, sizeof(redisReply));
+	reply->type = type;
+
+	if (task->parent != NULL) {
+		parent = (redisReply *)task->parent->obj;
+		parent->element[task->idx] = reply;
+	}
+	return reply;
+}
+
+static void *redis_reply_arena_create_string(
+	const redisReadTask *task,
+	char *str,
+	size_t len)
+{
+	struct redis_reply_arena *arena = redis_reply_arena_peek();
+	redisReply *reply;
+	char *copy;
+
+	copy = redis_reply_arena_alloc(arena, len + 1);
+	if (copy == NULL) {
+		return NULL;
+	}
+	memcpy(copy, str, len);
+	copy[len] = '\0';
+
+	reply = redis_reply_arena_create_object(task, task->type);
+	if (reply == NULL) {
+		return NULL;
+	}
+	reply->str = copy;
+	reply->len = len;
+	return reply;
+}
+
+static void *redis_reply_arena_create_array(
+	const redisReadTask *task,
+	int elements)
+{
+	struct redis_reply_arena *arena = redis_reply_arena_peek();
+	redisReply *reply;
+
+	reply = redis_reply_arena_create_object(task, REDIS_REPLY_ARRAY);
+	if (reply == NULL) {
+		return NULL;
+	}
+	if (elements > 0) {
+		reply->element = redis_reply_arena_alloc(arena,
+			elements * sizeof(redisReply *));
+		if (reply->element == NULL) {
+			return NULL;
+		}
+		memset(reply->element, 0, elements * sizeof(redisReply *));
+	}
+	reply->elements = elements;
+	return reply;
+}
+
+static void *redis_reply_arena_create_integer(
+	const redisReadTask *task,
+	long long value)
+{
+	redisReply *reply;
+
+	reply = redis_reply_arena_create_object(task, REDIS_REPLY_INTEGER);
+	if (reply == NULL) {
+		return NULL;
+	}
+	reply->integer = value;
+	return reply;
+}
+
+static void *redis_reply_arena_create_nil(
+	const redisReadTask *task)
+{
+	return redis_reply_arena_create_object(task, REDIS_REPLY_NIL);
+}
+
+// Objects in the arena are only ever freed by resetting it
+static void redis_reply_arena_free_object(
+	void *reply)
+{
+	(void)reply;
+}
+
+static redisReplyObjectFunctions redis_reply_arena_fns = {
+	.createString = redis_reply_arena_create_string,
+	.createArray = redis_reply_arena_create_array,
+	.createInteger = redis_reply_arena_create_integer,
+	.createNil = redis_reply_arena_create_nil,
+	.freeObject = redis_reply_arena_free_object,
+};
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// 	@brief	Gets the next reply on the context. If use_arena is set then
+//			the reply is built in the thread's arena, unless a reply is
+//			already in it, e.g. when a callback reads while handling a
+//			reply, in which case it's built as usual. Either way it must
+//			be freed with redis_reply_free on this thread
+//
+////////////////////////////////////////////////////////////////////////////////
+static int redis_reply_get(
+	redisContext *ctx,
+	redisReply **reply,
+	bool use_arena)
+{
+	struct redis_reply_arena *arena;
+	redisReplyObjectFunctions *fn;
+	int ret;
+
+	*reply = NULL;
+
+	// A reply that hiredis has started on was started with its own
+	//	functions and has to be finished with them
+	arena = use_arena ? redis_reply_arena_get() : NULL;
+	if ((arena == NULL) || arena->in_use || (ctx->reader->ridx != -1)) {
+		return redisGetReply(ctx, (void **)reply);
+	}
+
+	arena->in_use = true;
+	fn = ctx->reader->fn;
+	ctx->reader->fn = &redis_reply_arena_fns;
+	ret = redisGetReply(ctx, (void **)reply);
+
+	// If the read failed partway through a reply then the reader frees
+	//	what it has of it when the context's freed, so it keeps the arena's
+	//	functions, whose free does nothing
+	if ((ret == REDIS_OK) || (ctx->reader->ridx == -1)) {
+		ctx->reader->fn = fn;
+	}
+
+	if ((ret != REDIS_OK) || (*reply == NULL)) {
+		*reply = NULL;
+		redis_reply_arena_reset(arena);
+		return REDIS_ERR;
+	}
+
+	arena->root = *reply;
+	return REDIS_OK;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// 	@brief	Sends a command and gets its reply, in the arena if use_arena
+//			is set. Returns NULL on error
+//
+////////////////////////////////////////////////////////////////////////////////
+static redisReply *redis_command_argv_reply(
+	redisContext *ctx,
+	int argc,
+	const char **argv,
+	const size_t *argvlen,
+	bool use_arena)
+{
+	redisReply *reply;
+
+	if ((redisAppendCommandArgv(ctx, argc, argv, argvlen) != REDIS_OK) ||
+		(redis_reply_get(ctx, &reply, use_arena) != REDIS_OK))
+	{
+		return NULL;
+	}
+	return reply;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// 	@brief	Frees a reply, either by resetting the thread's arena if the
+//			reply was built in it or with freeReplyObject
+//
+////////////////////////////////////////////////////////////////////////////////
+void redis_reply_free(
+	redisReply *reply)
+{
+	struct redis_reply_arena *arena;
+
+	if (reply == NULL) {
+		return;
+	}
+
+	arena = redis_reply_arena_peek();
+	if ((arena != NULL) && arena->in_use && (arena->root == reply)) {
+		redis_reply_arena_reset(arena);
+	} else {
+		freeReplyObject(reply);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// 	@brief	Replaces a string reply's string with one allocated with malloc,
+//			which the reply takes over. The old string is freed, or left to
+//			the arena if it's in it
+//
+////////////////////////////////////////////////////////////////////////////////
+void redis_reply_set_str(
+	redisReply *reply,
+	char *str,
+	size_t len)
+{
+	struct redis_reply_arena *arena;
+	struct redis_reply_arena_str *node;
+	bool adopted = false;
+
+	arena = redis_reply_arena_peek();
+	if ((arena != NULL) && arena->in_use) {
+
+		// Strings that were already swapped in are tracked by the arena
+		for (node = arena->strs; node != NULL; node = node->next) {
+			if (node->str == reply->str) {
+				free(node->str);
+				node->str = str;
+				adopted = true;
+				break;
+			}
+		}
+
+		if (!adopted && redis_reply_arena_contains(arena, reply->str)) {
+			node = malloc(sizeof(struct redis_reply_arena_str));
+			assert(node != NULL);
+			node->str = str;
+			node->next = arena->strs;
+			arena->strs = node;
+			adopted = true;
+		}
+	}
+
+	if (!adopted) {
+		free(reply->str);
+	}
+	reply->str = str;
+	reply->len = len;
+}
+
+// The args of a command whose number of args isn't fixed, e.g. an XREAD
+//	of any number of streams. Each thread keeps its own s.t. building a
+//	command doesn't allocate once the argv is big enough. Only used while
+//	a command is being built and appended, so it's never in use twice
+struct redis_argv {
+	const char **argv;
+	size_t *argvlen;
+	size_t size;
+};
+
+static pthread_key_t redis_argv_key;
+static pthread_once_t redis_argv_once = PTHREAD_ONCE_INIT;
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// 	@brief	Frees a thread's argv when the thread exits
+//
+////////////////////////////////////////////////////////////////////////////////
+static void redis_argv_destroy(
+	void *data)
+{
+	struct redis_argv *args = (struct redis_argv *)data;
+
+	free(args->argv);
+	free(args->argvlen);
+	free(args);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// 	@brief	Makes the key that each thread's argv is kept under
+//
+////////////////////////////////////////////////////////////////////////////////
+static void redis_argv_make_key(void)
+{
+	int ret = pthread_key_create(&redis_argv_key, redis_argv_destroy);
+	assert(ret == 0);
+	(void)ret;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// 	@brief	Gets the calling thread's argv with room for at least n args
+//
+////////////////////////////////////////////////////////////////////////////////
+static struct redis_argv *redis_argv_get(
+	size_t n)
+{
+	struct redis_argv *args;
+	size_t size;
+
+	pthread_once(&redis_argv_once, redis_argv_make_key);
+	args = (struct redis_argv *)pthread_getspecific(redis_argv_key);
+	if (args == NULL) {
+		args = calloc(1, sizeof(struct redis_argv));
+		assert(args != NULL);
+		pthread_setspecific(redis_argv_key, args);
+	}
+
+	if (args->size < n) {
+		size = (args->size > 0) ? args->size : REDIS_ARGV_MIN_SIZE;
+		while (size < n) {
+			size *= 2;
+		}
+		args->argv = realloc(args->argv, size * sizeof(const char *));
+		assert(args->argv != NULL);
+		args->argvlen = realloc(args->argvlen, size * sizeof(size_t));
+		assert(args->argvlen != NULL);
+		args->size = size;
+	}
+
+	return args;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 //  @brief Prints out a redis reply recursively. When calling from the
@@ -130,41 +740,136 @@ void redis_print_xread_kv_items(
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-//  @brief Handles the response from an xread. Will loop over the streams
-//			and pass along the data from the response to each of the given
-//			callbacks. Will also update the last known ID in the stream infos
-//			s.t. on our next call we get the correct data
+//  @brief Hashes a string of the given length. FNV-1a, which is plenty
+//			good for the short keys and stream names we deal with and
+//			doesn't need the string to be NULL-terminated.
+//			See: http://www.isthe.com/chongo/tech/comp/fnv/
 //
 ////////////////////////////////////////////////////////////////////////////////
-static bool redis_xread_process_response(
-	struct redisReply *reply,
-	struct redis_stream_info *infos,
-	int n_infos)
+uint32_t redis_str_hash(
+	const char *str,
+	size_t len)
 {
-	bool ret_val = false;
-	redisReply *stream_array, *data_array, *data_point;
-	const char *name;
-	size_t stream, point;
-	int info;
-	struct redis_stream_info *found_info;
+	uint32_t hash = REDIS_FNV_OFFSET_BASIS;
+	size_t i;
 
-	// The first element of the reply should be an array
-	if (reply->type != REDIS_REPLY_ARRAY) {
-		fprintf(stderr, "Level 0 is not array!\n");
-		goto done;
+	for (i = 0; i < len; ++i) {
+		hash ^= (uint8_t)str[i];
+		hash *= REDIS_FNV_PRIME;
 	}
 
-	// Now, we want to loop over the elements of the array. Each element
-	//	should again be an array where the first item in the array is
-	//	a stream name
-	for (stream = 0; stream < reply->elements; stream++) {
+	return hash;
+}
 
-		// Get the stream array. It should be an array with 2 elements
-		stream_array = reply->element[stream];
-		if ((stream_array->type != REDIS_REPLY_ARRAY) ||
-			(stream_array->elements != 2))
-		{
-			fprintf(stderr, "Stream array incorrect!\n");
+////////////////////////////////////////////////////////////////////////////////
+//
+// 	@brief	Gets the current monotonic time in nanoseconds
+//
+////////////////////////////////////////////////////////////////////////////////
+static uint64_t redis_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// 	@brief	Applies the stream's read policy to the points read from it,
+//			returning the index of the first one to pass on. The points
+//			before it are counted as dropped and the last seen ID is moved
+//			past them. Returns SIZE_MAX if the points are malformed.
+//
+////////////////////////////////////////////////////////////////////////////////
+static size_t redis_read_policy_first(
+	struct redis_stream_info *info,
+	const redisReply *data_array)
+{
+	const redisReply *last;
+	size_t first;
+	uint64_t now;
+
+	if ((info->policy == REDIS_READ_ALL) || (data_array->elements == 0)) {
+		return 0;
+	}
+
+	// Only the newest point is passed on
+	first = data_array->elements - 1;
+
+	// And only if it's been long enough since the last one
+	if (info->policy == REDIS_READ_RATE) {
+		now = redis_now_ns();
+		if ((info->last_delivered_ns != 0) &&
+			((now - info->last_delivered_ns) < info->min_interval_ns))
+		{
+			first = data_array->elements;
+		} else {
+			info->last_delivered_ns = now;
+		}
+	}
+
+	// Skip past the dropped points s.t. we don't read them again
+	if (first > 0) {
+		last = data_array->element[first - 1];
+		if ((last->type != REDIS_REPLY_ARRAY) || (last->elements < 1) ||
+			(last->element[0]->type != REDIS_REPLY_STRING))
+		{
+			fprintf(stderr, "Data point is not an array!\n");
+			return SIZE_MAX;
+		}
+		strncpy(info->last_id, last->element[0]->str, sizeof(info->last_id));
+
+		if (info->items_dropped != NULL) {
+			*info->items_dropped += first;
+		}
+	}
+
+	return first;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Handles the response from an xread. Will loop over the streams
+//			and pass along the data from the response to each of the given
+//			callbacks. Will also update the last known ID in the stream infos
+//			s.t. on our next call we get the correct data
+//
+////////////////////////////////////////////////////////////////////////////////
+static bool redis_xread_process_response(
+	struct redisReply *reply,
+	struct redis_stream_info *infos,
+	int n_infos)
+{
+	bool ret_val = false;
+	redisReply *stream_array, *data_array, *data_point;
+	const char *name;
+	size_t name_len;
+	uint32_t name_hash;
+	size_t stream, point, first;
+	int info, n, search_start;
+	struct redis_stream_info *found_info;
+
+	// The first element of the reply should be an array
+	if (reply->type != REDIS_REPLY_ARRAY) {
+		fprintf(stderr, "Level 0 is not array!\n");
+		goto done;
+	}
+
+	// Now, we want to loop over the elements of the array. Each element
+	//	should again be an array where the first item in the array is
+	//	a stream name. Redis gives us the streams in the order that we
+	//	asked for them, so we start looking for each stream's info
+	//	right after the last one we found.
+	search_start = 0;
+	for (stream = 0; stream < reply->elements; stream++) {
+
+		// Get the stream array. It should be an array with 2 elements
+		stream_array = reply->element[stream];
+		if ((stream_array->type != REDIS_REPLY_ARRAY) ||
+			(stream_array->elements != 2))
+		{
+			fprintf(stderr, "Stream array incorrect!\n");
 			goto done;
 		}
 
@@ -176,12 +881,17 @@ static bool redis_xread_process_response(
 			goto done;
 		}
 		name = stream_array->element[0]->str;
+		name_len = stream_array->element[0]->len;
+		name_hash = redis_str_hash(name, name_len);
 		found_info = NULL;
-		for (info = 0; info < n_infos; ++info) {
-			// TODO: something safer/better than strcmp() and strlen()
-			if ((strlen(infos[info].name) == strlen(name)) &&
-				strcmp(infos[info].name, name) == 0) {
+		for (n = 0; n < n_infos; ++n) {
+			info = (search_start + n) % n_infos;
+			if ((infos[info].name_hash == name_hash) &&
+				(infos[info].name_len == name_len) &&
+				(memcmp(infos[info].name, name, name_len) == 0))
+			{
 				found_info = &infos[info];
+				search_start = info + 1;
 				break;
 			}
 		}
@@ -199,11 +909,18 @@ static bool redis_xread_process_response(
 			goto done;
 		}
 
+		// Figure out which of the points are passed on. The ones before
+		//	first are dropped, but we still need to move past them
+		first = redis_read_policy_first(found_info, data_array);
+		if (first == SIZE_MAX) {
+			goto done;
+		}
+
 		// Note how many elements we read
-		found_info->items_read = data_array->elements;
+		found_info->items_read = data_array->elements - first;
 
 		// Now, we want to loop over the datapoints in the data array
-		for (point = 0; point < data_array->elements; ++point) {
+		for (point = first; point < data_array->elements; ++point) {
 
 			// Note the data point
 			data_point = data_array->element[point];
@@ -238,6 +955,11 @@ static bool redis_xread_process_response(
 			{
 				fprintf(stderr, "Failed data callback\n");
 			}
+
+			// If the callback took the data then it's no longer ours to free
+			if (found_info->take_reply) {
+				data_point->element[1] = NULL;
+			}
 		}
 	}
 
@@ -251,47 +973,56 @@ done:
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// 	@brief	Performs an XREAD of the passed infos and calls the callback
-//			associated with the info for any data that comes through. In
-//			this manner we get a clean, zero-copy implementation of
-//			XREAD data passing as we'll call the callbacks while we're
-//			running through the response. This function will also
-//			set up the XREAD call.
+// 	@brief	Builds the argv for either an XREAD or, if group is non-NULL, an
+//			XREADGROUP of the passed infos. For XREADGROUP we always ask for
+//			entries that haven't been delivered to the group yet. The
+//			block and count numbers are printed into the buffers passed.
+//			Returns the number of args or -1 on error.
 //
 ////////////////////////////////////////////////////////////////////////////////
-bool redis_xread(
-	redisContext *ctx,
+static int redis_xread_build_argv(
+	const char *group,
+	const char *consumer,
 	struct redis_stream_info *infos,
 	int n_infos,
 	int block,
-	size_t maxcount)
+	size_t maxcount,
+	const char **argv,
+	size_t *argvlen,
+	char block_buffer[32],
+	char count_buffer[32])
 {
-	const char *argv[REDIS_XREAD_MAX_ARGS];
-	size_t argvlen[REDIS_XREAD_MAX_ARGS];
-	char block_buffer[32];
-	char count_buffer[32];
 	size_t len;
 	int argc = 0;
-	bool ret_val = false;
 	int i;
-	struct redisReply *reply;
 
-	// Put in the XREAD command
-	argv[argc] = REDIS_XREAD_CMD_STR;
-	argvlen[argc++] = CONST_STRLEN(REDIS_XREAD_CMD_STR);
+	// Put in the XREAD or XREADGROUP command
+	if (group != NULL) {
+		argv[argc] = REDIS_XREADGROUP_CMD_STR;
+		argvlen[argc++] = CONST_STRLEN(REDIS_XREADGROUP_CMD_STR);
+		argv[argc] = REDIS_XREADGROUP_GROUP_STR;
+		argvlen[argc++] = CONST_STRLEN(REDIS_XREADGROUP_GROUP_STR);
+		argv[argc] = group;
+		argvlen[argc++] = strlen(group);
+		argv[argc] = consumer;
+		argvlen[argc++] = strlen(consumer);
+	} else {
+		argv[argc] = REDIS_XREAD_CMD_STR;
+		argvlen[argc++] = CONST_STRLEN(REDIS_XREAD_CMD_STR);
+	}
 
 	// If we're blocking, add in the BLOCK command
 	if (block != REDIS_XREAD_DONTBLOCK) {
 		if (block < 0) {
 			fprintf(stderr, "Invalid block!\n");
-			goto done;
+			return -1;
 		}
 
 		argv[argc] = REDIS_XREAD_BLOCK_STR;
 		argvlen[argc++] = CONST_STRLEN(REDIS_XREAD_BLOCK_STR);
 
 		// Need to add in the block number
-		len = snprintf(block_buffer, sizeof(block_buffer), "%d", block);
+		len = snprintf(block_buffer, 32, "%d", block);
 		argv[argc] = block_buffer;
 		argvlen[argc++] = len;
 	}
@@ -302,7 +1033,7 @@ bool redis_xread(
 		argvlen[argc++] = CONST_STRLEN(REDIS_XREAD_COUNT_STR);
 
 		// Need to add in the count number
-		len = snprintf(count_buffer, sizeof(count_buffer), "%lu", maxcount);
+		len = snprintf(count_buffer, 32, "%lu", maxcount);
 		argv[argc] = count_buffer;
 		argvlen[argc++] = len;
 	}
@@ -315,175 +1046,953 @@ bool redis_xread(
 	//	The good news is that we can just reuse their buffers
 	for (i = 0; i < n_infos; ++i) {
 		argv[argc] = infos[i].name;
-		argvlen[argc++] = strlen(infos[i].name);
+		argvlen[argc++] = infos[i].name_len;
 	}
 
-	// And we need to add in the last seen ID for each stream
+	// And we need to add in the last seen ID for each stream, or that
+	//	we want new entries for the group
 	for (i = 0; i < n_infos; ++i) {
-		argv[argc] = infos[i].last_id;
-		argvlen[argc++] = strlen(infos[i].last_id);
+		if (group != NULL) {
+			argv[argc] = REDIS_XREADGROUP_NEW_ID_STR;
+			argvlen[argc++] = CONST_STRLEN(REDIS_XREADGROUP_NEW_ID_STR);
+		} else {
+			argv[argc] = infos[i].last_id;
+			argvlen[argc++] = strlen(infos[i].last_id);
+		}
 	}
 
-	// Now we should have a constructed XREAD command which we
-	//	can send to redis and then attempt to get the reply
-	reply = redisCommandArgv(ctx, argc, argv, argvlen);
-	if (reply == NULL) {
-		fprintf(stderr, "NULL from redisCommand\n");
+	return argc;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// 	@brief	Builds and sends either an XREAD or, if group is non-NULL, an
+//			XREADGROUP of the passed infos and calls the callback
+//			associated with the info for any data that comes through. For
+//			XREADGROUP we always ask for entries that haven't been delivered
+//			to the group yet and the last_id of each info is only used to
+//			note what we've seen.
+//
+////////////////////////////////////////////////////////////////////////////////
+static bool redis_xread_common(
+	redisContext *ctx,
+	const char *group,
+	const char *consumer,
+	struct redis_stream_info *infos,
+	int n_infos,
+	int block,
+	size_t maxcount)
+{
+	struct redis_argv *args;
+	char block_buffer[32];
+	char count_buffer[32];
+	int argc;
+	bool ret_val = false;
+	struct redisReply *reply;
+	uint64_t start;
+	bool use_arena = true;
+	int i;
+
+	if (n_infos < 0) {
+		fprintf(stderr, "Invalid number of streams!\n");
 		goto done;
 	}
 
-	// Otherwise we have a reply. If we timed out then there are no
-	//	callbacks to call so we can just note that. This is an acceptable
-	//	outcome.
-	if (reply->type == REDIS_REPLY_NIL) {
-		ret_val = true;
-		goto free_reply;
+	// Build the command
+	args = redis_argv_get(REDIS_XREAD_MAX_HEADER_ARGS + 2 * n_infos);
+	argc = redis_xread_build_argv(group, consumer, infos, n_infos, block,
+		maxcount, args->argv, args->argvlen, block_buffer, count_buffer);
+	if (argc < 0) {
+		goto done;
 	}
 
-	// Now, if we got here, we got data on at least 1 stream. We'll want to
-	//	process the response
-	if (!redis_xread_process_response(reply, infos, n_infos)) {
-		fprintf(stderr, "Failed to process response\n");
-		goto free_reply;
+	// Callbacks that take their replies need them to outlive the read,
+	//	so they can't be built in the arena
+	for (i = 0; i < n_infos; ++i) {
+		if (infos[i].take_reply) {
+			use_arena = false;
+			break;
+		}
 	}
 
-	// Note the success
-	ret_val = true;
+	// Now we should have a constructed XREAD command which we
+	//	can send to redis and then attempt to get the reply. Reads that
+	//	block mostly measure how long we waited for data, so only time
+	//	the ones that don't
+	start = (block == REDIS_XREAD_DONTBLOCK) ? metrics_timing_start() : 0;
+	reply = redis_command_argv_reply(ctx, argc, args->argv, args->argvlen,
+		use_arena);
+	if (reply == NULL) {
+		fprintf(stderr, "NULL from redisCommand\n");
+		goto done;
+	}
+	metrics_timing_end(METRICS_REDIS_XREAD, start);
 
-free_reply:
-	freeReplyObject(reply);
+	// Handle the reply, calling the callbacks for any data
+	ret_val = redis_xread_handle_reply(reply, infos, n_infos);
+
+	redis_reply_free(reply);
 done:
 	return ret_val;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// 	@brief	Parses the (key, value) array that we get back from an XREAD
-//			in an efficient manner. Fills in the infos passed to see if
-//			(1) they were all found and (2) if found their redisReply item
+// 	@brief	Formats an XREAD of the passed infos into a redis protocol
+//			command s.t. it can be sent on any kind of context, e.g. an
+//			async one. Returns the length of the command, or -1 on error.
+//			The command must be freed with redisFreeCommand.
 //
 ////////////////////////////////////////////////////////////////////////////////
-bool redis_xread_parse_kv(
-	const redisReply *reply,
-	struct redis_xread_kv_item *items,
-	size_t n_items)
+int redis_xread_format(
+	char **cmd,
+	struct redis_stream_info *infos,
+	int n_infos,
+	int block,
+	size_t maxcount)
 {
-	int idx, item;
-	bool ret_val = false;
+	struct redis_argv *args;
+	char block_buffer[32];
+	char count_buffer[32];
+	int argc;
 
-	// Initialize all of the found fields to false
-	for (item = 0; item < n_items; ++item) {
-		items[item].found = false;
+	if (n_infos < 0) {
+		return -1;
 	}
 
-	// Make sure there's an even number of elements in the array. It should
-	//	be a list of key1, value1, key2, value2, etc.
-	if (reply->elements & 0x1) {
-		fprintf(stderr, "Odd number of elements!\n");
-		goto done;
+	args = redis_argv_get(REDIS_XREAD_MAX_HEADER_ARGS + 2 * n_infos);
+	argc = redis_xread_build_argv(NULL, NULL, infos, n_infos, block,
+		maxcount, args->argv, args->argvlen, block_buffer, count_buffer);
+	if (argc < 0) {
+		return -1;
 	}
 
-	// Now, we want to loop over the reply looking for keys
-	for (idx = 0; idx < reply->elements; idx += 2) {
-
-		// For the key, we want to see if it's in the list of items that
-		//	we care about
-		for (item = 0; item < n_items; ++item) {
+	return redisFormatCommandArgv(cmd, argc, args->argv, args->argvlen);
+}
 
-			// If we've already found the item, just move on
-			if (items[item].found) {
-				continue;
-			}
+////////////////////////////////////////////////////////////////////////////////
+//
+// 	@brief	Gets the number of bytes of strings in a reply
+//
+////////////////////////////////////////////////////////////////////////////////
+static uint64_t redis_reply_size(
+	const struct redisReply *reply)
+{
+	uint64_t size = 0;
+	size_t i;
 
-			// Otherwise, check to see if the key is a match to the item
-			if ((reply->element[idx]->len == items[item].key_len) &&
-				(!strncmp(reply->element[idx]->str, items[item].key, items[item].key_len)))
-			{
-				items[item].found = true;
-				items[item].reply = reply->element[idx + 1];
-				break;
-			}
+	if (reply->type == REDIS_REPLY_ARRAY) {
+		for (i = 0; i < reply->elements; ++i) {
+			size += redis_reply_size(reply->element[i]);
 		}
+	} else if (reply->type == REDIS_REPLY_STRING) {
+		size = reply->len;
 	}
+	return size;
+}
 
-	// Note the success
-	ret_val = true;
+////////////////////////////////////////////////////////////////////////////////
+//
+// 	@brief	Handles the reply to an XREAD or XREADGROUP of the passed
+//			infos, calling the callbacks for any data in it. A NIL reply
+//			means the read timed out, which is fine. Does not free the
+//			reply.
+//
+////////////////////////////////////////////////////////////////////////////////
+bool redis_xread_handle_reply(
+	struct redisReply *reply,
+	struct redis_stream_info *infos,
+	int n_infos)
+{
+	// If we timed out then there are no callbacks to call
+	if (reply->type == REDIS_REPLY_NIL) {
+		return true;
+	}
 
-done:
-	return ret_val;
+	if (metrics_enabled()) {
+		metrics_count(METRICS_BYTES_IN, redis_reply_size(reply));
+	}
+
+	// Now, if we got here, we got data on at least 1 stream. We'll want to
+	//	process the response
+	if (!redis_xread_process_response(reply, infos, n_infos)) {
+		fprintf(stderr, "Failed to process response\n");
+		return false;
+	}
+
+	return true;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// 	@brief	Performs an XREVRANGE of the passed infos and calls the callback
+// 	@brief	Performs an XREAD of the passed infos and calls the callback
 //			associated with the info for any data that comes through. In
 //			this manner we get a clean, zero-copy implementation of
-//			data passing as we'll call the callbacks while we're
+//			XREAD data passing as we'll call the callbacks while we're
 //			running through the response. This function will also
-//			set up the XREVRANGE call.
+//			set up the XREAD call.
 //
 ////////////////////////////////////////////////////////////////////////////////
-bool redis_xrevrange(
+bool redis_xread(
 	redisContext *ctx,
-	const char *name,
-	bool (*data_cb)(
-		const char *id,
-		const struct redisReply *reply,
-		void *user_data),
-	size_t n,
-	void *user_data)
+	struct redis_stream_info *infos,
+	int n_infos,
+	int block,
+	size_t maxcount)
 {
-	char xrevrange_cmd_buffer[REDIS_CMD_BUFFER_LEN];
-	int ret;
-	bool ret_val = false;
-	struct redisReply *reply, *reply_item;
-	int item;
-
-	// Print the beginning of the command into the
-	//	command buffer
-	ret = snprintf(xrevrange_cmd_buffer, REDIS_CMD_BUFFER_LEN,
-		"XREVRANGE %s + - COUNT %lu", name, n);
-	if ((ret < 0) || (ret >= REDIS_CMD_BUFFER_LEN)) {
-		fprintf(stderr, "snprintf!\n");
-		goto done;
+	return redis_xread_common(
+		ctx, NULL, NULL, infos, n_infos, block, maxcount);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// 	@brief	Performs an XREADGROUP of the passed infos as the given consumer
+//			in the given group. Each entry is delivered to only one consumer
+//			in the group and stays pending for that consumer until it's
+//			acknowledged with redis_xack.
+//
+////////////////////////////////////////////////////////////////////////////////
+bool redis_xreadgroup(
+	redisContext *ctx,
+	const char *group,
+	const char *consumer,
+	struct redis_stream_info *infos,
+	int n_infos,
+	int block,
+	size_t maxcount)
+{
+	if ((group == NULL) || (consumer == NULL)) {
+		fprintf(stderr, "XREADGROUP needs a group and consumer!\n");
+		return false;
 	}
 
-	#if DEBUG_COMMANDS
-		fprintf(stderr, "Command: %s\n", xrevrange_cmd_buffer);
-	#endif
+	return redis_xread_common(
+		ctx, group, consumer, infos, n_infos, block, maxcount);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// 	@brief	Acknowledges an entry that was read by a consumer in the group,
+//			removing it from the group's pending entries list
+//
+////////////////////////////////////////////////////////////////////////////////
+bool redis_xack(
+	redisContext *ctx,
+	const char *stream_name,
+	const char *group,
+	const char *id)
+{
+	redisReply *reply;
+	const char *argv[REDIS_XACK_N_ARGS];
+	size_t argvlen[REDIS_XACK_N_ARGS];
+	bool ret_val = false;
 
-	// Now we should have a properly written XREAD buffer which we
-	//	can send to redis and then attemp,t to get the reply
-	reply = redisCommand(ctx, xrevrange_cmd_buffer);
+	argv[0] = REDIS_XACK_CMD_STR;
+	argvlen[0] = CONST_STRLEN(REDIS_XACK_CMD_STR);
+	argv[1] = stream_name;
+	argvlen[1] = strlen(stream_name);
+	argv[2] = group;
+	argvlen[2] = strlen(group);
+	argv[3] = id;
+	argvlen[3] = strlen(id);
+
+	reply = redisCommandArgv(ctx, REDIS_XACK_N_ARGS, argv, argvlen);
 	if (reply == NULL) {
-		fprintf(stderr, "NULL from redisCommand\n");
+		fprintf(stderr, "Failed to get reply!\n");
 		goto done;
 	}
 
-	// Otherwise we have a reply. If we timed out then there are no
-	//	callbacks to call so we can just note that
-	if (reply->type == REDIS_REPLY_NIL) {
-		fprintf(stderr, "timed out!\n");
+	// Reply is the number of entries acknowledged. 0 is fine, it just
+	//	means someone else already handled the entry
+	if (reply->type != REDIS_REPLY_INTEGER) {
+		fprintf(stderr, "Reply invalid!\n");
 		goto free_reply;
 	}
 
-	// Want to make sure the reply is an array
-	if (reply->type != REDIS_REPLY_ARRAY) {
-		fprintf(stderr, "Reply level 0 not array!\n");
-		goto free_reply;
-	}
-	if (reply->elements != n) {
-		fprintf(stderr, "Failed to read %lu elements\n", n);
+	// Note the success
+	ret_val = true;
+
+free_reply:
+	freeReplyObject(reply);
+done:
+	return ret_val;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// 	@brief	Creates a consumer group on the stream, creating the stream
+//			as well if it doesn't exist. The group starts reading after
+//			start_id. If the group already exists this succeeds and leaves
+//			the group where it is.
+//
+////////////////////////////////////////////////////////////////////////////////
+bool redis_xgroup_create(
+	redisContext *ctx,
+	const char *stream_name,
+	const char *group,
+	const char *start_id)
+{
+	redisReply *reply;
+	const char *argv[REDIS_XGROUP_CREATE_N_ARGS];
+	size_t argvlen[REDIS_XGROUP_CREATE_N_ARGS];
+	bool ret_val = false;
+
+	argv[0] = REDIS_XGROUP_CMD_STR;
+	argvlen[0] = CONST_STRLEN(REDIS_XGROUP_CMD_STR);
+	argv[1] = REDIS_XGROUP_CREATE_STR;
+	argvlen[1] = CONST_STRLEN(REDIS_XGROUP_CREATE_STR);
+	argv[2] = stream_name;
+	argvlen[2] = strlen(stream_name);
+	argv[3] = group;
+	argvlen[3] = strlen(group);
+	argv[4] = start_id;
+	argvlen[4] = strlen(start_id);
+	argv[5] = REDIS_XGROUP_MKSTREAM_STR;
+	argvlen[5] = CONST_STRLEN(REDIS_XGROUP_MKSTREAM_STR);
+
+	reply = redisCommandArgv(ctx, REDIS_XGROUP_CREATE_N_ARGS, argv, argvlen);
+	if (reply == NULL) {
+		fprintf(stderr, "Failed to get reply!\n");
+		goto done;
+	}
+
+	// Another consumer may well have created the group already
+	if ((reply->type == REDIS_REPLY_ERROR) &&
+		(strncmp(reply->str, REDIS_XGROUP_BUSYGROUP_STR,
+			CONST_STRLEN(REDIS_XGROUP_BUSYGROUP_STR)) == 0))
+	{
+		ret_val = true;
+		goto free_reply;
+	}
+
+	if (reply->type != REDIS_REPLY_STATUS) {
+		fprintf(stderr, "Reply invalid!\n");
+		goto free_reply;
+	}
+
+	// Note the success
+	ret_val = true;
+
+free_reply:
+	freeReplyObject(reply);
+done:
+	return ret_val;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// 	@brief	Removes a consumer from a group. Any entries still pending for
+//			the consumer are dropped from the group's pending entries list,
+//			so callers should check redis_xpending first.
+//
+////////////////////////////////////////////////////////////////////////////////
+bool redis_xgroup_delconsumer(
+	redisContext *ctx,
+	const char *stream_name,
+	const char *group,
+	const char *consumer)
+{
+	redisReply *reply;
+	const char *argv[REDIS_XGROUP_DELCONSUMER_N_ARGS];
+	size_t argvlen[REDIS_XGROUP_DELCONSUMER_N_ARGS];
+	bool ret_val = false;
+
+	argv[0] = REDIS_XGROUP_CMD_STR;
+	argvlen[0] = CONST_STRLEN(REDIS_XGROUP_CMD_STR);
+	argv[1] = REDIS_XGROUP_DELCONSUMER_STR;
+	argvlen[1] = CONST_STRLEN(REDIS_XGROUP_DELCONSUMER_STR);
+	argv[2] = stream_name;
+	argvlen[2] = strlen(stream_name);
+	argv[3] = group;
+	argvlen[3] = strlen(group);
+	argv[4] = consumer;
+	argvlen[4] = strlen(consumer);
+
+	reply = redisCommandArgv(
+		ctx, REDIS_XGROUP_DELCONSUMER_N_ARGS, argv, argvlen);
+	if (reply == NULL) {
+		fprintf(stderr, "Failed to get reply!\n");
+		goto done;
+	}
+
+	if (reply->type != REDIS_REPLY_INTEGER) {
+		fprintf(stderr, "Reply invalid!\n");
+		goto free_reply;
+	}
+
+	// Note the success
+	ret_val = true;
+
+free_reply:
+	freeReplyObject(reply);
+done:
+	return ret_val;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// 	@brief	Returns the number of entries pending for the consumer in the
+//			group, looking at no more than max_count of them. Returns -1
+//			on error.
+//
+////////////////////////////////////////////////////////////////////////////////
+int redis_xpending(
+	redisContext *ctx,
+	const char *stream_name,
+	const char *group,
+	const char *consumer,
+	size_t max_count)
+{
+	redisReply *reply;
+	const char *argv[REDIS_XPENDING_N_ARGS];
+	size_t argvlen[REDIS_XPENDING_N_ARGS];
+	char count_buffer[32];
+	int ret_val = -1;
+
+	argv[0] = REDIS_XPENDING_CMD_STR;
+	argvlen[0] = CONST_STRLEN(REDIS_XPENDING_CMD_STR);
+	argv[1] = stream_name;
+	argvlen[1] = strlen(stream_name);
+	argv[2] = group;
+	argvlen[2] = strlen(group);
+	argv[3] = "-";
+	argvlen[3] = 1;
+	argv[4] = "+";
+	argvlen[4] = 1;
+	argvlen[5] = snprintf(count_buffer, sizeof(count_buffer), "%lu", max_count);
+	argv[5] = count_buffer;
+	argv[6] = consumer;
+	argvlen[6] = strlen(consumer);
+
+	reply = redisCommandArgv(ctx, REDIS_XPENDING_N_ARGS, argv, argvlen);
+	if (reply == NULL) {
+		fprintf(stderr, "Failed to get reply!\n");
+		goto done;
+	}
+
+	if (reply->type != REDIS_REPLY_ARRAY) {
+		fprintf(stderr, "Reply invalid!\n");
+		goto free_reply;
+	}
+
+	ret_val = reply->elements;
+
+free_reply:
+	freeReplyObject(reply);
+done:
+	return ret_val;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// 	@brief	Claims entries in the group that have been pending for another
+//			consumer for at least min_idle_ms, i.e. ones that a crashed or
+//			stuck consumer never acknowledged, and calls the callback for
+//			each. Scans at most count entries starting at cursor and
+//			updates cursor to where the next call should pick up, which is
+//			"0-0" once the scan has wrapped around.
+//
+////////////////////////////////////////////////////////////////////////////////
+bool redis_xautoclaim(
+	redisContext *ctx,
+	const char *stream_name,
+	const char *group,
+	const char *consumer,
+	int min_idle_ms,
+	char cursor[STREAM_ID_BUFFLEN],
+	size_t count,
+	bool (*data_cb)(
+		const char *id,
+		const struct redisReply *reply,
+		void *user_data),
+	void *user_data)
+{
+	redisReply *reply, *entries, *entry;
+	const char *argv[REDIS_XAUTOCLAIM_N_ARGS];
+	size_t argvlen[REDIS_XAUTOCLAIM_N_ARGS];
+	char idle_buffer[32];
+	char count_buffer[32];
+	bool ret_val = false;
+	size_t i;
+
+	argv[0] = REDIS_XAUTOCLAIM_CMD_STR;
+	argvlen[0] = CONST_STRLEN(REDIS_XAUTOCLAIM_CMD_STR);
+	argv[1] = stream_name;
+	argvlen[1] = strlen(stream_name);
+	argv[2] = group;
+	argvlen[2] = strlen(group);
+	argv[3] = consumer;
+	argvlen[3] = strlen(consumer);
+	argvlen[4] = snprintf(idle_buffer, sizeof(idle_buffer), "%d", min_idle_ms);
+	argv[4] = idle_buffer;
+	argv[5] = cursor;
+	argvlen[5] = strlen(cursor);
+	argv[6] = REDIS_XREAD_COUNT_STR;
+	argvlen[6] = CONST_STRLEN(REDIS_XREAD_COUNT_STR);
+	argvlen[7] = snprintf(count_buffer, sizeof(count_buffer), "%lu", count);
+	argv[7] = count_buffer;
+
+	reply = redisCommandArgv(ctx, REDIS_XAUTOCLAIM_N_ARGS, argv, argvlen);
+	if (reply == NULL) {
+		fprintf(stderr, "Failed to get reply!\n");
+		goto done;
+	}
+
+	// Reply is the next cursor followed by the array of claimed entries.
+	//	Newer versions of redis also tack on the IDs of claimed entries
+	//	that no longer exist, which we don't care about
+	if ((reply->type != REDIS_REPLY_ARRAY) ||
+		(reply->elements < 2) ||
+		(reply->element[0]->type != REDIS_REPLY_STRING) ||
+		(reply->element[1]->type != REDIS_REPLY_ARRAY))
+	{
+		fprintf(stderr, "Reply invalid!\n");
+		goto free_reply;
+	}
+
+	strncpy(cursor, reply->element[0]->str, STREAM_ID_BUFFLEN);
+	cursor[STREAM_ID_BUFFLEN - 1] = '\0';
+
+	entries = reply->element[1];
+	for (i = 0; i < entries->elements; ++i) {
+
+		// Entries that were deleted while pending come back without data
+		entry = entries->element[i];
+		if ((entry->type != REDIS_REPLY_ARRAY) ||
+			(entry->elements != 2) ||
+			(entry->element[0]->type != REDIS_REPLY_STRING) ||
+			(entry->element[1]->type != REDIS_REPLY_ARRAY))
+		{
+			continue;
+		}
+
+		if (!data_cb(entry->element[0]->str, entry->element[1], user_data)) {
+			fprintf(stderr, "Data cb failed!\n");
+		}
+	}
+
+	// Note the success
+	ret_val = true;
+
+free_reply:
+	freeReplyObject(reply);
+done:
+	return ret_val;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// 	@brief	Parses the (key, value) array that we get back from an XREAD
+//			in an efficient manner. Fills in the infos passed to see if
+//			(1) they were all found and (2) if found their redisReply item
+//
+////////////////////////////////////////////////////////////////////////////////
+bool redis_xread_parse_kv(
+	const redisReply *reply,
+	struct redis_xread_kv_item *items,
+	size_t n_items)
+{
+	int idx, item;
+	bool ret_val = false;
+
+	// Initialize all of the found fields to false
+	for (item = 0; item < n_items; ++item) {
+		items[item].found = false;
+	}
+
+	// Make sure there's an even number of elements in the array. It should
+	//	be a list of key1, value1, key2, value2, etc.
+	if (reply->elements & 0x1) {
+		fprintf(stderr, "Odd number of elements!\n");
+		goto done;
+	}
+
+	// Now, we want to loop over the reply looking for keys
+	for (idx = 0; idx < reply->elements; idx += 2) {
+
+		// For the key, we want to see if it's in the list of items that
+		//	we care about
+		for (item = 0; item < n_items; ++item) {
+
+			// If we've already found the item, just move on
+			if (items[item].found) {
+				continue;
+			}
+
+			// Otherwise, check to see if the key is a match to the item
+			if ((reply->element[idx]->len == items[item].key_len) &&
+				(!strncmp(reply->element[idx]->str, items[item].key, items[item].key_len)))
+			{
+				items[item].found = true;
+				items[item].reply = reply->element[idx + 1];
+				break;
+			}
+		}
+	}
+
+	// Note the success
+	ret_val = true;
+
+done:
+	return ret_val;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// 	@brief	Builds an open-addressed hashtable over the kv items. The table
+//			is kept at most half full s.t. probes stay short. Each slot
+//			holds the index of its item plus one, with 0 being empty.
+//
+////////////////////////////////////////////////////////////////////////////////
+void redis_xread_kv_index_init(
+	struct redis_xread_kv_index *index,
+	struct redis_xread_kv_item *items,
+	size_t n_items)
+{
+	size_t n_slots = 1;
+	size_t item, n;
+	uint32_t slot;
+	bool duplicate;
+
+	while (n_slots < (2 * n_items)) {
+		n_slots <<= 1;
+	}
+
+	index->items = items;
+	index->n_items = n_items;
+	index->mask = n_slots - 1;
+
+	index->hashes = malloc((n_items > 0 ? n_items : 1) * sizeof(uint32_t));
+	assert(index->hashes != NULL);
+	index->slots = calloc(n_slots, sizeof(int));
+	assert(index->slots != NULL);
+
+	for (item = 0; item < n_items; ++item) {
+		index->hashes[item] = redis_str_hash(items[item].key, items[item].key_len);
+
+		// If the same key was asked for twice then only the first item
+		//	gets it, same as redis_xread_parse_kv
+		duplicate = false;
+		slot = index->hashes[item] & index->mask;
+		while (index->slots[slot] != 0) {
+			n = index->slots[slot] - 1;
+			if ((index->hashes[n] == index->hashes[item]) &&
+				(items[n].key_len == items[item].key_len) &&
+				(memcmp(items[n].key, items[item].key, items[item].key_len) == 0))
+			{
+				duplicate = true;
+				break;
+			}
+			slot = (slot + 1) & index->mask;
+		}
+		if (!duplicate) {
+			index->slots[slot] = item + 1;
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// 	@brief	Frees the memory of a kv index. Doesn't touch the items.
+//
+////////////////////////////////////////////////////////////////////////////////
+void redis_xread_kv_index_cleanup(
+	struct redis_xread_kv_index *index)
+{
+	if (index->hashes != NULL) {
+		free(index->hashes);
+		index->hashes = NULL;
+	}
+	if (index->slots != NULL) {
+		free(index->slots);
+		index->slots = NULL;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// 	@brief	Parses the (key, value) array that we get back from an XREAD
+//			using the index to find the item for each key. Stops as soon
+//			as all of the items have been found.
+//
+////////////////////////////////////////////////////////////////////////////////
+bool redis_xread_parse_kv_indexed(
+	const redisReply *reply,
+	const struct redis_xread_kv_index *index)
+{
+	struct redis_xread_kv_item *items = index->items;
+	const redisReply *key;
+	size_t idx, item, n_found = 0;
+	uint32_t hash, slot;
+
+	// Initialize all of the found fields to false
+	for (item = 0; item < index->n_items; ++item) {
+		items[item].found = false;
+	}
+
+	// Make sure there's an even number of elements in the array. It should
+	//	be a list of key1, value1, key2, value2, etc.
+	if (reply->elements & 0x1) {
+		fprintf(stderr, "Odd number of elements!\n");
+		return false;
+	}
+
+	for (idx = 0; (idx < reply->elements) && (n_found < index->n_items); idx += 2) {
+		key = reply->element[idx];
+		hash = redis_str_hash(key->str, key->len);
+
+		for (slot = hash & index->mask; index->slots[slot] != 0;
+			slot = (slot + 1) & index->mask)
+		{
+			item = index->slots[slot] - 1;
+			if ((index->hashes[item] == hash) &&
+				(items[item].key_len == key->len) &&
+				(memcmp(items[item].key, key->str, key->len) == 0))
+			{
+				if (!items[item].found) {
+					items[item].found = true;
+					items[item].reply = reply->element[idx + 1];
+					n_found++;
+				}
+				break;
+			}
+		}
+	}
+
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// 	@brief	Waits for the page of a range that's on its way, if there is
+//			one, s.t. the context can be used for other things
+//
+////////////////////////////////////////////////////////////////////////////////
+static void redis_range_drain(
+	redisContext *ctx,
+	struct redis_range *range)
+{
+	struct redisReply *reply = NULL;
+
+	if (range->pending) {
+		if ((redisGetReply(ctx, (void**)&reply) == REDIS_OK) && (reply != NULL)) {
+			freeReplyObject(reply);
+		}
+		range->pending = false;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// 	@brief	Starts reading a range of a stream. start and end are where
+//			the range begins and ends in the direction it's read, so start
+//			is newer than end if reverse is set. NULL means the newest or
+//			oldest entry as appropriate.
+//
+////////////////////////////////////////////////////////////////////////////////
+void redis_range_init(
+	struct redis_range *range,
+	const char *stream_name,
+	bool reverse,
+	const char *start,
+	const char *end,
+	size_t page_size,
+	size_t max_entries)
+{
+	memset(range, 0, sizeof(struct redis_range));
+
+	range->stream_name = strdup(stream_name);
+	assert(range->stream_name != NULL);
+	redis_range_restart(NULL, range, reverse, start, end, page_size,
+		max_entries);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// 	@brief	Starts a range over on the same stream, s.t. it can be read
+//			again without being set up again. If a page is still on its way
+//			then waits for it on ctx first.
+//
+////////////////////////////////////////////////////////////////////////////////
+void redis_range_restart(
+	redisContext *ctx,
+	struct redis_range *range,
+	bool reverse,
+	const char *start,
+	const char *end,
+	size_t page_size,
+	size_t max_entries)
+{
+	redis_range_drain(ctx, range);
+
+	range->requested = 0;
+	range->done = false;
+	range->reverse = reverse;
+	range->page_size = (page_size > 0) ? page_size : REDIS_RANGE_DEFAULT_PAGE_SIZE;
+	range->remaining = max_entries;
+	range->limited = (max_entries != REDIS_RANGE_NO_LIMIT);
+
+	if (start == NULL) {
+		start = reverse ? REDIS_RANGE_NEWEST : REDIS_RANGE_OLDEST;
+	}
+	if (end == NULL) {
+		end = reverse ? REDIS_RANGE_OLDEST : REDIS_RANGE_NEWEST;
+	}
+	snprintf(range->next_id, sizeof(range->next_id), "%s", start);
+	snprintf(range->end_id, sizeof(range->end_id), "%s", end);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// 	@brief	Sends the request for the next page of the range s.t. it's on
+//			its way while we're handling the current one. We write the
+//			request to the socket right away instead of leaving it in the
+//			output buffer until the next redisGetReply
+//
+////////////////////////////////////////////////////////////////////////////////
+static bool redis_range_request(
+	redisContext *ctx,
+	struct redis_range *range)
+{
+	const char *argv[REDIS_RANGE_N_ARGS];
+	size_t argvlen[REDIS_RANGE_N_ARGS];
+	char count_buffer[REDIS_RANGE_COUNT_BUFFLEN];
+	size_t count;
+	int done = 0;
+
+	count = range->page_size;
+	if (range->limited && (range->remaining < count)) {
+		count = range->remaining;
+	}
+	snprintf(count_buffer, sizeof(count_buffer), "%lu", count);
+
+	argv[0] = range->reverse ? REDIS_XREVRANGE_CMD_STR : REDIS_XRANGE_CMD_STR;
+	argvlen[0] = strlen(argv[0]);
+	argv[1] = range->stream_name;
+	argvlen[1] = strlen(range->stream_name);
+	argv[2] = range->next_id;
+	argvlen[2] = strlen(range->next_id);
+	argv[3] = range->end_id;
+	argvlen[3] = strlen(range->end_id);
+	argv[4] = REDIS_RANGE_COUNT_STR;
+	argvlen[4] = CONST_STRLEN(REDIS_RANGE_COUNT_STR);
+	argv[5] = count_buffer;
+	argvlen[5] = strlen(count_buffer);
+
+	#if DEBUG_COMMANDS
+		fprintf(stderr, "Command: %s %s %s %s COUNT %s\n", argv[0],
+			argv[1], argv[2], argv[3], argv[5]);
+	#endif
+
+	if (redisAppendCommandArgv(ctx, REDIS_RANGE_N_ARGS, argv, argvlen) != REDIS_OK) {
+		fprintf(stderr, "Failed to append %s\n", argv[0]);
+		return false;
+	}
+	while (!done) {
+		if (redisBufferWrite(ctx, &done) != REDIS_OK) {
+			fprintf(stderr, "Failed to send %s\n", argv[0]);
+			return false;
+		}
+	}
+
+	range->requested = count;
+	range->pending = true;
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// 	@brief	Reads the next page of the range and calls the callback for
+//			each entry in it. *n_read is set to the number of entries in the
+//			page and is 0 once the range is done. The request for the page
+//			after this one is sent before any callbacks are called. If
+//			take_reply is set then each reply passed to the callback is
+//			handed over to it.
+//
+////////////////////////////////////////////////////////////////////////////////
+bool redis_range_next(
+	redisContext *ctx,
+	struct redis_range *range,
+	bool (*data_cb)(
+		const char *id,
+		const struct redisReply *reply,
+		void *user_data),
+	void *user_data,
+	bool take_reply,
+	size_t *n_read)
+{
+	bool ret_val = false;
+	struct redisReply *reply = NULL, *reply_item, *last_id;
+	size_t item;
+	bool cb_ok;
+
+	*n_read = 0;
+
+	// If this is the first page then nothing has been requested yet
+	if (!range->pending && !range->done) {
+		if (range->limited && (range->remaining == 0)) {
+			range->done = true;
+		} else if (!redis_range_request(ctx, range)) {
+			goto done;
+		}
+	}
+
+	// If nothing is on its way then we're at the end
+	if (!range->pending) {
+		ret_val = true;
+		goto done;
+	}
+
+	range->pending = false;
+	if ((redis_reply_get(ctx, &reply, !take_reply) != REDIS_OK) ||
+		(reply == NULL))
+	{
+		fprintf(stderr, "Failed to get range reply\n");
+		range->done = true;
+		goto done;
+	}
+
+	// Want to make sure the reply is an array
+	if (reply->type != REDIS_REPLY_ARRAY) {
+		fprintf(stderr, "Reply level 0 not array!\n");
+		range->done = true;
 		goto free_reply;
 	}
 
-	// Otherwise, loop over the elements
-	for (item = 0; item < n; ++item) {
+	// A short page means there's nothing after it. Otherwise the next page
+	//	starts right after the last entry in this one
+	if (range->limited) {
+		range->remaining -= reply->elements;
+	}
+	if ((reply->elements < range->requested) ||
+		(range->limited && (range->remaining == 0)))
+	{
+		range->done = true;
+	} else {
+		last_id = reply->element[reply->elements - 1];
+		if ((last_id->type != REDIS_REPLY_ARRAY) ||
+			(last_id->elements != 2) ||
+			(last_id->element[0]->type != REDIS_REPLY_STRING))
+		{
+			fprintf(stderr, "Reply item doesn't have proper data!\n");
+			range->done = true;
+			goto free_reply;
+		}
+		snprintf(range->next_id, sizeof(range->next_id), "(%s",
+			last_id->element[0]->str);
+		if (!redis_range_request(ctx, range)) {
+			range->done = true;
+			goto free_reply;
+		}
+	}
+
+	// Loop over the elements
+	for (item = 0; item < reply->elements; ++item) {
 
 		// Get the item
 		reply_item = reply->element[item];
 		if (reply_item->type != REDIS_REPLY_ARRAY) {
-			fprintf(stderr, "Reply item %d is not an array!\n", item);
+			fprintf(stderr, "Reply item %lu is not an array!\n", item);
 			goto free_reply;
 		}
 
@@ -498,23 +2007,324 @@ bool redis_xrevrange(
 
 		// Finally, if we're here then we're good to pass the
 		//	data along to the callback function
-		if (!data_cb(
+		cb_ok = data_cb(
 			reply_item->element[0]->str,
 			reply_item->element[1],
-			user_data))
-		{
+			user_data);
+
+		// If the callback took the data then it's no longer ours to free
+		if (take_reply) {
+			reply_item->element[1] = NULL;
+		}
+
+		if (!cb_ok) {
 			fprintf(stderr, "Data cb failed!\n");
 			goto free_reply;
 		}
+	}
+
+	// Note the success
+	*n_read = reply->elements;
+	ret_val = true;
+
+free_reply:
+	redis_reply_free(reply);
+done:
+	return ret_val;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// 	@brief	Cleans up a range. If a page is still on its way then waits
+//			for it s.t. the context can be used for other things
+//
+////////////////////////////////////////////////////////////////////////////////
+void redis_range_cleanup(
+	redisContext *ctx,
+	struct redis_range *range)
+{
+	redis_range_drain(ctx, range);
+	range->done = true;
+
+	free(range->stream_name);
+	range->stream_name = NULL;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// 	@brief	Reads at most the n most recent entries on the stream as a
+//			single page of a range.
+//
+////////////////////////////////////////////////////////////////////////////////
+static bool redis_xrevrange_common(
+	redisContext *ctx,
+	const char *name,
+	bool (*data_cb)(
+		const char *id,
+		const struct redisReply *reply,
+		void *user_data),
+	size_t n,
+	void *user_data,
+	bool take_reply)
+{
+	struct redis_range range;
+	size_t n_read;
+	bool ret_val;
+
+	redis_range_init(&range, name, true, NULL, NULL, n, n);
+	ret_val = redis_range_next(ctx, &range, data_cb, user_data, take_reply, &n_read);
+	redis_range_cleanup(ctx, &range);
+
+	return ret_val;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// 	@brief	Performs an XREVRANGE for the n most recent entries on the
+//			stream and calls the callback for each. If the stream has
+//			fewer than n entries then calls it for all of them
+//
+////////////////////////////////////////////////////////////////////////////////
+bool redis_xrevrange(
+	redisContext *ctx,
+	const char *name,
+	bool (*data_cb)(
+		const char *id,
+		const struct redisReply *reply,
+		void *user_data),
+	size_t n,
+	void *user_data)
+{
+	return redis_xrevrange_common(ctx, name, data_cb, n, user_data, false);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// 	@brief	Same as redis_xrevrange, but hands each entry's reply over to
+//			the callback instead of freeing it along with the rest of the
+//			XREVRANGE response
+//
+////////////////////////////////////////////////////////////////////////////////
+bool redis_xrevrange_take_reply(
+	redisContext *ctx,
+	const char *name,
+	bool (*data_cb)(
+		const char *id,
+		const struct redisReply *reply,
+		void *user_data),
+	size_t n,
+	void *user_data)
+{
+	return redis_xrevrange_common(ctx, name, data_cb, n, user_data, true);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// 	@brief	Fills in a trim that keeps at most maxlen entries, or doesn't
+//			trim if maxlen is REDIS_XADD_NO_MAXLEN
+//
+////////////////////////////////////////////////////////////////////////////////
+void redis_trim_init_maxlen(
+	struct redis_trim *trim,
+	int maxlen,
+	bool approx)
+{
+	trim->type = (maxlen != REDIS_XADD_NO_MAXLEN) ?
+		REDIS_TRIM_MAXLEN : REDIS_TRIM_NONE;
+	trim->approx = approx;
+	trim->threshold = maxlen;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// 	@brief	Builds the trimming arguments of an XADD or XTRIM, i.e. MAXLEN
+//			or MINID, ~ and the threshold. The threshold points into
+//			buffer. Returns the number of arguments, 0 if not trimming
+//
+////////////////////////////////////////////////////////////////////////////////
+static int redis_trim_argv(
+	const struct redis_trim *trim,
+	const char **argv,
+	size_t *argvlen,
+	char buffer[REDIS_XADD_MAXLEN_BUFFLEN])
+{
+	int argc = 0;
+
+	if (trim->type == REDIS_TRIM_MAXLEN) {
+		argv[argc] = REDIS_XADD_MAXLEN_STR;
+		argvlen[argc++] = CONST_STRLEN(REDIS_XADD_MAXLEN_STR);
+	} else if (trim->type == REDIS_TRIM_MINID) {
+		argv[argc] = REDIS_XADD_MINID_STR;
+		argvlen[argc++] = CONST_STRLEN(REDIS_XADD_MINID_STR);
+	} else {
+		return 0;
+	}
+
+	if (trim->approx) {
+		argv[argc] = REDIS_XADD_MAXLEN_APPROX_STR;
+		argvlen[argc++] = CONST_STRLEN(REDIS_XADD_MAXLEN_APPROX_STR);
+	}
+
+	argv[argc] = buffer;
+	argvlen[argc++] = snprintf(buffer, REDIS_XADD_MAXLEN_BUFFLEN, "%lld",
+		trim->threshold);
+
+	return argc;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// 	@brief	Builds the arguments of an XADD that come before the (key, value)
+//			pairs. trim_buffer must outlive the use of the argv since the
+//			trim's threshold points into it. Returns the number of arguments
+//
+////////////////////////////////////////////////////////////////////////////////
+int redis_xadd_argv_header_trim(
+	const char *stream_name,
+	const struct redis_trim *trim,
+	const char *argv[REDIS_XADD_N_HEADER_ARGS],
+	size_t argvlen[REDIS_XADD_N_HEADER_ARGS],
+	char trim_buffer[REDIS_XADD_MAXLEN_BUFFLEN])
+{
+	int argc = 0;
+
+	// First, want to put the XADD and stream name
+	argv[argc] = REDIS_XADD_CMD_STR;
+	argvlen[argc++] = CONST_STRLEN(REDIS_XADD_CMD_STR);
+
+	argv[argc] = stream_name;
+	argvlen[argc++] = strlen(stream_name);
+
+	// Now, if we're trimming then say how
+	argc += redis_trim_argv(trim, &argv[argc], &argvlen[argc], trim_buffer);
+
+	// Add the ID string
+	argv[argc] = REDIS_XADD_ID_STR;
+	argvlen[argc++] = CONST_STRLEN(REDIS_XADD_ID_STR);
+
+	return argc;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// 	@brief	Same as above, trimming to maxlen
+//
+////////////////////////////////////////////////////////////////////////////////
+int redis_xadd_argv_header(
+	const char *stream_name,
+	int maxlen,
+	bool approx_maxlen,
+	const char *argv[REDIS_XADD_N_HEADER_ARGS],
+	size_t argvlen[REDIS_XADD_N_HEADER_ARGS],
+	char maxlen_buffer[REDIS_XADD_MAXLEN_BUFFLEN])
+{
+	struct redis_trim trim;
+
+	redis_trim_init_maxlen(&trim, maxlen, approx_maxlen);
+	return redis_xadd_argv_header_trim(
+		stream_name, &trim, argv, argvlen, maxlen_buffer);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// 	@brief	Builds the argv for an XADD of the array of (key, value) pairs
+//			into the passed buffers, which must have room for
+//			REDIS_XADD_N_HEADER_ARGS + 2 * info_len args. maxlen_buffer must
+//			outlive the use of the argv since the trim's threshold points
+//			into it. Returns the number of arguments.
+//
+////////////////////////////////////////////////////////////////////////////////
+static int redis_xadd_build_argv(
+	const char *stream_name,
+	struct redis_xadd_info *infos,
+	size_t info_len,
+	const struct redis_trim *trim,
+	const char **argv,
+	size_t *argvlen,
+	char maxlen_buffer[REDIS_XADD_MAXLEN_BUFFLEN])
+{
+	int argc;
+	int i;
+
+	// The XADD, stream name, trim and ID
+	argc = redis_xadd_argv_header_trim(stream_name, trim,
+		argv, argvlen, maxlen_buffer);
+
+	// Finally we can loop through the (key, value) pairs in the infos
+	//	adding them to the argv list
+	for (i = 0; i < info_len; ++i) {
+
+		// Put in the key. If the user passed us a key length (as they should
+		//	for constant key names) then we will use that, otherwise we'll
+		//	do strlen on the key
+		argv[argc] = infos[i].key;
+		argvlen[argc++] = (infos[i].key_len != 0) ?
+			infos[i].key_len : strlen(infos[i].key);
+
+		// Put in the data
+		argv[argc] = (const char*)infos[i].data;
+		argvlen[argc++] = infos[i].data_len;
+	}
+
+	#if DEBUG_COMMANDS
+		fprintf(stderr, "Redis Command: ");
+		for (i = 0; i < argc; ++i) {
+			fprintf(stderr, "%s ", argv[i]);
+		}
+		fprintf(stderr, "\n");
+	#endif
+
+	return argc;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// 	@brief	Gets the number of bytes of keys and values in an XADD
+//
+////////////////////////////////////////////////////////////////////////////////
+static uint64_t redis_xadd_size(
+	const struct redis_xadd_info *infos,
+	size_t info_len)
+{
+	uint64_t size = 0;
+	size_t i;
+
+	for (i = 0; i < info_len; ++i) {
+		size += infos[i].key_len + infos[i].data_len;
+	}
+	return size;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// 	@brief	Checks the reply to an XADD and copies the ID that was
+//			assigned into ret_id if it's non-NULL. Frees the reply.
+//
+////////////////////////////////////////////////////////////////////////////////
+static bool redis_xadd_process_reply(
+	struct redisReply *reply,
+	char ret_id[STREAM_ID_BUFFLEN])
+{
+	bool ret_val = false;
+
+	// Make sure the reply is a status type with the ID for the value that
+	//	we inserted
+	if (reply->type != REDIS_REPLY_STRING) {
+		fprintf(stderr, "Reply was not string!\n");
+		goto free_reply;
+	}
 
+	// And copy over the ID into the buffer if the user passed a non-NULL
+	//	pointer
+	if (ret_id != NULL) {
+		strncpy(ret_id, reply->str, STREAM_ID_BUFFLEN);
 	}
 
 	// Note the success
 	ret_val = true;
 
 free_reply:
-	freeReplyObject(reply);
-done:
+	redis_reply_free(reply);
 	return ret_val;
 }
 
@@ -533,97 +2343,247 @@ bool redis_xadd(
 	int maxlen,
 	bool approx_maxlen,
 	char ret_id[STREAM_ID_BUFFLEN])
+{
+	struct redis_trim trim;
+
+	redis_trim_init_maxlen(&trim, maxlen, approx_maxlen);
+	return redis_xadd_trim(ctx, stream_name, infos, info_len, &trim, ret_id);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// 	@brief	Adds the array of (key, value) pairs to the redis stream,
+//			trimming it as it goes
+//
+////////////////////////////////////////////////////////////////////////////////
+bool redis_xadd_trim(
+	redisContext *ctx,
+	const char *stream_name,
+	struct redis_xadd_info *infos,
+	size_t info_len,
+	const struct redis_trim *trim,
+	char ret_id[STREAM_ID_BUFFLEN])
 {
 	struct redisReply *reply;
-	int argc = 0;
-	const char *argv[REDIS_XADD_MAX_ARGS];
-	size_t argvlen[REDIS_XADD_MAX_ARGS];
+	struct redis_argv *args;
+	int argc;
 	char maxlen_buffer[REDIS_XADD_MAXLEN_BUFFLEN];
-	int maxlen_bytes;
 	int i;
 	bool ret_val = false;
+	uint64_t start;
 
-	// First, want to put the XADD and stream name
-	argv[argc] = REDIS_XADD_CMD_STR;
-	argvlen[argc++] = CONST_STRLEN(REDIS_XADD_CMD_STR);
+	// Build the command
+	args = redis_argv_get(REDIS_XADD_N_HEADER_ARGS + 2 * info_len);
+	argc = redis_xadd_build_argv(stream_name, infos, info_len, trim,
+		args->argv, args->argvlen, maxlen_buffer);
 
-	argv[argc] = stream_name;
-	argvlen[argc++] = strlen(stream_name);
+	// Now we're ready to send the redis command
+	start = metrics_timing_start();
+	reply = redis_command_argv_reply(ctx, argc, args->argv, args->argvlen,
+		true);
+	metrics_timing_end(METRICS_REDIS_XADD, start);
+	if (metrics_enabled()) {
+		metrics_count(METRICS_BYTES_OUT, redis_xadd_size(infos, info_len));
+	}
+	if (reply == NULL){
+		fprintf(stderr, "Bad XADD\n");
+		for (i = 0; i < argc; i++) {
+			fprintf(stderr, "Arg %d: %s: len %lu\n",
+				i, args->argv[i], args->argvlen[i]);
+		}
+		goto done;
+	}
 
-	// Now, if we have a max length then we want to use that
-	if (maxlen != REDIS_XADD_NO_MAXLEN) {
-		argv[argc] = REDIS_XADD_MAXLEN_STR;
-		argvlen[argc++] = CONST_STRLEN(REDIS_XADD_MAXLEN_STR);
+	ret_val = redis_xadd_process_reply(reply, ret_id);
+
+done:
+	return ret_val;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// 	@brief	Sends an XADD whose arguments have already been built. The
+//			header is from redis_xadd_argv_header and the rest of the
+//			arguments are the (key, value) pairs
+//
+////////////////////////////////////////////////////////////////////////////////
+bool redis_xadd_argv(
+	redisContext *ctx,
+	int argc,
+	const char **argv,
+	const size_t *argvlen,
+	char ret_id[STREAM_ID_BUFFLEN])
+{
+	struct redisReply *reply;
+	uint64_t start;
+	uint64_t size;
+	int i;
 
-		if (approx_maxlen) {
-			argv[argc] = REDIS_XADD_MAXLEN_APPROX_STR;
-			argvlen[argc++] = CONST_STRLEN(REDIS_XADD_MAXLEN_APPROX_STR);
+	start = metrics_timing_start();
+	reply = redis_command_argv_reply(ctx, argc, argv, argvlen, true);
+	metrics_timing_end(METRICS_REDIS_XADD, start);
+	if (metrics_enabled()) {
+		size = 0;
+		for (i = 0; i < argc; ++i) {
+			size += argvlen[i];
 		}
+		metrics_count(METRICS_BYTES_OUT, size);
+	}
+	if (reply == NULL) {
+		fprintf(stderr, "Bad XADD\n");
+		return false;
+	}
+
+	return redis_xadd_process_reply(reply, ret_id);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// 	@brief	Appends an XADD of the array of (key, value) pairs to the
+//			context's output buffer without waiting for the reply. hiredis
+//			copies the arguments when formatting the command, so the infos
+//			may be reused as soon as this returns. Each successful append
+//			must be matched by a call to redis_xadd_get_reply.
+//
+////////////////////////////////////////////////////////////////////////////////
+bool redis_xadd_append(
+	redisContext *ctx,
+	const char *stream_name,
+	struct redis_xadd_info *infos,
+	size_t info_len,
+	int maxlen,
+	bool approx_maxlen)
+{
+	struct redis_trim trim;
+
+	redis_trim_init_maxlen(&trim, maxlen, approx_maxlen);
+	return redis_xadd_append_trim(ctx, stream_name, infos, info_len, &trim);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// 	@brief	Same as above, trimming the stream as it goes
+//
+////////////////////////////////////////////////////////////////////////////////
+bool redis_xadd_append_trim(
+	redisContext *ctx,
+	const char *stream_name,
+	struct redis_xadd_info *infos,
+	size_t info_len,
+	const struct redis_trim *trim)
+{
+	struct redis_argv *args;
+	int argc;
+	char maxlen_buffer[REDIS_XADD_MAXLEN_BUFFLEN];
 
-		maxlen_bytes = snprintf(maxlen_buffer, REDIS_XADD_MAXLEN_BUFFLEN,
-			"%d", maxlen);
-		argv[argc] = maxlen_buffer;
-		argvlen[argc++] = maxlen_bytes;
+	// Build the command
+	args = redis_argv_get(REDIS_XADD_N_HEADER_ARGS + 2 * info_len);
+	argc = redis_xadd_build_argv(stream_name, infos, info_len, trim,
+		args->argv, args->argvlen, maxlen_buffer);
+
+	// And append it to the output buffer
+	if (redisAppendCommandArgv(ctx, argc, args->argv, args->argvlen) != REDIS_OK) {
+		fprintf(stderr, "Failed to append XADD\n");
+		return false;
+	}
+	if (metrics_enabled()) {
+		metrics_count(METRICS_BYTES_OUT, redis_xadd_size(infos, info_len));
 	}
 
-	// Add the ID string
-	argv[argc] = REDIS_XADD_ID_STR;
-	argvlen[argc++] = CONST_STRLEN(REDIS_XADD_ID_STR);
+	return true;
+}
 
-	// Finally we can loop through the (key, value) pairs in the infos
-	//	adding them to the argv list
-	for (i = 0; i < info_len; ++i) {
+////////////////////////////////////////////////////////////////////////////////
+//
+// 	@brief	Gets the reply for the oldest outstanding XADD appended with
+//			redis_xadd_append. The first call will flush the output buffer.
+//			Copies the new ID into ret_id if it's non-NULL. A false return
+//			with ctx->err set means the connection is broken and no further
+//			replies will come back.
+//
+////////////////////////////////////////////////////////////////////////////////
+bool redis_xadd_get_reply(
+	redisContext *ctx,
+	char ret_id[STREAM_ID_BUFFLEN])
+{
+	struct redisReply *reply = NULL;
 
-		// Put in the key. If the user passed us a key length (as they should
-		//	for constant key names) then we will use that, otherwise we'll
-		//	do strlen on the key
-		argv[argc] = infos[i].key;
-		argvlen[argc++] = (infos[i].key_len != 0) ?
-			infos[i].key_len : strlen(infos[i].key);
+	if ((redis_reply_get(ctx, &reply, true) != REDIS_OK) || (reply == NULL)) {
+		fprintf(stderr, "Failed to get XADD reply\n");
+		return false;
+	}
 
-		// Put in the data
-		argv[argc] = (const char*)infos[i].data;
-		argvlen[argc++] = infos[i].data_len;
+	return redis_xadd_process_reply(reply, ret_id);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// 	@brief	Appends an XTRIM of the stream to the context's output buffer.
+//			Each successful append must be matched by a call to
+//			redis_xtrim_get_reply.
+//
+////////////////////////////////////////////////////////////////////////////////
+bool redis_xtrim_append(
+	redisContext *ctx,
+	const char *stream_name,
+	const struct redis_trim *trim)
+{
+	const char *argv[REDIS_XTRIM_MAX_ARGS];
+	size_t argvlen[REDIS_XTRIM_MAX_ARGS];
+	char trim_buffer[REDIS_XADD_MAXLEN_BUFFLEN];
+	int argc = 0;
+
+	if (trim->type == REDIS_TRIM_NONE) {
+		fprintf(stderr, "Nothing to trim\n");
+		return false;
 	}
 
-	#if DEBUG_COMMANDS
-		fprintf(stderr, "Redis Command: ");
-		for (i = 0; i < argc; ++i) {
-			fprintf(stderr, "%s ", argv[i]);
-		}
-		fprintf(stderr, "\n");
-	#endif
+	argv[argc] = REDIS_XTRIM_CMD_STR;
+	argvlen[argc++] = CONST_STRLEN(REDIS_XTRIM_CMD_STR);
+	argv[argc] = stream_name;
+	argvlen[argc++] = strlen(stream_name);
+	argc += redis_trim_argv(trim, &argv[argc], &argvlen[argc], trim_buffer);
 
-	// Now we're ready to send the redis command
-	reply = redisCommandArgv(ctx, argc, argv, argvlen);
-	if (reply == NULL){
-		fprintf(stderr, "Bad XADD\n");
-		for (i = 0; i < argc; i++) {
-			fprintf(stderr, "Arg %d: %s: len %lu\n",
-				i, argv[i], argvlen[i]);
-		}
-		goto done;
+	if (redisAppendCommandArgv(ctx, argc, argv, argvlen) != REDIS_OK) {
+		fprintf(stderr, "Failed to append XTRIM\n");
+		return false;
 	}
 
-	// Make sure the reply is a status type with the ID for the value that
-	//	we inserted
-	if (reply->type != REDIS_REPLY_STRING) {
-		fprintf(stderr, "Reply was not string!\n");
-		goto free_reply;
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// 	@brief	Gets the reply for the oldest outstanding XTRIM, which is the
+//			number of entries trimmed. Same as redis_xadd_get_reply as far
+//			as the connection goes
+//
+////////////////////////////////////////////////////////////////////////////////
+bool redis_xtrim_get_reply(
+	redisContext *ctx,
+	long long *n_trimmed)
+{
+	struct redisReply *reply = NULL;
+	bool ret_val = false;
+
+	if ((redisGetReply(ctx, (void**)&reply) != REDIS_OK) || (reply == NULL)) {
+		fprintf(stderr, "Failed to get XTRIM reply\n");
+		return false;
 	}
 
-	// And copy over the ID into the buffer if the user passed a non-NULL
-	//	pointer
-	if (ret_id != NULL) {
-		strncpy(ret_id, reply->str, STREAM_ID_BUFFLEN);
+	if (reply->type != REDIS_REPLY_INTEGER) {
+		fprintf(stderr, "XTRIM failed: %s\n",
+			(reply->type == REDIS_REPLY_ERROR) ? reply->str : "bad reply");
+		goto done;
 	}
 
-	// Note the success
+	if (n_trimmed != NULL) {
+		*n_trimmed = reply->integer;
+	}
 	ret_val = true;
 
-free_reply:
-	freeReplyObject(reply);
 done:
+	freeReplyObject(reply);
 	return ret_val;
 }
 
@@ -789,6 +2749,186 @@ done:
 	return ret_val;
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// 	@brief	Adds or removes a member of a registry and bumps the registry's
+//			version in one round trip. The registry is a sorted set where
+//			every member has the same score s.t. it's kept in lexical order
+//
+////////////////////////////////////////////////////////////////////////////////
+bool redis_registry_update(
+	redisContext *ctx,
+	const char *key,
+	const char *version_key,
+	const char *member,
+	size_t member_len,
+	bool add)
+{
+	redisReply *reply;
+	const char *argv[REDIS_REGISTRY_ADD_N_ARGS];
+	size_t argvlen[REDIS_REGISTRY_ADD_N_ARGS];
+	int argc = 0;
+	bool ret_val = true;
+	int i;
+
+	if (add) {
+		argv[argc] = REDIS_REGISTRY_ADD_CMD_STR;
+		argvlen[argc++] = CONST_STRLEN(REDIS_REGISTRY_ADD_CMD_STR);
+		argv[argc] = key;
+		argvlen[argc++] = strlen(key);
+		argv[argc] = REDIS_REGISTRY_ADD_SCORE_STR;
+		argvlen[argc++] = CONST_STRLEN(REDIS_REGISTRY_ADD_SCORE_STR);
+	} else {
+		argv[argc] = REDIS_REGISTRY_REMOVE_CMD_STR;
+		argvlen[argc++] = CONST_STRLEN(REDIS_REGISTRY_REMOVE_CMD_STR);
+		argv[argc] = key;
+		argvlen[argc++] = strlen(key);
+	}
+	argv[argc] = member;
+	argvlen[argc++] = member_len;
+
+	if (redisAppendCommandArgv(ctx, argc, argv, argvlen) != REDIS_OK) {
+		fprintf(stderr, "Failed to append registry update\n");
+		return false;
+	}
+
+	argv[0] = REDIS_REGISTRY_VERSION_CMD_STR;
+	argvlen[0] = CONST_STRLEN(REDIS_REGISTRY_VERSION_CMD_STR);
+	argv[1] = version_key;
+	argvlen[1] = strlen(version_key);
+
+	if (redisAppendCommandArgv(ctx, REDIS_REGISTRY_VERSION_N_ARGS,
+		argv, argvlen) != REDIS_OK)
+	{
+		fprintf(stderr, "Failed to append registry version\n");
+		return false;
+	}
+
+	// Both replies need to be read to keep the context in sync, even if
+	//	the first was an error
+	for (i = 0; i < 2; ++i) {
+		if (redisGetReply(ctx, (void**)&reply) != REDIS_OK) {
+			fprintf(stderr, "Failed to get reply!\n");
+			return false;
+		}
+		if (reply->type != REDIS_REPLY_INTEGER) {
+			ret_val = false;
+		}
+		freeReplyObject(reply);
+	}
+
+	return ret_val;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// 	@brief	Calls the callback for each member of a registry between min and
+//			max, in lexical order. min and max are ZRANGEBYLEX bounds, i.e.
+//			"-" and "+" for everything. Returns the number of members or -1
+//			if the registry couldn't be read
+//
+////////////////////////////////////////////////////////////////////////////////
+int redis_registry_get(
+	redisContext *ctx,
+	const char *key,
+	const char *min,
+	const char *max,
+	bool (*data_cb)(const char *member, void *user_data),
+	void *user_data)
+{
+	redisReply *reply;
+	const char *argv[REDIS_REGISTRY_GET_N_ARGS];
+	size_t argvlen[REDIS_REGISTRY_GET_N_ARGS];
+	int ret_val = -1;
+	size_t i;
+
+	argv[0] = REDIS_REGISTRY_GET_CMD_STR;
+	argvlen[0] = CONST_STRLEN(REDIS_REGISTRY_GET_CMD_STR);
+	argv[1] = key;
+	argvlen[1] = strlen(key);
+	argv[2] = min;
+	argvlen[2] = strlen(min);
+	argv[3] = max;
+	argvlen[3] = strlen(max);
+
+	reply = redisCommandArgv(ctx, REDIS_REGISTRY_GET_N_ARGS, argv, argvlen);
+	if (reply == NULL) {
+		fprintf(stderr, "Failed to get reply!\n");
+		goto done;
+	}
+
+	// An error here is expected if the registry lives on another node of
+	//	a cluster, so leave it to the caller to decide what to do
+	if (reply->type != REDIS_REPLY_ARRAY) {
+		goto free_reply;
+	}
+
+	for (i = 0; i < reply->elements; ++i) {
+		if (reply->element[i]->type != REDIS_REPLY_STRING) {
+			fprintf(stderr, "Registry member is not a string!\n");
+			goto free_reply;
+		}
+		if (!data_cb(reply->element[i]->str, user_data)) {
+			fprintf(stderr, "Failed to call callback!\n");
+			goto free_reply;
+		}
+	}
+
+	ret_val = reply->elements;
+
+free_reply:
+	freeReplyObject(reply);
+done:
+	return ret_val;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// 	@brief	Gets an integer key, e.g. a registry version. A key that doesn't
+//			exist is 0
+//
+////////////////////////////////////////////////////////////////////////////////
+bool redis_get_integer(
+	redisContext *ctx,
+	const char *key,
+	long long *value)
+{
+	redisReply *reply;
+	const char *argv[REDIS_GET_N_ARGS];
+	size_t argvlen[REDIS_GET_N_ARGS];
+	char *end;
+	bool ret_val = false;
+
+	argv[0] = REDIS_GET_CMD_STR;
+	argvlen[0] = CONST_STRLEN(REDIS_GET_CMD_STR);
+	argv[1] = key;
+	argvlen[1] = strlen(key);
+
+	reply = redisCommandArgv(ctx, REDIS_GET_N_ARGS, argv, argvlen);
+	if (reply == NULL) {
+		fprintf(stderr, "Failed to get reply!\n");
+		goto done;
+	}
+
+	if (reply->type == REDIS_REPLY_NIL) {
+		*value = 0;
+	} else if (reply->type == REDIS_REPLY_STRING) {
+		*value = strtoll(reply->str, &end, 10);
+		if ((end == reply->str) || (*end != '\0')) {
+			goto free_reply;
+		}
+	} else {
+		goto free_reply;
+	}
+
+	ret_val = true;
+
+free_reply:
+	freeReplyObject(reply);
+done:
+	return ret_val;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 // 	@brief	Gets a new redis handle to a remote redis server
@@ -862,8 +3002,15 @@ bool redis_init_stream_info(
 
 	// Set the name, data callback and user data
 	info->name = name;
+	info->name_len = (name != NULL) ? strlen(name) : 0;
+	info->name_hash = redis_str_hash(name, info->name_len);
 	info->data_cb = data_cb;
 	info->user_data = user_data;
+	info->take_reply = false;
+	info->policy = REDIS_READ_ALL;
+	info->min_interval_ns = 0;
+	info->last_delivered_ns = 0;
+	info->items_dropped = NULL;
 
 	// Prefer to use the last ID.
 	if (last_id != NULL) {
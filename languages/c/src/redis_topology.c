@@ -0,0 +1,442 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @file redis_topology.c
+//
+//  @brief Implements sharding data streams across redis servers and redis
+//			cluster hash slots
+//
+//  @copy 2018 Elementary Robotics. All rights reserved.
+//
+////////////////////////////////////////////////////////////////////////////////
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <hiredis/hiredis.h>
+
+#include "redis.h"
+#include "redis_topology.h"
+
+#define REDIS_CLUSTER_SLOTS_N_ARGS 2
+#define REDIS_CLUSTER_CMD_STR "CLUSTER"
+#define REDIS_CLUSTER_SLOTS_STR "SLOTS"
+
+#define REDIS_TOPOLOGY_SHARD_SEP ","
+#define REDIS_TOPOLOGY_PORT_SEP ':'
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Computes the CRC16 (XMODEM) that redis cluster uses for key slots
+//
+////////////////////////////////////////////////////////////////////////////////
+uint16_t redis_crc16(
+	const char *buf,
+	size_t len)
+{
+	uint16_t crc = 0;
+	size_t i;
+	int j;
+
+	for (i = 0; i < len; ++i) {
+		crc ^= (uint16_t)((unsigned char)buf[i]) << 8;
+		for (j = 0; j < 8; ++j) {
+			if (crc & 0x8000) {
+				crc = (crc << 1) ^ 0x1021;
+			} else {
+				crc = crc << 1;
+			}
+		}
+	}
+
+	return crc;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Gets the cluster hash slot of a key. Follows the redis rules for
+//			hash tags: if the key has a '{' followed later by a '}' with
+//			at least one character between them then only those characters
+//			are hashed.
+//
+////////////////////////////////////////////////////////////////////////////////
+uint16_t redis_key_slot(
+	const char *key,
+	size_t len)
+{
+	size_t start, end;
+
+	for (start = 0; start < len; ++start) {
+		if (key[start] == '{') {
+			break;
+		}
+	}
+
+	if (start < len) {
+		for (end = start + 1; end < len; ++end) {
+			if (key[end] == '}') {
+				break;
+			}
+		}
+
+		if ((end < len) && (end != start + 1)) {
+			key += start + 1;
+			len = end - start - 1;
+		}
+	}
+
+	return redis_crc16(key, len) & (REDIS_CLUSTER_N_SLOTS - 1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Finds a shard by address, adding it if it's new. Returns the
+//			index of the shard.
+//
+////////////////////////////////////////////////////////////////////////////////
+static size_t redis_topology_add_shard(
+	struct redis_topology *topology,
+	const char *host,
+	size_t host_len,
+	int port)
+{
+	size_t i;
+	struct redis_shard *shard;
+
+	for (i = 0; i < topology->n_shards; ++i) {
+		shard = &topology->shards[i];
+		if ((shard->port == port) &&
+			(shard->host != NULL) &&
+			(strlen(shard->host) == host_len) &&
+			(strncmp(shard->host, host, host_len) == 0))
+		{
+			return i;
+		}
+	}
+
+	topology->shards = realloc(topology->shards,
+		(topology->n_shards + 1) * sizeof(struct redis_shard));
+	assert(topology->shards != NULL);
+
+	shard = &topology->shards[topology->n_shards];
+	shard->host = strndup(host, host_len);
+	assert(shard->host != NULL);
+	shard->port = port;
+	shard->socket = NULL;
+
+	return topology->n_shards++;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Parses a comma-separated list of servers into the shards of the
+//			topology. Anything with a '/' in it is a unix socket, else
+//			it's host:port
+//
+////////////////////////////////////////////////////////////////////////////////
+static bool redis_topology_parse_shards(
+	struct redis_topology *topology,
+	const char *list)
+{
+	char *copy, *tok, *save, *port_str, *end;
+	long port;
+	bool ret_val = false;
+	struct redis_shard *shard;
+
+	copy = strdup(list);
+	assert(copy != NULL);
+
+	for (tok = strtok_r(copy, REDIS_TOPOLOGY_SHARD_SEP, &save);
+		tok != NULL;
+		tok = strtok_r(NULL, REDIS_TOPOLOGY_SHARD_SEP, &save))
+	{
+		if (strchr(tok, '/') != NULL) {
+			topology->shards = realloc(topology->shards,
+				(topology->n_shards + 1) * sizeof(struct redis_shard));
+			assert(topology->shards != NULL);
+
+			shard = &topology->shards[topology->n_shards++];
+			shard->host = NULL;
+			shard->port = 0;
+			shard->socket = strdup(tok);
+			assert(shard->socket != NULL);
+			continue;
+		}
+
+		port_str = strrchr(tok, REDIS_TOPOLOGY_PORT_SEP);
+		if ((port_str == NULL) || (port_str == tok)) {
+			fprintf(stderr, "Invalid redis server '%s', expected host:port\n", tok);
+			goto done;
+		}
+
+		port = strtol(port_str + 1, &end, 10);
+		if ((*end != '\0') || (port <= 0) || (port > 65535)) {
+			fprintf(stderr, "Invalid port in redis server '%s'\n", tok);
+			goto done;
+		}
+
+		redis_topology_add_shard(topology, tok, port_str - tok, (int)port);
+	}
+
+	if (topology->n_shards == 0) {
+		fprintf(stderr, "No redis servers in topology\n");
+		goto done;
+	}
+
+	ret_val = true;
+
+done:
+	free(copy);
+	return ret_val;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Asks a cluster node for the slot map and turns the masters into
+//			the shards of the topology
+//
+////////////////////////////////////////////////////////////////////////////////
+static bool redis_topology_load_slots(
+	struct redis_topology *topology,
+	redisContext *ctx)
+{
+	const char *argv[REDIS_CLUSTER_SLOTS_N_ARGS] = {
+		REDIS_CLUSTER_CMD_STR, REDIS_CLUSTER_SLOTS_STR };
+	size_t argvlen[REDIS_CLUSTER_SLOTS_N_ARGS] = {
+		CONST_STRLEN(REDIS_CLUSTER_CMD_STR),
+		CONST_STRLEN(REDIS_CLUSTER_SLOTS_STR) };
+	redisReply *reply, *range, *master;
+	size_t i, shard;
+	long long slot;
+	bool ret_val = false;
+
+	reply = redisCommandArgv(ctx, REDIS_CLUSTER_SLOTS_N_ARGS, argv, argvlen);
+	if ((reply == NULL) || (reply->type != REDIS_REPLY_ARRAY)) {
+		fprintf(stderr, "Failed to get cluster slots\n");
+		goto done;
+	}
+
+	for (i = 0; i < reply->elements; ++i) {
+		range = reply->element[i];
+		if ((range->type != REDIS_REPLY_ARRAY) ||
+			(range->elements < 3) ||
+			(range->element[0]->type != REDIS_REPLY_INTEGER) ||
+			(range->element[1]->type != REDIS_REPLY_INTEGER) ||
+			(range->element[2]->type != REDIS_REPLY_ARRAY) ||
+			(range->element[2]->elements < 2) ||
+			(range->element[2]->element[0]->type != REDIS_REPLY_STRING) ||
+			(range->element[2]->element[1]->type != REDIS_REPLY_INTEGER) ||
+			(range->element[0]->integer < 0) ||
+			(range->element[1]->integer >= REDIS_CLUSTER_N_SLOTS))
+		{
+			fprintf(stderr, "Invalid cluster slots reply\n");
+			goto done;
+		}
+
+		master = range->element[2];
+		shard = redis_topology_add_shard(topology,
+			master->element[0]->str, master->element[0]->len,
+			(int)master->element[1]->integer);
+
+		for (slot = range->element[0]->integer;
+			slot <= range->element[1]->integer;
+			++slot)
+		{
+			topology->slots[slot] = shard;
+		}
+	}
+
+	for (slot = 0; slot < REDIS_CLUSTER_N_SLOTS; ++slot) {
+		if (topology->slots[slot] == REDIS_TOPOLOGY_NUCLEUS) {
+			fprintf(stderr, "Cluster slot %lld is not served\n", slot);
+			goto done;
+		}
+	}
+
+	ret_val = true;
+
+done:
+	if (reply != NULL) {
+		freeReplyObject(reply);
+	}
+	return ret_val;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Finds the cluster from the seed list. The seeds are thrown away
+//			once one of them tells us the slots.
+//
+////////////////////////////////////////////////////////////////////////////////
+static bool redis_topology_init_cluster(
+	struct redis_topology *topology,
+	const char *seeds)
+{
+	struct redis_topology seed_list;
+	redisContext *ctx;
+	size_t i, slot;
+	bool ret_val = false;
+
+	memset(&seed_list, 0, sizeof(seed_list));
+	seed_list.type = REDIS_TOPOLOGY_REMOTE;
+	if (!redis_topology_parse_shards(&seed_list, seeds)) {
+		goto done;
+	}
+
+	topology->slots = malloc(REDIS_CLUSTER_N_SLOTS * sizeof(size_t));
+	assert(topology->slots != NULL);
+
+	for (i = 0; i < seed_list.n_shards; ++i) {
+		ctx = redis_topology_connect(&seed_list, i);
+		if (ctx == NULL) {
+			continue;
+		}
+
+		for (slot = 0; slot < REDIS_CLUSTER_N_SLOTS; ++slot) {
+			topology->slots[slot] = REDIS_TOPOLOGY_NUCLEUS;
+		}
+
+		ret_val = redis_topology_load_slots(topology, ctx);
+		redis_context_cleanup(ctx);
+		if (ret_val) {
+			break;
+		}
+	}
+
+	if (!ret_val) {
+		fprintf(stderr, "Failed to get slots from any cluster seed\n");
+	}
+
+done:
+	redis_topology_cleanup(&seed_list);
+	return ret_val;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Initializes the topology from the spec or the environment
+//
+////////////////////////////////////////////////////////////////////////////////
+bool redis_topology_init(
+	struct redis_topology *topology,
+	const char *spec)
+{
+	bool ret_val = false;
+
+	memset(topology, 0, sizeof(struct redis_topology));
+	topology->type = REDIS_TOPOLOGY_LOCAL;
+
+	if (spec == NULL) {
+		spec = getenv(REDIS_TOPOLOGY_ENV);
+	}
+
+	if ((spec == NULL) || (spec[0] == '\0') ||
+		(strcmp(spec, REDIS_TOPOLOGY_LOCAL_STR) == 0))
+	{
+		return true;
+	}
+
+	if (strncmp(spec, REDIS_TOPOLOGY_REMOTE_PREFIX,
+		CONST_STRLEN(REDIS_TOPOLOGY_REMOTE_PREFIX)) == 0)
+	{
+		topology->type = REDIS_TOPOLOGY_REMOTE;
+		ret_val = redis_topology_parse_shards(topology,
+			spec + CONST_STRLEN(REDIS_TOPOLOGY_REMOTE_PREFIX));
+	}
+	else if (strncmp(spec, REDIS_TOPOLOGY_CLUSTER_PREFIX,
+		CONST_STRLEN(REDIS_TOPOLOGY_CLUSTER_PREFIX)) == 0)
+	{
+		topology->type = REDIS_TOPOLOGY_CLUSTER;
+		ret_val = redis_topology_init_cluster(topology,
+			spec + CONST_STRLEN(REDIS_TOPOLOGY_CLUSTER_PREFIX));
+	}
+	else
+	{
+		fprintf(stderr, "Invalid redis topology '%s'\n", spec);
+	}
+
+	if (!ret_val) {
+		redis_topology_cleanup(topology);
+	}
+
+	return ret_val;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Frees the shards and slot map and leaves the topology local
+//
+////////////////////////////////////////////////////////////////////////////////
+void redis_topology_cleanup(
+	struct redis_topology *topology)
+{
+	size_t i;
+
+	for (i = 0; i < topology->n_shards; ++i) {
+		free(topology->shards[i].host);
+		free(topology->shards[i].socket);
+	}
+	free(topology->shards);
+	free(topology->slots);
+
+	memset(topology, 0, sizeof(struct redis_topology));
+	topology->type = REDIS_TOPOLOGY_LOCAL;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Gets the shard for a data stream. Across remote servers we hash
+//			the element name and not the key s.t. an element's streams
+//			stay together. If there's no element then the key is used.
+//
+////////////////////////////////////////////////////////////////////////////////
+size_t redis_topology_get_shard(
+	const struct redis_topology *topology,
+	const char *element,
+	const char *key)
+{
+	switch (topology->type) {
+		case REDIS_TOPOLOGY_REMOTE:
+			if ((element == NULL) || (element[0] == '\0')) {
+				element = key;
+			}
+			return redis_key_slot(element, strlen(element)) %
+				topology->n_shards;
+		case REDIS_TOPOLOGY_CLUSTER:
+			return topology->slots[redis_key_slot(key, strlen(key))];
+		default:
+			return REDIS_TOPOLOGY_NUCLEUS;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Connects to a shard. Returns NULL on failure
+//
+////////////////////////////////////////////////////////////////////////////////
+redisContext *redis_topology_connect(
+	const struct redis_topology *topology,
+	size_t shard)
+{
+	redisContext *ctx;
+	const struct redis_shard *info;
+
+	if (shard >= topology->n_shards) {
+		return NULL;
+	}
+
+	info = &topology->shards[shard];
+	if (info->socket != NULL) {
+		ctx = redis_context_init_local(info->socket);
+	} else {
+		ctx = redis_context_init_remote(info->host, info->port);
+	}
+
+	if ((ctx != NULL) && ctx->err) {
+		fprintf(stderr, "Failed to connect to redis shard %zu: %s\n",
+			shard, ctx->errstr);
+		redis_context_cleanup(ctx);
+		ctx = NULL;
+	}
+
+	return ctx;
+}
@@ -10,9 +10,11 @@
 #include <gtest/gtest.h>
 #include <string.h>
 #include <list>
+#include <vector>
 #include <hiredis/hiredis.h>
 #include "atom.h"
 #include "redis.h"
+#include "redis_topology.h"
 
 //
 // Tests for valid element names
@@ -29,6 +31,9 @@ protected:
 	virtual void SetUp() {
 		ctx = redisConnectUnix("/shared/redis.sock");
 		ASSERT_NE(ctx, (void*)NULL);
+		// Start without a registry s.t. discovery falls back to scanning
+		//	for the keys the tests make
+		clear_registry();
 		// Initialize the atom_list to an invalid value. This ensures
 		//	that the list creation takes care of it
 		atom_list = (struct atom_list_node*)0xDEADBEEF;
@@ -43,10 +48,20 @@ protected:
 			ASSERT_NE(reply, (redisReply*)NULL) << "Redis doesn't seem to be working...";
 			EXPECT_NE(reply->type, REDIS_REPLY_ERROR);
 		}
+		clear_registry();
 		redisFree(ctx);
 		atom_list_free(atom_list);
 	};
 
+	// Removes the element and stream registries
+	void clear_registry()
+	{
+		redisReply *reply = (redisReply *)redisCommand(ctx, "DEL %s %s %s",
+			ATOM_REGISTRY_ELEMENTS, ATOM_REGISTRY_STREAMS, ATOM_REGISTRY_VERSION);
+		ASSERT_NE(reply, (redisReply*)NULL) << "Redis doesn't seem to be working...";
+		freeReplyObject(reply);
+	}
+
 	// Adds a key to redis
 	void add_stream(std::string name)
 	{
@@ -239,3 +254,326 @@ TEST_F(AtomRedisTest, multiple_streams_multiple_elements_with_filter) {
 		"hello"
 	});
 }
+
+// Tests finding elements through the registry. Once anything is registered
+//	the keyspace isn't scanned
+TEST_F(AtomRedisTest, registry_elements) {
+	long long version;
+
+	EXPECT_EQ(atom_registry_get_version(ctx, &version), ATOM_NO_ERROR);
+	EXPECT_EQ(version, 0);
+
+	add_element("scanned");
+	EXPECT_EQ(atom_registry_add_element(ctx, "c"), ATOM_NO_ERROR);
+	EXPECT_EQ(atom_registry_add_element(ctx, "a"), ATOM_NO_ERROR);
+	EXPECT_EQ(atom_registry_add_element(ctx, "b"), ATOM_NO_ERROR);
+	EXPECT_EQ(atom_registry_add_element(ctx, "a"), ATOM_NO_ERROR);
+	EXPECT_EQ(atom_get_all_elements(ctx, &atom_list), ATOM_NO_ERROR);
+	check_list(atom_list, std::vector<std::string>{"a", "b", "c"});
+	atom_list_free(atom_list);
+
+	EXPECT_EQ(atom_registry_remove_element(ctx, "b"), ATOM_NO_ERROR);
+	EXPECT_EQ(atom_get_all_elements(ctx, &atom_list), ATOM_NO_ERROR);
+	check_list(atom_list, std::vector<std::string>{"a", "c"});
+
+	EXPECT_EQ(atom_registry_get_version(ctx, &version), ATOM_NO_ERROR);
+	EXPECT_EQ(version, 5);
+}
+
+// Tests finding streams through the registry, with and without a filter
+TEST_F(AtomRedisTest, registry_streams) {
+	EXPECT_EQ(atom_registry_add_stream(ctx, "stream:test_elem:some_data"), ATOM_NO_ERROR);
+	EXPECT_EQ(atom_registry_add_stream(ctx, "stream:test_elem:cool_data"), ATOM_NO_ERROR);
+	EXPECT_EQ(atom_registry_add_stream(ctx, "stream:test_elem2:hello"), ATOM_NO_ERROR);
+	EXPECT_EQ(atom_registry_add_stream(ctx, "stream:foo_elem:world"), ATOM_NO_ERROR);
+
+	EXPECT_EQ(atom_get_all_data_streams(ctx, NULL, &atom_list), ATOM_NO_ERROR);
+	check_list(atom_list, std::vector<std::string>{
+		get_data_stream("foo_elem", "world"),
+		get_data_stream("test_elem", "cool_data"),
+		get_data_stream("test_elem", "some_data"),
+		get_data_stream("test_elem2", "hello"),
+	});
+	atom_list_free(atom_list);
+
+	EXPECT_EQ(atom_get_all_data_streams(ctx, "test_elem", &atom_list), ATOM_NO_ERROR);
+	check_list(atom_list, std::vector<std::string>{"cool_data", "some_data"});
+	atom_list_free(atom_list);
+
+	// An element without streams doesn't fall back to scanning
+	add_data_stream("test", "scanned");
+	EXPECT_EQ(atom_get_all_data_streams(ctx, "test", &atom_list), ATOM_NO_ERROR);
+	EXPECT_EQ(atom_list, (struct atom_list_node*)NULL);
+}
+
+// Tests parsing an entry's keys and values with a prebuilt index
+TEST_F(AtomRedisTest, parse_kv_indexed) {
+	redisReply *reply;
+	struct redis_xread_kv_item items[3];
+	struct redis_xread_kv_index index;
+
+	reply = (redisReply *)redisCommand(ctx,
+		"XADD stream:test_kv * a 1 b 2 c 3 a 4");
+	ASSERT_NE(reply, (redisReply *)NULL);
+	freeReplyObject(reply);
+	keys_created.push_back("stream:test_kv");
+
+	items[0].key = "c";
+	items[0].key_len = 1;
+	items[1].key = "a";
+	items[1].key_len = 1;
+	items[2].key = "missing";
+	items[2].key_len = strlen("missing");
+	redis_xread_kv_index_init(&index, items, 3);
+
+	reply = (redisReply *)redisCommand(ctx, "XRANGE stream:test_kv - +");
+	ASSERT_NE(reply, (redisReply *)NULL);
+	ASSERT_EQ(reply->type, REDIS_REPLY_ARRAY);
+	ASSERT_EQ(reply->elements, 1);
+
+	EXPECT_TRUE(redis_xread_parse_kv_indexed(reply->element[0]->element[1], &index));
+	ASSERT_TRUE(items[0].found);
+	EXPECT_STREQ(items[0].reply->str, "3");
+	// The first of a duplicated key wins, same as redis_xread_parse_kv
+	ASSERT_TRUE(items[1].found);
+	EXPECT_STREQ(items[1].reply->str, "1");
+	EXPECT_FALSE(items[2].found);
+
+	freeReplyObject(reply);
+	redis_xread_kv_index_cleanup(&index);
+}
+
+// Collects the IDs of the entries passed to a stream info's callback
+static bool collect_ids_cb(
+	const char *id,
+	const struct redisReply *reply,
+	void *user_data)
+{
+	((std::vector<std::string> *)user_data)->push_back(id);
+	return true;
+}
+
+// Tests that the read policies only pass on the newest entries and count
+//	the rest as dropped
+TEST_F(AtomRedisTest, read_policy) {
+	redisReply *reply;
+	std::vector<std::string> added, read;
+	struct redis_stream_info info;
+	size_t dropped = 0;
+
+	// Adds n entries to the stream, noting their IDs
+	auto add = [&](int n) {
+		for (int i = 0; i < n; ++i) {
+			reply = (redisReply *)redisCommand(ctx, "XADD stream:test_policy * a %d", i);
+			ASSERT_NE(reply, (redisReply *)NULL);
+			ASSERT_EQ(reply->type, REDIS_REPLY_STRING);
+			added.push_back(reply->str);
+			freeReplyObject(reply);
+		}
+	};
+	keys_created.push_back("stream:test_policy");
+
+	ASSERT_TRUE(redis_init_stream_info(ctx, &info, "stream:test_policy",
+		collect_ids_cb, "0", &read));
+	info.policy = REDIS_READ_LATEST;
+	info.items_dropped = &dropped;
+
+	// Only the newest of the backlog is passed on
+	add(5);
+	ASSERT_TRUE(redis_xread(ctx, &info, 1, REDIS_XREAD_DONTBLOCK, REDIS_XREAD_NOMAXCOUNT));
+	ASSERT_EQ(read.size(), 1);
+	EXPECT_EQ(read[0], added[4]);
+	EXPECT_EQ(dropped, 4);
+	EXPECT_EQ(info.items_read, 1);
+
+	// A single new entry isn't dropped
+	add(1);
+	ASSERT_TRUE(redis_xread(ctx, &info, 1, REDIS_XREAD_DONTBLOCK, REDIS_XREAD_NOMAXCOUNT));
+	ASSERT_EQ(read.size(), 2);
+	EXPECT_EQ(read[1], added[5]);
+	EXPECT_EQ(dropped, 4);
+
+	// With a rate the first read passes on the newest, and reads within
+	//	the interval after it pass on nothing but still move past the
+	//	entries
+	info.policy = REDIS_READ_RATE;
+	info.min_interval_ns = 3600ULL * 1000000000ULL;
+	add(3);
+	ASSERT_TRUE(redis_xread(ctx, &info, 1, REDIS_XREAD_DONTBLOCK, REDIS_XREAD_NOMAXCOUNT));
+	ASSERT_EQ(read.size(), 3);
+	EXPECT_EQ(read[2], added[8]);
+	EXPECT_EQ(dropped, 6);
+
+	add(2);
+	ASSERT_TRUE(redis_xread(ctx, &info, 1, REDIS_XREAD_DONTBLOCK, REDIS_XREAD_NOMAXCOUNT));
+	EXPECT_EQ(read.size(), 3);
+	EXPECT_EQ(dropped, 8);
+	EXPECT_STREQ(info.last_id, added[10].c_str());
+	EXPECT_EQ(info.items_read, 0);
+}
+
+// Copies the values of the entries passed to a stream info's callback.
+//	Reads the stream again from inside the callback s.t. a reply is built
+//	while another's still in the arena
+struct arena_read {
+	redisContext *ctx;
+	std::vector<std::string> values;
+	size_t nested;
+};
+
+static bool nested_cb(
+	const char *id,
+	const struct redisReply *reply,
+	void *user_data)
+{
+	((struct arena_read *)user_data)->nested++;
+	return true;
+}
+
+static bool collect_values_cb(
+	const char *id,
+	const struct redisReply *reply,
+	void *user_data)
+{
+	struct arena_read *read = (struct arena_read *)user_data;
+
+	if ((reply->elements != 2) ||
+		(reply->element[1]->type != REDIS_REPLY_STRING))
+	{
+		return false;
+	}
+	read->values.push_back(
+		std::string(reply->element[1]->str, reply->element[1]->len));
+	return redis_xrevrange(read->ctx, "stream:test_arena", nested_cb, 1, read);
+}
+
+// Tests that replies built in the arena come through whole, whether they
+//	fit in a block or not, and that the arena is reused from read to read
+TEST_F(AtomRedisTest, reply_arena) {
+	struct redis_stream_info info;
+	struct redis_xadd_info item;
+	struct arena_read read;
+	std::vector<std::string> added;
+	char id[STREAM_ID_BUFFLEN];
+
+	keys_created.push_back("stream:test_arena");
+	read.ctx = ctx;
+	read.nested = 0;
+	ASSERT_TRUE(redis_init_stream_info(ctx, &info, "stream:test_arena",
+		collect_values_cb, "0", &read));
+
+	for (int round = 0; round < 3; ++round) {
+
+		// Lots of small values and one bigger than a block
+		added.clear();
+		read.values.clear();
+		for (int i = 0; i < 200; ++i) {
+			added.push_back(std::to_string(round) + ":" + std::to_string(i));
+		}
+		added.push_back(std::string(100 * 1024, 'a' + round));
+
+		for (auto const &v : added) {
+			item.key = "v";
+			item.key_len = 1;
+			item.data = (const uint8_t *)v.data();
+			item.data_len = v.size();
+			ASSERT_TRUE(redis_xadd(ctx, "stream:test_arena", &item, 1,
+				REDIS_XADD_NO_MAXLEN, false, id));
+		}
+
+		ASSERT_TRUE(redis_xread(ctx, &info, 1, REDIS_XREAD_DONTBLOCK,
+			REDIS_XREAD_NOMAXCOUNT));
+		EXPECT_EQ(read.values, added);
+	}
+	EXPECT_EQ(read.nested, 3 * 201);
+}
+
+// Counts the keys of the entries passed to a stream info's callback
+static bool count_keys_cb(
+	const char *id,
+	const struct redisReply *reply,
+	void *user_data)
+{
+	*(size_t *)user_data += reply->elements / 2;
+	return true;
+}
+
+// Tests XADDs and XREADs with many more args than used to fit
+TEST_F(AtomRedisTest, many_args) {
+	const size_t n_streams = 200;
+	const size_t n_keys = 100;
+	std::vector<std::string> names, keys;
+	std::vector<struct redis_xadd_info> items(n_keys);
+	std::vector<struct redis_stream_info> infos(n_streams);
+	size_t n_read = 0;
+	char id[STREAM_ID_BUFFLEN];
+
+	for (size_t k = 0; k < n_keys; ++k) {
+		keys.push_back("key" + std::to_string(k));
+	}
+	for (size_t k = 0; k < n_keys; ++k) {
+		items[k].key = keys[k].c_str();
+		items[k].key_len = keys[k].size();
+		items[k].data = (const uint8_t *)keys[k].data();
+		items[k].data_len = keys[k].size();
+	}
+
+	for (size_t i = 0; i < n_streams; ++i) {
+		names.push_back("stream:test_many_" + std::to_string(i));
+		keys_created.push_back(names.back());
+	}
+	for (size_t i = 0; i < n_streams; ++i) {
+		ASSERT_TRUE(redis_xadd(ctx, names[i].c_str(), items.data(), n_keys,
+			REDIS_XADD_NO_MAXLEN, false, id));
+		ASSERT_TRUE(redis_init_stream_info(ctx, &infos[i], names[i].c_str(),
+			count_keys_cb, "0", &n_read));
+	}
+
+	ASSERT_TRUE(redis_xread(ctx, infos.data(), n_streams,
+		REDIS_XREAD_DONTBLOCK, REDIS_XREAD_NOMAXCOUNT));
+	EXPECT_EQ(n_read, n_streams * n_keys);
+	for (size_t i = 0; i < n_streams; ++i) {
+		EXPECT_EQ(infos[i].items_read, 1);
+	}
+}
+
+TEST_F(AtomRedisTest, topology_key_slot) {
+
+	// Values from the redis cluster spec
+	EXPECT_EQ(redis_crc16("123456789", 9), 0x31C3);
+	EXPECT_EQ(redis_key_slot("foo", 3), 12182);
+
+	// Only a non-empty hash tag is hashed
+	EXPECT_EQ(redis_key_slot("{user1000}.following", 20),
+		redis_key_slot("{user1000}.followers", 20));
+	EXPECT_EQ(redis_key_slot("{user1000}.following", 20),
+		redis_key_slot("user1000", 8));
+	EXPECT_EQ(redis_key_slot("foo{}{bar}", 10),
+		redis_crc16("foo{}{bar}", 10) & (REDIS_CLUSTER_N_SLOTS - 1));
+	EXPECT_NE(redis_key_slot("foo{}{bar}", 10), redis_key_slot("bar", 3));
+}
+
+TEST_F(AtomRedisTest, topology_remote) {
+	struct redis_topology topology;
+
+	ASSERT_TRUE(redis_topology_init(&topology, "remote:a:6379,b:6380,/tmp/c.sock"));
+	EXPECT_EQ(topology.type, REDIS_TOPOLOGY_REMOTE);
+	ASSERT_EQ(topology.n_shards, 3);
+	EXPECT_STREQ(topology.shards[1].host, "b");
+	EXPECT_EQ(topology.shards[1].port, 6380);
+	EXPECT_STREQ(topology.shards[2].socket, "/tmp/c.sock");
+
+	// All of an element's streams are on one shard
+	size_t shard = redis_topology_get_shard(&topology, "elem", "stream:elem:a");
+	EXPECT_LT(shard, 3);
+	EXPECT_EQ(redis_topology_get_shard(&topology, "elem", "stream:elem:b"), shard);
+	redis_topology_cleanup(&topology);
+
+	// Bad specs leave us local
+	EXPECT_FALSE(redis_topology_init(&topology, "remote:a"));
+	EXPECT_EQ(topology.type, REDIS_TOPOLOGY_LOCAL);
+	EXPECT_FALSE(redis_topology_init(&topology, "bogus"));
+	EXPECT_TRUE(redis_topology_init(&topology, "local"));
+	EXPECT_EQ(redis_topology_get_shard(&topology, "elem", "stream:elem:a"),
+		REDIS_TOPOLOGY_NUCLEUS);
+}
@@ -0,0 +1,975 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @file bench_atom.cc
+//
+//  @brief Benchmarks for atom. Each benchmark runs a fixed number of
+//			iterations after a warmup and the results for all of them are
+//			written out as JSON s.t. runs can be compared against a baseline.
+//
+//  @copy 2018 Elementary Robotics. All rights reserved.
+//
+////////////////////////////////////////////////////////////////////////////////
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <time.h>
+#include <sys/utsname.h>
+#include <hiredis/hiredis.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "atom/atom.h"
+#include "atom/redis.h"
+#include "element.h"
+#include "element_response.h"
+#include "element_read_map.h"
+
+using namespace atom;
+
+// Version of the JSON that we write. Bump this if the layout changes
+#define BENCH_SCHEMA_VERSION 1
+
+// Name of the element that sends the commands and writes the streams and
+//	of the one that handles the commands
+#define BENCH_ELEMENT "bench"
+#define BENCH_CMD_ELEMENT "bench_cmd"
+
+// Defaults for the number of timed iterations and the warmup before them
+#define BENCH_DEFAULT_ITERATIONS 1000
+#define BENCH_DEFAULT_WARMUP 100
+
+// Cap on the bytes written by a single entryWrite benchmark s.t. the large
+//	payloads don't take forever
+#define BENCH_MAX_WRITE_BYTES (256 * 1024 * 1024)
+
+// Settings passed on the command line
+struct BenchConfig {
+	int iterations;
+	int warmup;
+	std::string filter;
+	std::string output;
+};
+
+// Stats over a set of samples, in nanoseconds
+struct BenchStats {
+	size_t n;
+	double mean;
+	uint64_t min;
+	uint64_t p50;
+	uint64_t p90;
+	uint64_t p99;
+	uint64_t p999;
+	uint64_t max;
+};
+
+// Result of a single benchmark
+struct BenchResult {
+	std::string name;
+	std::vector<std::pair<std::string, long long>> params;
+	BenchStats latency;
+	double ops_per_sec;
+	double bytes_per_sec;
+	bool ok;
+};
+
+std::vector<BenchResult> results;
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Returns the current time in nanoseconds
+//
+////////////////////////////////////////////////////////////////////////////////
+static uint64_t nowNs()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Computes the stats for the samples, sorting them in place
+//
+////////////////////////////////////////////////////////////////////////////////
+static BenchStats computeStats(
+	std::vector<uint64_t> &samples)
+{
+	BenchStats stats;
+	memset(&stats, 0, sizeof(stats));
+
+	stats.n = samples.size();
+	if (stats.n == 0) {
+		return stats;
+	}
+
+	std::sort(samples.begin(), samples.end());
+
+	double total = 0;
+	for (auto const &x : samples) {
+		total += x;
+	}
+
+	auto percentile = [&samples](double p) {
+		size_t idx = (size_t)(p * (samples.size() - 1) + 0.5);
+		return samples[idx];
+	};
+
+	stats.mean = total / stats.n;
+	stats.min = samples.front();
+	stats.p50 = percentile(0.50);
+	stats.p90 = percentile(0.90);
+	stats.p99 = percentile(0.99);
+	stats.p999 = percentile(0.999);
+	stats.max = samples.back();
+	return stats;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Starts a result for a benchmark. Returns false if the benchmark
+//			doesn't match the filter and shouldn't be run
+//
+////////////////////////////////////////////////////////////////////////////////
+static bool benchStart(
+	const BenchConfig &cfg,
+	BenchResult &res,
+	std::string name,
+	std::vector<std::pair<std::string, long long>> params)
+{
+	res.name = name;
+	for (auto const &x : params) {
+		res.name += "/" + x.first + ":" + std::to_string(x.second);
+	}
+	res.params = params;
+	res.ops_per_sec = 0;
+	res.bytes_per_sec = 0;
+	res.ok = false;
+	memset(&res.latency, 0, sizeof(res.latency));
+
+	if (!cfg.filter.empty() && (res.name.find(cfg.filter) == std::string::npos)) {
+		return false;
+	}
+
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Finishes a result and adds it to the list of results
+//
+////////////////////////////////////////////////////////////////////////////////
+static void benchFinish(
+	BenchResult &res,
+	std::vector<uint64_t> &samples,
+	uint64_t elapsed_ns,
+	size_t n_ops,
+	size_t n_bytes,
+	bool ok)
+{
+	res.latency = computeStats(samples);
+	if (elapsed_ns > 0) {
+		res.ops_per_sec = (double)n_ops * 1e9 / elapsed_ns;
+		res.bytes_per_sec = (double)n_bytes * 1e9 / elapsed_ns;
+	}
+	res.ok = ok;
+
+	if (!ok) {
+		fprintf(stderr, "%s: FAILED\n", res.name.c_str());
+	} else {
+		fprintf(stderr, "%s: p50 %.1fus p99 %.1fus %.0f ops/s\n", res.name.c_str(),
+			res.latency.p50 / 1e3, res.latency.p99 / 1e3, res.ops_per_sec);
+	}
+
+	results.push_back(res);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Makes a payload of the given size. The contents are the same
+//			from run to run
+//
+////////////////////////////////////////////////////////////////////////////////
+static std::string makePayload(
+	size_t size,
+	unsigned seed)
+{
+	std::string payload(size, '\0');
+	uint32_t x = 2463534242u + seed;
+	for (size_t i = 0; i < size; ++i) {
+		x ^= x << 13;
+		x ^= x >> 17;
+		x ^= x << 5;
+		payload[i] = (char)(x & 0xFF);
+	}
+	return payload;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Removes all existing keys s.t. each run starts from the same state
+//
+////////////////////////////////////////////////////////////////////////////////
+static bool flushAll()
+{
+	redisContext *ctx = redis_context_init();
+	if (ctx == NULL) {
+		return false;
+	}
+	redisReply *reply = (redisReply *)redisCommand(ctx, "FLUSHALL");
+	bool ok = (reply != NULL);
+	if (reply != NULL) {
+		freeReplyObject(reply);
+	}
+	redis_context_cleanup(ctx);
+	return ok;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Waits until the element shows up in the system
+//
+////////////////////////////////////////////////////////////////////////////////
+static bool waitForElement(
+	Element &element,
+	std::string name)
+{
+	for (int i = 0; i < 100; ++i) {
+		std::vector<std::string> elements;
+		if (element.getAllElements(elements) != ATOM_NO_ERROR) {
+			return false;
+		}
+		if (std::find(elements.begin(), elements.end(), name) != elements.end()) {
+			return true;
+		}
+		usleep(100000);
+	}
+	return false;
+}
+
+// Raw command that sends back what it was sent
+bool benchEchoCB(
+	const uint8_t *data,
+	size_t data_len,
+	ElementResponse *resp,
+	void *user_data)
+{
+	resp->setData(data, data_len);
+	return true;
+}
+
+// Msgpack command that sends back what it was sent
+class BenchMsgpackEcho : public CommandMsgpack<std::string, std::string> {
+public:
+	using CommandMsgpack<std::string, std::string>::CommandMsgpack;
+
+	virtual bool validate() { return true; }
+
+	virtual bool run() {
+		*res_data = *req_data;
+		return true;
+	}
+};
+
+// Msgpack command with no response
+class BenchMsgpackNoRes : public CommandMsgpack<std::string, std::nullptr_t> {
+public:
+	using CommandMsgpack<std::string, std::nullptr_t>::CommandMsgpack;
+
+	virtual bool validate() { return true; }
+
+	virtual bool run() { return true; }
+};
+
+// Number of bytes in the command payloads
+static const std::vector<long long> command_sizes = {16, 1024, 65536};
+
+// The ways of sending a command that we time
+enum BenchCommandVariant {
+	BENCH_COMMAND_RAW,
+	BENCH_COMMAND_FAST,
+	BENCH_COMMAND_MSGPACK,
+	BENCH_COMMAND_NORESPONSE,
+	BENCH_COMMAND_MSGPACK_NORESPONSE,
+};
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Sends a single command of the given variant. Returns whether it
+//			was a success
+//
+////////////////////////////////////////////////////////////////////////////////
+static bool sendBenchCommand(
+	Element &element,
+	enum BenchCommandVariant variant,
+	std::string &payload)
+{
+	ElementResponse resp;
+	enum atom_error_t err;
+	std::string res;
+
+	switch (variant) {
+		case BENCH_COMMAND_RAW:
+			err = element.sendCommand(resp, BENCH_CMD_ELEMENT, "echo",
+				(const uint8_t *)payload.data(), payload.size());
+			return (err == ATOM_NO_ERROR) && (resp.getData().size() == payload.size());
+		case BENCH_COMMAND_FAST:
+			err = element.sendCommandFast(resp, BENCH_CMD_ELEMENT, "echo_fast",
+				(const uint8_t *)payload.data(), payload.size());
+			return (err == ATOM_NO_ERROR) && (resp.getData().size() == payload.size());
+		case BENCH_COMMAND_MSGPACK:
+			err = element.sendCommand<std::string, std::string>(
+				resp, BENCH_CMD_ELEMENT, "echo_msgpack", payload, res);
+			return (err == ATOM_NO_ERROR) && (res.size() == payload.size());
+		case BENCH_COMMAND_NORESPONSE:
+			err = element.sendCommand(resp, BENCH_CMD_ELEMENT, "echo",
+				(const uint8_t *)payload.data(), payload.size(), false);
+			return (err == ATOM_NO_ERROR);
+		case BENCH_COMMAND_MSGPACK_NORESPONSE:
+			err = element.sendCommandNoRes<std::string>(
+				resp, BENCH_CMD_ELEMENT, "nores_msgpack", payload);
+			return (err == ATOM_NO_ERROR);
+	}
+
+	return false;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Times the round trip of commands to another element, one
+//			command at a time
+//
+////////////////////////////////////////////////////////////////////////////////
+static void benchCommands(
+	const BenchConfig &cfg)
+{
+	static const std::vector<std::pair<std::string, enum BenchCommandVariant>> variants = {
+		{"command_rtt_raw", BENCH_COMMAND_RAW},
+		{"command_rtt_fast", BENCH_COMMAND_FAST},
+		{"command_rtt_msgpack", BENCH_COMMAND_MSGPACK},
+		{"command_rtt_noresponse", BENCH_COMMAND_NORESPONSE},
+		{"command_rtt_msgpack_noresponse", BENCH_COMMAND_MSGPACK_NORESPONSE},
+	};
+
+	// Figure out if we need the command element at all
+	std::vector<std::pair<BenchResult, std::pair<enum BenchCommandVariant, long long>>> todo;
+	for (auto const &v : variants) {
+		for (auto const &size : command_sizes) {
+			BenchResult res;
+			if (benchStart(cfg, res, v.first, {{"bytes", size}})) {
+				todo.push_back({res, {v.second, size}});
+			}
+		}
+	}
+	if (todo.empty()) {
+		return;
+	}
+
+	flushAll();
+	Element element(BENCH_ELEMENT);
+	Element cmd_element(BENCH_CMD_ELEMENT);
+	cmd_element.addCommand("echo", "echoes the data", benchEchoCB, NULL, 1000);
+	cmd_element.addCommand("echo_fast", "echoes the data", benchEchoCB, NULL, 1000, true);
+	cmd_element.addCommand(
+		new BenchMsgpackEcho("echo_msgpack", "echoes the data", 1000));
+	cmd_element.addCommand(
+		new BenchMsgpackNoRes("nores_msgpack", "takes the data", 1000));
+
+	std::thread cmd_thread([&cmd_element]() { cmd_element.run(); });
+	bool alive = waitForElement(element, BENCH_CMD_ELEMENT);
+
+	for (auto &x : todo) {
+		BenchResult &res = x.first;
+		enum BenchCommandVariant variant = x.second.first;
+		std::string payload = makePayload(x.second.second, 0);
+		std::vector<uint64_t> samples;
+		samples.reserve(cfg.iterations);
+		bool ok = alive;
+
+		for (int i = 0; ok && (i < cfg.warmup); ++i) {
+			ok = sendBenchCommand(element, variant, payload);
+		}
+
+		uint64_t begin = nowNs();
+		for (int i = 0; ok && (i < cfg.iterations); ++i) {
+			uint64_t start = nowNs();
+			ok = sendBenchCommand(element, variant, payload);
+			samples.push_back(nowNs() - start);
+		}
+		uint64_t elapsed = nowNs() - begin;
+
+		benchFinish(res, samples, elapsed, samples.size(),
+			samples.size() * payload.size(), ok);
+	}
+
+	cmd_element.stop();
+	cmd_thread.join();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Times entryWrite for different payload sizes and numbers of keys
+//
+////////////////////////////////////////////////////////////////////////////////
+static void benchEntryWrite(
+	const BenchConfig &cfg)
+{
+	static const std::vector<long long> sizes = {16, 256, 4096, 65536, 1048576};
+	static const std::vector<long long> n_keys = {1, 4, 16};
+
+	for (auto const &size : sizes) {
+		for (auto const &keys : n_keys) {
+			BenchResult res;
+			if (!benchStart(cfg, res, "entry_write", {{"bytes", size}, {"keys", keys}})) {
+				continue;
+			}
+
+			flushAll();
+			Element element(BENCH_ELEMENT);
+
+			entry_data_t data;
+			for (long long k = 0; k < keys; ++k) {
+				data["key" + std::to_string(k)] = makePayload(size, k);
+			}
+
+			size_t entry_bytes = size * keys;
+			int iterations = std::max(1, std::min(cfg.iterations,
+				(int)(BENCH_MAX_WRITE_BYTES / entry_bytes)));
+			int warmup = std::min(cfg.warmup, iterations);
+			std::vector<uint64_t> samples;
+			samples.reserve(iterations);
+			bool ok = true;
+
+			for (int i = 0; ok && (i < warmup); ++i) {
+				ok = (element.entryWrite("bench", data) == ATOM_NO_ERROR);
+			}
+
+			uint64_t begin = nowNs();
+			for (int i = 0; ok && (i < iterations); ++i) {
+				uint64_t start = nowNs();
+				ok = (element.entryWrite("bench", data) == ATOM_NO_ERROR);
+				samples.push_back(nowNs() - start);
+			}
+			uint64_t elapsed = nowNs() - begin;
+
+			benchFinish(res, samples, elapsed, samples.size(),
+				samples.size() * entry_bytes, ok);
+		}
+	}
+}
+
+// Fields for the StreamWriter benchmark, the same keys as entry_write with
+//	4 keys
+ATOM_STREAM_FIELD(BenchKey0, "key0");
+ATOM_STREAM_FIELD(BenchKey1, "key1");
+ATOM_STREAM_FIELD(BenchKey2, "key2");
+ATOM_STREAM_FIELD(BenchKey3, "key3");
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Times a StreamWriter for different payload sizes. Comparable to
+//			entry_write with 4 keys
+//
+////////////////////////////////////////////////////////////////////////////////
+static void benchStreamWriter(
+	const BenchConfig &cfg)
+{
+	static const std::vector<long long> sizes = {16, 256, 4096, 65536, 1048576};
+	static const long long keys = 4;
+
+	for (auto const &size : sizes) {
+		BenchResult res;
+		if (!benchStart(cfg, res, "stream_writer", {{"bytes", size}, {"keys", keys}})) {
+			continue;
+		}
+
+		flushAll();
+		Element element(BENCH_ELEMENT);
+		StreamWriter<BenchKey0, BenchKey1, BenchKey2, BenchKey3> writer(
+			element, "bench");
+
+		std::vector<std::string> values;
+		for (long long k = 0; k < keys; ++k) {
+			values.push_back(makePayload(size, k));
+		}
+		writer.bind(values[0], values[1], values[2], values[3]);
+
+		size_t entry_bytes = size * keys;
+		int iterations = std::max(1, std::min(cfg.iterations,
+			(int)(BENCH_MAX_WRITE_BYTES / entry_bytes)));
+		int warmup = std::min(cfg.warmup, iterations);
+		std::vector<uint64_t> samples;
+		samples.reserve(iterations);
+		bool ok = true;
+
+		for (int i = 0; ok && (i < warmup); ++i) {
+			ok = (writer.write() == ATOM_NO_ERROR);
+		}
+
+		uint64_t begin = nowNs();
+		for (int i = 0; ok && (i < iterations); ++i) {
+			uint64_t start = nowNs();
+			ok = (writer.write() == ATOM_NO_ERROR);
+			samples.push_back(nowNs() - start);
+		}
+		uint64_t elapsed = nowNs() - begin;
+
+		benchFinish(res, samples, elapsed, samples.size(),
+			samples.size() * entry_bytes, ok);
+	}
+}
+
+// Counts the entries read for the fan-in benchmark and notes when the
+//	last one came in
+struct FanInCount {
+	size_t n;
+	uint64_t last_ns;
+};
+
+bool benchFanInCB(
+	EntryView &e,
+	void *user_data)
+{
+	FanInCount *count = (FanInCount *)user_data;
+	count->n += 1;
+	count->last_ns = nowNs();
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Times how fast entryReadLoop gets through entries written to
+//			many streams at once. The latency is from each write returning
+//			to the reader having read all of the entries up to it.
+//
+////////////////////////////////////////////////////////////////////////////////
+static void benchEntryReadLoop(
+	const BenchConfig &cfg)
+{
+	static const std::vector<long long> n_streams = {1, 8, 32, 128};
+	static const long long payload_size = 256;
+
+	for (auto const &streams : n_streams) {
+		BenchResult res;
+		if (!benchStart(cfg, res, "entry_read_loop_fan_in",
+			{{"streams", streams}, {"bytes", payload_size}}))
+		{
+			continue;
+		}
+
+		flushAll();
+		Element writer(BENCH_ELEMENT);
+		Element reader("bench_reader");
+
+		// Each stream gets the same number of entries
+		int per_stream = std::max(1, cfg.iterations / (int)streams);
+		size_t total = per_stream * streams;
+
+		std::vector<FanInCount> counts(streams, FanInCount{0, 0});
+		ElementReadMap m;
+		for (long long s = 0; s < streams; ++s) {
+			m.addHandler(BENCH_ELEMENT, "fan_in_" + std::to_string(s),
+				{"data"}, benchFanInCB, &counts[s]);
+		}
+
+		enum atom_error_t read_err = ATOM_NO_ERROR;
+		std::thread read_thread([&]() {
+			read_err = reader.entryReadLoop(m, per_stream);
+		});
+
+		// The reader only gets entries added after its first XREAD, so
+		//	give it a moment to get there
+		usleep(200000);
+
+		entry_data_t data;
+		data["data"] = makePayload(payload_size, 0);
+
+		bool ok = true;
+		uint64_t begin = nowNs();
+		for (int i = 0; ok && (i < per_stream); ++i) {
+			for (long long s = 0; ok && (s < streams); ++s) {
+				ok = (writer.entryWrite("fan_in_" + std::to_string(s), data,
+					ELEMENT_DATA_WRITE_DEFAULT_TIMESTAMP, per_stream) == ATOM_NO_ERROR);
+			}
+		}
+
+		// If a write failed the reader will never finish, so stop it by
+		//	writing out the rest of what it's waiting on
+		if (!ok) {
+			for (long long s = 0; s < streams; ++s) {
+				for (int i = 0; i < per_stream; ++i) {
+					writer.entryWrite("fan_in_" + std::to_string(s), data);
+				}
+			}
+		}
+		read_thread.join();
+
+		uint64_t last = begin;
+		size_t n_read = 0;
+		for (auto const &x : counts) {
+			last = std::max(last, x.last_ns);
+			n_read += x.n;
+		}
+		ok = ok && (read_err == ATOM_NO_ERROR) && (n_read >= total);
+
+		// Only the total time is meaningful here, one sample per run
+		std::vector<uint64_t> samples = {last - begin};
+		benchFinish(res, samples, last - begin, n_read, n_read * payload_size, ok);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Times entryReadN for different numbers of entries, both copying
+//			the entries and as views into the reply
+//
+////////////////////////////////////////////////////////////////////////////////
+static void benchEntryReadN(
+	const BenchConfig &cfg)
+{
+	static const std::vector<long long> depths = {1, 10, 100, 1000};
+	static const long long payload_size = 256;
+
+	for (auto const &depth : depths) {
+		for (int view = 0; view < 2; ++view) {
+			BenchResult res;
+			if (!benchStart(cfg, res, view ? "entry_read_n_view" : "entry_read_n",
+				{{"depth", depth}, {"bytes", payload_size}}))
+			{
+				continue;
+			}
+
+			flushAll();
+			Element element(BENCH_ELEMENT);
+
+			entry_data_t data;
+			data["data"] = makePayload(payload_size, 0);
+			bool ok = true;
+			for (long long i = 0; ok && (i < depth); ++i) {
+				ok = (element.entryWrite("depth", data,
+					ELEMENT_DATA_WRITE_DEFAULT_TIMESTAMP, depth) == ATOM_NO_ERROR);
+			}
+
+			std::vector<std::string> keys = {"data"};
+			auto read = [&]() {
+				if (view) {
+					std::vector<EntryView> ret;
+					return (element.entryReadN(BENCH_ELEMENT, "depth", keys, depth, ret) == ATOM_NO_ERROR) &&
+						(ret.size() == (size_t)depth);
+				} else {
+					std::vector<Entry> ret;
+					return (element.entryReadN(BENCH_ELEMENT, "depth", keys, depth, ret) == ATOM_NO_ERROR) &&
+						(ret.size() == (size_t)depth);
+				}
+			};
+
+			std::vector<uint64_t> samples;
+			samples.reserve(cfg.iterations);
+
+			for (int i = 0; ok && (i < cfg.warmup); ++i) {
+				ok = read();
+			}
+
+			uint64_t begin = nowNs();
+			for (int i = 0; ok && (i < cfg.iterations); ++i) {
+				uint64_t start = nowNs();
+				ok = read();
+				samples.push_back(nowNs() - start);
+			}
+			uint64_t elapsed = nowNs() - begin;
+
+			benchFinish(res, samples, elapsed, samples.size() * depth,
+				samples.size() * depth * payload_size, ok);
+		}
+	}
+}
+
+// Value decoded by the stream reader benchmark
+struct BenchSample {
+	std::vector<double> data;
+};
+
+bool benchSampleCB(
+	BenchSample &value,
+	EntryView &e,
+	void *user_data)
+{
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Times reading entries of msgpack and decoding them, both the
+//			way handlers of copied entries do it and with a StreamReader
+//
+////////////////////////////////////////////////////////////////////////////////
+static void benchStreamReader(
+	const BenchConfig &cfg)
+{
+	static const long long depth = 100;
+	static const long long n_values = 32;
+
+	for (int typed = 0; typed < 2; ++typed) {
+		BenchResult res;
+		if (!benchStart(cfg, res, typed ? "stream_reader" : "entry_read_n_msgpack",
+			{{"depth", depth}, {"values", n_values}}))
+		{
+			continue;
+		}
+
+		flushAll();
+		Element element(BENCH_ELEMENT);
+
+		msgpack::sbuffer buffer;
+		msgpack::pack(buffer, std::vector<double>(n_values, 1.0));
+		entry_data_t data;
+		data["data"] = std::string(buffer.data(), buffer.size());
+		bool ok = true;
+		for (long long i = 0; ok && (i < depth); ++i) {
+			ok = (element.entryWrite("msgpack", data,
+				ELEMENT_DATA_WRITE_DEFAULT_TIMESTAMP, depth) == ATOM_NO_ERROR);
+		}
+
+		StreamReader<BenchSample> reader(benchSampleCB);
+		reader.field("data", &BenchSample::data);
+		std::vector<std::string> keys = reader.getKeys();
+
+		auto read = [&]() {
+			if (typed) {
+				std::vector<EntryView> ret;
+				if (element.entryReadN(BENCH_ELEMENT, "msgpack", keys, depth, ret) != ATOM_NO_ERROR) {
+					return false;
+				}
+				for (auto &e : ret) {
+					if (!reader.decode(e)) {
+						return false;
+					}
+				}
+				return ret.size() == (size_t)depth;
+			} else {
+				std::vector<Entry> ret;
+				if (element.entryReadN(BENCH_ELEMENT, "msgpack", keys, depth, ret) != ATOM_NO_ERROR) {
+					return false;
+				}
+				for (auto &e : ret) {
+					const std::string &value = e.getKey("data");
+					msgpack::object_handle oh = msgpack::unpack(value.data(), value.size());
+					std::vector<double> sample = oh.get().as<std::vector<double>>();
+					if (sample.size() != (size_t)n_values) {
+						return false;
+					}
+				}
+				return ret.size() == (size_t)depth;
+			}
+		};
+
+		std::vector<uint64_t> samples;
+		samples.reserve(cfg.iterations);
+
+		for (int i = 0; ok && (i < cfg.warmup); ++i) {
+			ok = read();
+		}
+
+		uint64_t begin = nowNs();
+		for (int i = 0; ok && (i < cfg.iterations); ++i) {
+			uint64_t start = nowNs();
+			ok = read();
+			samples.push_back(nowNs() - start);
+		}
+		uint64_t elapsed = nowNs() - begin;
+
+		benchFinish(res, samples, elapsed, samples.size() * depth,
+			samples.size() * depth * data["data"].size(), ok);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Escapes a string for JSON
+//
+////////////////////////////////////////////////////////////////////////////////
+static std::string jsonString(
+	const std::string &s)
+{
+	std::string out = "\"";
+	for (auto const &c : s) {
+		switch (c) {
+			case '"':
+				out += "\\\"";
+				break;
+			case '\\':
+				out += "\\\\";
+				break;
+			case '\n':
+				out += "\\n";
+				break;
+			default:
+				if ((unsigned char)c < 0x20) {
+					char buf[8];
+					snprintf(buf, sizeof(buf), "\\u%04x", c);
+					out += buf;
+				} else {
+					out += c;
+				}
+				break;
+		}
+	}
+	return out + "\"";
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Writes out the results along with the host they were run on
+//
+////////////////////////////////////////////////////////////////////////////////
+static void writeResults(
+	const BenchConfig &cfg,
+	std::ostream &out)
+{
+	struct utsname host;
+	if (uname(&host) != 0) {
+		memset(&host, 0, sizeof(host));
+	}
+
+	char timestamp[32];
+	time_t now = time(NULL);
+	strftime(timestamp, sizeof(timestamp), "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+
+	out << "{\n";
+	out << "  \"schema\": " << BENCH_SCHEMA_VERSION << ",\n";
+	out << "  \"language\": \"cpp\",\n";
+	out << "  \"version\": " << jsonString(ATOM_VERSION) << ",\n";
+	out << "  \"timestamp\": " << jsonString(timestamp) << ",\n";
+	out << "  \"host\": {\n";
+	out << "    \"name\": " << jsonString(host.nodename) << ",\n";
+	out << "    \"kernel\": " << jsonString(host.release) << ",\n";
+	out << "    \"machine\": " << jsonString(host.machine) << ",\n";
+	out << "    \"cpus\": " << std::thread::hardware_concurrency() << "\n";
+	out << "  },\n";
+	out << "  \"config\": {\n";
+	out << "    \"iterations\": " << cfg.iterations << ",\n";
+	out << "    \"warmup\": " << cfg.warmup << ",\n";
+	out << "    \"filter\": " << jsonString(cfg.filter) << "\n";
+	out << "  },\n";
+	out << "  \"benchmarks\": [";
+
+	for (size_t i = 0; i < results.size(); ++i) {
+		const BenchResult &res = results[i];
+		out << (i == 0 ? "\n" : ",\n");
+		out << "    {\n";
+		out << "      \"name\": " << jsonString(res.name) << ",\n";
+		out << "      \"ok\": " << (res.ok ? "true" : "false") << ",\n";
+		out << "      \"params\": {";
+		for (size_t j = 0; j < res.params.size(); ++j) {
+			out << (j == 0 ? "" : ", ") << jsonString(res.params[j].first)
+				<< ": " << res.params[j].second;
+		}
+		out << "},\n";
+		out << "      \"ops_per_sec\": " << res.ops_per_sec << ",\n";
+		out << "      \"bytes_per_sec\": " << res.bytes_per_sec << ",\n";
+		out << "      \"latency_ns\": {";
+		out << "\"n\": " << res.latency.n;
+		out << ", \"mean\": " << (uint64_t)res.latency.mean;
+		out << ", \"min\": " << res.latency.min;
+		out << ", \"p50\": " << res.latency.p50;
+		out << ", \"p90\": " << res.latency.p90;
+		out << ", \"p99\": " << res.latency.p99;
+		out << ", \"p999\": " << res.latency.p999;
+		out << ", \"max\": " << res.latency.max;
+		out << "}\n";
+		out << "    }";
+	}
+
+	out << "\n  ]\n";
+	out << "}\n";
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Prints the usage
+//
+////////////////////////////////////////////////////////////////////////////////
+static void usage(
+	const char *prog)
+{
+	fprintf(stderr,
+		"Usage: %s [-i iterations] [-w warmup] [-f filter] [-o output.json]\n"
+		"  -i  timed iterations per benchmark (default %d)\n"
+		"  -w  untimed iterations before each benchmark (default %d)\n"
+		"  -f  only run benchmarks whose name contains filter\n"
+		"  -o  file to write the JSON results to (default stdout)\n",
+		prog, BENCH_DEFAULT_ITERATIONS, BENCH_DEFAULT_WARMUP);
+}
+
+int main(
+	int argc,
+	char **argv)
+{
+	BenchConfig cfg;
+	cfg.iterations = BENCH_DEFAULT_ITERATIONS;
+	cfg.warmup = BENCH_DEFAULT_WARMUP;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "i:w:f:o:h")) != -1) {
+		switch (opt) {
+			case 'i':
+				cfg.iterations = atoi(optarg);
+				break;
+			case 'w':
+				cfg.warmup = atoi(optarg);
+				break;
+			case 'f':
+				cfg.filter = optarg;
+				break;
+			case 'o':
+				cfg.output = optarg;
+				break;
+			default:
+				usage(argv[0]);
+				return (opt == 'h') ? 0 : 1;
+		}
+	}
+
+	if ((cfg.iterations <= 0) || (cfg.warmup < 0)) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	if (!flushAll()) {
+		fprintf(stderr, "Failed to connect to redis\n");
+		return 1;
+	}
+
+	benchCommands(cfg);
+	benchEntryWrite(cfg);
+	benchStreamWriter(cfg);
+	benchEntryReadLoop(cfg);
+	benchEntryReadN(cfg);
+	benchStreamReader(cfg);
+
+	if (cfg.output.empty()) {
+		writeResults(cfg, std::cout);
+	} else {
+		std::ofstream out(cfg.output);
+		if (!out) {
+			fprintf(stderr, "Failed to open %s\n", cfg.output.c_str());
+			return 1;
+		}
+		writeResults(cfg, out);
+	}
+
+	// Fail if any of the benchmarks did
+	for (auto const &res : results) {
+		if (!res.ok) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
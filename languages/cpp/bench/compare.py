@@ -0,0 +1,76 @@
+#!/usr/bin/env python3
+"""
+Compares the results of a benchmark run against a baseline from
+bench_atom_cpp. Exits nonzero if any benchmark got slower than the
+threshold or failed.
+"""
+import argparse
+import json
+import sys
+
+
+def load(path):
+    with open(path) as f:
+        results = json.load(f)
+    return {b["name"]: b for b in results["benchmarks"]}
+
+
+def change(old, new):
+    if old == 0:
+        return 0.0
+    return (new - old) / old
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("baseline", help="JSON results to compare against")
+    parser.add_argument("results", help="JSON results of the new run")
+    parser.add_argument(
+        "--threshold",
+        type=float,
+        default=0.10,
+        help="fractional slowdown that counts as a regression (default 0.10)",
+    )
+    parser.add_argument(
+        "--percentile",
+        default="p50",
+        choices=["mean", "p50", "p90", "p99", "p999"],
+        help="latency percentile to compare (default p50)",
+    )
+    args = parser.parse_args()
+
+    baseline = load(args.baseline)
+    results = load(args.results)
+
+    regressed = []
+    print(f"{'benchmark':<60} {'latency':>9} {'ops/s':>9}")
+    for name in sorted(results):
+        new = results[name]
+        if not new["ok"]:
+            print(f"{name:<60} {'FAILED':>9}")
+            regressed.append(name)
+            continue
+        if name not in baseline or not baseline[name]["ok"]:
+            print(f"{name:<60} {'new':>9}")
+            continue
+
+        old = baseline[name]
+        latency = change(old["latency_ns"][args.percentile], new["latency_ns"][args.percentile])
+        ops = change(old["ops_per_sec"], new["ops_per_sec"])
+        flag = ""
+        if latency > args.threshold or ops < -args.threshold:
+            flag = " REGRESSED"
+            regressed.append(name)
+        print(f"{name:<60} {latency:>+9.1%} {ops:>+9.1%}{flag}")
+
+    for name in sorted(set(baseline) - set(results)):
+        print(f"{name:<60} {'missing':>9}")
+
+    if regressed:
+        print(f"\n{len(regressed)} benchmark(s) regressed by more than {args.threshold:.0%}")
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
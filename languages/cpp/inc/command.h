@@ -12,6 +12,8 @@
 #define __ELEMENT_COMMAND_H
 
 #include <sstream>
+#include <mutex>
+#include <vector>
 #include <msgpack.hpp>
 #include <iostream>
 #include "element_response.h"
@@ -32,8 +34,117 @@ typedef bool (*command_handler_t)(
 // Default command timeout of 1s
 #define COMMAND_DEFAULT_TIMEOUT_MS 1000
 
+// Error codes returned by the stages of a command
+#define COMMAND_ERROR_DESERIALIZE 101
+#define COMMAND_ERROR_VALIDATE 102
+#define COMMAND_ERROR_RUN 103
+#define COMMAND_ERROR_SERIALIZE 104
+
+class Command;
+
+// Reference function for unpacking requests. Strings, binary and extension
+//	data point into the buffer being unpacked instead of being copied into
+//	the zone. Requests are only unpacked while the command data is alive.
+inline bool commandUnpackReferenceFn(
+	msgpack::type::object_type type,
+	std::size_t length,
+	void *user_data)
+{
+	return true;
+}
+
+// State for a single call of a command. Lives from when the command
+//	handler is called until the response has been sent. Invocations are
+//	recycled by the command s.t. a call doesn't allocate once the command
+//	is warmed up.
+class CommandInvocation {
+public:
+	Command *cmd;
+	ElementResponse response;
+
+	// Zone the request is unpacked into and buffer the response is
+	//	packed into
+	msgpack::zone unpack_zone;
+	msgpack::sbuffer pack_buffer;
+
+	CommandInvocation(
+		Command *c) : cmd(c) {}
+
+	virtual ~CommandInvocation() {}
+
+	// Resets the state left over from the last call
+	virtual void reset()
+	{
+		response.clear();
+	}
+};
+
+// Returns the invocation being run on the calling thread
+inline CommandInvocation *&commandCurrentInvocation()
+{
+	static thread_local CommandInvocation *current = NULL;
+	return current;
+}
+
+// Makes an invocation the calling thread's current one for as long
+//	as it's in scope
+class CommandInvocationScope {
+	CommandInvocation *prev;
+
+public:
+	CommandInvocationScope(
+		CommandInvocation *inv) : prev(commandCurrentInvocation())
+	{
+		commandCurrentInvocation() = inv;
+	}
+
+	~CommandInvocationScope()
+	{
+		commandCurrentInvocation() = prev;
+	}
+};
+
+// Pointer to per-call data of a command. Dereferences to the data of the
+//	invocation being run on the calling thread s.t. command members like
+//	response and req_data can be used as before while calls of the same
+//	command run concurrently.
+template <typename T, T *(*Get)(CommandInvocation *)>
+class CommandCallPtr {
+public:
+	T *get() const { return Get(commandCurrentInvocation()); }
+	T &operator*() const { return *get(); }
+	T *operator->() const { return get(); }
+	operator T *() const { return get(); }
+};
+
+// Same as above but for per-call values that are read and assigned
+//	rather than dereferenced
+template <typename T, T *(*Get)(CommandInvocation *)>
+class CommandCallValue {
+public:
+	operator T() const { return *Get(commandCurrentInvocation()); }
+	CommandCallValue &operator=(
+		T value)
+	{
+		*Get(commandCurrentInvocation()) = value;
+		return *this;
+	}
+};
+
+// Gets the response from an invocation
+inline ElementResponse *commandInvocationResponse(
+	CommandInvocation *inv)
+{
+	return &inv->response;
+}
+
 // Base command class. Virtual deserialize and serialize
-//	functions MUST be implemented by any inheriting class
+//	functions MUST be implemented by any inheriting class.
+//
+// The request and response live in the invocation, so when the element is
+//	run with multiple command workers, calls of the same command run
+//	concurrently. Anything else a command keeps in its own members is
+//	shared between those calls and has to be protected by the command.
 class Command {
 public:
 
@@ -42,32 +153,35 @@ public:
 
 	int timeout_ms;
 
+	// Fast commands skip the separate ACK. See ELEMENT_COMMAND_FLAG_FAST.
+	//	Must be set before the command is added to the element
+	bool fast;
+
 	Element *elem;
-	ElementResponse *response;
 
-	// Constructor takes a name, description and timeout
+	// Response of the call being run on this thread
+	CommandCallPtr<ElementResponse, commandInvocationResponse> response;
+
+	// Constructor takes a name, description, timeout and whether the
+	//	command is fast
 	Command(
 		std::string n,
 		std::string d,
-		int t = COMMAND_DEFAULT_TIMEOUT_MS) :
+		int t = COMMAND_DEFAULT_TIMEOUT_MS,
+		bool f = false) :
 		name(n),
 		desc(d),
 		timeout_ms(t),
-		elem(NULL),
-		response(NULL)
-	{
-		// Call the _init() function so that we, by default
-		//	have request and response data
-		_init();
-	}
+		fast(f),
+		elem(NULL) {}
 
 	// Virtual destructor. This is s.t. the derived classes
 	//	can be properly destroyed
 	virtual ~Command()
 	{
-		// Call the _cleanup() function since we created
-		//	memory in the _init() function
-		_cleanup();
+		for (auto inv : free_invocations) {
+			delete inv;
+		}
 	}
 
 	// Add an element to the command
@@ -83,8 +197,7 @@ public:
 	//	a callback. Will call the inherited
 	//	class's setup as well
 	void _init() {
-		_cleanup();
-		response = new ElementResponse();
+		commandCurrentInvocation()->reset();
 		init();
 	}
 
@@ -95,13 +208,127 @@ public:
 	// Cleanup function for each time we finish a callback.
 	//	Will call the inherited class's cleanup as well
 	void _cleanup() {
-		if (response != NULL) {
-			delete response;
-			response = NULL;
-		}
 		cleanup();
 	}
 
+	// Invocations that have finished and can be used for the next call
+	std::mutex invocation_mutex;
+	std::vector<CommandInvocation *> free_invocations;
+
+	// Makes the state for a call. Commands with their own per-call data
+	//	return a subclass holding it
+	virtual CommandInvocation *newInvocation()
+	{
+		return new CommandInvocation(this);
+	}
+
+	// Gets the state for a new call of the command, recycling a finished
+	//	one if there is one
+	CommandInvocation *getInvocation()
+	{
+		{
+			std::lock_guard<std::mutex> lock(invocation_mutex);
+			if (!free_invocations.empty()) {
+				CommandInvocation *inv = free_invocations.back();
+				free_invocations.pop_back();
+				return inv;
+			}
+		}
+		return newInvocation();
+	}
+
+	// Hands back the state for a call once it's finished
+	void releaseInvocation(
+		CommandInvocation *inv)
+	{
+		inv->response.clear();
+
+		std::lock_guard<std::mutex> lock(invocation_mutex);
+		free_invocations.push_back(inv);
+	}
+
+	// Unpacks msgpack data into value. Strings and binary data are
+	//	referenced from data rather than copied while unpacking
+	template <typename T>
+	bool unpackRequest(
+		const uint8_t *data,
+		size_t data_len,
+		T &value)
+	{
+		msgpack::zone &zone = commandCurrentInvocation()->unpack_zone;
+		try {
+			zone.clear();
+			msgpack::object obj = msgpack::unpack(
+				zone, (const char *)data, data_len,
+				commandUnpackReferenceFn);
+			obj.convert(value);
+			return true;
+		} catch (...) {
+			return false;
+		}
+	}
+
+	// Packs value into the response
+	template <typename T>
+	bool packResponse(
+		const T &value)
+	{
+		msgpack::sbuffer &buffer = commandCurrentInvocation()->pack_buffer;
+		try {
+			buffer.clear();
+			msgpack::pack(buffer, value);
+			response->setData(
+				(const uint8_t *)buffer.data(), buffer.size());
+			return true;
+		} catch (...) {
+			return false;
+		}
+	}
+
+	// Runs a single call of the command on the data, returning the
+	//	error code. By default runs through deserialize(), validate(),
+	//	run() and serialize() with the invocation as this thread's
+	//	current one.
+	virtual int _invoke(
+		const uint8_t *data,
+		size_t data_len,
+		CommandInvocation &inv,
+		const char **error_str)
+	{
+		CommandInvocationScope scope(&inv);
+
+		// Initialize the command
+		_init();
+
+		// Run through the command functions
+		if (!deserialize(data, data_len)) {
+			*error_str = "Failed to deserialize";
+			return COMMAND_ERROR_DESERIALIZE;
+		}
+		if (!validate()) {
+			*error_str = "Failed to validate";
+			return COMMAND_ERROR_VALIDATE;
+		}
+		if (!run()) {
+			*error_str = "Failed to run";
+			return COMMAND_ERROR_RUN;
+		}
+		if (!serialize()) {
+			*error_str = "Failed to serialize";
+			return COMMAND_ERROR_SERIALIZE;
+		}
+
+		return 0;
+	}
+
+	// Called once the response for the invocation has been sent
+	virtual void _finish(
+		CommandInvocation &inv)
+	{
+		CommandInvocationScope scope(&inv);
+		_cleanup();
+	}
+
 	// Deserialization function pointer
 	virtual bool deserialize(
 		const uint8_t *data,
@@ -117,14 +344,41 @@ public:
 	virtual bool run() = 0;
 };
 
+// Per-call request data of a user callback command
+class CommandUserCallbackInvocation : public CommandInvocation {
+public:
+	const uint8_t *req_data;
+	size_t req_data_len;
+
+	CommandUserCallbackInvocation(
+		Command *c) : CommandInvocation(c), req_data(NULL), req_data_len(0) {}
+
+	// Get the request data from an invocation
+	static const uint8_t **getReqData(
+		CommandInvocation *inv)
+	{
+		return &static_cast<CommandUserCallbackInvocation *>(inv)->req_data;
+	}
+
+	static size_t *getReqDataLen(
+		CommandInvocation *inv)
+	{
+		return &static_cast<CommandUserCallbackInvocation *>(inv)->req_data_len;
+	}
+};
+
 // Command that executes a user callback with the
 //	given callback function and data
 class CommandUserCallback : public Command {
 public:
 	command_handler_t cb;
 	void *udata;
-	const uint8_t *req_data;
-	size_t req_data_len;
+
+	// Request data of the call being run on this thread
+	CommandCallValue<const uint8_t *,
+		CommandUserCallbackInvocation::getReqData> req_data;
+	CommandCallValue<size_t,
+		CommandUserCallbackInvocation::getReqDataLen> req_data_len;
 
 	// Initialize the user callback command with the
 	//	handler and the callback
@@ -133,8 +387,9 @@ public:
 		std::string d,
 		command_handler_t handler,
 		void *user_data,
-		int t = COMMAND_DEFAULT_TIMEOUT_MS) :
-		Command(n, d, t),
+		int t = COMMAND_DEFAULT_TIMEOUT_MS,
+		bool f = false) :
+		Command(n, d, t, f),
 		cb(handler),
 		udata(user_data) {}
 
@@ -158,50 +413,85 @@ public:
 
 	// Serialization. Nothing to do here
 	virtual bool serialize() { return true; }
+
+	// The request data is kept in the invocation s.t. calls can run
+	//	concurrently and still go through init() and cleanup()
+	virtual CommandInvocation *newInvocation()
+	{
+		return new CommandUserCallbackInvocation(this);
+	}
 };
 
-// Msgpack message template with both request and response
+// Clears a request or response for the next call. Anything with a clear(),
+//	like the containers, is cleared in place s.t. it keeps its capacity,
+//	and anything else is set back to its default
+template <class T>
+inline auto commandClearValue(
+	T &value,
+	int) -> decltype(value.clear(), void())
+{
+	value.clear();
+}
+
+template <class T>
+inline void commandClearValue(
+	T &value,
+	long)
+{
+	value = T();
+}
+
+// Per-call request and response of a msgpack command
 template <class Req, class Res>
-class CommandMsgpack : public Command {
+class CommandMsgpackInvocation : public CommandInvocation {
 public:
-	// Request and response
-	Req *req_data;
-	Res *res_data;
+	Req req;
+	Res res;
 
-	// Use the constructor and destructor from the base class
-	CommandMsgpack(
-		std::string n,
-		std::string d,
-		int t = COMMAND_DEFAULT_TIMEOUT_MS) :
-		Command(n, d, t),
-		req_data(NULL),
-		res_data(NULL)
+	CommandMsgpackInvocation(
+		Command *c) : CommandInvocation(c) {}
+
+	// Starts the next call with an empty request and response
+	virtual void reset()
 	{
-		init();
+		CommandInvocation::reset();
+		commandClearValue(req, 0);
+		commandClearValue(res, 0);
 	}
 
-	virtual ~CommandMsgpack()
+	// Get the request and response from an invocation
+	static Req *getReq(
+		CommandInvocation *inv)
 	{
-		cleanup();
+		return &static_cast<CommandMsgpackInvocation *>(inv)->req;
 	}
 
-	// Init function. Allocate the request and response
-	virtual void init() {
-		cleanup();
-		req_data = new Req;
-		res_data = new Res;
+	static Res *getRes(
+		CommandInvocation *inv)
+	{
+		return &static_cast<CommandMsgpackInvocation *>(inv)->res;
 	}
+};
 
-	// Cleanup function. Free the request and response
-	virtual void cleanup() {
-		if (req_data != NULL) {
-			delete req_data;
-			req_data = NULL;
-		}
-		if (res_data != NULL) {
-			delete res_data;
-			res_data = NULL;
-		}
+// Msgpack message template with both request and response
+template <class Req, class Res>
+class CommandMsgpack : public Command {
+public:
+	typedef CommandMsgpackInvocation<Req, Res> Invocation;
+
+	// Request and response of the call being run on this thread
+	CommandCallPtr<Req, Invocation::getReq> req_data;
+	CommandCallPtr<Res, Invocation::getRes> res_data;
+
+	// Use the constructor and destructor from the base class
+	// The request and response live in the invocation and are reset
+	//	at the start of each call
+	using Command::Command;
+
+	// Each call gets its own request and response
+	virtual CommandInvocation *newInvocation()
+	{
+		return new Invocation(this);
 	}
 
 	// Deserialization function into req_data.
@@ -209,32 +499,13 @@ public:
 		const uint8_t *data,
 		size_t data_len)
 	{
-        // Convert into the request data
-        try {
-			msgpack::object_handle oh =
-				msgpack::unpack((const char *)data, data_len);
-	        msgpack::object deserialized = oh.get();
-        	deserialized.convert(*req_data);
-        	return true;
-        } catch (...) {
-        	return false;
-        }
+		return unpackRequest(data, data_len, *req_data);
 	}
 
 	// Serialization function
 	virtual bool serialize()
 	{
-		std::stringstream buffer;
-
-		// Try to serialize the data. This shouldn't
-		//	ever fail since the class is templated
-		try {
-			msgpack::pack(buffer, *res_data);
-			response->setData(buffer.str());
-			return true;
-		} catch (...) {
-			return false;
-		}
+		return packResponse(*res_data);
 	}
 };
 
@@ -242,37 +513,20 @@ public:
 template <class Res>
 class CommandMsgpack<std::nullptr_t, Res> : public Command {
 public:
-	// Request and response
-	Res *res_data;
+	typedef CommandMsgpackInvocation<std::nullptr_t, Res> Invocation;
+
+	// Response of the call being run on this thread
+	CommandCallPtr<Res, Invocation::getRes> res_data;
 
 	// Use the constructor and destructor from the base class
-	CommandMsgpack(
-		std::string n,
-		std::string d,
-		int t = COMMAND_DEFAULT_TIMEOUT_MS) :
-		Command(n, d, t),
-		res_data(NULL)
-	{
-		init();
-	}
+	// The response lives in the invocation and is reset at the start
+	//	of each call
+	using Command::Command;
 
-	virtual ~CommandMsgpack()
+	// Each call gets its own response
+	virtual CommandInvocation *newInvocation()
 	{
-		cleanup();
-	}
-
-	// Init function. Allocate the request and response
-	virtual void init() {
-		cleanup();
-		res_data = new Res;
-	}
-
-	// Cleanup function. Free the request and response
-	virtual void cleanup() {
-		if (res_data != NULL) {
-			delete res_data;
-			res_data = NULL;
-		}
+		return new Invocation(this);
 	}
 
 	// Deserialization function into req_data.
@@ -290,17 +544,7 @@ public:
 	// Serialization function
 	virtual bool serialize()
 	{
-		std::stringstream buffer;
-
-		// Try to serialize the data. This shouldn't
-		//	ever fail since the class is templated
-		try {
-			msgpack::pack(buffer, *res_data);
-			response->setData(buffer.str());
-			return true;
-		} catch (...) {
-			return false;
-		}
+		return packResponse(*res_data);
 	}
 };
 
@@ -308,37 +552,20 @@ public:
 template <class Req>
 class CommandMsgpack<Req, std::nullptr_t>: public Command {
 public:
-	// Request and response
-	Req *req_data;
+	typedef CommandMsgpackInvocation<Req, std::nullptr_t> Invocation;
+
+	// Request of the call being run on this thread
+	CommandCallPtr<Req, Invocation::getReq> req_data;
 
 	// Use the constructor and destructor from the base class
-	CommandMsgpack(
-		std::string n,
-		std::string d,
-		int t = COMMAND_DEFAULT_TIMEOUT_MS) :
-		Command(n, d, t),
-		req_data(NULL)
-	{
-		init();
-	}
+	// The request lives in the invocation and is reset at the start
+	//	of each call
+	using Command::Command;
 
-	virtual ~CommandMsgpack()
+	// Each call gets its own request
+	virtual CommandInvocation *newInvocation()
 	{
-		cleanup();
-	}
-
-	// Init function. Allocate the request and response
-	virtual void init() {
-		cleanup();
-		req_data = new Req;
-	}
-
-	// Cleanup function. Free the request and response
-	virtual void cleanup() {
-		if (req_data != NULL) {
-			delete req_data;
-			req_data = NULL;
-		}
+		return new Invocation(this);
 	}
 
 	// Deserialization function into req_data.
@@ -346,16 +573,7 @@ public:
 		const uint8_t *data,
 		size_t data_len)
 	{
-        // Convert into the request data
-        try {
-			msgpack::object_handle oh =
-				msgpack::unpack((const char *)data, data_len);
-	        msgpack::object deserialized = oh.get();
-        	deserialized.convert(*req_data);
-        	return true;
-        } catch (...) {
-        	return false;
-        }
+		return unpackRequest(data, data_len, *req_data);
 	}
 
 	// Serialization function
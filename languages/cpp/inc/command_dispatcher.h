@@ -0,0 +1,166 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @file command_dispatcher.h
+//
+//  @brief Header for the asynchronous command dispatcher. The dispatcher
+//			owns a thread that reads an element's response stream and
+//			routes ACKs and responses to the commands waiting on them.
+//
+//  @copy 2018 Elementary Robotics. All rights reserved.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __ATOM_CPP_COMMAND_DISPATCHER_H
+#define __ATOM_CPP_COMMAND_DISPATCHER_H
+
+#include <map>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <string>
+#include <functional>
+#include <condition_variable>
+
+#include "atom/atom.h"
+#include "atom/redis.h"
+#include "element_response.h"
+
+// How long the dispatcher blocks in each XREAD of the response stream.
+//	Bounds how long it takes to notice a timeout or a shutdown
+#define COMMAND_DISPATCHER_BLOCK_MS 100
+
+// How long an ACK or response that doesn't match any pending command is
+//	kept around in case the command that it belongs to is still being
+//	registered
+#define COMMAND_DISPATCHER_ORPHAN_TIMEOUT_MS 1000
+
+namespace atom {
+
+// Callback for a command sent asynchronously. Called from the dispatcher
+//	thread once the command completes, fails or times out
+typedef void (*commandResponseFn)(
+	ElementResponse &response,
+	void *user_data);
+
+class CommandDispatcher {
+
+	typedef std::chrono::steady_clock clock;
+	typedef std::function<void(ElementResponse &)> completion_t;
+
+	// Command that's waiting on an ACK and/or response
+	struct PendingCommand {
+		std::string cmd_elem;
+		bool block;
+		bool acked;
+		clock::time_point deadline;
+		completion_t complete;
+	};
+
+	// ACK or response read from the stream
+	struct ResponseMessage {
+		std::string cmd_elem;
+		bool is_ack;
+		int timeout;
+		int err_code;
+		std::string err_str;
+		std::string data;
+		clock::time_point expires;
+	};
+
+	// Response stream that we're reading
+	std::string stream;
+
+	// Context for the XREADs and the info that tracks the last ID
+	//	we've seen
+	redisContext *ctx;
+	struct redis_stream_info info;
+
+	// Commands we're waiting on and messages we couldn't match yet,
+	//	keyed by (element, command ID). Command IDs are only unique
+	//	per command stream.
+	typedef std::pair<std::string, std::string> pending_key_t;
+	std::map<pending_key_t, PendingCommand> pending;
+	std::map<pending_key_t, std::vector<ResponseMessage>> orphans;
+	std::mutex pending_mutex;
+	std::condition_variable pending_cv;
+
+	// Commands that completed during the last XREAD. Only touched by the
+	//	dispatcher thread, and run without the lock held
+	std::vector<std::pair<completion_t, ElementResponse>> ready;
+
+	// Dispatcher thread, if we have one
+	bool running;
+	bool has_thread;
+	std::thread thread;
+
+	// Called when a command is added s.t. whoever is reading the stream
+	//	for us can notice its deadline
+	std::function<void()> wake_fn;
+
+	// Reads the response stream until stopped
+	void loop();
+
+	// Handles an ACK or response for a command. Called with the
+	//	pending lock held. Returns true if the command completed, in which
+	//	case the response and completion are filled in and the command is
+	//	no longer pending
+	bool handleMessage(
+		const pending_key_t &key,
+		const ResponseMessage &msg,
+		ElementResponse &response,
+		completion_t &complete);
+
+	// Completes any commands that are past their deadline and throws out
+	//	orphans that have been around too long. Called with the pending
+	//	lock held. Returns how long until the next deadline
+	std::chrono::milliseconds expire(
+		clock::time_point now);
+
+public:
+
+	// Constructor takes the name of the response stream to read. Notes
+	//	the current time on the stream s.t. any command registered after
+	//	this returns will see its ACK and response. If threaded is false
+	//	then no thread is started and whoever owns the dispatcher reads
+	//	the stream with getStreamInfo() and calls poll()
+	CommandDispatcher(
+		const std::string &response_stream,
+		bool threaded = true);
+
+	// Destructor stops the thread. Any commands still pending are
+	//	completed with ATOM_INTERNAL_ERROR
+	~CommandDispatcher();
+
+	// Registers a command that has been written with the given ID. The
+	//	completion is called exactly once from the dispatcher thread, or
+	//	from this thread if the command has already completed
+	void add(
+		const std::string &cmd_id,
+		const std::string &cmd_elem,
+		bool block,
+		completion_t complete);
+
+	// Gets the number of commands waiting on an ACK or response
+	size_t size();
+
+	// For dispatchers without a thread. The stream info is for reading
+	//	the response stream, and its callback routes what's read to the
+	//	pending commands. poll() then completes those along with any that
+	//	timed out and returns the ms until the next deadline, or -1 if
+	//	there's nothing pending. wake_fn is called from whichever thread
+	//	adds a command.
+	const struct redis_stream_info &getStreamInfo();
+	int poll();
+	void setWakeFn(
+		std::function<void()> fn);
+
+	// Handles the data callback from the XREAD. Public s.t. the C
+	//	callback can get to it
+	void onEntry(
+		const redisReply *reply);
+};
+
+} // namespace atom
+
+#endif // __ATOM_CPP_COMMAND_DISPATCHER_H
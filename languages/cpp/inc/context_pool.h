@@ -0,0 +1,141 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @file context_pool.h
+//
+//  @brief Header for the redis context pool
+//
+//  @copy 2018 Elementary Robotics. All rights reserved.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __ATOM_CPP_CONTEXT_POOL_H
+#define __ATOM_CPP_CONTEXT_POOL_H
+
+#include <deque>
+#include <mutex>
+#include <chrono>
+#include <stdint.h>
+#include <condition_variable>
+
+#include "atom/atom.h"
+#include "atom/redis.h"
+#include "atom/redis_topology.h"
+
+// Pass as the timeout to wait as long as it takes to get a context
+#define CONTEXT_POOL_WAIT_FOREVER (-1)
+
+namespace atom {
+
+class ContextPool;
+
+// Statistics for a context pool
+struct ContextPoolStats {
+
+	// Number of contexts that currently exist and how many of them
+	//	are leased out
+	size_t n_contexts;
+	size_t n_in_use;
+	size_t peak_in_use;
+	size_t max_contexts;
+
+	// Total number of acquires, how many of them had to wait on a context
+	//	to be released and how many of those gave up
+	uint64_t n_acquires;
+	uint64_t n_waits;
+	uint64_t n_timeouts;
+
+	// Time spent waiting on contexts, in microseconds
+	uint64_t total_wait_us;
+	uint64_t max_wait_us;
+
+	// Number of times we had to grow the pool and number of errored
+	//	contexts that were reconnected or thrown out on release
+	uint64_t n_grows;
+	uint64_t n_reconnects;
+	uint64_t n_dropped;
+};
+
+// RAII lease on a context. The context goes back to the pool when the
+//	lease is destroyed. Move-only.
+class ContextLease {
+	ContextPool *pool;
+	redisContext *ctx;
+
+public:
+
+	ContextLease() : pool(NULL), ctx(NULL) {}
+	ContextLease(
+		ContextPool *p,
+		redisContext *c) : pool(p), ctx(c) {}
+	ContextLease(
+		ContextLease &&other);
+	ContextLease &operator=(
+		ContextLease &&other);
+	ContextLease(const ContextLease &) = delete;
+	ContextLease &operator=(const ContextLease &) = delete;
+	~ContextLease();
+
+	// Gets the context. NULL if the acquire timed out
+	redisContext *get() const { return ctx; }
+	explicit operator bool() const { return ctx != NULL; }
+
+	// Returns the context to the pool early
+	void release();
+};
+
+// Pool of redis contexts. Starts with n_initial contexts and makes new
+//	ones on demand up to max_contexts, after which callers wait for a
+//	context to be released. Contexts that come back with an error are
+//	reconnected before they're handed out again.
+class ContextPool {
+
+	typedef std::chrono::steady_clock clock;
+
+	std::deque<redisContext *> idle;
+	const struct redis_topology *topology;
+	size_t shard;
+	size_t n_contexts;
+	size_t max_contexts;
+
+	ContextPoolStats stats;
+
+	std::mutex mutex;
+	std::condition_variable cv;
+
+	// Makes a new connection. Returns NULL if we couldn't connect
+	redisContext *connect();
+
+public:
+
+	// Constructor/Destructor. All leases must be returned before the
+	//	pool is destroyed. If a topology is passed then the contexts go
+	//	to that shard of it instead of the local nucleus. The topology
+	//	must outlive the pool
+	ContextPool(
+		size_t n_initial,
+		size_t n_max,
+		const struct redis_topology *topology = NULL,
+		size_t shard = REDIS_TOPOLOGY_NUCLEUS);
+	~ContextPool();
+
+	// Gets a context, waiting at most timeout_ms for one to free up if
+	//	the pool is at its cap. Returns NULL if we timed out or couldn't
+	//	connect to redis. The context must be passed back to release()
+	redisContext *acquire(
+		int timeout_ms = CONTEXT_POOL_WAIT_FOREVER);
+
+	// Returns a context to the pool
+	void release(
+		redisContext *ctx);
+
+	// Gets a context wrapped in a lease s.t. it's returned automatically
+	ContextLease lease(
+		int timeout_ms = CONTEXT_POOL_WAIT_FOREVER);
+
+	// Gets a snapshot of the stats
+	ContextPoolStats getStats();
+};
+
+} // namespace atom
+
+#endif // __ATOM_CPP_CONTEXT_POOL_H
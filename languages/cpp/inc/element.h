@@ -10,8 +10,13 @@
 #ifndef __ATOM_CPP_ELEMENT_H
 #define __ATOM_CPP_ELEMENT_H
 
+#include <set>
+#include <deque>
 #include <queue>
 #include <mutex>
+#include <future>
+#include <thread>
+#include <condition_variable>
 #include <syslog.h>
 #include <iostream>
 
@@ -21,20 +26,75 @@
 #include "atom/element_entry_read.h"
 #include "atom/element_command_server.h"
 #include "atom/element_command_send.h"
+#include "atom/element_reference.h"
+#include "atom/codec.h"
 #include "element_response.h"
 #include "element_read_map.h"
 #include "command.h"
+#include "stream_batch.h"
+#include "entry_view.h"
+#include "reference_view.h"
+#include "command_dispatcher.h"
+#include "context_pool.h"
+#include "event_loop.h"
+#include "shm_ring.h"
+#include "rw_lock.h"
+#include "stream_range.h"
+#include "prepared_read.h"
+#include "stream_writer.h"
+#include "stream_reader.h"
+#include "stream_recording.h"
 
 #define ELEMENT_DEFAULT_N_CONTEXTS 20
+#define ELEMENT_DEFAULT_MAX_CONTEXTS 256
 
 #define ELEMENT_INFINITE_COMMAND_LOOPS 0
 
+// How long a command worker waits before trying again to get a context
+#define ELEMENT_COMMAND_WORKER_RETRY_MS 100
+
 #define ELEMENT_INFINITE_READ_LOOPS 0
 
+// Most streams that entryReadLoop reads with a single XREAD. More streams
+//	than this on a shard are split across several of its contexts, which
+//	are read at the same time
+#define ELEMENT_READ_LOOP_MAX_STREAMS 64
+
+// How often streams with deferred retention policies are trimmed
+#define ELEMENT_RETENTION_TRIM_PERIOD_MS 1000
+
 namespace atom {
 
-// Entry value
-typedef std::map<std::string, std::string> entry_data_t;
+// How much of a stream to keep, see element_retention. Deferred policies
+//	are enforced by a thread that trims every
+//	ELEMENT_RETENTION_TRIM_PERIOD_MS rather than by each write
+struct RetentionPolicy {
+	enum element_retention_type type;
+	int maxlen;
+	int64_t max_age_ms;
+	size_t max_bytes;
+	bool deferred;
+
+	RetentionPolicy(
+		enum element_retention_type t = ELEMENT_RETENTION_COUNT,
+		int len = ELEMENT_DATA_WRITE_DEFAULT_MAXLEN,
+		int64_t age_ms = 0,
+		size_t bytes = 0,
+		bool d = false) : type(t), maxlen(len), max_age_ms(age_ms),
+			max_bytes(bytes), deferred(d) {}
+
+	static RetentionPolicy count(int maxlen, bool deferred = false) {
+		return RetentionPolicy(ELEMENT_RETENTION_COUNT, maxlen, 0, 0, deferred);
+	}
+	static RetentionPolicy time(int64_t max_age_ms, bool deferred = false) {
+		return RetentionPolicy(ELEMENT_RETENTION_TIME,
+			ELEMENT_DATA_WRITE_DEFAULT_MAXLEN, max_age_ms, 0, deferred);
+	}
+	static RetentionPolicy bytes(size_t max_bytes, bool deferred = false) {
+		return RetentionPolicy(ELEMENT_RETENTION_BYTES,
+			ELEMENT_DATA_WRITE_DEFAULT_MAXLEN, 0, max_bytes, deferred);
+	}
+};
 
 // Entry Class
 class Entry {
@@ -46,6 +106,8 @@ public:
 	// Constructor/Destructor
 	Entry(
 		const char *xread_id);
+	Entry(
+		const EntryView &view);
 	~Entry();
 
 	// Add data to the entry
@@ -53,6 +115,9 @@ public:
 		const char *key,
 		const char *data,
 		size_t data_len);
+	void addData(
+		const char *key,
+		std::string &&data);
 
 	// Get the ID of the entry
 	const std::string &getID();
@@ -78,23 +143,147 @@ class Element {
 	struct element *elem;
 
 	// Redis context pool
-	std::queue<redisContext *>context_pool;
-	mutable std::mutex context_mutex;
+	ContextPool context_pool;
+
+	// Where our data streams live, and a context pool for each shard if
+	//	they're not all on the nucleus
+	struct redis_topology topology;
+	std::vector<ContextPool *> shard_pools;
 
 	// Streams that we're currently publishing on
 	std::map<std::string, struct element_entry_write_info *> streams;
 
+	// Streams whose large values go through shared memory, and the
+	//	smallest value that does
+	struct ShmStream {
+		ShmRingWriter *ring;
+		size_t min_size;
+	};
+	std::map<std::string, ShmStream> shm_streams;
+
+	// Streams whose values are compressed, and the smallest value that is
+	struct CodecStream {
+		enum codec_type codec;
+		size_t min_size;
+	};
+	std::map<std::string, CodecStream> codec_streams;
+
+	// Streams that are kept to a retention policy. The policies are
+	//	kept until we're destroyed, even once replaced, since writes in
+	//	flight may be pointing at them
+	std::deque<struct element_retention> retentions;
+	std::map<std::string, struct element_retention *> retention_streams;
+
+	// Thread that trims the streams with deferred policies. Started the
+	//	first time one is used
+	std::thread trim_thread;
+	bool trim_running;
+	std::condition_variable_any trim_cv;
+	void trimLoop();
+
 	// List of commands we currently have support for
 	std::map<std::string, Command *> commands;
 
-	// Functions for getting redis contexts
-	void initContextPool(
-		int n_contexts);
-	void cleanupContextPool();
+	// Event loop for run()
+	EventLoop event_loop;
+
+	// Shared implementation of run(). m may be NULL
+	enum atom_error_t runLoop(
+		ElementReadMap *m);
+
+	// Dispatcher for commands sent asynchronously. Started the first
+	//	time an asynchronous command is sent
+	CommandDispatcher *dispatcher;
+	std::mutex dispatcher_mutex;
+	CommandDispatcher *getDispatcher();
+
+	// Sends a command and registers its completion with the dispatcher
+	enum atom_error_t sendCommandAsync(
+		std::string element,
+		std::string command,
+		const uint8_t *data,
+		size_t data_len,
+		bool block,
+		std::function<void(ElementResponse &)> complete);
+
+	// Functions for getting redis contexts. getContext() will wait for
+	//	a context if the pool is at its cap and throws if we can't connect
 	redisContext *getContext();
 	void releaseContext(
 		redisContext *ctx);
 
+	// Same as above but for the pool of a data stream's shard. Returns
+	//	the nucleus pool if the stream isn't sharded
+	ContextPool &getStreamPool(
+		const std::string &element,
+		const std::string &stream);
+	redisContext *getContext(
+		ContextPool &pool);
+	void releaseContext(
+		ContextPool &pool,
+		redisContext *ctx);
+
+	// Streams that we're currently publishing on are guarded by this.
+	//	Writes only need it as a reader once their stream is set up
+	RWLock streams_mutex;
+
+	// Streams that StreamWriters have been made for, cleaned up with the
+	//	rest of our streams
+	std::set<std::string> writer_streams;
+
+	// Sets up a stream for a StreamWriter. Fills in the stream's key,
+	//	registers it and returns the pool for its shard
+	ContextPool &openWriterStream(
+		const std::string &stream,
+		char key[ATOM_NAME_MAXLEN]);
+	friend class StreamWriterBase;
+	friend class StreamReplayer;
+
+	// Registry read from a server, good until the registry's version on
+	//	the server changes
+	struct DiscoveryCache {
+		bool valid;
+		long long version;
+		std::vector<std::string> members;
+	};
+	bool discovery_cache_enabled;
+	std::mutex discovery_mutex;
+	DiscoveryCache element_cache;
+	std::map<ContextPool *, DiscoveryCache> stream_cache;
+
+	// Gets the streams on a server, from the cache if it's enabled and
+	//	still good. element is NULL for all streams
+	enum atom_error_t getPoolStreams(
+		ContextPool &pool,
+		const char *element,
+		std::vector<std::string> &stream_list);
+
+	// Fills in a write info for a single write of data to the stream,
+	//	creating the stream's cached info if needed. Values that go
+	//	through shared memory are replaced by descriptors and values that
+	//	look like descriptors are framed, both kept in shm_values. If
+	//	pipelining, the keys of new streams that need to be registered
+	//	once the replies are read go in unregistered
+	void getWriteInfo(
+		redisContext *ctx,
+		const std::string &stream,
+		entry_data_t &data,
+		bool pipelining,
+		struct element_entry_write_info &write_info,
+		std::vector<struct redis_xadd_info> &items,
+		std::vector<std::string> &shm_values,
+		std::vector<std::string> *unregistered = NULL);
+	struct element_entry_write_info *findWriteInfo(
+		const std::string &stream,
+		entry_data_t &data);
+	void fillWriteInfo(
+		const std::string &stream,
+		entry_data_t &data,
+		struct element_entry_write_info *info,
+		struct element_entry_write_info &write_info,
+		std::vector<struct redis_xadd_info> &items,
+		std::vector<std::string> &shm_values);
+
 	// Function for converting a readMap into element_entry_read_info
 	struct element_entry_read_info *readMapToEntryInfo(
 		ElementReadMap &m);
@@ -104,47 +293,92 @@ class Element {
 		struct element_entry_read_info *info,
 		size_t n_infos);
 
+	// Shared implementations of entryReadN and entryReadSince. Exactly one
+	//	of fn and view_fn should be set and is called with each entry
+	enum atom_error_t entryReadN(
+		std::string element,
+		std::string stream,
+		std::vector<std::string> &keys,
+		size_t n,
+		readHandlerFn fn,
+		readViewHandlerFn view_fn,
+		void *user_data);
+	enum atom_error_t entryReadSince(
+		std::string element,
+		std::string stream,
+		std::vector<std::string> &keys,
+		size_t n,
+		readHandlerFn fn,
+		readViewHandlerFn view_fn,
+		void *user_data,
+		std::string last_id,
+		int timeout);
+
+	// Reads the next page of a range into the iterator, returning whether
+	//	there were any entries in it, and closes it
+	bool entryRangeNext(
+		StreamRangeIterator &it);
+	void entryRangeClose(
+		StreamRangeIterator &it);
+	friend class StreamRangeIterator;
+
+	// Shared implementation of the prepared entryReadN and entryReadSince.
+	//	since says which, and exactly one of fn and view_fn should be set
+	enum atom_error_t entryReadPrepared(
+		PreparedRead &read,
+		bool since,
+		size_t n,
+		readHandlerFn fn,
+		readViewHandlerFn view_fn,
+		void *user_data,
+		int timeout);
+	void preparedReadClose(
+		PreparedRead &read);
+	friend class PreparedRead;
+
 	// Throws a std::runtime_error and also logs it to atom s.t. we can
 	//	see in the logs why it happened
 	void error(
 		std::string str = "",
 		bool log_atom = true);
 
-	// Serializes Data
+	// Serializes data into the calling thread's buffer, which is reused
+	//	from command to command. The buffer is valid until the thread's
+	//	next call
 	template <typename Req>
-	bool sendCommandSerialize(
-		std::stringstream &buffer,
-		Req &req_data,
-		size_t &buffer_len)
+	msgpack::sbuffer *sendCommandSerialize(
+		Req &req_data)
 	{
+		static thread_local msgpack::sbuffer buffer;
+
+		buffer.clear();
 		try {
 			msgpack::pack(buffer, req_data);
 		} catch (...) {
 			log(LOG_ERR, "Failed to serialize");
-			return false;
+			return NULL;
 		}
 
-		// Get the buffer size and then seek it back
-		//	to the beginning
-		buffer.seekg(0, buffer.end);
-		buffer_len = (size_t)buffer.tellg();
-		buffer.seekg(0, buffer.beg);
-
-		return true;
+		return &buffer;
 	}
 
-	// Deserializes data
+	// Deserializes data. Unpacks into the calling thread's zone, which
+	//	is reused from command to command, with strings and binary data
+	//	referencing the response rather than being copied twice
 	template <typename Res>
 	bool sendCommandDeserialize(
 		ElementResponse &response,
 		Res &res_data)
 	{
+		static thread_local msgpack::zone zone;
+
 		try {
-			msgpack::object_handle oh = msgpack::unpack(
+			zone.clear();
+			msgpack::object deserialized = msgpack::unpack(
+				zone,
 				response.getData().c_str(),
-				response.getDataLen());
-
-			msgpack::object deserialized = oh.get();
+				response.getDataLen(),
+				commandUnpackReferenceFn);
 			deserialized.convert(res_data);
 		// TODO: make this more specific
 		} catch (...) {
@@ -158,10 +392,25 @@ class Element {
 
 public:
 
-	// Constructors
+	// Constructors. The element starts with n_contexts redis contexts and
+	//	will make more on demand, up to max_contexts
+	Element(
+		std::string n,
+		int n_contexts = ELEMENT_DEFAULT_N_CONTEXTS,
+		int max_contexts = ELEMENT_DEFAULT_MAX_CONTEXTS);
+
+	// Same as above, but with the data streams spread across the redis
+	//	servers in the topology, see redis_topology.h. Commands, responses
+	//	and logs stay on the local nucleus s.t. a command and its response
+	//	are always on the same server, while each element's data streams
+	//	all go to one of the remote servers or to the cluster node that
+	//	serves them. By default uses REDIS_TOPOLOGY_ENV. Throws if the
+	//	topology is invalid
 	Element(
 		std::string n,
-		int n_contexts = ELEMENT_DEFAULT_N_CONTEXTS);
+		std::string topology_spec,
+		int n_contexts = ELEMENT_DEFAULT_N_CONTEXTS,
+		int max_contexts = ELEMENT_DEFAULT_MAX_CONTEXTS);
 
 	// Destructor
 	~Element();
@@ -169,6 +418,16 @@ public:
 	// Returns the name of the element
 	const std::string &getName();
 
+	// Returns the stats for the element's redis context pool
+	ContextPoolStats getContextPoolStats();
+
+	// Caches the elements and streams found by getAllElements() and
+	//	getAllStreams(). Each call then only checks that the registry
+	//	hasn't changed rather than reading it again. Only use this if
+	//	everything in the system registers its elements and streams
+	void useDiscoveryCache(
+		bool enable = true);
+
 	// Returns a list of all elements
 	enum atom_error_t getAllElements(
 		std::vector<std::string> &elem_list);
@@ -183,32 +442,124 @@ public:
 
 	// Adds support for a barebones command. Takes a command name,
 	//	handler function and timeout to be returned to callers of this
-	//	command
+	//	command. Fast commands are answered in a single round trip, see
+	//	sendCommandFast()
 	void addCommand(
 		std::string name,
 		std::string description,
 		command_handler_t fn,
 		void *user_data,
-		int timeout);
+		int timeout,
+		bool fast = false);
 
 	// Adds support for a command class. Takes a reference
 	//	to the class and does the rest internally
 	void addCommand(
 		Command *cmd);
 
+	// Makes this element one of a group of replicas sharing the
+	//	commands sent to the element's name. Each command is handled by
+	//	only one of the replicas, and commands a replica leaves unfinished
+	//	for claim_idle_ms, e.g. because it crashed, are taken over by
+	//	another. consumer must be unique to each replica and defaults
+	//	to one made from the hostname and pid. Call before commandLoop().
+	void useCommandGroup(
+		std::string group = "",
+		std::string consumer = "",
+		int claim_idle_ms = ELEMENT_COMMAND_GROUP_DEFAULT_CLAIM_MS);
+
 	// Processes incoming commands per the command
 	//	handler table. If no args passed, then will loop indefinitely,
-	//	else will handle only N commands and then will exit
+	//	else will do N reads of the command stream and then will exit.
+	//	If n_workers is nonzero then commands are ACKed as soon as
+	//	they're read and handed off to a pool of n_workers threads, each
+	//	with its own context, s.t. a slow command doesn't hold up the
+	//	others. Calls of the same command run concurrently too, each
+	//	with its own request and response. Returns once all of the
+	//	commands that were read have been handled.
 	enum atom_error_t commandLoop(
-		int n_loops = ELEMENT_INFINITE_COMMAND_LOOPS);
+		int n_loops = ELEMENT_INFINITE_COMMAND_LOOPS,
+		int n_workers = 0);
+
+	// Runs the element on this thread until stop() is called. Handles
+	//	commands, the entries on the streams in the read map, responses
+	//	to commands sent with sendCommandAsync() and events on any fds
+	//	added to getEventLoop(), all from a single epoll loop. The streams
+	//	are read with one XREAD on a non-blocking connection. Async
+	//	commands still waiting when run() returns fail. Not for use along
+	//	with commandLoop() or by elements in a command group. The streams
+	//	in the read map must be on the nucleus, use entryReadLoop() on
+	//	another thread for sharded streams.
+	enum atom_error_t run(
+		ElementReadMap &m);
+	enum atom_error_t run();
+
+	// Stops run(). May be called from any thread, including from within
+	//	a handler
+	void stop();
 
-	// Sends a command to a given element
+	// Gets the event loop used by run() s.t. other fds can be added to it
+	EventLoop &getEventLoop();
+
+	// Sends a command to a given element. If deadline_ms, see
+	//	atom_deadline_ms(), is set then gives up once it passes, and the
+	//	element doesn't handle the command if it only gets to it after then
 	enum atom_error_t sendCommand(
 		ElementResponse &response,
 		std::string element,
 		std::string command,
 		const uint8_t *data,
 		size_t data_len,
+		bool block = true,
+		int64_t deadline_ms = ATOM_NO_DEADLINE);
+
+	// Sends a fast command to a given element and waits up to timeout_ms
+	//	in total for the response. The element must have added the command
+	//	as fast, else there's no response until after its ACK timeout.
+	enum atom_error_t sendCommandFast(
+		ElementResponse &response,
+		std::string element,
+		std::string command,
+		const uint8_t *data,
+		size_t data_len,
+		int timeout_ms = COMMAND_DEFAULT_TIMEOUT_MS);
+
+	// Sends a command to each of the elements and waits for all of the
+	//	responses, which are put in responses in the same order. Rather
+	//	than a few round trips per element it costs about one round trip
+	//	and the slowest handler. Returns the first error, but each
+	//	response has its own. deadline_ms is the same as for sendCommand()
+	enum atom_error_t sendCommandMulti(
+		std::vector<ElementResponse> &responses,
+		const std::vector<std::string> &elements,
+		std::string command,
+		const uint8_t *data,
+		size_t data_len,
+		int64_t deadline_ms = ATOM_NO_DEADLINE);
+
+	// Sends a command to a given element without waiting on the ACK
+	//	or response. Any number of commands may be outstanding at once. The
+	//	future is ready once the response comes in, or once the ACK comes
+	//	in if block is false. Errors, including timeouts, are reported in
+	//	the response
+	std::future<ElementResponse> sendCommandAsync(
+		std::string element,
+		std::string command,
+		const uint8_t *data,
+		size_t data_len,
+		bool block = true);
+
+	// Same as above but calls fn with the response instead. fn is called
+	//	exactly once, from the dispatcher thread, and should not block.
+	//	Returns an error if the command couldn't be sent, in which case
+	//	fn has already been called with the error
+	enum atom_error_t sendCommandAsync(
+		std::string element,
+		std::string command,
+		const uint8_t *data,
+		size_t data_len,
+		commandResponseFn fn,
+		void *user_data,
 		bool block = true);
 
 	// Sends a commad using msgpack for serialization and deserialization
@@ -219,12 +570,12 @@ public:
 		std::string command,
 		Req &req_data,
 		Res &res_data,
-		bool block = true)
+		bool block = true,
+		int64_t deadline_ms = ATOM_NO_DEADLINE)
 	{
 		// Pack the buffer
-		std::stringstream buffer;
-		size_t buffer_len;
-		if (!sendCommandSerialize<Req>(buffer, req_data, buffer_len)) {
+		msgpack::sbuffer *buffer = sendCommandSerialize<Req>(req_data);
+		if (buffer == NULL) {
 			return ATOM_SERIALIZATION_ERROR;
 		}
 
@@ -233,8 +584,10 @@ public:
 			response,
 			element,
 			command,
-			(uint8_t*)buffer.str().c_str(),
-			buffer_len);
+			(const uint8_t*)buffer->data(),
+			buffer->size(),
+			block,
+			deadline_ms);
 		if (err != ATOM_NO_ERROR) {
 			return err;
 		}
@@ -285,9 +638,8 @@ public:
 		bool block = true)
 	{
 		// Pack the buffer
-		std::stringstream buffer;
-		size_t buffer_len;
-		if (!sendCommandSerialize<Req>(buffer, req_data, buffer_len)) {
+		msgpack::sbuffer *buffer = sendCommandSerialize<Req>(req_data);
+		if (buffer == NULL) {
 			return ATOM_SERIALIZATION_ERROR;
 		}
 
@@ -296,8 +648,8 @@ public:
 			response,
 			element,
 			command,
-			(uint8_t*)buffer.str().c_str(),
-			buffer_len);
+			(const uint8_t*)buffer->data(),
+			buffer->size());
 		if (err != ATOM_NO_ERROR) {
 			return err;
 		}
@@ -307,14 +659,19 @@ public:
 	}
 
 	// Reads entries from the passed streams and passes the
-	//	data onto the proper handlers
+	//	data onto the proper handlers. If the streams are on more than
+	//	one shard, or there are more than ELEMENT_READ_LOOP_MAX_STREAMS
+	//	on a shard, then each group of them is read on its own context
+	//	and thread, so handlers for streams in different groups may be
+	//	called at the same time
 	enum atom_error_t entryReadLoop(
 		ElementReadMap &m,
 		int loops = ELEMENT_INFINITE_READ_LOOPS);
 
 	// Reads N entries from the stream, returning them in order from
 	//	newest to oldest. As such the most recent value is always
-	//	at index 0 in the list
+	//	at index 0 in the list. If the stream has fewer than N entries
+	//	then returns all of them
 	enum atom_error_t entryReadN(
 		std::string element,
 		std::string stream,
@@ -322,6 +679,15 @@ public:
 		size_t n,
 		std::vector<Entry> &ret);
 
+	// Same as above, but the entries point into the data read from redis
+	//	rather than copying it
+	enum atom_error_t entryReadN(
+		std::string element,
+		std::string stream,
+		std::vector<std::string> &keys,
+		size_t n,
+		std::vector<EntryView> &ret);
+
 	// Reads at most N entries from the stream since the passed ID
 	//	Default nonblocking. Pass 0 for timeout to block indefinitely,
 	//	else a value in milliseconds
@@ -334,6 +700,69 @@ public:
 		std::string last_id = "",
 		int timeout=REDIS_XREAD_DONTBLOCK);
 
+	// Same as above, but the entries point into the data read from redis
+	//	rather than copying it
+	enum atom_error_t entryReadSince(
+		std::string element,
+		std::string stream,
+		std::vector<std::string> &keys,
+		size_t n,
+		std::vector<EntryView> &ret,
+		std::string last_id = "",
+		int timeout=REDIS_XREAD_DONTBLOCK);
+
+	// Sets up a read of the keys of the stream that can be done over and
+	//	over with the entryReadN and entryReadSince below, which don't
+	//	allocate anything for the read itself. Reads since start after
+	//	last_id or, if it's "", after the time on the stream's server now.
+	//	Any read the PreparedRead was prepared for before is closed
+	enum atom_error_t prepareRead(
+		std::string element,
+		std::string stream,
+		std::vector<std::string> &keys,
+		PreparedRead &read,
+		std::string last_id = "");
+
+	// Same as the entryReadN and entryReadSince above, for a prepared
+	//	read. Each entryReadSince reads after the last entry the one
+	//	before it got
+	enum atom_error_t entryReadN(
+		PreparedRead &read,
+		size_t n,
+		std::vector<Entry> &ret);
+	enum atom_error_t entryReadN(
+		PreparedRead &read,
+		size_t n,
+		std::vector<EntryView> &ret);
+	enum atom_error_t entryReadSince(
+		PreparedRead &read,
+		size_t n,
+		std::vector<Entry> &ret,
+		int timeout=REDIS_XREAD_DONTBLOCK);
+	enum atom_error_t entryReadSince(
+		PreparedRead &read,
+		size_t n,
+		std::vector<EntryView> &ret,
+		int timeout=REDIS_XREAD_DONTBLOCK);
+
+	// Sets up the iterator to go through the entries on the stream from
+	//	start to end, oldest first or newest first if reverse is set.
+	//	start and end are IDs, inclusive unless prefixed with '(', and ""
+	//	means the end of the stream. At most max_entries are read unless
+	//	it's REDIS_RANGE_NO_LIMIT, page_size at a time. Unlike entryReadN
+	//	only a couple of pages are in memory at once, so this is the way to
+	//	go through long histories.
+	enum atom_error_t entryRange(
+		std::string element,
+		std::string stream,
+		std::vector<std::string> &keys,
+		StreamRangeIterator &it,
+		bool reverse = false,
+		std::string start = "",
+		std::string end = "",
+		size_t max_entries = REDIS_RANGE_NO_LIMIT,
+		size_t page_size = REDIS_RANGE_DEFAULT_PAGE_SIZE);
+
 	// Writes an entry to a data stream
 	enum atom_error_t entryWrite(
 		std::string stream,
@@ -341,6 +770,73 @@ public:
 		int timestamp = ELEMENT_DATA_WRITE_DEFAULT_TIMESTAMP,
 		int maxlen = ELEMENT_DATA_WRITE_DEFAULT_MAXLEN);
 
+	// Puts values of at least min_size bytes written to the stream in a
+	//	shared-memory ring of ring_size bytes rather than in redis. Readers
+	//	on this host read them straight out of the ring, readers on other
+	//	hosts can't read them at all, so only use this for streams that
+	//	are read locally. Values bigger than the ring are written to redis
+	//	as usual. Throws if we can't make the ring
+	void useSharedMemory(
+		std::string stream,
+		size_t ring_size = SHM_DEFAULT_RING_SIZE,
+		size_t min_size = SHM_DEFAULT_MIN_SIZE);
+
+	// Compresses values of at least min_size bytes written to the stream
+	//	with the codec. The entries are tagged with the codec s.t. readers
+	//	decompress them without having to know. Pass CODEC_NONE to stop
+	//	compressing. Throws if atom wasn't built with the codec
+	void useCompression(
+		std::string stream,
+		enum codec_type codec,
+		size_t min_size = CODEC_DEFAULT_MIN_SIZE);
+
+	// Keeps the stream to a retention policy in place of the maxlen
+	//	passed to each write, e.g. the last 10 seconds of a fast stream or
+	//	64MB of a camera. Time windows need redis 6.2. StreamWriters keep
+	//	the maxlen they were made with unless the policy is deferred
+	void useRetention(
+		std::string stream,
+		const RetentionPolicy &policy);
+
+	// Same as above but for the data of commands sent to the element, or
+	//	just its command if command isn't "". The element decompresses
+	//	the data before handing it to the command. Responses aren't
+	//	compressed. Call before sending commands to the element
+	void useCommandCompression(
+		std::string element,
+		std::string command,
+		enum codec_type codec,
+		size_t min_size = CODEC_DEFAULT_MIN_SIZE);
+
+	// Writes all of the entries in the batch with a single round trip
+	//	to redis. The ID and error for each entry are stored in the batch.
+	//	Returns ATOM_NO_ERROR only if all entries were written
+	enum atom_error_t entryWriteBatch(
+		StreamBatch &batch);
+
+	// Makes a reference to each key in an entry of another element's
+	//	stream, filling in refs with key -> reference. If id is "" then
+	//	uses the most recent entry. The references are deleted by redis
+	//	after timeout_ms unless it's ELEMENT_REFERENCE_NO_TIMEOUT
+	enum atom_error_t referenceCreateFromStream(
+		std::string element,
+		std::string stream,
+		std::map<std::string, std::string> &refs,
+		std::string id = "",
+		int timeout_ms = ELEMENT_REFERENCE_DEFAULT_TIMEOUT_MS);
+
+	// Gets the values of references in a single round trip. The values
+	//	point into the data read from redis rather than copying it
+	enum atom_error_t referenceGet(
+		const std::vector<std::string> &refs,
+		ReferenceView &ret);
+
+	// Deletes references s.t. their memory is freed before they time out.
+	//	n_deleted, if non-NULL, is set to the number that still existed
+	enum atom_error_t referenceDelete(
+		const std::vector<std::string> &refs,
+		size_t *n_deleted = NULL);
+
 	// Writes an entry to the logs
 	void log(
 		int level,
@@ -350,6 +846,11 @@ public:
 		const char *fmt,
 		...);
 
+	// Waits for the logs written so far to make it to the log stream.
+	//	Logs are written in the background so call this before reading
+	//	them back
+	void logFlush();
+
 };
 
 } // namespace atom
@@ -14,24 +14,56 @@
 #include "atom/atom.h"
 #include "atom/redis.h"
 #include "element_response.h"
+#include "handler_executor.h"
 #include <map>
+#include <deque>
+#include <memory>
 
 namespace atom {
 
-// Forward declaration for the entry class
+// Forward declaration for the entry classes
 class Entry;
+class EntryView;
+template <typename T> class StreamReader;
 
 // Read handler function
 typedef bool (*readHandlerFn)(
 	Entry &e,
 	void *user_data);
 
-// Typedef the tuple
-typedef std::tuple<std::string, std::string, std::vector<std::string>, readHandlerFn, void*> handler_t;
+// Read handler function that gets the entry without it being copied
+typedef bool (*readViewHandlerFn)(
+	EntryView &e,
+	void *user_data);
+
+// Which entries a handler gets when it falls behind, see redis_read_policy.
+//	By default it gets all of them. latest() only gets the newest entry
+//	each time the stream is read and rate() also doesn't get more than
+//	max_hz of them a second. Controllers that only care about the
+//	freshest state should use one of those s.t. they don't get further and
+//	further behind going through stale entries.
+struct ReadPolicy {
+	enum redis_read_policy policy;
+	double max_hz;
+
+	ReadPolicy(
+		enum redis_read_policy p = REDIS_READ_ALL,
+		double hz = 0) : policy(p), max_hz(hz) {}
+
+	static ReadPolicy all() { return ReadPolicy(REDIS_READ_ALL); }
+	static ReadPolicy latest() { return ReadPolicy(REDIS_READ_LATEST); }
+	static ReadPolicy rate(double hz) { return ReadPolicy(REDIS_READ_RATE, hz); }
+};
+
+// Typedef the tuple. Exactly one of the handler functions is set. Then
+//	the number of entries dropped by the read policy, how the handler is
+//	run and the counters for its queue if it has one
+typedef std::tuple<std::string, std::string, std::vector<std::string>, readHandlerFn, void*, readViewHandlerFn, ReadPolicy, size_t, HandlerExecutor, std::shared_ptr<HandlerQueueStats>> handler_t;
 
-// Response class
+// Response class. Handlers are kept in a deque s.t. adding one doesn't
+//	move the others
 class ElementReadMap {
-	std::vector<handler_t> handlers;
+	std::deque<handler_t> handlers;
 
 public:
 
@@ -46,17 +78,59 @@ public:
 		std::vector<std::string> keys,
 		readHandlerFn fn);
 
-	// Add in a handler with user data
+	// Add in a handler with user data. By default the handler's run on
+	//	the thread that reads the streams, see HandlerExecutor for running
+	//	it on another
 	void addHandler(
 		std::string element,
 		std::string stream,
 		std::vector<std::string> keys,
 		readHandlerFn fn,
-		void *user_data);
+		void *user_data,
+		ReadPolicy policy = ReadPolicy(),
+		HandlerExecutor executor = HandlerExecutor());
+
+	// Add in a handler that gets a view into the entry rather than a
+	//	copy of it. The view may be kept after the handler returns
+	void addHandler(
+		std::string element,
+		std::string stream,
+		std::vector<std::string> keys,
+		readViewHandlerFn fn,
+		void *user_data = NULL,
+		ReadPolicy policy = ReadPolicy(),
+		HandlerExecutor executor = HandlerExecutor());
+
+	// Add in a handler that gets each entry decoded into the reader's
+	//	value, see StreamReader. Only the keys bound in the reader are
+	//	read, so bind them all before adding it
+	template <typename T>
+	void addTypedHandler(
+		std::string element,
+		std::string stream,
+		StreamReader<T> &reader,
+		ReadPolicy policy = ReadPolicy(),
+		HandlerExecutor executor = HandlerExecutor())
+	{
+		addHandler(std::move(element), std::move(stream), reader.getKeys(),
+			&StreamReader<T>::viewCB, (void *)&reader, policy, executor);
+	}
 
 	// Gets the number of handlers
 	size_t getNumHandlers();
 
+	// Gets the number of entries the Nth handler's read policy has
+	//	dropped. Kept up to date as the streams are read, but should only
+	//	be called from the handlers or once the read has returned
+	size_t getNumDropped(int n);
+
+	// Gets how many entries are in the Nth handler's queue, the most
+	//	there have been and how many were dropped since it was full. All
+	//	0 if the handler's run directly
+	size_t getQueueDepth(int n);
+	size_t getMaxQueueDepth(int n);
+	size_t getNumQueueDropped(int n);
+
 	// Gets the info for a particular handler
 	handler_t &getHandler(int n);
 };
@@ -40,6 +40,10 @@ public:
 	void setData(
 		std::string d);
 
+	// Resets the response s.t. it can be reused. Keeps the memory
+	//	allocated for the data
+	void clear();
+
 	// Checks to see if the response has data
 	bool hasData();
 
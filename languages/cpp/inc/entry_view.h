@@ -0,0 +1,123 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @file entry_view.h
+//
+//  @brief Header for the zero-copy entry implementation
+//
+//  @copy 2018 Elementary Robotics. All rights reserved.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __ATOM_CPP_ENTRY_VIEW_H
+#define __ATOM_CPP_ENTRY_VIEW_H
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <utility>
+#include <hiredis/hiredis.h>
+
+#include "shm_ring.h"
+
+namespace atom {
+
+// Reference to the bytes of a key or value in an EntryView. Doesn't own
+//	anything and is only valid for as long as the EntryView it came from,
+//	or a copy of it, is around
+class EntryField {
+	const char *ptr;
+	size_t len;
+
+public:
+	EntryField() : ptr(NULL), len(0) {}
+	EntryField(const char *p, size_t l) : ptr(p), len(l) {}
+
+	// Gets the bytes of the field. Not NULL-terminated
+	const char *data() const { return ptr; }
+
+	// Gets the number of bytes in the field
+	size_t size() const { return len; }
+
+	// Makes a copy of the field
+	std::string str() const { return std::string(ptr, len); }
+
+	bool operator==(const std::string &s) const {
+		return (s.size() == len) && (s.compare(0, len, ptr, len) == 0);
+	}
+	bool operator!=(const std::string &s) const {
+		return !(*this == s);
+	}
+};
+
+// Entry read from a stream that, rather than copying its data, keeps the
+//	redis reply it was read from alive and points into it. Copies are cheap
+//	and share the reply, which is freed once the last copy goes away.
+//	Values that were written to shared memory point into the writer's
+//	ring, which is kept mapped for as long as the view is around.
+class EntryView {
+
+	// Value in a shared-memory ring
+	struct ShmRef {
+		std::shared_ptr<ShmSegment> segment;
+		uint64_t pos;
+		uint64_t len;
+		uint64_t gen;
+	};
+
+	std::string id;
+	std::shared_ptr<redisReply> reply;
+	std::vector<std::pair<EntryField, EntryField>> fields;
+	std::vector<ShmRef> shm_refs;
+
+public:
+
+	// Constructor. Takes ownership of the reply, which is the array of
+	//	keys and values for the entry
+	EntryView(
+		const char *xread_id,
+		redisReply *r);
+	~EntryView();
+
+	// Copies share the reply and moves take it over
+	EntryView(const EntryView &) = default;
+	EntryView(EntryView &&) = default;
+	EntryView &operator=(const EntryView &) = default;
+	EntryView &operator=(EntryView &&) = default;
+
+	// Adds a field to the entry. The key and value must point into the
+	//	entry's reply. If the value is a shared-memory descriptor then the
+	//	field points at the data in shared memory instead. Returns false,
+	//	without adding the field, if that data can't be read from here
+	bool addField(
+		const redisReply *key,
+		const redisReply *value);
+
+	// Get the ID of the entry
+	const std::string &getID() const;
+
+	// Get all of the fields in the entry as (key, value) pairs, in the
+	//	order in which they were requested
+	const std::vector<std::pair<EntryField, EntryField>> &getFields() const;
+
+	// Get the number of fields in the entry
+	size_t size() const;
+
+	// Returns whether the entry has the key
+	bool hasKey(
+		const std::string &key) const;
+
+	// Get the value of a key in the entry. Throws std::out_of_range if
+	//	the key isn't there
+	EntryField getKey(
+		const std::string &key) const;
+
+	// Returns whether none of the values in shared memory have been
+	//	overwritten by their writer. Values in shared memory are only valid
+	//	until the writer comes around the ring again, so check this after
+	//	reading them
+	bool isValid() const;
+};
+
+} // namespace atom
+
+#endif // __ATOM_CPP_ENTRY_VIEW_H
@@ -0,0 +1,105 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @file event_loop.h
+//
+//  @brief Header for the epoll event loop. The loop drives hiredis async
+//			contexts and any other file descriptors registered with it
+//			from a single thread.
+//
+//  @copy 2018 Elementary Robotics. All rights reserved.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __ATOM_CPP_EVENT_LOOP_H
+#define __ATOM_CPP_EVENT_LOOP_H
+
+#include <map>
+#include <vector>
+#include <atomic>
+#include <functional>
+#include <sys/epoll.h>
+#include <hiredis/async.h>
+
+// Max number of events handled per epoll_wait
+#define EVENT_LOOP_MAX_EVENTS 64
+
+// Timeout for poll() to wait until there's an event
+#define EVENT_LOOP_NO_TIMEOUT -1
+
+namespace atom {
+
+// Called with the epoll events, e.g. EPOLLIN, that are ready on an fd
+typedef std::function<void(uint32_t events)> eventLoopFdFn;
+
+// Single-threaded epoll reactor. Handlers for the file descriptors and
+//	async contexts registered with the loop are called from poll(). Other
+//	than wake() and stop(), which may be called from any thread, the loop
+//	must only be used from the thread running it or while it isn't running.
+class EventLoop {
+
+	// Handler for a registered fd. Handlers removed while we're handling
+	//	events are freed once we're done with the events
+	struct FdHandler {
+		int fd;
+		uint32_t events;
+		eventLoopFdFn fn;
+		bool removed;
+	};
+
+	int epoll_fd;
+	int wake_fd;
+	std::map<int, FdHandler *> handlers;
+	std::vector<FdHandler *> removed;
+	std::atomic<bool> stopped;
+
+public:
+
+	// Constructor/destructor. Throws if we can't make the epoll fd
+	EventLoop();
+	~EventLoop();
+
+	// Registers an fd with the loop. fn is called with the ready events
+	//	whenever any of the events passed are ready on the fd
+	void addFd(
+		int fd,
+		uint32_t events,
+		eventLoopFdFn fn);
+
+	// Changes the events we wait for on a registered fd
+	void modifyFd(
+		int fd,
+		uint32_t events);
+
+	// Unregisters an fd. Safe to call from a handler, including the fd's
+	void removeFd(
+		int fd);
+
+	// Returns whether the fd is registered
+	bool hasFd(
+		int fd);
+
+	// Hooks the async context up to the loop s.t. its reads and writes
+	//	are driven by poll(). The context is unhooked when it's freed
+	void attach(
+		redisAsyncContext *ac);
+
+	// Waits up to timeout_ms for events and handles them. Returns the
+	//	number of events or -1 on error
+	int poll(
+		int timeout_ms = EVENT_LOOP_NO_TIMEOUT);
+
+	// Makes a poll() that's waiting return right away
+	void wake();
+
+	// Marks the loop as stopped and wakes it. Whoever's running the loop
+	//	should check isStopped() after each poll()
+	void stop();
+	bool isStopped();
+
+	// Clears the stopped flag s.t. the loop can be run again
+	void reset();
+};
+
+} // namespace atom
+
+#endif // __ATOM_CPP_EVENT_LOOP_H
@@ -0,0 +1,186 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @file handler_executor.h
+//
+//  @brief Header for running read handlers off of the thread that reads
+//			the streams. Each such handler gets a bounded queue of entries
+//			that's run on a thread of its own or on a pool shared with
+//			other handlers, s.t. a slow handler doesn't hold up the reads
+//			of every other stream in the read map.
+//
+//  @copy 2018 Elementary Robotics. All rights reserved.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __ATOM_CPP_HANDLER_EXECUTOR_H
+#define __ATOM_CPP_HANDLER_EXECUTOR_H
+
+#include <mutex>
+#include <deque>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <condition_variable>
+
+#include "entry_view.h"
+
+// Defaults for HandlerExecutor and HandlerPool
+#define HANDLER_DEFAULT_QUEUE_SIZE 64
+#define HANDLER_POOL_DEFAULT_THREADS 4
+
+// Most entries of a handler a pool thread runs before moving on to the
+//	next handler that has some
+#define HANDLER_POOL_BATCH 16
+
+namespace atom {
+
+// Where a handler runs. Directly on the thread reading the streams, as
+//	it always has, on a thread of its own or on a HandlerPool
+enum handler_executor_type {
+	HANDLER_EXECUTOR_DIRECT,
+	HANDLER_EXECUTOR_DEDICATED,
+	HANDLER_EXECUTOR_SHARED,
+};
+
+// What's done with an entry that comes in while the handler's queue is
+//	full. Either the oldest entry in the queue or the new one is dropped,
+//	or the read waits for the handler to catch up, which holds up the
+//	other streams read with it
+enum handler_overflow_policy {
+	HANDLER_OVERFLOW_DROP_OLDEST,
+	HANDLER_OVERFLOW_DROP_NEWEST,
+	HANDLER_OVERFLOW_BLOCK,
+};
+
+// Forward declarations
+class HandlerPool;
+class HandlerQueue;
+
+// How a handler in a read map is run
+struct HandlerExecutor {
+	enum handler_executor_type type;
+	size_t queue_size;
+	enum handler_overflow_policy overflow;
+	HandlerPool *handler_pool;
+
+	HandlerExecutor(
+		enum handler_executor_type t = HANDLER_EXECUTOR_DIRECT,
+		size_t size = HANDLER_DEFAULT_QUEUE_SIZE,
+		enum handler_overflow_policy o = HANDLER_OVERFLOW_DROP_OLDEST,
+		HandlerPool *p = NULL) : type(t), queue_size(size), overflow(o),
+			handler_pool(p) {}
+
+	static HandlerExecutor direct() {
+		return HandlerExecutor(HANDLER_EXECUTOR_DIRECT);
+	}
+	static HandlerExecutor dedicated(
+		size_t size = HANDLER_DEFAULT_QUEUE_SIZE,
+		enum handler_overflow_policy o = HANDLER_OVERFLOW_DROP_OLDEST) {
+		return HandlerExecutor(HANDLER_EXECUTOR_DEDICATED, size, o);
+	}
+	static HandlerExecutor shared(
+		HandlerPool &p,
+		size_t size = HANDLER_DEFAULT_QUEUE_SIZE,
+		enum handler_overflow_policy o = HANDLER_OVERFLOW_DROP_OLDEST) {
+		return HandlerExecutor(HANDLER_EXECUTOR_SHARED, size, o, &p);
+	}
+};
+
+// Counters for a handler's queue. Kept in the read map s.t. they can be
+//	looked at while the streams are being read and after
+struct HandlerQueueStats {
+	std::atomic<size_t> depth;
+	std::atomic<size_t> max_depth;
+	std::atomic<size_t> dropped;
+
+	HandlerQueueStats() : depth(0), max_depth(0), dropped(0) {}
+};
+
+// Threads that run the queues of the handlers that share them. A handler
+//	is only ever run on one of them at a time, so its entries are still
+//	handled in order. Must outlive the reads that use it
+class HandlerPool {
+	std::mutex mutex;
+	std::condition_variable cv;
+	std::deque<HandlerQueue *> ready;
+	std::vector<std::thread> threads;
+	bool stopping;
+
+	void worker();
+
+	// Queues up a handler that has entries to run
+	void schedule(
+		HandlerQueue *queue);
+	friend class HandlerQueue;
+
+public:
+
+	HandlerPool(
+		size_t n_threads = HANDLER_POOL_DEFAULT_THREADS);
+	~HandlerPool();
+
+	HandlerPool(const HandlerPool &) = delete;
+	HandlerPool &operator=(const HandlerPool &) = delete;
+
+	// Gets the number of threads
+	size_t size() const { return threads.size(); }
+};
+
+// Handler that entries are queued up for
+typedef void (*queuedHandlerFn)(
+	EntryView &e,
+	void *user_data);
+
+// Bounded queue of entries for a handler and whatever runs it. Entries are
+//	views s.t. queueing one doesn't copy anything
+class HandlerQueue {
+	queuedHandlerFn fn;
+	void *user_data;
+	HandlerExecutor executor;
+	std::shared_ptr<HandlerQueueStats> stats;
+
+	std::mutex mutex;
+	std::condition_variable not_empty;
+	std::condition_variable not_full;
+	std::condition_variable idle;
+	std::deque<EntryView> entries;
+	bool busy;
+	bool stopping;
+	std::thread thread;
+
+	void threadLoop();
+
+	// Runs the next few entries on a pool thread. Returns whether there
+	//	are more, in which case the handler is still scheduled
+	bool runBatch();
+	friend class HandlerPool;
+
+	// Takes the entry at the front. Called with the lock held
+	EntryView pop();
+
+public:
+
+	// Constructor/destructor. The queue is done with once it's destroyed,
+	//	which waits for the entries in it to be handled
+	HandlerQueue(
+		queuedHandlerFn fn,
+		void *user_data,
+		const HandlerExecutor &executor,
+		std::shared_ptr<HandlerQueueStats> stats);
+	~HandlerQueue();
+
+	HandlerQueue(const HandlerQueue &) = delete;
+	HandlerQueue &operator=(const HandlerQueue &) = delete;
+
+	// Queues up an entry, dropping one or waiting if the queue is full
+	void push(
+		EntryView &&e);
+
+	// Waits for everything in the queue to be handled
+	void drain();
+};
+
+} // namespace atom
+
+#endif // __ATOM_CPP_HANDLER_EXECUTOR_H
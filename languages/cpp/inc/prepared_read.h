@@ -0,0 +1,80 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @file prepared_read.h
+//
+//  @brief Header for reads of a stream that are set up once and done
+//			over and over
+//
+//  @copy 2018 Elementary Robotics. All rights reserved.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __ATOM_CPP_PREPARED_READ_H
+#define __ATOM_CPP_PREPARED_READ_H
+
+#include <string>
+#include <vector>
+
+#include "atom/atom.h"
+#include "atom/redis.h"
+#include "atom/element_entry_read.h"
+
+namespace atom {
+
+// Forward declarations
+class Element;
+class ContextPool;
+
+// A read of some keys of a stream that's set up once by
+//	Element::prepareRead() and then done any number of times with the
+//	entryReadN and entryReadSince that take it, e.g.
+//
+//	PreparedRead read;
+//	element.prepareRead("camera", "pose", keys, read);
+//	while (running) {
+//		element.entryReadSince(read, 10, entries);
+//	}
+//
+//	The stream's name, the keys and the rest of what a read needs are
+//	kept in here s.t. polling a stream doesn't make them for every read.
+//	Each entryReadSince picks up after the last entry the one before it
+//	got. A read is only done by one thread at a time and must not outlive
+//	the element
+class PreparedRead {
+	friend class Element;
+
+	Element *element;
+	ContextPool *pool;
+	std::string element_name;
+	std::string stream;
+	std::vector<std::string> keys;
+	std::vector<struct redis_xread_kv_item> kv_items;
+	struct element_entry_read_info info;
+	struct element_entry_prepared_read read;
+
+public:
+
+	// Constructor and destructor. The read is good for nothing until
+	//	it's been prepared
+	PreparedRead();
+	~PreparedRead();
+
+	// Not copyable since the read info points into it
+	PreparedRead(const PreparedRead &) = delete;
+	PreparedRead &operator=(const PreparedRead &) = delete;
+
+	// Whether the read has been prepared and not closed since
+	bool isPrepared() const { return element != NULL; }
+
+	// Gets and sets the ID that the next entryReadSince reads after
+	std::string getLastID() const;
+	void setLastID(
+		const std::string &id);
+
+	// Frees everything the read was prepared with
+	void close();
+};
+
+} // namespace atom
+
+#endif // __ATOM_CPP_PREPARED_READ_H
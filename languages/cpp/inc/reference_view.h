@@ -0,0 +1,53 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @file reference_view.h
+//
+//  @brief Header for the zero-copy reference values implementation
+//
+//  @copy 2018 Elementary Robotics. All rights reserved.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __ATOM_CPP_REFERENCE_VIEW_H
+#define __ATOM_CPP_REFERENCE_VIEW_H
+
+#include <memory>
+#include <vector>
+#include <hiredis/hiredis.h>
+
+#include "entry_view.h"
+
+namespace atom {
+
+// Values of references read from redis. Like an EntryView, the values
+//	point into the redis replies they were read in, which are kept alive
+//	for as long as this, or a copy of it, is around.
+class ReferenceView {
+	std::vector<std::shared_ptr<redisReply>> replies;
+	std::vector<const redisReply *> values;
+
+public:
+
+	// Takes ownership of an MGET reply and adds its values
+	void addReply(
+		redisReply *r);
+
+	// Removes all of the values
+	void clear();
+
+	// Get the number of values, one per reference asked for
+	size_t size() const;
+
+	// Returns whether the reference at idx existed
+	bool hasValue(
+		size_t idx) const;
+
+	// Get the value of the reference at idx. Throws std::out_of_range if
+	//	there's no such reference or it didn't exist
+	EntryField getValue(
+		size_t idx) const;
+};
+
+} // namespace atom
+
+#endif // __ATOM_CPP_REFERENCE_VIEW_H
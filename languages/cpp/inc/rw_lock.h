@@ -0,0 +1,61 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @file rw_lock.h
+//
+//  @brief Reader/writer lock. C++11 doesn't have std::shared_mutex, so
+//			this wraps a pthread rwlock in the same interface
+//
+//  @copy 2018 Elementary Robotics. All rights reserved.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __ATOM_CPP_RW_LOCK_H
+#define __ATOM_CPP_RW_LOCK_H
+
+#include <pthread.h>
+
+namespace atom {
+
+// Lock that any number of readers can hold at once, or one writer. lock()
+//	and unlock() are the writer's s.t. it works with std::lock_guard and
+//	std::unique_lock
+class RWLock {
+	pthread_rwlock_t rwlock;
+
+public:
+	RWLock() { pthread_rwlock_init(&rwlock, NULL); }
+	~RWLock() { pthread_rwlock_destroy(&rwlock); }
+
+	RWLock(const RWLock &) = delete;
+	RWLock &operator=(const RWLock &) = delete;
+
+	void lock() { pthread_rwlock_wrlock(&rwlock); }
+	void unlock() { pthread_rwlock_unlock(&rwlock); }
+
+	void lock_shared() { pthread_rwlock_rdlock(&rwlock); }
+	void unlock_shared() { pthread_rwlock_unlock(&rwlock); }
+};
+
+// Holds a lock as a reader for as long as it's in scope
+class SharedLock {
+	RWLock &rwlock;
+
+public:
+	SharedLock(
+		RWLock &l) : rwlock(l)
+	{
+		rwlock.lock_shared();
+	}
+
+	~SharedLock()
+	{
+		rwlock.unlock_shared();
+	}
+
+	SharedLock(const SharedLock &) = delete;
+	SharedLock &operator=(const SharedLock &) = delete;
+};
+
+} // namespace atom
+
+#endif // __ATOM_CPP_RW_LOCK_H
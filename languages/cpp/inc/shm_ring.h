@@ -0,0 +1,164 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @file shm_ring.h
+//
+//  @brief Header for the shared-memory transport. Large values written to
+//			a stream can be put in a shared-memory ring on the writer's
+//			host, in which case the stream entry only carries a small
+//			descriptor of where the value is. Readers on the same host
+//			map the ring and read the value out of it directly.
+//
+//  @copy 2018 Elementary Robotics. All rights reserved.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __ATOM_CPP_SHM_RING_H
+#define __ATOM_CPP_SHM_RING_H
+
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <stdint.h>
+
+// Magic at the start of every ring
+#define SHM_RING_MAGIC 0x61746f6d2d73686dULL
+
+// Descriptor values start with this. The leading NUL keeps it from
+//	colliding with text values and msgpack's nil is 0xc0, not 0x00
+#define SHM_DESCRIPTOR_PREFIX "\0atom-shm\0"
+#define SHM_DESCRIPTOR_PREFIX_LEN 10
+
+// Every value written through an element that starts with the prefix is
+//	framed. The prefix is followed by a byte that says whether the rest is
+//	a descriptor or the original value, which only happens if the original
+//	value started with the prefix
+#define SHM_FRAME_DESCRIPTOR 0
+#define SHM_FRAME_STORED 1
+#define SHM_FRAME_HEADER_LEN (SHM_DESCRIPTOR_PREFIX_LEN + 1)
+
+// Defaults for Element::useSharedMemory()
+#define SHM_DEFAULT_RING_SIZE (64 * 1024 * 1024)
+#define SHM_DEFAULT_MIN_SIZE (64 * 1024)
+
+namespace atom {
+
+// Header at the start of a ring. head is the total number of bytes ever
+//	reserved in the ring, s.t. positions are monotonic and a position's
+//	offset in the ring is pos % size. generation is unique to each time
+//	a ring is made so that readers can tell a new ring from an old one
+//	with the same name
+struct ShmRingHeader {
+	uint64_t magic;
+	uint64_t generation;
+	uint64_t size;
+	std::atomic<uint64_t> head;
+};
+
+// Where a value is in a ring
+struct ShmDescriptor {
+	std::string segment;
+	uint64_t pos;
+	uint64_t len;
+	uint64_t gen;
+	std::string host;
+
+	// Makes the value to put in the stream in place of the data
+	std::string encode() const;
+
+	// Returns whether a stream value is framed, i.e. is either a
+	//	descriptor or a stored value
+	static bool isFramed(
+		const char *data,
+		size_t len);
+
+	// Returns whether a framed value is a stored value
+	static bool isStored(
+		const char *data,
+		size_t len);
+
+	// Frames a value that starts with the prefix as stored
+	static std::string frame(
+		const char *data,
+		size_t len);
+
+	// Parses a descriptor. Returns false if it's malformed
+	static bool decode(
+		const char *data,
+		size_t len,
+		ShmDescriptor &desc);
+};
+
+// Gets the ID of this host. Only readers with the same host ID as the
+//	writer of a descriptor can read it
+const std::string &shmHostID();
+
+// Ring written by a single element for a single stream. Values are put
+//	at the head of the ring, wrapping back to the start when they won't
+//	fit before the end, and old values are overwritten as needed. The ring
+//	is removed when the writer goes away.
+class ShmRingWriter {
+	std::string name;
+	int fd;
+	size_t map_size;
+	ShmRingHeader *header;
+	char *data;
+
+public:
+
+	// Constructor/destructor. Throws if we can't make the ring
+	ShmRingWriter(
+		const std::string &segment,
+		size_t size);
+	~ShmRingWriter();
+
+	// Copies the data into the ring and fills in its descriptor. Returns
+	//	false if the data is too big for the ring. Thread-safe
+	bool write(
+		const char *buf,
+		size_t len,
+		ShmDescriptor &desc);
+};
+
+// Read-only mapping of a ring. Shared by everything on the host reading
+//	from the ring and kept mapped for as long as any of them are using it
+class ShmSegment {
+	std::string name;
+	size_t map_size;
+	const ShmRingHeader *header;
+	const char *data;
+
+	ShmSegment(
+		const std::string &segment);
+
+public:
+	~ShmSegment();
+
+	// Returns whether the mapping is of a proper ring
+	bool isMapped() const;
+
+	// Returns whether the value at pos hasn't been overwritten
+	bool intact(
+		uint64_t pos,
+		uint64_t len,
+		uint64_t gen) const;
+
+	// Finds the mapping for the descriptor and points ptr at the value.
+	//	Returns NULL if the value can't be read on this host or has
+	//	already been overwritten. The value may still be overwritten
+	//	after this returns, check intact() once done with it
+	static std::shared_ptr<ShmSegment> resolve(
+		const ShmDescriptor &desc,
+		const char *&ptr);
+
+	// Copies out the value for the descriptor. Returns false if it
+	//	can't be read or was overwritten while we were copying it
+	static bool copy(
+		const ShmDescriptor &desc,
+		std::string &out);
+};
+
+} // namespace atom
+
+#endif // __ATOM_CPP_SHM_RING_H
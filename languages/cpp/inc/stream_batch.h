@@ -0,0 +1,79 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @file stream_batch.h
+//
+//  @brief Header for the stream batch implementation
+//
+//  @copy 2018 Elementary Robotics. All rights reserved.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __ATOM_CPP_STREAM_BATCH_H
+#define __ATOM_CPP_STREAM_BATCH_H
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "atom/atom.h"
+#include "atom/redis.h"
+#include "atom/element_entry_write.h"
+
+namespace atom {
+
+// Entry value
+typedef std::map<std::string, std::string> entry_data_t;
+
+// Batch of entries to be written with a single call to
+//	Element::entryWriteBatch. Entries may be on any number of streams
+//	and are written in the order in which they were added. Once the
+//	batch has been written the ID and error for each entry can be
+//	queried by its index.
+class StreamBatch {
+
+	// A single entry in the batch
+	struct BatchEntry {
+		std::string stream;
+		entry_data_t data;
+		int timestamp;
+		int maxlen;
+	};
+
+	std::vector<BatchEntry> entries;
+	std::vector<std::string> ids;
+	std::vector<enum atom_error_t> errors;
+
+	friend class Element;
+
+public:
+
+	// Constructor/Destructor
+	StreamBatch() {}
+	~StreamBatch() {}
+
+	// Adds an entry to the batch. Returns the index of the entry
+	size_t add(
+		std::string stream,
+		entry_data_t data,
+		int timestamp = ELEMENT_DATA_WRITE_DEFAULT_TIMESTAMP,
+		int maxlen = ELEMENT_DATA_WRITE_DEFAULT_MAXLEN);
+
+	// Gets the number of entries in the batch
+	size_t size();
+
+	// Removes all entries and results from the batch s.t. it can be reused
+	void clear();
+
+	// Gets the ID of the nth entry once the batch has been written. Empty
+	//	if the entry failed to write
+	const std::string &getID(
+		size_t n);
+
+	// Gets the error of the nth entry once the batch has been written
+	enum atom_error_t getError(
+		size_t n);
+};
+
+} // namespace atom
+
+#endif // __ATOM_CPP_STREAM_BATCH_H
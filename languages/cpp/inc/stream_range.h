@@ -0,0 +1,84 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @file stream_range.h
+//
+//  @brief Header for iterating over a range of a stream a page at a time
+//
+//  @copy 2018 Elementary Robotics. All rights reserved.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __ATOM_CPP_STREAM_RANGE_H
+#define __ATOM_CPP_STREAM_RANGE_H
+
+#include <string>
+#include <vector>
+#include <hiredis/hiredis.h>
+
+#include "atom/atom.h"
+#include "atom/redis.h"
+#include "atom/element_entry_read.h"
+#include "entry_view.h"
+
+namespace atom {
+
+// Forward declaration of the element class s.t. the iterator can give its
+//	context back
+class Element;
+class ContextPool;
+
+// Iterates over the entries in a range of a stream, oldest first or
+//	newest first. The range is read a page at a time and the next page is
+//	requested while the current one is being gone through, so at most two
+//	pages are in memory at once no matter how long the range is. Made by
+//	Element::entryRange(), and holds onto one of the element's contexts
+//	until it's done or closed.
+class StreamRangeIterator {
+	friend class Element;
+
+	Element *element;
+	ContextPool *pool;
+	redisContext *ctx;
+	std::string element_name;
+	std::string stream;
+	std::vector<std::string> keys;
+	std::vector<struct redis_xread_kv_item> kv_items;
+	struct element_entry_read_info info;
+	struct element_entry_range range;
+	std::vector<EntryView> page;
+	size_t pos;
+	size_t n_read;
+	enum atom_error_t err;
+
+public:
+
+	// Constructor and destructor. The destructor closes the range
+	StreamRangeIterator();
+	~StreamRangeIterator();
+
+	// Not copyable since it holds a context
+	StreamRangeIterator(const StreamRangeIterator &) = delete;
+	StreamRangeIterator &operator=(const StreamRangeIterator &) = delete;
+
+	// Moves to the next entry, reading the next page if needed. Returns
+	//	false once there are no more entries or if there was an error, in
+	//	which case getError() says which
+	bool next();
+
+	// Gets the current entry. Only valid after next() returns true. The
+	//	view may be kept after moving on
+	EntryView &get();
+
+	// Gets the error that stopped the iterator, if any
+	enum atom_error_t getError() const;
+
+	// Gets the number of entries read so far
+	size_t count() const;
+
+	// Stops reading the range and gives back the context
+	void close();
+};
+
+} // namespace atom
+
+#endif // __ATOM_CPP_STREAM_RANGE_H
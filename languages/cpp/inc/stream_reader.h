@@ -0,0 +1,180 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @file stream_reader.h
+//
+//  @brief Header for reading a stream of msgpack values into a struct
+//
+//  @copy 2018 Elementary Robotics. All rights reserved.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __ATOM_CPP_STREAM_READER_H
+#define __ATOM_CPP_STREAM_READER_H
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <syslog.h>
+#include <msgpack.hpp>
+
+#include "atom/atom.h"
+#include "entry_view.h"
+
+namespace atom {
+
+// Lets msgpack point strings and binaries into the reply rather than
+//	copying them into the zone
+inline bool streamUnpackReferenceFn(
+	msgpack::type::object_type type,
+	std::size_t length,
+	void *user_data)
+{
+	return true;
+}
+
+// Reads entries whose values are msgpack into a T. Each key the reader
+//	asks for is bound to a member of T, e.g.
+//
+//	StreamReader<Pose> reader(poseCB);
+//	reader.field("x", &Pose::x).field("y", &Pose::y);
+//	m.addTypedHandler("robot", "pose", reader);
+//
+//	Only the bound keys are read from the stream. Each value is unpacked
+//	straight out of the reply, with the objects in a zone that's kept
+//	from entry to entry, and converted into the same T every time s.t.
+//	strings and vectors in it keep their memory. Keys that aren't in an
+//	entry leave their member as it was. The handler gets the value for as
+//	long as it's running and must copy anything it wants to keep. Entries
+//	that can't be decoded are counted and skipped. A reader is used by
+//	one handler at a time and must outlive the read map it's in.
+template <typename T>
+class StreamReader {
+
+public:
+
+	// Handler for each decoded entry. The entry is the one it was
+	//	decoded from
+	typedef bool (*typedHandlerFn)(
+		T &value,
+		EntryView &e,
+		void *user_data);
+
+private:
+
+	// Converts the value of a field into its member
+	struct FieldDecoder {
+		virtual ~FieldDecoder() {}
+		virtual void decode(
+			const msgpack::object &obj,
+			T &value) const = 0;
+	};
+
+	template <typename M>
+	struct MemberDecoder : public FieldDecoder {
+		M T::*member;
+
+		MemberDecoder(
+			M T::*m) : member(m) {}
+
+		void decode(
+			const msgpack::object &obj,
+			T &value) const override
+		{
+			obj.convert(value.*member);
+		}
+	};
+
+	std::vector<std::string> keys;
+	std::vector<std::unique_ptr<FieldDecoder>> decoders;
+	msgpack::zone zone;
+	T value;
+	typedHandlerFn fn;
+	void *user_data;
+	size_t n_errors;
+
+public:
+
+	StreamReader(
+		typedHandlerFn f,
+		void *data = NULL) : fn(f), user_data(data), n_errors(0) {}
+
+	// Not copyable since the read map points at it
+	StreamReader(const StreamReader &) = delete;
+	StreamReader &operator=(const StreamReader &) = delete;
+
+	// Binds a key to a member of T. Returns the reader s.t. these can be
+	//	chained
+	template <typename M>
+	StreamReader &field(
+		const std::string &key,
+		M T::*member)
+	{
+		keys.push_back(key);
+		decoders.emplace_back(new MemberDecoder<M>(member));
+		return *this;
+	}
+
+	// Gets the keys that are bound, in the order they were bound
+	const std::vector<std::string> &getKeys() const { return keys; }
+
+	// Decodes an entry into the value. The entry's fields are in the
+	//	order of the keys, without the ones it doesn't have, so they're
+	//	matched up in a single pass. Returns false if a value wasn't
+	//	msgpack of the member's type or was in shared memory that's since
+	//	been overwritten
+	bool decode(
+		EntryView &e)
+	{
+		const std::vector<std::pair<EntryField, EntryField>> &fields =
+			e.getFields();
+
+		// Everything from the last entry is done with
+		zone.clear();
+
+		try {
+			size_t j = 0;
+			for (size_t i = 0; (i < keys.size()) && (j < fields.size()); ++i) {
+				if (fields[j].first != keys[i]) {
+					continue;
+				}
+				msgpack::object obj = msgpack::unpack(zone,
+					fields[j].second.data(), fields[j].second.size(),
+					streamUnpackReferenceFn);
+				decoders[i]->decode(obj, value);
+				++j;
+			}
+		} catch (...) {
+			return false;
+		}
+
+		return e.isValid();
+	}
+
+	// Gets the value that the last entry was decoded into
+	T &get() { return value; }
+
+	// Gets the number of entries that couldn't be decoded
+	size_t getNumErrors() const { return n_errors; }
+
+	// Read handler for the read map. Entries that can't be decoded don't
+	//	stop the read
+	static bool viewCB(
+		EntryView &e,
+		void *user_data)
+	{
+		StreamReader *reader = (StreamReader *)user_data;
+
+		if (!reader->decode(e)) {
+			++reader->n_errors;
+			atom_logf(NULL, NULL, LOG_ERR,
+				"Couldn't decode entry %s", e.getID().c_str());
+			return true;
+		}
+
+		return reader->fn(reader->value, e, reader->user_data);
+	}
+};
+
+} // namespace atom
+
+#endif // __ATOM_CPP_STREAM_READER_H
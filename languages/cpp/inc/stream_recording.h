@@ -0,0 +1,265 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @file stream_recording.h
+//
+//  @brief Header for recording streams to disk and replaying them. A
+//			recording is two append-only files that are memory-mapped
+//			rather than read or written, a segment with the entries and
+//			an index of where each entry is and when it was written, s.t.
+//			sessions of many GB can be searched and replayed without
+//			reading them into memory.
+//
+//  @copy 2018 Elementary Robotics. All rights reserved.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __ATOM_CPP_STREAM_RECORDING_H
+#define __ATOM_CPP_STREAM_RECORDING_H
+
+#include <mutex>
+#include <deque>
+#include <string>
+#include <vector>
+#include <utility>
+#include <stdint.h>
+
+#include "atom/atom.h"
+#include "atom/element_entry_write.h"
+#include "entry_view.h"
+
+// Magic at the start of the segment and the index
+#define RECORDING_MAGIC 0x61746f6d2d726563ULL
+#define RECORDING_VERSION 1
+
+// The index goes next to the segment, with this on the end of its path
+#define RECORDING_INDEX_SUFFIX ".idx"
+
+// How much the files grow by, and so how much of them is mapped, at a time
+#define RECORDING_DEFAULT_CHUNK_SIZE (64 * 1024 * 1024)
+
+// Replay speeds. Other speeds are multiples of the original timing
+#define RECORDING_REPLAY_ORIGINAL 1.0
+#define RECORDING_REPLAY_FAST 0.0
+
+// Most entries sent before waiting for their replies when replaying
+#define RECORDING_REPLAY_BATCH 256
+
+namespace atom {
+
+// Forward declarations
+class Element;
+class ElementReadMap;
+
+// Header at the start of both files. size is how much of the file is
+//	done, the number of bytes of entries in the segment and the number of
+//	entries in the index, and is only moved once an entry is fully written
+//	s.t. a recording that wasn't closed properly is still good up to there
+struct RecordingHeader {
+	uint64_t magic;
+	uint32_t version;
+	uint32_t n_streams;
+	uint64_t data_start;
+	uint64_t size;
+};
+
+// Where an entry is in the segment. time_ms is the time in the entry's ID,
+//	but never less than that of the entries before it s.t. the index can
+//	be searched by time even though streams are read a batch at a time
+struct RecordingIndexEntry {
+	uint64_t offset;
+	int64_t time_ms;
+	uint64_t id_ms;
+	uint64_t id_seq;
+	uint32_t stream;
+	uint32_t len;
+};
+
+// A stream to record and the keys of it to record
+struct RecordedStream {
+	std::string element;
+	std::string stream;
+	std::vector<std::string> keys;
+};
+
+// An entry read back from a recording. The fields point into the mapped
+//	segment and are valid for as long as the replayer is
+struct RecordedEntry {
+	size_t stream;
+	int64_t time_ms;
+	uint64_t id_ms;
+	uint64_t id_seq;
+	std::vector<std::pair<EntryField, EntryField>> fields;
+};
+
+// An append-only file. Only the chunk being written and the header are
+//	mapped at any time
+class RecordingFile {
+	int fd;
+	size_t chunk_size;
+	uint64_t file_size;
+	RecordingHeader *header;
+	char *window;
+	uint64_t window_offset;
+	size_t window_len;
+
+public:
+
+	// Constructor/destructor. Makes the file, replacing any that's
+	//	there, and throws if we can't
+	RecordingFile(
+		const std::string &path,
+		size_t chunk_size);
+	~RecordingFile();
+
+	RecordingFile(const RecordingFile &) = delete;
+	RecordingFile &operator=(const RecordingFile &) = delete;
+
+	// Gets the file's header
+	RecordingHeader &getHeader() { return *header; }
+
+	// Gets len bytes at offset to write to, growing the file if need be.
+	//	Only valid until the next call. Returns NULL if the file can't grow
+	char *reserve(
+		uint64_t offset,
+		size_t len);
+
+	// Cuts the file down to len bytes once we're done writing it
+	void finish(
+		uint64_t len);
+};
+
+// Records entries from streams. Add it to a read map and each entry the
+//	read loop gets is appended to the recording, e.g.
+//
+//	StreamRecorder recorder("run.rec", {{"camera", "rgb", {"data"}}});
+//	ElementReadMap m;
+//	recorder.addTo(m);
+//	element.entryReadLoop(m);
+//
+//	The recording is complete up to the last entry written even if it's
+//	never closed. Thread-safe s.t. streams on different shards can be
+//	recorded by the same recorder
+class StreamRecorder {
+
+	// What the read map's handlers get
+	struct Handler {
+		StreamRecorder *recorder;
+		size_t stream;
+	};
+
+	std::vector<RecordedStream> streams;
+	std::deque<Handler> handlers;
+	std::mutex mutex;
+	RecordingFile segment;
+	RecordingFile index;
+	int64_t last_time_ms;
+	size_t n_dropped;
+
+	static bool viewCB(
+		EntryView &e,
+		void *user_data);
+
+public:
+
+	// Constructor. Makes the recording at path and its index next to it,
+	//	replacing any that are there. Throws if we can't
+	StreamRecorder(
+		const std::string &path,
+		const std::vector<RecordedStream> &streams,
+		size_t chunk_size = RECORDING_DEFAULT_CHUNK_SIZE);
+	~StreamRecorder();
+
+	// Adds a handler for each of the streams to the read map
+	void addTo(
+		ElementReadMap &m);
+
+	// Appends an entry of the nth stream. Returns false if the entry
+	//	couldn't be written or its values in shared memory were
+	//	overwritten while it was being copied, in which case it's dropped
+	bool record(
+		size_t stream,
+		const EntryView &e);
+
+	// Gets the number of entries recorded and dropped
+	size_t size();
+	size_t getNumDropped();
+};
+
+// Reads back a recording and replays it. Both files are mapped in full,
+//	which only takes address space, and read in order s.t. the kernel
+//	can read ahead and drop what's been replayed. Not thread-safe
+class StreamReplayer {
+	std::string path;
+	std::vector<RecordedStream> streams;
+	std::vector<std::vector<EntryField>> keys;
+	const char *segment;
+	size_t segment_len;
+	const char *index_map;
+	size_t index_map_len;
+	const RecordingIndexEntry *index;
+	size_t n_entries;
+	size_t pos;
+
+	// Reads the table of streams at the start of the segment
+	bool readStreams(
+		const RecordingHeader &header);
+
+	// Unmaps the files
+	void unmap();
+
+public:
+
+	// Constructor/destructor. Throws if the recording can't be read
+	StreamReplayer(
+		const std::string &path);
+	~StreamReplayer();
+
+	StreamReplayer(const StreamReplayer &) = delete;
+	StreamReplayer &operator=(const StreamReplayer &) = delete;
+
+	// Gets the streams in the recording, which entries refer to by their
+	//	position in this
+	const std::vector<RecordedStream> &getStreams() const { return streams; }
+
+	// Gets the number of entries in the recording and the position of
+	//	the next entry to read
+	size_t size() const { return n_entries; }
+	size_t tell() const { return pos; }
+
+	// Moves to the nth entry
+	void seek(
+		size_t n);
+
+	// Moves to the first entry written at or after time_ms, in ms
+	//	since the epoch
+	void seekTime(
+		int64_t time_ms);
+
+	// Moves to the first entry of the stream with an ID of at least id.
+	//	Returns false, and moves to the end, if there isn't one
+	bool seekID(
+		const std::string &element,
+		const std::string &stream,
+		const std::string &id);
+
+	// Reads the next entry. Returns false at the end of the recording
+	bool next(
+		RecordedEntry &entry);
+
+	// Writes the entries from here on back to their streams, at most
+	//	max_entries of them if it's non-zero. At
+	//	RECORDING_REPLAY_ORIGINAL they're written as far apart as they
+	//	were recorded, at RECORDING_REPLAY_FAST as fast as redis can take
+	//	them and else at speed times the original rate. The entries get
+	//	new IDs. Either way they're pipelined, RECORDING_REPLAY_BATCH at
+	//	a time
+	enum atom_error_t replay(
+		Element &element,
+		double speed = RECORDING_REPLAY_FAST,
+		size_t max_entries = 0,
+		int maxlen = ELEMENT_DATA_WRITE_DEFAULT_MAXLEN);
+};
+
+} // namespace atom
+
+#endif // __ATOM_CPP_STREAM_RECORDING_H
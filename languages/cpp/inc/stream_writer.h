@@ -0,0 +1,167 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @file stream_writer.h
+//
+//  @brief Header for writing a stream whose keys are fixed at compile time
+//
+//  @copy 2018 Elementary Robotics. All rights reserved.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __ATOM_CPP_STREAM_WRITER_H
+#define __ATOM_CPP_STREAM_WRITER_H
+
+#include <array>
+#include <string>
+#include <vector>
+#include <string.h>
+#include <hiredis/hiredis.h>
+
+#include "atom/atom.h"
+#include "atom/redis.h"
+#include "atom/element_entry_write.h"
+
+// Declares a field of a stream for StreamWriter, e.g.
+//	ATOM_STREAM_FIELD(Position, "position");
+#define ATOM_STREAM_FIELD(type, key_str) \
+	struct type { \
+		static constexpr const char *key() { return key_str; } \
+		static constexpr size_t key_len() { return sizeof(key_str) - 1; } \
+	}
+
+namespace atom {
+
+// Forward declaration of the element class s.t. the writer can get its
+//	context
+class Element;
+class ContextPool;
+
+// A value for a field. Only points at the data, which isn't copied
+struct FieldValue {
+	const void *data;
+	size_t len;
+
+	FieldValue(
+		const void *d,
+		size_t l) : data(d), len(l) {}
+	FieldValue(
+		const char *str) : data(str), len(strlen(str)) {}
+	FieldValue(
+		const std::string &str) : data(str.data()), len(str.size()) {}
+	template <typename T>
+	FieldValue(
+		const std::vector<T> &v) : data(v.data()), len(v.size() * sizeof(T)) {}
+	template <typename T, size_t N>
+	FieldValue(
+		const std::array<T, N> &a) : data(a.data()), len(N * sizeof(T)) {}
+};
+
+// The part of the writer that doesn't depend on the fields. Holds the
+//	XADD's arguments, built once, and one of the element's contexts on
+//	the stream's shard until it's destroyed
+class StreamWriterBase {
+
+	Element &element;
+	ContextPool &pool;
+	redisContext *ctx;
+	char stream_key[ATOM_NAME_MAXLEN];
+	char maxlen_buffer[REDIS_XADD_MAXLEN_BUFFLEN];
+	char last_id[STREAM_ID_BUFFLEN];
+	size_t n_header;
+	std::vector<const char *> argv;
+	std::vector<size_t> argvlen;
+
+protected:
+
+	StreamWriterBase(
+		Element &element,
+		const std::string &stream,
+		int maxlen,
+		const char *const *keys,
+		const size_t *key_lens,
+		size_t n_fields);
+
+	// Points a field at its value
+	void setValue(
+		size_t field,
+		const FieldValue &value)
+	{
+		argv[n_header + 2 * field + 1] = (const char *)value.data;
+		argvlen[n_header + 2 * field + 1] = value.len;
+	}
+
+public:
+
+	~StreamWriterBase();
+
+	// Not copyable since it holds a context
+	StreamWriterBase(const StreamWriterBase &) = delete;
+	StreamWriterBase &operator=(const StreamWriterBase &) = delete;
+
+	// Writes an entry with the values that are currently bound
+	enum atom_error_t write();
+
+	// Gets the ID of the last entry written
+	const char *getID() const { return last_id; }
+};
+
+// Writes a stream whose keys are the Fields, declared with
+//	ATOM_STREAM_FIELD. The XADD is built when the writer is made, so each
+//	write only points the values at their data and sends it, without
+//	looking anything up or copying anything. Entries don't get a
+//	timestamp and aren't compressed or put in shared memory. Values that
+//	look like shared memory descriptors are the only ones copied, s.t.
+//	they can be framed. The writer
+//	must not outlive the element and is used by one thread at a time.
+template <typename... Fields>
+class StreamWriter : public StreamWriterBase {
+
+	static constexpr size_t N_FIELDS = sizeof...(Fields);
+	static_assert(N_FIELDS > 0, "A stream needs at least one field");
+
+	static constexpr const char *keys[N_FIELDS] = { Fields::key()... };
+	static constexpr size_t key_lens[N_FIELDS] = { Fields::key_len()... };
+
+public:
+
+	StreamWriter(
+		Element &element,
+		const std::string &stream,
+		int maxlen = ELEMENT_DATA_WRITE_DEFAULT_MAXLEN) :
+			StreamWriterBase(element, stream, maxlen, keys, key_lens, N_FIELDS) {}
+
+	// Binds the values, in the order of the fields. Only the location of
+	//	each value is kept, so each value needs to stay where it is, e.g.
+	//	a std::array or a buffer, for as long as it's bound. Then write()
+	//	sends whatever's in them
+	template <typename... Values>
+	void bind(
+		const Values &... values)
+	{
+		static_assert(sizeof...(Values) == N_FIELDS,
+			"Need one value for each field");
+		const FieldValue spans[] = { FieldValue(values)... };
+		for (size_t i = 0; i < N_FIELDS; ++i) {
+			setValue(i, spans[i]);
+		}
+	}
+
+	// Binds the values and writes them
+	using StreamWriterBase::write;
+	template <typename... Values>
+	enum atom_error_t write(
+		const Values &... values)
+	{
+		bind(values...);
+		return StreamWriterBase::write();
+	}
+};
+
+template <typename... Fields>
+constexpr const char *StreamWriter<Fields...>::keys[];
+template <typename... Fields>
+constexpr size_t StreamWriter<Fields...>::key_lens[];
+
+} // namespace atom
+
+#endif // __ATOM_CPP_STREAM_WRITER_H
@@ -0,0 +1,474 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @file command_dispatcher.cc
+//
+//  @brief Asynchronous command dispatcher implementation
+//
+//  @copy 2018 Elementary Robotics. All rights reserved.
+//
+////////////////////////////////////////////////////////////////////////////////
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "atom/atom.h"
+#include "atom/redis.h"
+#include "atom/element_command_send.h"
+#include "command_dispatcher.h"
+
+namespace atom {
+
+// Callbacks for atom C api need to be in an "extern C" block
+extern "C" {
+
+	bool commandDispatcherCB(
+		const char *id,
+		const struct redisReply *reply,
+		void *user_data);
+}
+
+// Keys we look for in messages on the response stream. The first two are
+//	shared by ACKs and responses
+enum dispatcher_keys_t {
+	DISPATCHER_KEY_ELEMENT = STREAM_KEY_ELEMENT,
+	DISPATCHER_KEY_ID = STREAM_KEY_ID,
+	DISPATCHER_KEY_TIMEOUT,
+	DISPATCHER_KEY_ERR_CODE,
+	DISPATCHER_KEY_ERR_STR,
+	DISPATCHER_KEY_DATA,
+	DISPATCHER_N_KEYS,
+};
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Data callback for the XREAD on the response stream
+//
+////////////////////////////////////////////////////////////////////////////////
+bool commandDispatcherCB(
+	const char *id,
+	const struct redisReply *reply,
+	void *user_data)
+{
+	CommandDispatcher *dispatcher = (CommandDispatcher *)user_data;
+	dispatcher->onEntry(reply);
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Constructor. Makes the context for the dispatcher, notes the
+//			current time on the stream and starts the thread if we're
+//			threaded
+//
+////////////////////////////////////////////////////////////////////////////////
+CommandDispatcher::CommandDispatcher(
+	const std::string &response_stream,
+	bool threaded) : stream(response_stream), running(true),
+	has_thread(threaded)
+{
+	ctx = redis_context_init();
+	assert(ctx != NULL);
+
+	if (!redis_init_stream_info(
+		ctx,
+		&info,
+		stream.c_str(),
+		commandDispatcherCB,
+		NULL,
+		this))
+	{
+		throw std::runtime_error("Failed to initialize dispatcher stream");
+	}
+
+	if (has_thread) {
+		thread = std::thread(&CommandDispatcher::loop, this);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Destructor. Stops the thread and fails anything still pending
+//
+////////////////////////////////////////////////////////////////////////////////
+CommandDispatcher::~CommandDispatcher()
+{
+	{
+		std::lock_guard<std::mutex> lock(pending_mutex);
+		running = false;
+	}
+	pending_cv.notify_all();
+	if (has_thread) {
+		thread.join();
+	}
+
+	for (auto &x : pending) {
+		ElementResponse response;
+		response.setError(ATOM_INTERNAL_ERROR, "Element shut down");
+		x.second.complete(response);
+	}
+	pending.clear();
+
+	redis_context_cleanup(ctx);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Registers a command. If we've already seen its ACK and/or
+//			response then we apply them right away.
+//
+////////////////////////////////////////////////////////////////////////////////
+void CommandDispatcher::add(
+	const std::string &cmd_id,
+	const std::string &cmd_elem,
+	bool block,
+	completion_t complete)
+{
+	ElementResponse response;
+	completion_t done;
+	pending_key_t key(cmd_elem, cmd_id);
+
+	{
+		std::lock_guard<std::mutex> lock(pending_mutex);
+
+		PendingCommand cmd;
+		cmd.cmd_elem = cmd_elem;
+		cmd.block = block;
+		cmd.acked = false;
+		cmd.deadline = clock::now() +
+			std::chrono::milliseconds(ELEMENT_COMMAND_ACK_TIMEOUT);
+		cmd.complete = std::move(complete);
+		pending.emplace(key, std::move(cmd));
+
+		// See if the dispatcher beat us to it
+		auto orphan = orphans.find(key);
+		if (orphan != orphans.end()) {
+			for (auto const &msg : orphan->second) {
+				if (handleMessage(key, msg, response, done) && done) {
+					break;
+				}
+			}
+			orphans.erase(orphan);
+		}
+	}
+
+	// Wake up the dispatcher if it was idle
+	pending_cv.notify_one();
+	if (wake_fn) {
+		wake_fn();
+	}
+
+	if (done) {
+		done(response);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Sets the function called when a command is added
+//
+////////////////////////////////////////////////////////////////////////////////
+void CommandDispatcher::setWakeFn(
+	std::function<void()> fn)
+{
+	wake_fn = std::move(fn);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Returns the stream info for the response stream
+//
+////////////////////////////////////////////////////////////////////////////////
+const struct redis_stream_info &CommandDispatcher::getStreamInfo()
+{
+	return info;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Completes commands that got their response or timed out since
+//			the last call. Returns how long until the next deadline, or -1
+//			if there's nothing pending
+//
+////////////////////////////////////////////////////////////////////////////////
+int CommandDispatcher::poll()
+{
+	int next = -1;
+
+	{
+		std::lock_guard<std::mutex> lock(pending_mutex);
+		std::chrono::milliseconds block = expire(clock::now());
+		if (!pending.empty()) {
+			next = (int)block.count();
+		}
+	}
+
+	for (auto &x : ready) {
+		x.first(x.second);
+	}
+	ready.clear();
+
+	return next;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Returns the number of commands we're waiting on
+//
+////////////////////////////////////////////////////////////////////////////////
+size_t CommandDispatcher::size()
+{
+	std::lock_guard<std::mutex> lock(pending_mutex);
+	return pending.size();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Applies an ACK or response to the pending command. Returns false
+//			if there's no such command.
+//
+////////////////////////////////////////////////////////////////////////////////
+bool CommandDispatcher::handleMessage(
+	const pending_key_t &key,
+	const ResponseMessage &msg,
+	ElementResponse &response,
+	completion_t &complete)
+{
+	auto it = pending.find(key);
+	if (it == pending.end()) {
+		return false;
+	}
+	PendingCommand &cmd = it->second;
+
+	if (msg.is_ack) {
+
+		// Already got the ACK, or already got the response
+		if (cmd.acked) {
+			return true;
+		}
+		cmd.acked = true;
+
+		// If we're not blocking then the ACK is all we wanted
+		if (!cmd.block) {
+			complete = std::move(cmd.complete);
+			pending.erase(it);
+			return true;
+		}
+
+		// Otherwise now wait on the response for the timeout the
+		//	element gave us
+		cmd.deadline = clock::now() + std::chrono::milliseconds(msg.timeout);
+		return true;
+	}
+
+	// Got the response. Fill it in like the synchronous send would
+	if (msg.err_code != ATOM_NO_ERROR) {
+		response.setError(msg.err_code, msg.err_str);
+	} else {
+		response.setData(msg.data);
+	}
+
+	complete = std::move(cmd.complete);
+	pending.erase(it);
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Parses an entry from the response stream and routes it to the
+//			command that it belongs to.
+//
+////////////////////////////////////////////////////////////////////////////////
+void CommandDispatcher::onEntry(
+	const redisReply *reply)
+{
+	struct redis_xread_kv_item items[DISPATCHER_N_KEYS];
+
+	items[DISPATCHER_KEY_ELEMENT].key = STREAM_KEY_ELEMENT_STR;
+	items[DISPATCHER_KEY_ELEMENT].key_len = CONST_STRLEN(STREAM_KEY_ELEMENT_STR);
+	items[DISPATCHER_KEY_ID].key = STREAM_KEY_ID_STR;
+	items[DISPATCHER_KEY_ID].key_len = CONST_STRLEN(STREAM_KEY_ID_STR);
+	items[DISPATCHER_KEY_TIMEOUT].key = ACK_KEY_TIMEOUT_STR;
+	items[DISPATCHER_KEY_TIMEOUT].key_len = CONST_STRLEN(ACK_KEY_TIMEOUT_STR);
+	items[DISPATCHER_KEY_ERR_CODE].key = RESPONSE_KEY_ERR_CODE_STR;
+	items[DISPATCHER_KEY_ERR_CODE].key_len = CONST_STRLEN(RESPONSE_KEY_ERR_CODE_STR);
+	items[DISPATCHER_KEY_ERR_STR].key = RESPONSE_KEY_ERR_STR_STR;
+	items[DISPATCHER_KEY_ERR_STR].key_len = CONST_STRLEN(RESPONSE_KEY_ERR_STR_STR);
+	items[DISPATCHER_KEY_DATA].key = RESPONSE_KEY_DATA_STR;
+	items[DISPATCHER_KEY_DATA].key_len = CONST_STRLEN(RESPONSE_KEY_DATA_STR);
+
+	if (!redis_xread_parse_kv(reply, items, DISPATCHER_N_KEYS)) {
+		return;
+	}
+
+	// Need the element and the command ID to route the message
+	for (int i = DISPATCHER_KEY_ELEMENT; i <= DISPATCHER_KEY_ID; ++i) {
+		if (!items[i].found || (items[i].reply->type != REDIS_REPLY_STRING)) {
+			return;
+		}
+	}
+
+	ResponseMessage msg;
+	msg.cmd_elem = std::string(
+		items[DISPATCHER_KEY_ELEMENT].reply->str,
+		items[DISPATCHER_KEY_ELEMENT].reply->len);
+
+	// Responses have an error code, ACKs have a timeout
+	if (items[DISPATCHER_KEY_ERR_CODE].found &&
+		(items[DISPATCHER_KEY_ERR_CODE].reply->type == REDIS_REPLY_STRING))
+	{
+		msg.is_ack = false;
+		msg.timeout = 0;
+		msg.err_code = atoi(items[DISPATCHER_KEY_ERR_CODE].reply->str);
+		if (items[DISPATCHER_KEY_ERR_STR].found &&
+			(items[DISPATCHER_KEY_ERR_STR].reply->type == REDIS_REPLY_STRING))
+		{
+			msg.err_str = std::string(
+				items[DISPATCHER_KEY_ERR_STR].reply->str,
+				items[DISPATCHER_KEY_ERR_STR].reply->len);
+		}
+		if (items[DISPATCHER_KEY_DATA].found &&
+			(items[DISPATCHER_KEY_DATA].reply->type == REDIS_REPLY_STRING))
+		{
+			msg.data = std::string(
+				items[DISPATCHER_KEY_DATA].reply->str,
+				items[DISPATCHER_KEY_DATA].reply->len);
+		}
+	} else if (items[DISPATCHER_KEY_TIMEOUT].found &&
+		(items[DISPATCHER_KEY_TIMEOUT].reply->type == REDIS_REPLY_STRING))
+	{
+		msg.is_ack = true;
+		msg.timeout = atoi(items[DISPATCHER_KEY_TIMEOUT].reply->str);
+		msg.err_code = ATOM_NO_ERROR;
+	} else {
+		return;
+	}
+
+	pending_key_t key(msg.cmd_elem, std::string(
+		items[DISPATCHER_KEY_ID].reply->str,
+		items[DISPATCHER_KEY_ID].reply->len));
+
+	std::lock_guard<std::mutex> lock(pending_mutex);
+
+	ElementResponse response;
+	completion_t complete;
+	if (handleMessage(key, msg, response, complete)) {
+		if (complete) {
+			ready.push_back(std::make_pair(std::move(complete), response));
+		}
+
+	// Might be for a command that's being registered right now. Hang on
+	//	to it for a bit
+	} else {
+		msg.expires = clock::now() +
+			std::chrono::milliseconds(COMMAND_DISPATCHER_ORPHAN_TIMEOUT_MS);
+		orphans[key].push_back(std::move(msg));
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Times out commands and orphans. Returns how long until the next
+//			command deadline, capped at the XREAD block time.
+//
+////////////////////////////////////////////////////////////////////////////////
+std::chrono::milliseconds CommandDispatcher::expire(
+	clock::time_point now)
+{
+	std::chrono::milliseconds next(COMMAND_DISPATCHER_BLOCK_MS);
+
+	for (auto it = pending.begin(); it != pending.end(); ) {
+		if (now >= it->second.deadline) {
+			ElementResponse response;
+			if (it->second.acked) {
+				response.setError(ATOM_COMMAND_NO_RESPONSE, "Timed out waiting for response");
+			} else {
+				response.setError(ATOM_COMMAND_NO_ACK, "Timed out waiting for ACK");
+			}
+			ready.push_back(std::make_pair(std::move(it->second.complete), response));
+			it = pending.erase(it);
+		} else {
+			auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+				it->second.deadline - now) + std::chrono::milliseconds(1);
+			if (remaining < next) {
+				next = remaining;
+			}
+			++it;
+		}
+	}
+
+	for (auto it = orphans.begin(); it != orphans.end(); ) {
+		auto &msgs = it->second;
+		while (!msgs.empty() && (now >= msgs.front().expires)) {
+			msgs.erase(msgs.begin());
+		}
+		if (msgs.empty()) {
+			it = orphans.erase(it);
+		} else {
+			++it;
+		}
+	}
+
+	return next;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Dispatcher thread. Reads the response stream while there are
+//			commands waiting on it and sleeps otherwise. Since we keep the
+//			last ID when sleeping we don't miss anything that comes in
+//			before we wake up.
+//
+////////////////////////////////////////////////////////////////////////////////
+void CommandDispatcher::loop()
+{
+	while (true) {
+		std::chrono::milliseconds block;
+
+		{
+			std::unique_lock<std::mutex> lock(pending_mutex);
+			if (!running) {
+				break;
+			}
+
+			block = expire(clock::now());
+
+			// Nothing to do, so wait until there's a command to wait on
+			if (pending.empty() && ready.empty()) {
+				pending_cv.wait(lock, [this]() {
+					return !running || !pending.empty();
+				});
+				continue;
+			}
+		}
+
+		// Complete anything that timed out
+		for (auto &x : ready) {
+			x.first(x.second);
+		}
+		ready.clear();
+
+		// Read the stream. Everything we get is routed from the callback
+		if (!redis_xread(
+			ctx,
+			&info,
+			1,
+			(int)block.count(),
+			REDIS_XREAD_NOMAXCOUNT))
+		{
+			atom_logf(NULL, NULL, LOG_ERR,
+				"Command dispatcher failed to XREAD %s", stream.c_str());
+			if (ctx->err) {
+				redisReconnect(ctx);
+			}
+			std::this_thread::sleep_for(block);
+		}
+
+		// And complete anything that we got responses for
+		for (auto &x : ready) {
+			x.first(x.second);
+		}
+		ready.clear();
+	}
+}
+
+} // namespace atom
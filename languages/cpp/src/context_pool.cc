@@ -0,0 +1,283 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @file context_pool.cc
+//
+//  @brief Redis context pool implementation
+//
+//  @copy 2018 Elementary Robotics. All rights reserved.
+//
+////////////////////////////////////////////////////////////////////////////////
+#include <string.h>
+
+#include "atom/atom.h"
+#include "atom/redis.h"
+#include "atom/metrics.h"
+#include "context_pool.h"
+
+namespace atom {
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Move constructor for a lease
+//
+////////////////////////////////////////////////////////////////////////////////
+ContextLease::ContextLease(
+	ContextLease &&other) : pool(other.pool), ctx(other.ctx)
+{
+	other.pool = NULL;
+	other.ctx = NULL;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Move assignment for a lease. Releases whatever we were holding
+//
+////////////////////////////////////////////////////////////////////////////////
+ContextLease &ContextLease::operator=(
+	ContextLease &&other)
+{
+	if (this != &other) {
+		release();
+		pool = other.pool;
+		ctx = other.ctx;
+		other.pool = NULL;
+		other.ctx = NULL;
+	}
+	return *this;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Returns the context to the pool
+//
+////////////////////////////////////////////////////////////////////////////////
+ContextLease::~ContextLease()
+{
+	release();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Returns the context to the pool early
+//
+////////////////////////////////////////////////////////////////////////////////
+void ContextLease::release()
+{
+	if ((pool != NULL) && (ctx != NULL)) {
+		pool->release(ctx);
+	}
+	pool = NULL;
+	ctx = NULL;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Constructor. Makes the initial contexts
+//
+////////////////////////////////////////////////////////////////////////////////
+ContextPool::ContextPool(
+	size_t n_initial,
+	size_t n_max,
+	const struct redis_topology *t,
+	size_t s) : topology(t), shard(s), n_contexts(0), max_contexts(n_max)
+{
+	memset(&stats, 0, sizeof(stats));
+
+	if (max_contexts < n_initial) {
+		max_contexts = n_initial;
+	}
+
+	for (size_t i = 0; i < n_initial; ++i) {
+		redisContext *ctx = connect();
+		if (ctx == NULL) {
+			break;
+		}
+		idle.push_back(ctx);
+		++n_contexts;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Destructor. Frees all of the idle contexts
+//
+////////////////////////////////////////////////////////////////////////////////
+ContextPool::~ContextPool()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	if (idle.size() != n_contexts) {
+		atom_logf(NULL, NULL, LOG_WARNING,
+			"Context pool destroyed with %zu contexts leased",
+			n_contexts - idle.size());
+	}
+	while (!idle.empty()) {
+		redis_context_cleanup(idle.front());
+		idle.pop_front();
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Makes a new context, either to the nucleus or to our shard
+//
+////////////////////////////////////////////////////////////////////////////////
+redisContext *ContextPool::connect()
+{
+	if ((topology != NULL) && (shard != REDIS_TOPOLOGY_NUCLEUS)) {
+		return redis_topology_connect(topology, shard);
+	}
+
+	redisContext *ctx = redis_context_init();
+	if ((ctx != NULL) && ctx->err) {
+		atom_logf(NULL, NULL, LOG_ERR,
+			"Failed to connect to redis: %s", ctx->errstr);
+		redis_context_cleanup(ctx);
+		ctx = NULL;
+	}
+	return ctx;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Gets a context. Prefers an idle one, then grows the pool, then
+//			waits for one to be released. Connecting is done without the
+//			lock held s.t. other threads can keep acquiring and releasing.
+//
+////////////////////////////////////////////////////////////////////////////////
+redisContext *ContextPool::acquire(
+	int timeout_ms)
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	clock::time_point start = clock::now();
+	bool waited = false;
+	redisContext *ctx = NULL;
+
+	++stats.n_acquires;
+
+	while (true) {
+
+		// Idle context available
+		if (!idle.empty()) {
+			ctx = idle.front();
+			idle.pop_front();
+			break;
+		}
+
+		// Room to grow. Reserve our spot and then connect
+		if (n_contexts < max_contexts) {
+			++n_contexts;
+			lock.unlock();
+			ctx = connect();
+			lock.lock();
+
+			if (ctx != NULL) {
+				++stats.n_grows;
+				break;
+			}
+
+			// Couldn't connect. Give the spot back and fail. If we're
+			//	waiting on other contexts there's no point, since redis
+			//	is likely down
+			--n_contexts;
+			cv.notify_one();
+			break;
+		}
+
+		// Need to wait for a release
+		if (!waited) {
+			++stats.n_waits;
+			waited = true;
+		}
+		if (timeout_ms == CONTEXT_POOL_WAIT_FOREVER) {
+			cv.wait(lock);
+		} else if (cv.wait_until(lock, start + std::chrono::milliseconds(timeout_ms)) ==
+			std::cv_status::timeout)
+		{
+			// One last check in case we raced with a release
+			if (idle.empty()) {
+				++stats.n_timeouts;
+				break;
+			}
+		}
+	}
+
+	// Note how long we waited
+	clock::duration waited_for = clock::now() - start;
+	uint64_t wait_us = std::chrono::duration_cast<std::chrono::microseconds>(
+		waited_for).count();
+	stats.total_wait_us += wait_us;
+	metrics_timing_add(METRICS_CONTEXT_WAIT,
+		std::chrono::duration_cast<std::chrono::nanoseconds>(waited_for).count());
+	if (wait_us > stats.max_wait_us) {
+		stats.max_wait_us = wait_us;
+	}
+
+	if (ctx != NULL) {
+		size_t in_use = n_contexts - idle.size();
+		if (in_use > stats.peak_in_use) {
+			stats.peak_in_use = in_use;
+		}
+	}
+
+	return ctx;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Returns a context to the pool. If the context has an error then
+//			we try to reconnect it, and if that fails we throw it out s.t.
+//			the next acquire can make a fresh one.
+//
+////////////////////////////////////////////////////////////////////////////////
+void ContextPool::release(
+	redisContext *ctx)
+{
+	bool keep = true;
+
+	if (ctx->err) {
+		if (redisReconnect(ctx) == REDIS_OK) {
+			std::lock_guard<std::mutex> lock(mutex);
+			++stats.n_reconnects;
+		} else {
+			keep = false;
+		}
+	}
+
+	std::lock_guard<std::mutex> lock(mutex);
+	if (keep) {
+		idle.push_back(ctx);
+	} else {
+		redis_context_cleanup(ctx);
+		--n_contexts;
+		++stats.n_dropped;
+	}
+	cv.notify_one();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Gets a context as a lease
+//
+////////////////////////////////////////////////////////////////////////////////
+ContextLease ContextPool::lease(
+	int timeout_ms)
+{
+	return ContextLease(this, acquire(timeout_ms));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Gets the current stats
+//
+////////////////////////////////////////////////////////////////////////////////
+ContextPoolStats ContextPool::getStats()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	ContextPoolStats ret = stats;
+	ret.n_contexts = n_contexts;
+	ret.n_in_use = n_contexts - idle.size();
+	ret.max_contexts = max_contexts;
+	return ret;
+}
+
+} // namespace atom
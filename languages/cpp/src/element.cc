@@ -9,6 +9,9 @@
 ////////////////////////////////////////////////////////////////////////////////
 #include <mutex>
 #include <queue>
+#include <deque>
+#include <thread>
+#include <condition_variable>
 #include <assert.h>
 #include <string.h>
 #include <iostream>
@@ -40,6 +43,17 @@ extern "C" {
 		int n_kv_items,
 		void *user_data);
 
+	bool entryReadReplyCB(
+		const char *id,
+		redisReply *reply,
+		const struct redis_xread_kv_item *kv_items,
+		int n_kv_items,
+		void *user_data);
+
+	void entryReadQueuedCB(
+		EntryView &e,
+		void *user_data);
+
 	int commandCB(
 		uint8_t *data,
 		size_t data_len,
@@ -50,24 +64,119 @@ extern "C" {
 
 	void commandCleanup(
 		void *cleanup_ptr);
+
+	void commandDispatchCB(
+		struct element_command_request *req,
+		void *user_data);
+
+	void elementRunReadCB(
+		redisAsyncContext *ac,
+		void *r,
+		void *privdata);
+
+	bool referenceGetReplyCB(
+		redisReply *reply,
+		size_t first,
+		void *user_data);
 }
 
-// Class for entry info from a handler to be passed to the callback function
+// State for Element::run(). All of the streams we read, the command stream
+//	first, are read in a single XREAD on the async context
+struct ElementRunState {
+	struct element *elem;
+	EventLoop *loop;
+	redisAsyncContext *ac;
+	std::vector<struct redis_stream_info> infos;
+	CommandDispatcher *dispatcher;
+	enum atom_error_t err;
+};
+
+// Queue of commands that have been ACKed and are waiting on a worker
+class CommandWorkQueue {
+	std::deque<struct element_command_request *> requests;
+	std::mutex mutex;
+	std::condition_variable cv;
+	bool done;
+
+public:
+	CommandWorkQueue() : done(false) {}
+
+	// Frees anything the workers couldn't get to
+	~CommandWorkQueue()
+	{
+		for (auto req : requests) {
+			element_command_request_free(req);
+		}
+	}
+
+	// Adds a request to the queue
+	void push(
+		struct element_command_request *req)
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			requests.push_back(req);
+		}
+		cv.notify_one();
+	}
+
+	// Gets the next request, waiting for one. Returns NULL once the
+	//	queue has been stopped and drained
+	struct element_command_request *pop()
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		cv.wait(lock, [this]() { return done || !requests.empty(); });
+		if (requests.empty()) {
+			return NULL;
+		}
+		struct element_command_request *req = requests.front();
+		requests.pop_front();
+		return req;
+	}
+
+	// Returns whether the queue has been stopped
+	bool isStopped()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		return done;
+	}
+
+	// Stops the queue. Workers finish what's left and then exit
+	void stop()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			done = true;
+		}
+		cv.notify_all();
+	}
+};
+
+// Class for entry info from a handler to be passed to the callback function.
+//	Only one of fn and view_fn is set
 class EntryReadInfo {
 public:
 	readHandlerFn fn;
+	readViewHandlerFn view_fn;
 	void *data;
 
+	// Queue the entries go through if the handler isn't run directly
+	HandlerQueue *queue;
+
 	EntryReadInfo(
 		readHandlerFn f,
-		void *d) : fn(f), data(d)
+		readViewHandlerFn vf,
+		void *d) : fn(f), view_fn(vf), data(d), queue(NULL)
 	{
 
 	}
 
+	// Waits for whatever's queued to be handled
 	~EntryReadInfo()
 	{
-
+		if (queue != NULL) {
+			delete queue;
+		}
 	}
 };
 
@@ -83,6 +192,19 @@ Entry::Entry(
 	id = std::string(xread_id);
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Entry constructor from a view. Copies all of the view's data
+//
+////////////////////////////////////////////////////////////////////////////////
+Entry::Entry(
+	const EntryView &view) : id(view.getID())
+{
+	for (auto const &x : view.getFields()) {
+		data.emplace(x.first.str(), x.second.str());
+	}
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 //  @brief Entry destructor. Not much to do
@@ -107,6 +229,18 @@ void Entry::addData(
 	data.emplace(k, std::move(new_str));
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Add data to an entry without copying it
+//
+////////////////////////////////////////////////////////////////////////////////
+void Entry::addData(
+	const char *k,
+	std::string &&d)
+{
+	data.emplace(k, std::move(d));
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 //  @brief Get ID of an entry
@@ -150,75 +284,135 @@ size_t Entry::size()
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-//  @brief Initializes the context pool for an element. Creates a queue of
-//			contexts that will be used to communicate with redis
+//  @brief Gets a context from our context pool. Waits for one if they're
+//			all in use
 //
 ////////////////////////////////////////////////////////////////////////////////
-void Element::initContextPool(
-	int n_contexts)
+redisContext *Element::getContext()
 {
-	std::lock_guard<std::mutex> lock(context_mutex);
-
-	for (int i = 0; i < n_contexts; ++i) {
-		redisContext *new_context = redis_context_init();
-		context_pool.push(new_context);
+	redisContext *ctx = context_pool.acquire();
+	if (ctx == NULL) {
+		// Can't log this to atom since we don't have a context
+		error("Failed to get redis context", false);
 	}
+	return ctx;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Releases a context back to the context pool
+//
+////////////////////////////////////////////////////////////////////////////////
+void Element::releaseContext(redisContext *ctx)
+{
+	context_pool.release(ctx);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-//  @brief Frees and cleans up all of the redis contexts we've created
+//  @brief Gets the pool for the shard that an element's data stream is on
 //
 ////////////////////////////////////////////////////////////////////////////////
-void Element::cleanupContextPool()
+ContextPool &Element::getStreamPool(
+	const std::string &element,
+	const std::string &stream)
 {
-	std::lock_guard<std::mutex> lock(context_mutex);
-	while (!context_pool.empty()) {
-		redisContext *ctx = context_pool.front();
-		redis_context_cleanup(ctx);
-		context_pool.pop();
+	if (shard_pools.empty()) {
+		return context_pool;
+	}
+
+	char key[ATOM_NAME_MAXLEN];
+	atom_get_data_stream_str(
+		(element.size() > 0) ? element.c_str() : NULL,
+		stream.c_str(),
+		key);
+
+	size_t shard = redis_topology_get_shard(&topology,
+		(element.size() > 0) ? element.c_str() : NULL, key);
+	if (shard >= shard_pools.size()) {
+		return context_pool;
 	}
+	return *shard_pools[shard];
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-//  @brief Gets a context from our context pool
+//  @brief Gets a context from a shard's pool
 //
 ////////////////////////////////////////////////////////////////////////////////
-redisContext *Element::getContext()
+redisContext *Element::getContext(
+	ContextPool &pool)
 {
-	std::lock_guard<std::mutex> lock(context_mutex);
-	redisContext *ctx = context_pool.front();
-	context_pool.pop();
+	redisContext *ctx = pool.acquire();
+	if (ctx == NULL) {
+		error("Failed to get redis context for data stream shard");
+	}
 	return ctx;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-//  @brief Releases a context back to the context pool
+//  @brief Releases a context back to a shard's pool
 //
 ////////////////////////////////////////////////////////////////////////////////
-void Element::releaseContext(redisContext *ctx)
+void Element::releaseContext(
+	ContextPool &pool,
+	redisContext *ctx)
+{
+	pool.release(ctx);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Returns the stats for the context pool
+//
+////////////////////////////////////////////////////////////////////////////////
+ContextPoolStats Element::getContextPoolStats()
+{
+	return context_pool.getStats();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Main constructor. Takes an element name, the number of
+//			contexts to start the pool with and the max number of
+//			contexts the pool can grow to
+//
+////////////////////////////////////////////////////////////////////////////////
+Element::Element(
+	std::string n,
+	int n_contexts,
+	int max_contexts) : Element(n, "", n_contexts, max_contexts)
 {
-	std::lock_guard<std::mutex> lock(context_mutex);
-	context_pool.push(ctx);
+
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-//  @brief Main constructor. Takes an element name and the number of
-//			contexts to keep in the pool
+//  @brief Constructor with a topology for the data streams. The shard pools
+//			start small since most elements only use one or two shards
 //
 ////////////////////////////////////////////////////////////////////////////////
 Element::Element(
 	std::string n,
-	int n_contexts) : context_pool(), context_mutex()
+	std::string topology_spec,
+	int n_contexts,
+	int max_contexts) : context_pool(n_contexts, max_contexts), trim_running(false),
+		dispatcher(NULL), discovery_cache_enabled(false), element_cache()
 {
 	// Copy over the name
 	name = n;
 
-	// Initialize the context pool
-	initContextPool(n_contexts);
+	// Figure out where the data streams go. We don't have an element to
+	//	log to yet
+	if (!redis_topology_init(&topology,
+		(topology_spec.size() > 0) ? topology_spec.c_str() : NULL))
+	{
+		error("Invalid redis topology", false);
+	}
+	for (size_t i = 0; i < topology.n_shards; ++i) {
+		shard_pools.push_back(new ContextPool(1, max_contexts, &topology, i));
+	}
 
 	// Get a context
 	redisContext *ctx = getContext();
@@ -238,15 +432,54 @@ Element::Element(
 ////////////////////////////////////////////////////////////////////////////////
 Element::~Element()
 {
-	redisContext *ctx = getContext();
+	// Stop the dispatcher, if we started it
+	if (dispatcher != NULL) {
+		delete dispatcher;
+	}
+
+	// And the trim thread, before the streams it trims go away
+	{
+		std::lock_guard<RWLock> lock(streams_mutex);
+		trim_running = false;
+	}
+	trim_cv.notify_all();
+	if (trim_thread.joinable()) {
+		trim_thread.join();
+	}
 
-	// Need to clean up all of the stream infos that we're publishing
+	// Need to clean up all of the stream infos that we're publishing,
+	//	each on the shard it's on
 	for (auto const &x : streams) {
 		struct element_entry_write_info *info = x.second;
 		for (size_t i = 0; i < info->n_items; ++i) {
 			free((char*)info->items[i].key);
 		}
-		element_entry_write_cleanup(ctx, x.second);
+		ContextPool &pool = getStreamPool(name, x.first);
+		redisContext *data_ctx = getContext(pool);
+		element_entry_write_cleanup(data_ctx, x.second);
+		releaseContext(pool, data_ctx);
+	}
+	for (auto const &stream : writer_streams) {
+		if (streams.find(stream) != streams.end()) {
+			continue;
+		}
+		char key[ATOM_NAME_MAXLEN];
+		atom_get_data_stream_str(name.c_str(), stream.c_str(), key);
+		ContextPool &pool = getStreamPool(name, stream);
+		redisContext *data_ctx = getContext(pool);
+		redis_remove_key(data_ctx, key, true);
+		atom_registry_remove_stream(data_ctx, key);
+		releaseContext(pool, data_ctx);
+	}
+	for (auto pool : shard_pools) {
+		delete pool;
+	}
+	redis_topology_cleanup(&topology);
+
+	redisContext *ctx = getContext();
+
+	for (auto const &x : shm_streams) {
+		delete x.second.ring;
 	}
 
 	//Need to delete all of the command classes associated with us
@@ -256,7 +489,6 @@ Element::~Element()
 
 	element_cleanup(ctx, elem);
 	releaseContext(ctx);
-	cleanupContextPool();
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -305,6 +537,21 @@ bool getAllElementsStreamsCB(
 	return true;
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Turns the discovery cache on or off
+//
+////////////////////////////////////////////////////////////////////////////////
+void Element::useDiscoveryCache(
+	bool enable)
+{
+	std::lock_guard<std::mutex> lock(discovery_mutex);
+
+	discovery_cache_enabled = enable;
+	element_cache.valid = false;
+	stream_cache.clear();
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 //  @brief Returns a list of all elements
@@ -313,20 +560,109 @@ bool getAllElementsStreamsCB(
 enum atom_error_t Element::getAllElements(
 	std::vector<std::string> &elem_list)
 {
+	std::unique_lock<std::mutex> lock(discovery_mutex, std::defer_lock);
+	long long version = 0;
+	bool cacheable = false;
+
 	// Get a context
 	redisContext *ctx = getContext();
 
+	// If we're caching, the cached list is good as long as the version
+	//	hasn't changed. The version is read before the registry s.t. if
+	//	the registry changes in between we'll just read it again next time
+	if (discovery_cache_enabled) {
+		lock.lock();
+		cacheable = (atom_registry_get_version(ctx, &version) == ATOM_NO_ERROR) &&
+			(version != 0);
+		if (cacheable && element_cache.valid && (element_cache.version == version)) {
+			releaseContext(ctx);
+			elem_list.insert(elem_list.end(), element_cache.members.begin(),
+				element_cache.members.end());
+			return ATOM_NO_ERROR;
+		}
+	}
+
 	// Call the function to get all elements
+	std::vector<std::string> found;
 	enum atom_error_t err = atom_get_all_elements_cb(
 		ctx,
 		getAllElementsStreamsCB,
-		(void*)&elem_list);
+		(void*)&found);
 
 	releaseContext(ctx);
 
+	if ((err == ATOM_NO_ERROR) && cacheable) {
+		element_cache.valid = true;
+		element_cache.version = version;
+		element_cache.members = found;
+	}
+
+	elem_list.insert(elem_list.end(), found.begin(), found.end());
 	return err;
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Gets the streams on a server. The cache keeps all of the streams
+//			on the server and is filtered down to the element's
+//
+////////////////////////////////////////////////////////////////////////////////
+enum atom_error_t Element::getPoolStreams(
+	ContextPool &pool,
+	const char *element,
+	std::vector<std::string> &stream_list)
+{
+	enum atom_error_t err;
+	redisContext *ctx = getContext(pool);
+
+	if (!discovery_cache_enabled) {
+		err = atom_get_all_data_streams_cb(
+			ctx,
+			element,
+			getAllElementsStreamsCB,
+			(void*)&stream_list);
+		releaseContext(pool, ctx);
+		return err;
+	}
+
+	std::lock_guard<std::mutex> lock(discovery_mutex);
+	long long version = 0;
+	bool cacheable = (atom_registry_get_version(ctx, &version) == ATOM_NO_ERROR) &&
+		(version != 0);
+
+	DiscoveryCache &cache = stream_cache[&pool];
+	if (!cacheable || !cache.valid || (cache.version != version)) {
+		std::vector<std::string> found;
+		err = atom_get_all_data_streams_cb(
+			ctx,
+			NULL,
+			getAllElementsStreamsCB,
+			(void*)&found);
+		if (err != ATOM_NO_ERROR) {
+			releaseContext(pool, ctx);
+			return err;
+		}
+		cache.valid = cacheable;
+		cache.version = version;
+		cache.members = std::move(found);
+	}
+	releaseContext(pool, ctx);
+
+	if (element == NULL) {
+		stream_list.insert(stream_list.end(), cache.members.begin(),
+			cache.members.end());
+		return ATOM_NO_ERROR;
+	}
+
+	std::string prefix = std::string(element) + ":";
+	for (auto const &x : cache.members) {
+		if (x.compare(0, prefix.size(), prefix) == 0) {
+			stream_list.push_back(x.substr(prefix.size()));
+		}
+	}
+	return ATOM_NO_ERROR;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 //  @brief Returns a list of all streams for a given element
@@ -336,17 +672,19 @@ enum atom_error_t Element::getAllStreams(
 	std::vector<std::string> &stream_list,
 	std::string element)
 {
-	// Get a context
-	redisContext *ctx = getContext();
-
-	// Call the function to get all streams
-	enum atom_error_t err = atom_get_all_data_streams_cb(
-		ctx,
+	// The streams on the nucleus
+	enum atom_error_t err = getPoolStreams(
+		context_pool,
 		element.c_str(),
-		getAllElementsStreamsCB,
-		(void*)&stream_list);
+		stream_list);
 
-	releaseContext(ctx);
+	// And the streams on each of the shards
+	for (auto pool : shard_pools) {
+		if (err != ATOM_NO_ERROR) {
+			break;
+		}
+		err = getPoolStreams(*pool, element.c_str(), stream_list);
+	}
 
 	return err;
 }
@@ -359,20 +697,22 @@ enum atom_error_t Element::getAllStreams(
 enum atom_error_t Element::getAllStreams(
 	std::map<std::string, std::vector<std::string>> &stream_map)
 {
-	// Get a context
-	redisContext *ctx = getContext();
-
 	// Make the list for all of the strings
 	std::vector<std::string> stream_list;
 
-	// Call the function to get all streams
-	enum atom_error_t err = atom_get_all_data_streams_cb(
-		ctx,
+	// The streams on the nucleus
+	enum atom_error_t err = getPoolStreams(
+		context_pool,
 		NULL,
-		getAllElementsStreamsCB,
-		(void*)&stream_list);
+		stream_list);
 
-	releaseContext(ctx);
+	// And the streams on each of the shards
+	for (auto pool : shard_pools) {
+		if (err != ATOM_NO_ERROR) {
+			break;
+		}
+		err = getPoolStreams(*pool, NULL, stream_list);
+	}
 
 	// Now, parse the list down into the map
 	for (auto const &x: stream_list) {
@@ -424,16 +764,19 @@ bool sendCommandResponseCB(
 void commandCleanup(
 	void *cleanup_ptr)
 {
-	// Cast the user data into a command
-	Command *cmd = (Command *)cleanup_ptr;
+	// Cast the user data into the invocation
+	CommandInvocation *inv = (CommandInvocation *)cleanup_ptr;
 
-	// Clean up anything the command allocated
-    cmd->_cleanup();
+	// Clean up anything the command allocated and hand the state back
+	//	to the command for the next call
+	inv->cmd->_finish(*inv);
+	inv->cmd->releaseInvocation(inv);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-//  @brief Callback for when we get a command
+//  @brief Callback for when we get a command. May be called from multiple
+//			command workers at once.
 //
 ////////////////////////////////////////////////////////////////////////////////
 int commandCB(
@@ -446,51 +789,30 @@ int commandCB(
 	void **cleanup_ptr)
 {
 	int error = 0;
-
-	const char *deserializeError = "Failed to deserialize";
-	const char *validateError = "Failed to validate";
-	const char *runError = "Failed to run";
-	const char *serializeError = "Failed to serialize";
-
-	// We'll need to call the _cleanup function for the
-	//	command after it's done
-	*cleanup_ptr = user_data;
+	const char *stage_error = NULL;
 
 	// Cast the user data into a command
 	Command *cmd = (Command *)user_data;
 
-	// Initialize the command
-	cmd->_init();
-
-	// Run through the command functions
-    if (!cmd->deserialize(data, data_len)) {
-        *error_str = (char*)deserializeError;
-        error = 101;
-        goto done;
-    }
-    if (!cmd->validate()) {
-        *error_str = (char*)validateError;
-        error = 102;
-        goto done;
-    }
-    if (!cmd->run()) {
-        *error_str = (char*)runError;
-        error = 103;
-        goto done;
-    }
-    if (!cmd->serialize()) {
-        *error_str = (char*)serializeError;
-        error = 104;
-        goto done;
-    }
+	// Get the state for this call. We'll need to clean it up
+	//	after the response is sent
+	CommandInvocation *inv = cmd->getInvocation();
+	*cleanup_ptr = inv;
+
+	// Run the command
+	error = cmd->_invoke(data, data_len, *inv, &stage_error);
+	if (error != 0) {
+		*error_str = (char*)stage_error;
+		goto done;
+	}
 
 	// If we had a successful handler call
-	if (!cmd->response->isError()) {
+	if (!inv->response.isError()) {
 
 		// Copy over the data, if any
-		if (cmd->response->hasData()) {
-			*response = (uint8_t*)cmd->response->getDataPtr();
-			*response_len = cmd->response->getDataLen();
+		if (inv->response.hasData()) {
+			*response = (uint8_t*)inv->response.getDataPtr();
+			*response_len = inv->response.getDataLen();
 		} else {
 			*response = NULL;
 			*response_len = 0;
@@ -498,10 +820,10 @@ int commandCB(
 
 	// Otherwise get the error string and log the error
 	} else {
-		*error_str = (char*)cmd->response->getErrorStrPtr();
+		*error_str = (char*)inv->response.getErrorStrPtr();
 	}
 
-	error = cmd->response->getError();
+	error = inv->response.getError();
 
 done:
 	if (error != 0) {
@@ -510,7 +832,9 @@ done:
 			error,
 			(*error_str != NULL) ? *error_str : "");
 	} else {
-		cmd->elem->log(LOG_DEBUG, "Command %s: Success", cmd->name.c_str());
+		if (ATOM_LOG_ENABLED(LOG_DEBUG)) {
+			cmd->elem->log(LOG_DEBUG, "Command %s: Success", cmd->name.c_str());
+		}
 	}
 
 	// And return the response code
@@ -527,7 +851,8 @@ void Element::addCommand(
 	std::string description,
 	command_handler_t fn,
 	void *user_data,
-	int timeout)
+	int timeout,
+	bool fast)
 {
 	std::cout << "Creating command with name " << name << std::endl;
 
@@ -537,19 +862,21 @@ void Element::addCommand(
 		description,
 		fn,
 		user_data,
-		timeout);
+		timeout,
+		fast);
 	new_cmd->addElement(this);
 
 	// Put the command in the map
 	commands.emplace(name, new_cmd);
 
-	if (!element_command_add(
+	if (!element_command_add_with_flags(
 		elem,
 		name.c_str(),
 		commandCB,
 		commandCleanup,
 		new_cmd,
-		timeout))
+		timeout,
+		fast ? ELEMENT_COMMAND_FLAG_FAST : 0))
 	{
 		error("Failed to add command");
 	}
@@ -567,478 +894,1999 @@ void Element::addCommand(
 	cmd->addElement(this);
 	commands.emplace(cmd->name, cmd);
 
-	if (!element_command_add(
+	if (!element_command_add_with_flags(
 		elem,
 		cmd->name.c_str(),
 		commandCB,
 		commandCleanup,
 		cmd,
-		cmd->timeout_ms))
+		cmd->timeout_ms,
+		cmd->fast ? ELEMENT_COMMAND_FLAG_FAST : 0))
 	{
 		error("Failed to add command");
 	}
 }
 
 
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Switches the element over to sharing its command stream with
+//			other replicas through a consumer group. Empty strings get
+//			the defaults, the element name for the group and the
+//			hostname and pid for the consumer.
+//
+////////////////////////////////////////////////////////////////////////////////
+void Element::useCommandGroup(
+	std::string group,
+	std::string consumer,
+	int claim_idle_ms)
+{
+	redisContext *ctx = getContext();
+
+	enum atom_error_t err = element_command_use_group(
+		ctx,
+		elem,
+		group.empty() ? NULL : group.c_str(),
+		consumer.empty() ? NULL : consumer.c_str(),
+		claim_idle_ms);
+
+	releaseContext(ctx);
+
+	if (err != ATOM_NO_ERROR) {
+		error("Failed to set up command group");
+	}
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 //  @brief Loops, handling all commands
 //
 ////////////////////////////////////////////////////////////////////////////////
 enum atom_error_t Element::commandLoop(
-	int n_loops)
+	int n_loops,
+	int n_workers)
 {
 	redisContext *ctx = getContext();
-	enum atom_error_t err;
+	enum atom_error_t err = ATOM_NO_ERROR;
+
+	// Set up the workers, if we're using them. Each one holds onto its
+	//	own context until it breaks, at which point it goes back to the
+	//	pool to be reconnected and the worker gets another one. A worker
+	//	without a context doesn't take commands s.t. the others can
+	CommandWorkQueue queue;
+	std::vector<std::thread> workers;
+	for (int i = 0; i < n_workers; ++i) {
+		workers.push_back(std::thread([this, &queue]() {
+			ContextLease lease;
+			struct element_command_request *req;
+			while (true) {
+				if (!lease) {
+					lease = context_pool.lease();
+				}
+				if (!lease) {
+					log(LOG_ERR, "Command worker failed to get a context");
+					if (queue.isStopped()) {
+						break;
+					}
+					std::this_thread::sleep_for(std::chrono::milliseconds(
+						ELEMENT_COMMAND_WORKER_RETRY_MS));
+					continue;
+				}
+
+				if ((req = queue.pop()) == NULL) {
+					break;
+				}
+				element_command_process(lease.get(), elem, req);
+				element_command_request_free(req);
+
+				if (lease.get()->err) {
+					lease.release();
+				}
+			}
+		}));
+	}
+
+	// With workers the loop just reads and ACKs commands, handing them off
+	void (*dispatch_fn)(struct element_command_request *, void *) =
+		(n_workers > 0) ? commandDispatchCB : NULL;
 
 	if (n_loops == ELEMENT_INFINITE_COMMAND_LOOPS) {
-		err = element_command_loop(
+		err = element_command_loop_dispatch(
 			ctx,
 			elem,
 			true,
-			ELEMENT_COMMAND_LOOP_NO_TIMEOUT);
+			ELEMENT_COMMAND_LOOP_NO_TIMEOUT,
+			dispatch_fn,
+			&queue);
 	} else {
 		for (int i = 0; i < n_loops; ++i) {
-			err = element_command_loop(
+			err = element_command_loop_dispatch(
 				ctx,
 				elem,
 				false,
-				ELEMENT_COMMAND_LOOP_NO_TIMEOUT);
+				ELEMENT_COMMAND_LOOP_NO_TIMEOUT,
+				dispatch_fn,
+				&queue);
 			if (err != ATOM_NO_ERROR) {
 				break;
 			}
 		}
 	}
 	releaseContext(ctx);
+
+	// Let the workers finish up anything that's outstanding
+	queue.stop();
+	for (auto &worker : workers) {
+		worker.join();
+	}
+
 	return err;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-//  @brief Sends a command to another element. Note that the caller needs to
-//			delete this response upon receiving it.
+//  @brief Dispatch callback for the command loop. Passes the request
+//			along to the workers
 //
 ////////////////////////////////////////////////////////////////////////////////
-enum atom_error_t Element::sendCommand(
-	ElementResponse &response,
-	std::string element,
-	std::string command,
-	const uint8_t *data,
-	size_t data_len,
-	bool block)
+void commandDispatchCB(
+	struct element_command_request *req,
+	void *user_data)
 {
-	// Want to be able to get the error string
-	char *error_str = NULL;
-
-	// Get a redis context
-	redisContext *ctx = getContext();
-
-	// Attempt to send the command
-	enum atom_error_t err = element_command_send(
-		ctx,
-		elem,
-		element.c_str(),
-		command.c_str(),
-		data,
-		data_len,
-		block,
-		sendCommandResponseCB,
-		(void*)&response,
-		&error_str);
-
-	// Release the context
-	releaseContext(ctx);
+	CommandWorkQueue *queue = (CommandWorkQueue *)user_data;
+	queue->push(req);
+}
 
-	// If there's an error we want to update the response with that info
-	if (err != ATOM_NO_ERROR) {
-		response.setError(err, error_str);
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Sends the XREAD of all of the streams for run() on the async
+//			context. Blocks until there's something to read.
+//
+////////////////////////////////////////////////////////////////////////////////
+static bool elementRunSendRead(
+	ElementRunState *state)
+{
+	char *cmd;
+	int len = redis_xread_format(
+		&cmd,
+		state->infos.data(),
+		state->infos.size(),
+		REDIS_XREAD_BLOCK_INDEFINITE,
+		REDIS_XREAD_NOMAXCOUNT);
+	if (len < 0) {
+		return false;
 	}
 
-	// If there's an error string returned from the API then we want to
-	//	free it
-	if (error_str != NULL) {
-		free(error_str);
-	}
+	int ret = redisAsyncFormattedCommand(
+		state->ac, elementRunReadCB, state, cmd, len);
+	redisFreeCommand(cmd);
 
-	return err;
+	return ret == REDIS_OK;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-//  @brief Callback for when we get info from a stream
+//  @brief Called with the reply to each of run()'s XREADs. Hands the data
+//			off to the stream infos and then reads again. A NULL reply
+//			means the context is going away.
 //
 ////////////////////////////////////////////////////////////////////////////////
-bool entryReadResponseCB(
-	const char *id,
-	const struct redis_xread_kv_item *kv_items,
-	int n_kv_items,
-	void *user_data)
+void elementRunReadCB(
+	redisAsyncContext *ac,
+	void *r,
+	void *privdata)
+{
+	ElementRunState *state = (ElementRunState *)privdata;
+	redisReply *reply = (redisReply *)r;
+
+	if (reply == NULL) {
+		if (!state->loop->isStopped()) {
+			atom_logf(NULL, state->elem, LOG_ERR, "Lost connection in run()");
+			state->err = ATOM_REDIS_ERROR;
+			state->loop->stop();
+		}
+		return;
+	}
+
+	if (reply->type == REDIS_REPLY_ERROR) {
+		atom_logf(NULL, state->elem, LOG_ERR,
+			"XREAD failed in run(): %s", reply->str);
+		state->err = ATOM_REDIS_ERROR;
+		state->loop->stop();
+		return;
+	}
+
+	if (!redis_xread_handle_reply(
+		reply, state->infos.data(), state->infos.size()))
+	{
+		atom_logf(NULL, state->elem, LOG_ERR,
+			"Failed to handle XREAD in run()");
+	}
+
+	// Complete any async commands we just got responses for
+	if (state->dispatcher != NULL) {
+		state->dispatcher->poll();
+	}
+
+	if (!state->loop->isStopped() && !elementRunSendRead(state)) {
+		atom_logf(NULL, state->elem, LOG_ERR,
+			"Failed to send XREAD in run()");
+		state->err = ATOM_REDIS_ERROR;
+		state->loop->stop();
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Runs the element's event loop. Multiplexes the command stream,
+//			the response stream for async commands, if their dispatcher
+//			isn't already running, and any streams in the read map onto
+//			one async connection. Commands are handled inline and their
+//			ACKs and responses go out on the element's command context.
+//
+////////////////////////////////////////////////////////////////////////////////
+enum atom_error_t Element::runLoop(
+	ElementReadMap *m)
+{
+	struct element_command_reader reader;
+	struct element_entry_read_streams read_streams;
+	struct element_entry_read_info *read_infos = NULL;
+	size_t n_read_infos = 0;
+	bool own_dispatcher = false;
+	ElementRunState state;
+
+	// The async connection is to the nucleus, so that's where all of the
+	//	streams need to be
+	for (size_t i = 0; (m != NULL) && (i < m->getNumHandlers()); ++i) {
+		auto &handler = m->getHandler(i);
+		if (&getStreamPool(std::get<0>(handler), std::get<1>(handler)) !=
+			&context_pool)
+		{
+			error("run() can't read sharded stream " + std::get<1>(handler));
+		}
+	}
+
+	if (!element_command_reader_init(elem, &reader)) {
+		error("Failed to set up the command stream for run()");
+	}
+
+	state.elem = elem;
+	state.loop = &event_loop;
+	state.ac = NULL;
+	state.dispatcher = NULL;
+	state.err = ATOM_NO_ERROR;
+	state.infos.push_back(reader.info);
+
+	// If no one has sent an async command yet then we read the response
+	//	stream ourselves instead of starting the dispatcher thread
+	{
+		std::lock_guard<std::mutex> lock(dispatcher_mutex);
+		if (dispatcher == NULL) {
+			dispatcher = new CommandDispatcher(elem->response.stream, false);
+			dispatcher->setWakeFn([this]() { event_loop.wake(); });
+			own_dispatcher = true;
+		}
+	}
+	if (own_dispatcher) {
+		state.dispatcher = dispatcher;
+		state.infos.push_back(dispatcher->getStreamInfo());
+	}
+
+	// Add in all of the data streams
+	read_streams.stream_info = NULL;
+	read_streams.cb_data = NULL;
+	read_streams.n_infos = 0;
+	if ((m != NULL) && (m->getNumHandlers() > 0)) {
+
+		read_infos = readMapToEntryInfo(*m);
+		n_read_infos = m->getNumHandlers();
+
+		redisContext *ctx = getContext();
+		element_entry_read_streams_init(
+			ctx, &read_streams, read_infos, n_read_infos);
+		releaseContext(ctx);
+
+		for (size_t i = 0; i < n_read_infos; ++i) {
+			state.infos.push_back(read_streams.stream_info[i]);
+		}
+	}
+
+	// Connect and start reading
+	state.ac = redisAsyncConnectUnix(REDIS_DEFAULT_LOCAL_SOCKET);
+	if ((state.ac == NULL) || state.ac->err) {
+		log(LOG_ERR, "Failed to connect for run()");
+		if (state.ac != NULL) {
+			redisAsyncFree(state.ac);
+			state.ac = NULL;
+		}
+		state.err = ATOM_REDIS_ERROR;
+	} else {
+		event_loop.attach(state.ac);
+		if (!elementRunSendRead(&state)) {
+			log(LOG_ERR, "Failed to send XREAD for run()");
+			state.err = ATOM_REDIS_ERROR;
+			event_loop.stop();
+		}
+	}
+
+	// Run until someone stops us or something breaks
+	while ((state.ac != NULL) && !event_loop.isStopped()) {
+		int timeout = own_dispatcher ?
+			state.dispatcher->poll() : EVENT_LOOP_NO_TIMEOUT;
+		if (event_loop.poll(timeout) < 0) {
+			log(LOG_ERR, "epoll failed in run()");
+			state.err = ATOM_INTERNAL_ERROR;
+			break;
+		}
+	}
+
+	// Mark the loop as stopped s.t. the callback knows the NULL reply
+	//	it gets when we free the context is expected
+	event_loop.stop();
+	if (state.ac != NULL) {
+		redisAsyncFree(state.ac);
+	}
+	event_loop.reset();
+
+	// And clean up
+	if (own_dispatcher) {
+		std::lock_guard<std::mutex> lock(dispatcher_mutex);
+		delete dispatcher;
+		dispatcher = NULL;
+	}
+	if (read_infos != NULL) {
+		element_entry_read_streams_cleanup(&read_streams);
+		freeEntryInfo(read_infos, n_read_infos);
+	}
+	element_command_reader_cleanup(&reader);
+
+	return state.err;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Runs the event loop with commands and the data streams in the
+//			read map
+//
+////////////////////////////////////////////////////////////////////////////////
+enum atom_error_t Element::run(
+	ElementReadMap &m)
+{
+	return runLoop(&m);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Runs the event loop with just commands
+//
+////////////////////////////////////////////////////////////////////////////////
+enum atom_error_t Element::run()
+{
+	return runLoop(NULL);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Stops run(). Thread-safe
+//
+////////////////////////////////////////////////////////////////////////////////
+void Element::stop()
+{
+	event_loop.stop();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Gets the event loop used by run()
+//
+////////////////////////////////////////////////////////////////////////////////
+EventLoop &Element::getEventLoop()
+{
+	return event_loop;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Sends a command to another element. Note that the caller needs to
+//			delete this response upon receiving it.
+//
+////////////////////////////////////////////////////////////////////////////////
+enum atom_error_t Element::sendCommand(
+	ElementResponse &response,
+	std::string element,
+	std::string command,
+	const uint8_t *data,
+	size_t data_len,
+	bool block,
+	int64_t deadline_ms)
+{
+	// Want to be able to get the error string
+	char *error_str = NULL;
+
+	// Get a redis context
+	redisContext *ctx = getContext();
+
+	// Attempt to send the command
+	enum atom_error_t err = element_command_send_deadline(
+		ctx,
+		elem,
+		element.c_str(),
+		command.c_str(),
+		data,
+		data_len,
+		block,
+		deadline_ms,
+		sendCommandResponseCB,
+		(void*)&response,
+		&error_str);
+
+	// Release the context
+	releaseContext(ctx);
+
+	// If there's an error we want to update the response with that info
+	if (err != ATOM_NO_ERROR) {
+		response.setError(err, error_str);
+	}
+
+	// If there's an error string returned from the API then we want to
+	//	free it
+	if (error_str != NULL) {
+		free(error_str);
+	}
+
+	return err;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Sends a fast command to another element, waiting on the response
+//			alone
+//
+////////////////////////////////////////////////////////////////////////////////
+enum atom_error_t Element::sendCommandFast(
+	ElementResponse &response,
+	std::string element,
+	std::string command,
+	const uint8_t *data,
+	size_t data_len,
+	int timeout_ms)
+{
+	char *error_str = NULL;
+
+	redisContext *ctx = getContext();
+
+	enum atom_error_t err = element_command_send_fast(
+		ctx,
+		elem,
+		element.c_str(),
+		command.c_str(),
+		data,
+		data_len,
+		timeout_ms,
+		sendCommandResponseCB,
+		(void*)&response,
+		&error_str);
+
+	releaseContext(ctx);
+
+	if (err != ATOM_NO_ERROR) {
+		response.setError(err, error_str);
+	}
+	if (error_str != NULL) {
+		free(error_str);
+	}
+
+	return err;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Sends a command to many elements at once and waits for all of
+//			the responses
+//
+////////////////////////////////////////////////////////////////////////////////
+enum atom_error_t Element::sendCommandMulti(
+	std::vector<ElementResponse> &responses,
+	const std::vector<std::string> &elements,
+	std::string command,
+	const uint8_t *data,
+	size_t data_len,
+	int64_t deadline_ms)
+{
+	responses.clear();
+	responses.resize(elements.size());
+
+	std::vector<struct element_command_target> targets(elements.size());
+	for (size_t i = 0; i < elements.size(); ++i) {
+		targets[i].cmd_elem = elements[i].c_str();
+		targets[i].user_data = (void*)&responses[i];
+	}
+
+	redisContext *ctx = getContext();
+
+	enum atom_error_t err = element_command_send_multi(
+		ctx,
+		elem,
+		targets.data(),
+		targets.size(),
+		command.c_str(),
+		data,
+		data_len,
+		deadline_ms,
+		sendCommandResponseCB);
+
+	releaseContext(ctx);
+
+	for (size_t i = 0; i < targets.size(); ++i) {
+		if (targets[i].err_code != ATOM_NO_ERROR) {
+			responses[i].setError(targets[i].err_code, targets[i].error_str);
+		}
+		if (targets[i].error_str != NULL) {
+			free(targets[i].error_str);
+		}
+	}
+
+	return err;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Gets the dispatcher for asynchronous commands, starting it if
+//			this is the first asynchronous command
+//
+////////////////////////////////////////////////////////////////////////////////
+CommandDispatcher *Element::getDispatcher()
+{
+	std::lock_guard<std::mutex> lock(dispatcher_mutex);
+	if (dispatcher == NULL) {
+		dispatcher = new CommandDispatcher(elem->response.stream);
+	}
+	return dispatcher;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Writes a command to the element and hands it off to the
+//			dispatcher to wait on. If the write fails the completion is
+//			called here with the error.
+//
+////////////////////////////////////////////////////////////////////////////////
+enum atom_error_t Element::sendCommandAsync(
+	std::string element,
+	std::string command,
+	const uint8_t *data,
+	size_t data_len,
+	bool block,
+	std::function<void(ElementResponse &)> complete)
+{
+	char cmd_id[STREAM_ID_BUFFLEN];
+
+	// Make sure the dispatcher is reading before the command goes out
+	CommandDispatcher *d = getDispatcher();
+
+	// Get a redis context and write the command
+	redisContext *ctx = getContext();
+	enum atom_error_t err = element_command_send_request(
+		ctx,
+		elem,
+		element.c_str(),
+		command.c_str(),
+		data,
+		data_len,
+		cmd_id);
+	releaseContext(ctx);
+
+	if (err != ATOM_NO_ERROR) {
+		ElementResponse response;
+		response.setError(err, "Failed to send command");
+		complete(response);
+		return err;
+	}
+
+	d->add(cmd_id, element, block, std::move(complete));
+	return ATOM_NO_ERROR;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Sends a command asynchronously, returning a future for the
+//			response
+//
+////////////////////////////////////////////////////////////////////////////////
+std::future<ElementResponse> Element::sendCommandAsync(
+	std::string element,
+	std::string command,
+	const uint8_t *data,
+	size_t data_len,
+	bool block)
+{
+	std::shared_ptr<std::promise<ElementResponse>> promise =
+		std::make_shared<std::promise<ElementResponse>>();
+	std::future<ElementResponse> future = promise->get_future();
+
+	sendCommandAsync(element, command, data, data_len, block,
+		[promise](ElementResponse &response) {
+			promise->set_value(response);
+		});
+
+	return future;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Sends a command asynchronously, calling the callback with the
+//			response
+//
+////////////////////////////////////////////////////////////////////////////////
+enum atom_error_t Element::sendCommandAsync(
+	std::string element,
+	std::string command,
+	const uint8_t *data,
+	size_t data_len,
+	commandResponseFn fn,
+	void *user_data,
+	bool block)
+{
+	return sendCommandAsync(element, command, data, data_len, block,
+		[fn, user_data](ElementResponse &response) {
+			fn(response, user_data);
+		});
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Callback for when we get info from a stream
+//
+////////////////////////////////////////////////////////////////////////////////
+bool entryReadResponseCB(
+	const char *id,
+	const struct redis_xread_kv_item *kv_items,
+	int n_kv_items,
+	void *user_data)
+{
+	// Cast the user data to the proper handler function
+	EntryReadInfo *udata = (EntryReadInfo *)user_data;
+
+	// Convert the kv items into the ElementReadData
+	Entry e(id);
+	for (int i = 0; i < n_kv_items; ++i) {
+		if (!kv_items[i].found) {
+			atom_logf(NULL, NULL, LOG_ERR, "Couldn't find key");
+			continue;
+		}
+
+		const redisReply *value = kv_items[i].reply;
+		if (!ShmDescriptor::isFramed(value->str, value->len)) {
+			e.addData(kv_items[i].key, value->str, value->len);
+			continue;
+		}
+		if (ShmDescriptor::isStored(value->str, value->len)) {
+			e.addData(kv_items[i].key, value->str + SHM_FRAME_HEADER_LEN,
+				value->len - SHM_FRAME_HEADER_LEN);
+			continue;
+		}
+
+		// Value is in shared memory, copy it out
+		ShmDescriptor desc;
+		std::string shm_data;
+		if (!ShmDescriptor::decode(value->str, value->len, desc) ||
+			!ShmSegment::copy(desc, shm_data))
+		{
+			atom_logf(NULL, NULL, LOG_ERR,
+				"Couldn't read key %s from shared memory", kv_items[i].key);
+			continue;
+		}
+		e.addData(kv_items[i].key, std::move(shm_data));
+	}
+
+	// Now, we want to call the user callback
+	if (!udata->fn(e, udata->data)) {
+		atom_logf(NULL, NULL, LOG_ERR, "User callback failed");
+	}
+
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Callback for when we get info from a stream and the handler wants
+//			a view of it. The view takes over the reply s.t. nothing is
+//			copied.
+//
+////////////////////////////////////////////////////////////////////////////////
+bool entryReadReplyCB(
+	const char *id,
+	redisReply *reply,
+	const struct redis_xread_kv_item *kv_items,
+	int n_kv_items,
+	void *user_data)
+{
+	// Cast the user data to the proper handler function
+	EntryReadInfo *udata = (EntryReadInfo *)user_data;
+
+	// Make the view first s.t. it owns the reply no matter what
+	EntryView e(id, reply);
+
+	// The kv items point at the values in the reply. Each key is the
+	//	item right before its value, and we want the reply's copy of it
+	//	s.t. the view doesn't depend on the read info
+	for (int i = 0; i < n_kv_items; ++i) {
+		if (!kv_items[i].found) {
+			atom_logf(NULL, NULL, LOG_ERR, "Couldn't find key");
+			continue;
+		}
+		for (size_t j = 1; j < reply->elements; j += 2) {
+			if (reply->element[j] == kv_items[i].reply) {
+				if (!e.addField(reply->element[j - 1], reply->element[j])) {
+					atom_logf(NULL, NULL, LOG_ERR,
+						"Couldn't read key %s from shared memory",
+						kv_items[i].key);
+				}
+				break;
+			}
+		}
+	}
+
+	// Hand it off if the handler's run elsewhere, else call it now
+	if (udata->queue != NULL) {
+		udata->queue->push(std::move(e));
+	} else if (!udata->view_fn(e, udata->data)) {
+		atom_logf(NULL, NULL, LOG_ERR, "User callback failed");
+	}
+
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Runs a handler on an entry that was queued up for it. Handlers
+//			that want a copy get it here, off of the reading thread
+//
+////////////////////////////////////////////////////////////////////////////////
+void entryReadQueuedCB(
+	EntryView &e,
+	void *user_data)
 {
-	// Cast the user data to the proper handler function
 	EntryReadInfo *udata = (EntryReadInfo *)user_data;
+	bool ok;
+
+	if (udata->view_fn != NULL) {
+		ok = udata->view_fn(e, udata->data);
+	} else {
+		Entry entry(e);
+		ok = udata->fn(entry, udata->data);
+	}
+
+	if (!ok) {
+		atom_logf(NULL, NULL, LOG_ERR, "User callback failed");
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Reads in a loop from the handlers in the ElementReadMap
+//
+////////////////////////////////////////////////////////////////////////////////
+struct element_entry_read_info *Element::readMapToEntryInfo(
+	ElementReadMap &m)
+{
+	// Need to fill out the read info.
+	size_t n_infos = m.getNumHandlers();
+
+	struct element_entry_read_info *read_infos = (struct element_entry_read_info *)
+		malloc(n_infos * sizeof(struct element_entry_read_info));
+	assert(read_infos != NULL);
+
+	// Loop over the infos and fill them out
+	for (size_t i = 0; i < n_infos; ++i) {
+		auto &handler = m.getHandler(i);
+
+		// First is element, second is stream, third
+		std::string &element = std::get<0>(handler);
+		read_infos[i].element = (element.size() > 0) ? strdup(element.c_str()) : NULL;
+		read_infos[i].stream = strdup(std::get<1>(handler).c_str());
+
+		// Get the keys
+		auto keys = std::get<2>(handler);
+		size_t n_keys = keys.size();
+
+		// Make the KV items
+		read_infos[i].kv_items = (struct redis_xread_kv_item *)
+			malloc(n_keys * sizeof(struct redis_xread_kv_item));
+		read_infos[i].n_kv_items = n_keys;
+
+		// Fill in the kv items
+		for (size_t j = 0; j < n_keys; ++j) {
+			read_infos[i].kv_items[j].key = strdup(keys[j].c_str());
+			read_infos[i].kv_items[j].key_len = keys[j].size();
+		}
+
+		// Fill in the handler and response callback. Queued entries are
+		//	always views s.t. queueing them doesn't copy anything
+		EntryReadInfo *udata = new EntryReadInfo(
+			std::get<3>(handler),
+			std::get<5>(handler),
+			std::get<4>(handler));
+		HandlerExecutor &executor = std::get<8>(handler);
+		if ((executor.type == HANDLER_EXECUTOR_DEDICATED) ||
+			((executor.type == HANDLER_EXECUTOR_SHARED) &&
+				(executor.handler_pool != NULL)))
+		{
+			udata->queue = new HandlerQueue(entryReadQueuedCB, udata,
+				executor, std::get<9>(handler));
+		}
+		read_infos[i].user_data = (void*)udata;
+		read_infos[i].response_cb = entryReadResponseCB;
+		read_infos[i].response_reply_cb =
+			((std::get<5>(handler) != NULL) || (udata->queue != NULL)) ?
+				entryReadReplyCB : NULL;
+
+		// And the read policy, which counts what it drops in the map
+		ReadPolicy &policy = std::get<6>(handler);
+		read_infos[i].policy = policy.policy;
+		read_infos[i].min_interval_ns = (policy.max_hz > 0) ?
+			(uint64_t)(1e9 / policy.max_hz) : 0;
+		read_infos[i].items_dropped = &std::get<7>(handler);
+	}
+
+	return read_infos;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Reads in a loop from the handlers in the ElementReadMap
+//
+////////////////////////////////////////////////////////////////////////////////
+void Element::freeEntryInfo(
+	struct element_entry_read_info *info,
+	size_t n_infos)
+{
+	// And go ahead and free all of the info
+	if (info != NULL) {
+		for (size_t i = 0; i < n_infos; ++i) {
+			if (info[i].element != NULL) {
+				free((void*)info[i].element);
+			}
+			if (info[i].stream != NULL) {
+				free((void*)info[i].stream);
+			}
+			if (info[i].kv_items != NULL) {
+				for (size_t j = 0; j < info[i].n_kv_items; ++j) {
+					free((void*)info[i].kv_items[j].key);
+				}
+				free(info[i].kv_items);
+			}
+			if (info[i].user_data != NULL) {
+				delete (EntryReadInfo *)info[i].user_data;
+			}
+		}
+		free(info);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Reads in a loop from the handlers in the ElementReadMap. Streams
+//			on different shards are read on their own threads, which
+//			are all joined before we return
+//
+////////////////////////////////////////////////////////////////////////////////
+enum atom_error_t Element::entryReadLoop(
+	ElementReadMap &m,
+	int n_loops)
+{
+	struct element_entry_read_info *read_infos = readMapToEntryInfo(m);
+	size_t n_infos = m.getNumHandlers();
+	bool loop_forever = (n_loops == ELEMENT_INFINITE_READ_LOOPS);
+
+	if (!loop_forever) {
+		for (size_t i = 0; i < n_infos; ++i) {
+			read_infos[i].items_to_read = n_loops;
+		}
+	}
+
+	// Group the streams by the shard they're on. Each group gets its own
+	//	XREAD since a single one can't span servers, and big groups are
+	//	split s.t. one slow XREAD of hundreds of streams doesn't hold up
+	//	all of them
+	std::vector<std::pair<ContextPool *, std::vector<struct element_entry_read_info>>> groups;
+	for (size_t i = 0; i < n_infos; ++i) {
+		auto &handler = m.getHandler(i);
+		ContextPool *pool = &getStreamPool(std::get<0>(handler), std::get<1>(handler));
+		size_t g = 0;
+		while ((g < groups.size()) && ((groups[g].first != pool) ||
+			(groups[g].second.size() >= ELEMENT_READ_LOOP_MAX_STREAMS)))
+		{
+			++g;
+		}
+		if (g == groups.size()) {
+			groups.emplace_back(pool, std::vector<struct element_entry_read_info>());
+		}
+		groups[g].second.push_back(read_infos[i]);
+	}
+
+	// Reads all of the streams in a group on a context from its shard
+	auto readGroup = [this, loop_forever](
+		ContextPool &pool,
+		std::vector<struct element_entry_read_info> &infos)
+	{
+		redisContext *ctx = getContext(pool);
+		enum atom_error_t group_err = element_entry_read_loop(
+			ctx,
+			elem,
+			infos.data(),
+			infos.size(),
+			loop_forever,
+			ELEMENT_ENTRY_READ_LOOP_FOREVER);
+		releaseContext(pool, ctx);
+		return group_err;
+	};
+
+	enum atom_error_t err = ATOM_NO_ERROR;
+	if (groups.size() <= 1) {
+		if (n_infos > 0) {
+			err = readGroup(*groups[0].first, groups[0].second);
+		} else {
+			redisContext *ctx = getContext();
+			err = element_entry_read_loop(ctx, elem, read_infos, n_infos,
+				loop_forever, ELEMENT_ENTRY_READ_LOOP_FOREVER);
+			releaseContext(ctx);
+		}
+	} else {
+
+		// Read each of the groups at the same time, keeping the first error
+		std::vector<enum atom_error_t> errs(groups.size(), ATOM_NO_ERROR);
+		std::vector<std::thread> readers;
+		for (size_t g = 0; g < groups.size(); ++g) {
+			readers.push_back(std::thread([&, g]() {
+				try {
+					errs[g] = readGroup(*groups[g].first, groups[g].second);
+				} catch (std::runtime_error &e) {
+					errs[g] = ATOM_REDIS_ERROR;
+				}
+			}));
+		}
+		for (size_t g = 0; g < groups.size(); ++g) {
+			readers[g].join();
+			if ((err == ATOM_NO_ERROR) && (errs[g] != ATOM_NO_ERROR)) {
+				err = errs[g];
+			}
+		}
+	}
+
+	// And free the entry info we made
+	freeEntryInfo(read_infos, n_infos);
+
+	return err;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Copies the data into the vector passed in user_data
+//
+////////////////////////////////////////////////////////////////////////////////
+bool entryCopyCB(
+	Entry &e,
+	void *user_data)
+{
+	std::vector<Entry> *user_vector =
+		(std::vector<Entry>*)user_data;
+
+	user_vector->emplace_back(std::move(e));
+
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Adds the view to the vector passed in user_data. Only the
+//			reference to the reply is copied
+//
+////////////////////////////////////////////////////////////////////////////////
+bool entryViewCopyCB(
+	EntryView &e,
+	void *user_data)
+{
+	std::vector<EntryView> *user_vector =
+		(std::vector<EntryView>*)user_data;
+
+	user_vector->emplace_back(std::move(e));
+
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Reads N pieces of data from each stream passed, calling the
+//			handler with each
+//
+////////////////////////////////////////////////////////////////////////////////
+enum atom_error_t Element::entryReadN(
+	std::string element,
+	std::string stream,
+	std::vector<std::string> &keys,
+	size_t n,
+	readHandlerFn fn,
+	readViewHandlerFn view_fn,
+	void *user_data)
+{
+	PreparedRead read;
+	prepareRead(element, stream, keys, read,
+		ENTRY_READ_SINCE_BEGIN_BLOCKING_WITH_NEWEST_ID);
+
+	return entryReadPrepared(read, false, n, fn, view_fn, user_data,
+		REDIS_XREAD_DONTBLOCK);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Reads N pieces of data from each stream passed
+//
+////////////////////////////////////////////////////////////////////////////////
+enum atom_error_t Element::entryReadN(
+	std::string element,
+	std::string stream,
+	std::vector<std::string> &keys,
+	size_t n,
+	std::vector<Entry> &ret)
+{
+	return entryReadN(element, stream, keys, n,
+		entryCopyCB, NULL, (void*)&ret);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Reads N pieces of data from each stream passed without copying
+//			the data
+//
+////////////////////////////////////////////////////////////////////////////////
+enum atom_error_t Element::entryReadN(
+	std::string element,
+	std::string stream,
+	std::vector<std::string> &keys,
+	size_t n,
+	std::vector<EntryView> &ret)
+{
+	return entryReadN(element, stream, keys, n,
+		NULL, entryViewCopyCB, (void*)&ret);
+}
 
-	// Convert the kv items into the ElementReadData
-	Entry e(id);
-	for (int i = 0; i < n_kv_items; ++i) {
-		if (kv_items[i].found) {
-			e.addData(kv_items[i].key, kv_items[i].reply->str, kv_items[i].reply->len);
-		} else {
-			atom_logf(NULL, NULL, LOG_ERR, "Couldn't find key");
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Sets up an iterator over a range of a stream. The iterator
+//			holds onto a context until it's closed
+//
+////////////////////////////////////////////////////////////////////////////////
+enum atom_error_t Element::entryRange(
+	std::string element,
+	std::string stream,
+	std::vector<std::string> &keys,
+	StreamRangeIterator &it,
+	bool reverse,
+	std::string start,
+	std::string end,
+	size_t max_entries,
+	size_t page_size)
+{
+	it.close();
+
+	// The read info points into the iterator s.t. it lives as long as the
+	//	range does
+	it.element_name = element;
+	it.stream = stream;
+	it.keys = keys;
+	it.kv_items.resize(it.keys.size());
+	for (size_t j = 0; j < it.keys.size(); ++j) {
+		it.kv_items[j].key = it.keys[j].c_str();
+		it.kv_items[j].key_len = it.keys[j].size();
+	}
+
+	memset(&it.info, 0, sizeof(it.info));
+	it.info.element = (it.element_name.size() > 0) ? it.element_name.c_str() : NULL;
+	it.info.stream = it.stream.c_str();
+	it.info.kv_items = it.kv_items.data();
+	it.info.n_kv_items = it.kv_items.size();
+	it.info.user_data = (void*)new EntryReadInfo(NULL, entryViewCopyCB, &it.page);
+	it.info.response_cb = entryReadResponseCB;
+	it.info.response_reply_cb = entryReadReplyCB;
+
+	it.pool = &getStreamPool(element, stream);
+	it.ctx = getContext(*it.pool);
+	element_entry_range_init(
+		&it.range,
+		&it.info,
+		reverse,
+		(start.size() > 0) ? start.c_str() : NULL,
+		(end.size() > 0) ? end.c_str() : NULL,
+		page_size,
+		max_entries);
+
+	it.element = this;
+	it.page.clear();
+	it.pos = 0;
+	it.n_read = 0;
+	it.err = ATOM_NO_ERROR;
+
+	return ATOM_NO_ERROR;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Reads the next page of a range into the iterator's page
+//
+////////////////////////////////////////////////////////////////////////////////
+bool Element::entryRangeNext(
+	StreamRangeIterator &it)
+{
+	size_t n_read;
+
+	it.err = element_entry_range_next(it.ctx, elem, &it.range, &n_read);
+	return (it.err == ATOM_NO_ERROR) && (it.page.size() > 0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Closes a range, giving back its context
+//
+////////////////////////////////////////////////////////////////////////////////
+void Element::entryRangeClose(
+	StreamRangeIterator &it)
+{
+	element_entry_range_cleanup(it.ctx, &it.range);
+	releaseContext(*it.pool, it.ctx);
+	it.pool = NULL;
+	it.ctx = NULL;
+	delete (EntryReadInfo *)it.info.user_data;
+	it.info.user_data = NULL;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Reads at most N entries from the stream since the passed ID,
+//			calling the handler with each
+//
+////////////////////////////////////////////////////////////////////////////////
+enum atom_error_t Element::entryReadSince(
+	std::string element,
+	std::string stream,
+	std::vector<std::string> &keys,
+	size_t n,
+	readHandlerFn fn,
+	readViewHandlerFn view_fn,
+	void *user_data,
+	std::string last_id,
+	int timeout)
+{
+	PreparedRead read;
+	prepareRead(element, stream, keys, read, (last_id.size() > 0) ?
+		last_id : ENTRY_READ_SINCE_BEGIN_BLOCKING_WITH_NEWEST_ID);
+
+	return entryReadPrepared(read, true, n, fn, view_fn, user_data, timeout);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Reads at most N entries from the stream since the passed ID.
+//			Default nonblocking
+//
+////////////////////////////////////////////////////////////////////////////////
+enum atom_error_t Element::entryReadSince(
+	std::string element,
+	std::string stream,
+	std::vector<std::string> &keys,
+	size_t n,
+	std::vector<Entry> &ret,
+	std::string last_id,
+	int timeout)
+{
+	return entryReadSince(element, stream, keys, n,
+		entryCopyCB, NULL, (void*)&ret, last_id, timeout);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Reads at most N entries from the stream since the passed ID
+//			without copying the data. Default nonblocking
+//
+////////////////////////////////////////////////////////////////////////////////
+enum atom_error_t Element::entryReadSince(
+	std::string element,
+	std::string stream,
+	std::vector<std::string> &keys,
+	size_t n,
+	std::vector<EntryView> &ret,
+	std::string last_id,
+	int timeout)
+{
+	return entryReadSince(element, stream, keys, n,
+		NULL, entryViewCopyCB, (void*)&ret, last_id, timeout);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Sets up a read that can be done over and over. The read info
+//			points into the PreparedRead s.t. it lives as long as it does
+//
+////////////////////////////////////////////////////////////////////////////////
+enum atom_error_t Element::prepareRead(
+	std::string element,
+	std::string stream,
+	std::vector<std::string> &keys,
+	PreparedRead &read,
+	std::string last_id)
+{
+	read.close();
+
+	read.element_name = element;
+	read.stream = stream;
+	read.keys = keys;
+	read.kv_items.resize(read.keys.size());
+	for (size_t j = 0; j < read.keys.size(); ++j) {
+		read.kv_items[j].key = read.keys[j].c_str();
+		read.kv_items[j].key_len = read.keys[j].size();
+	}
+
+	// The handler is filled in by each read
+	memset(&read.info, 0, sizeof(read.info));
+	read.info.element = (read.element_name.size() > 0) ?
+		read.element_name.c_str() : NULL;
+	read.info.stream = read.stream.c_str();
+	read.info.kv_items = read.kv_items.data();
+	read.info.n_kv_items = read.kv_items.size();
+	read.info.user_data = (void*)new EntryReadInfo(NULL, NULL, NULL);
+	read.info.response_cb = entryReadResponseCB;
+
+	// The context is only needed to get the server's time if we weren't
+	//	given an ID
+	read.pool = &getStreamPool(element, stream);
+	redisContext *ctx = getContext(*read.pool);
+	element_entry_prepared_read_init(ctx, &read.read, &read.info,
+		(last_id.size() > 0) ? last_id.c_str() : NULL);
+	releaseContext(*read.pool, ctx);
+
+	read.element = this;
+	return ATOM_NO_ERROR;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Does a prepared read, calling the handler with each entry
+//
+////////////////////////////////////////////////////////////////////////////////
+enum atom_error_t Element::entryReadPrepared(
+	PreparedRead &read,
+	bool since,
+	size_t n,
+	readHandlerFn fn,
+	readViewHandlerFn view_fn,
+	void *user_data,
+	int timeout)
+{
+	if (read.element != this) {
+		atom_logf(NULL, elem, LOG_ERR, "Read wasn't prepared by this element");
+		return ATOM_INTERNAL_ERROR;
+	}
+
+	EntryReadInfo *udata = (EntryReadInfo *)read.info.user_data;
+	udata->fn = fn;
+	udata->view_fn = view_fn;
+	udata->data = user_data;
+	read.info.response_reply_cb = (view_fn != NULL) ? entryReadReplyCB : NULL;
+
+	redisContext *ctx = getContext(*read.pool);
+	enum atom_error_t err = since ?
+		element_entry_prepared_read_since(ctx, elem, &read.read, timeout, n) :
+		element_entry_prepared_read_n(ctx, elem, &read.read, n);
+	releaseContext(*read.pool, ctx);
+
+	return err;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Reads the N most recent entries with a prepared read
+//
+////////////////////////////////////////////////////////////////////////////////
+enum atom_error_t Element::entryReadN(
+	PreparedRead &read,
+	size_t n,
+	std::vector<Entry> &ret)
+{
+	return entryReadPrepared(read, false, n, entryCopyCB, NULL, (void*)&ret,
+		REDIS_XREAD_DONTBLOCK);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Reads the N most recent entries with a prepared read without
+//			copying the data
+//
+////////////////////////////////////////////////////////////////////////////////
+enum atom_error_t Element::entryReadN(
+	PreparedRead &read,
+	size_t n,
+	std::vector<EntryView> &ret)
+{
+	return entryReadPrepared(read, false, n, NULL, entryViewCopyCB,
+		(void*)&ret, REDIS_XREAD_DONTBLOCK);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Reads at most N entries with a prepared read since the last one
+//			it read
+//
+////////////////////////////////////////////////////////////////////////////////
+enum atom_error_t Element::entryReadSince(
+	PreparedRead &read,
+	size_t n,
+	std::vector<Entry> &ret,
+	int timeout)
+{
+	return entryReadPrepared(read, true, n, entryCopyCB, NULL, (void*)&ret,
+		timeout);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Reads at most N entries with a prepared read since the last one
+//			it read without copying the data
+//
+////////////////////////////////////////////////////////////////////////////////
+enum atom_error_t Element::entryReadSince(
+	PreparedRead &read,
+	size_t n,
+	std::vector<EntryView> &ret,
+	int timeout)
+{
+	return entryReadPrepared(read, true, n, NULL, entryViewCopyCB,
+		(void*)&ret, timeout);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Frees everything a read was prepared with
+//
+////////////////////////////////////////////////////////////////////////////////
+void Element::preparedReadClose(
+	PreparedRead &read)
+{
+	element_entry_prepared_read_cleanup(&read.read);
+	delete (EntryReadInfo *)read.info.user_data;
+	read.info.user_data = NULL;
+	read.pool = NULL;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Finds the cached write info for the stream if its keys are the
+//			same as the data's, else NULL. streams_mutex must be held
+//
+////////////////////////////////////////////////////////////////////////////////
+struct element_entry_write_info *Element::findWriteInfo(
+	const std::string &stream,
+	entry_data_t &data)
+{
+	auto exists = streams.find(stream);
+	if ((exists == streams.end()) ||
+		(exists->second->n_items != data.size()))
+	{
+		return NULL;
+	}
+
+	struct element_entry_write_info *info = exists->second;
+	for (size_t idx = 0; idx < info->n_items; ++idx) {
+		if (data.find(info->items[idx].key) == data.end()) {
+			return NULL;
 		}
 	}
 
-	// Now, we want to call the user callback
-	if (!udata->fn(e, udata->data)) {
-		atom_logf(NULL, NULL, LOG_ERR, "User callback failed");
+	return info;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Fills in a write info for a single write of the data passed.
+//			The info's items point into the data and the passed items
+//			vector s.t. concurrent writes to the same stream don't share
+//			anything. Once the stream's cached info has been made this
+//			only needs streams_mutex as a reader, so writes on other
+//			threads don't wait on each other. If we haven't written to the
+//			stream before or the keys have changed then the cached info
+//			will be (re)made as the writer. If pipelining then the context
+//			has outstanding replies and we can't remove the old stream
+//			while remaking the info, so just free it
+//
+////////////////////////////////////////////////////////////////////////////////
+void Element::getWriteInfo(
+	redisContext *ctx,
+	const std::string &stream,
+	entry_data_t &data,
+	bool pipelining,
+	struct element_entry_write_info &write_info,
+	std::vector<struct redis_xadd_info> &items,
+	std::vector<std::string> &shm_values,
+	std::vector<std::string> *unregistered)
+{
+	// Usually the info is already there
+	{
+		SharedLock lock(streams_mutex);
+		struct element_entry_write_info *info = findWriteInfo(stream, data);
+		if (info != NULL) {
+			fillWriteInfo(stream, data, info, write_info, items, shm_values);
+			return;
+		}
 	}
 
-	return true;
+	std::lock_guard<RWLock> lock(streams_mutex);
+
+	// Someone else may have made it while we weren't holding the lock
+	struct element_entry_write_info *info = findWriteInfo(stream, data);
+	if (info == NULL) {
+
+		// If the stream info exists we want to clean it up
+		auto exists = streams.find(stream);
+		if (exists != streams.end()) {
+			info = exists->second;
+			for (size_t i = 0; i < info->n_items; ++i) {
+				free((char*)info->items[i].key);
+			}
+			if (pipelining) {
+				free(info->items);
+				free(info);
+			} else {
+				element_entry_write_cleanup(ctx, info);
+			}
+			streams.erase(exists);
+		}
+
+		// Make the info. If pipelining then the stream can't be registered
+		//	until the replies are in, so leave that to the caller
+		info = element_entry_write_init(
+			pipelining ? NULL : ctx,
+			elem,
+			stream.c_str(),
+			data.size());
+		assert(info != NULL);
+		if (pipelining && (unregistered != NULL)) {
+			unregistered->push_back(info->stream);
+		}
+
+		// Fill in the keys in the info
+		int idx = 0;
+		for (auto const &x: data) {
+
+			// Fill in the write info
+			info->items[idx].key = strdup(x.first.c_str());
+			info->items[idx].key_len = x.first.size();
+
+			// Increment the index
+			idx += 1;
+		}
+
+		streams.emplace(stream, info);
+	}
+
+	fillWriteInfo(stream, data, info, write_info, items, shm_values);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Fills in the items of a write from the data and the stream's
+//			cached info. streams_mutex must be held, as a reader is enough
+//
+////////////////////////////////////////////////////////////////////////////////
+void Element::fillWriteInfo(
+	const std::string &stream,
+	entry_data_t &data,
+	struct element_entry_write_info *info,
+	struct element_entry_write_info &write_info,
+	std::vector<struct redis_xadd_info> &items,
+	std::vector<std::string> &shm_values)
+{
+	// Now fill in the items for this write, leaving room for the
+	//	additional keys
+	items.resize(data.size() + DATA_N_ADDITIONAL_KEYS);
+
+	// Reserve s.t. the descriptors don't move as we add them
+	auto shm = shm_streams.find(stream);
+	shm_values.clear();
+	shm_values.reserve(data.size());
+
+	size_t idx = 0;
+	for (auto const &x: data) {
+		items[idx].key = x.first.c_str();
+		items[idx].key_len = x.first.size();
+		items[idx].data = (const uint8_t*)x.second.c_str();
+		items[idx].data_len = x.second.size();
+
+		ShmDescriptor desc;
+		if ((shm != shm_streams.end()) &&
+			(x.second.size() >= shm->second.min_size) &&
+			shm->second.ring->write(x.second.data(), x.second.size(), desc))
+		{
+			shm_values.push_back(desc.encode());
+			items[idx].data = (const uint8_t*)shm_values.back().data();
+			items[idx].data_len = shm_values.back().size();
+
+		// Anything that looks like a descriptor has to be framed, else
+		//	readers would try to find it in shared memory
+		} else if (ShmDescriptor::isFramed(x.second.data(), x.second.size())) {
+			shm_values.push_back(
+				ShmDescriptor::frame(x.second.data(), x.second.size()));
+			items[idx].data = (const uint8_t*)shm_values.back().data();
+			items[idx].data_len = shm_values.back().size();
+		}
+		++idx;
+	}
+
+	write_info.items = items.data();
+	write_info.n_items = data.size();
+	memcpy(write_info.stream, info->stream, sizeof(write_info.stream));
+
+	auto codec = codec_streams.find(stream);
+	write_info.codec = (codec != codec_streams.end()) ?
+		codec->second.codec : CODEC_NONE;
+	write_info.codec_min_size = (codec != codec_streams.end()) ?
+		codec->second.min_size : CODEC_DEFAULT_MIN_SIZE;
+
+	auto retention = retention_streams.find(stream);
+	write_info.retention = (retention != retention_streams.end()) ?
+		retention->second : NULL;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Sets up shared memory for a stream. The ring is named after us
+//			and the stream, which can't have any more slashes in it
+//
+////////////////////////////////////////////////////////////////////////////////
+void Element::useSharedMemory(
+	std::string stream,
+	size_t ring_size,
+	size_t min_size)
+{
+	std::string segment = "/atom." + name + "." + stream;
+	for (size_t i = 1; i < segment.size(); ++i) {
+		if (segment[i] == '/') {
+			segment[i] = '_';
+		}
+	}
+
+	// The old ring has to go first since the new one has the same name
+	std::lock_guard<RWLock> lock(streams_mutex);
+	auto exists = shm_streams.find(stream);
+	if (exists != shm_streams.end()) {
+		delete exists->second.ring;
+		shm_streams.erase(exists);
+	}
+
+	try {
+		ShmRingWriter *ring = new ShmRingWriter(segment, ring_size);
+		shm_streams.emplace(stream, ShmStream{ ring, min_size });
+	} catch (std::runtime_error &e) {
+		error(e.what());
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Sets up compression for a stream
+//
+////////////////////////////////////////////////////////////////////////////////
+void Element::useCompression(
+	std::string stream,
+	enum codec_type codec,
+	size_t min_size)
+{
+	if (!codec_available(codec)) {
+		error(std::string("Codec ") + codec_name(codec) + " isn't built in");
+	}
+
+	std::lock_guard<RWLock> lock(streams_mutex);
+	if (codec == CODEC_NONE) {
+		codec_streams.erase(stream);
+	} else {
+		codec_streams[stream] = CodecStream{ codec, min_size };
+	}
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-//  @brief Reads in a loop from the handlers in the ElementReadMap
+//  @brief Sets up a retention policy for a stream, starting the trim
+//			thread if it's deferred and the thread isn't running yet
 //
 ////////////////////////////////////////////////////////////////////////////////
-struct element_entry_read_info *Element::readMapToEntryInfo(
-	ElementReadMap &m)
+void Element::useRetention(
+	std::string stream,
+	const RetentionPolicy &policy)
 {
-	// Need to fill out the read info.
-	size_t n_infos = m.getNumHandlers();
-
-	struct element_entry_read_info *read_infos = (struct element_entry_read_info *)
-		malloc(n_infos * sizeof(struct element_entry_read_info));
-	assert(read_infos != NULL);
-
-	// Loop over the infos and fill them out
-	for (size_t i = 0; i < n_infos; ++i) {
-		auto handler = m.getHandler(i);
-
-		// First is element, second is stream, third
-		std::string &element = std::get<0>(handler);
-		read_infos[i].element = (element.size() > 0) ? strdup(element.c_str()) : NULL;
-		read_infos[i].stream = strdup(std::get<1>(handler).c_str());
-
-		// Get the keys
-		auto keys = std::get<2>(handler);
-		size_t n_keys = keys.size();
-
-		// Make the KV items
-		read_infos[i].kv_items = (struct redis_xread_kv_item *)
-			malloc(n_keys * sizeof(struct redis_xread_kv_item));
-		read_infos[i].n_kv_items = n_keys;
+	struct element_retention retention;
+	retention.type = policy.type;
+	retention.maxlen = policy.maxlen;
+	retention.max_age_ms = policy.max_age_ms;
+	retention.max_bytes = policy.max_bytes;
+	retention.deferred = policy.deferred;
+	retention.avg_entry_bytes = 0;
+	retention.clock_offset_ms = 0;
+	retention.clock_known = false;
+
+	std::lock_guard<RWLock> lock(streams_mutex);
+
+	// Carry over what we've seen of the entries and the server's clock
+	auto exists = retention_streams.find(stream);
+	if (exists != retention_streams.end()) {
+		retention.avg_entry_bytes = __atomic_load_n(
+			&exists->second->avg_entry_bytes, __ATOMIC_RELAXED);
+		retention.clock_offset_ms = __atomic_load_n(
+			&exists->second->clock_offset_ms, __ATOMIC_RELAXED);
+		retention.clock_known = __atomic_load_n(
+			&exists->second->clock_known, __ATOMIC_ACQUIRE);
+	}
 
-		// Fill in the kv items
-		for (size_t j = 0; j < n_keys; ++j) {
-			read_infos[i].kv_items[j].key = strdup(keys[j].c_str());
-			read_infos[i].kv_items[j].key_len = keys[j].size();
-		}
+	retentions.push_back(retention);
+	retention_streams[stream] = &retentions.back();
 
-		// Fill in the handler and response callback
-		read_infos[i].user_data = (void*)new EntryReadInfo(
-			std::get<3>(handler),
-			std::get<4>(handler));
-		read_infos[i].response_cb = entryReadResponseCB;
+	if (policy.deferred && !trim_running) {
+		trim_running = true;
+		trim_thread = std::thread(&Element::trimLoop, this);
 	}
-
-	return read_infos;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-//  @brief Reads in a loop from the handlers in the ElementReadMap
+//  @brief Trims the streams with deferred retention policies every so
+//			often until we're destroyed. Each shard's streams are trimmed
+//			in one round trip
 //
 ////////////////////////////////////////////////////////////////////////////////
-void Element::freeEntryInfo(
-	struct element_entry_read_info *info,
-	size_t n_infos)
+void Element::trimLoop()
 {
-	// And go ahead and free all of the info
-	if (info != NULL) {
-		for (size_t i = 0; i < n_infos; ++i) {
-			if (info[i].element != NULL) {
-				free((void*)info[i].element);
+	std::unique_lock<RWLock> lock(streams_mutex);
+
+	while (trim_running) {
+		trim_cv.wait_for(lock,
+			std::chrono::milliseconds(ELEMENT_RETENTION_TRIM_PERIOD_MS));
+		if (!trim_running) {
+			break;
+		}
+
+		// Note what to trim and let the writes go on while we do
+		std::map<ContextPool *,
+			std::vector<std::pair<std::string, struct element_retention *>>>
+				to_trim;
+		for (auto const &x : retention_streams) {
+			if (!x.second->deferred || !element_retention_ready(x.second)) {
+				continue;
 			}
-			if (info[i].stream != NULL) {
-				free((void*)info[i].stream);
+			char key[ATOM_NAME_MAXLEN];
+			atom_get_data_stream_str(name.c_str(), x.first.c_str(), key);
+			to_trim[&getStreamPool(name, x.first)].emplace_back(key, x.second);
+		}
+		lock.unlock();
+
+		// Nothing to throw to on this thread, so wait for the next round
+		//	if a shard is down
+		for (auto const &x : to_trim) {
+			redisContext *ctx;
+			try {
+				ctx = getContext(*x.first);
+			} catch (std::runtime_error &e) {
+				continue;
 			}
-			if (info[i].kv_items != NULL) {
-				for (size_t j = 0; j < info[i].n_kv_items; ++j) {
-					free((void*)info[i].kv_items[j].key);
+			size_t n_appended = 0;
+			for (auto const &stream : x.second) {
+				if (element_retention_trim_append(ctx, stream.first.c_str(),
+					stream.second) == ATOM_NO_ERROR)
+				{
+					++n_appended;
 				}
-				free(info[i].kv_items);
-			}
-			if (info[i].user_data != NULL) {
-				delete (EntryReadInfo *)info[i].user_data;
 			}
+			element_retention_trim_flush(ctx, n_appended);
+			releaseContext(*x.first, ctx);
 		}
-		free(info);
+
+		lock.lock();
 	}
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-//  @brief Reads in a loop from the handlers in the ElementReadMap
+//  @brief Sets up compression for commands sent to an element
 //
 ////////////////////////////////////////////////////////////////////////////////
-enum atom_error_t Element::entryReadLoop(
-	ElementReadMap &m,
-	int n_loops)
+void Element::useCommandCompression(
+	std::string element,
+	std::string command,
+	enum codec_type codec,
+	size_t min_size)
 {
-	struct element_entry_read_info *read_infos = readMapToEntryInfo(m);
-	size_t n_infos = m.getNumHandlers();
+	if (!codec_available(codec)) {
+		error(std::string("Codec ") + codec_name(codec) + " isn't built in");
+	}
 
-	// And now call element_entry_read_loop
-	redisContext *ctx = getContext();
+	element_command_set_codec(
+		elem,
+		element.c_str(),
+		(command.size() > 0) ? command.c_str() : NULL,
+		codec,
+		min_size);
+}
 
-	// And if we're looping infinitely
-	enum atom_error_t err;
-	if (n_loops == ELEMENT_INFINITE_READ_LOOPS) {
-		err = element_entry_read_loop(
-			ctx,
-			elem,
-			read_infos,
-			n_infos,
-			true,
-			ELEMENT_ENTRY_READ_LOOP_FOREVER);
-	} else {
-		for (size_t i = 0; i < n_infos; ++i) {
-			read_infos[i].items_to_read = n_loops;
-		}
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Writes an entry to a stream
+//
+////////////////////////////////////////////////////////////////////////////////
+enum atom_error_t Element::entryWrite(
+	std::string stream,
+	entry_data_t &data,
+	int timestamp,
+	int maxlen)
+{
+	// The items are remade each write, keep the storage around s.t.
+	//	writing doesn't need to allocate once the thread's written before
+	struct element_entry_write_info info;
+	static thread_local std::vector<struct redis_xadd_info> items;
+	static thread_local std::vector<std::string> shm_values;
 
-		err = element_entry_read_loop(
-			ctx,
-			elem,
-			read_infos,
-			n_infos,
-			false,
-			ELEMENT_ENTRY_READ_LOOP_FOREVER);
-	}
+	ContextPool &pool = getStreamPool(name, stream);
+	redisContext *ctx = getContext(pool);
 
-	// Put the context back
-	releaseContext(ctx);
+	// Get the info with the data filled in
+	getWriteInfo(ctx, stream, data, false, info, items, shm_values);
 
-	// And free the entry info we made
-	freeEntryInfo(read_infos, n_infos);
+	// Do the write
+	enum atom_error_t err = element_entry_write(
+		ctx,
+		&info,
+		timestamp,
+		maxlen);
+
+	// Return the context
+	releaseContext(pool, ctx);
 
+	// And return the error
 	return err;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-//  @brief Copies the data into the vector passed in user_data
+//  @brief Sets up a stream for a StreamWriter
 //
 ////////////////////////////////////////////////////////////////////////////////
-bool entryCopyCB(
-	Entry &e,
-	void *user_data)
+ContextPool &Element::openWriterStream(
+	const std::string &stream,
+	char key[ATOM_NAME_MAXLEN])
 {
-	std::vector<Entry> *user_vector =
-		(std::vector<Entry>*)user_data;
+	if (atom_get_data_stream_str(name.c_str(), stream.c_str(), key) == NULL) {
+		error("Invalid stream name " + stream);
+	}
 
-	user_vector->emplace_back(std::move(e));
+	ContextPool &pool = getStreamPool(name, stream);
 
-	return true;
+	std::lock_guard<RWLock> lock(streams_mutex);
+	if (writer_streams.insert(stream).second) {
+		redisContext *ctx = getContext(pool);
+		atom_registry_add_stream(ctx, key);
+		releaseContext(pool, ctx);
+	}
+
+	return pool;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-//  @brief Reads N pieces of data from each stream passed
+//  @brief Writes a batch of entries. Each entry is appended to the output
+//			buffer of a context on its stream's shard and then all of them
+//			are sent at once and the replies are collected in order. An
+//			entry that fails to be appended is marked as failed without
+//			affecting the others.
 //
 ////////////////////////////////////////////////////////////////////////////////
-enum atom_error_t Element::entryReadN(
-	std::string element,
-	std::string stream,
-	std::vector<std::string> &keys,
-	size_t n,
-	std::vector<Entry> &ret)
+enum atom_error_t Element::entryWriteBatch(
+	StreamBatch &batch)
 {
-	struct element_entry_read_info read_info;
+	enum atom_error_t ret = ATOM_NO_ERROR;
+	size_t n = batch.entries.size();
 
-	// Fill in the read info
-	read_info.element = (element.size() > 0) ? element.c_str() : NULL;
-	read_info.stream = stream.c_str();
-
-	// Get the keys
-	size_t n_keys = keys.size();
-
-	// Make the KV items
-	read_info.kv_items = (struct redis_xread_kv_item *)
-		malloc(n_keys * sizeof(struct redis_xread_kv_item));
-	assert(read_info.kv_items != NULL);
-	read_info.n_kv_items = n_keys;
+	batch.ids.assign(n, "");
+	batch.errors.assign(n, ATOM_NO_ERROR);
+	if (n == 0) {
+		return ret;
+	}
 
-	// Fill in the kv items
-	for (size_t j = 0; j < n_keys; ++j) {
-		read_info.kv_items[j].key = keys[j].c_str();
-		read_info.kv_items[j].key_len = keys[j].size();
+	// Group the entries by the shard their stream is on. There's only one
+	//	group unless the streams are sharded
+	std::vector<std::pair<ContextPool *, std::vector<size_t>>> groups;
+	for (size_t i = 0; i < n; ++i) {
+		ContextPool *pool = &getStreamPool(name, batch.entries[i].stream);
+		size_t g = 0;
+		while ((g < groups.size()) && (groups[g].first != pool)) {
+			++g;
+		}
+		if (g == groups.size()) {
+			groups.emplace_back(pool, std::vector<size_t>());
+		}
+		groups[g].second.push_back(i);
 	}
 
-	// Fill in the handler and response callback
-	read_info.user_data = (void*)new EntryReadInfo(entryCopyCB, (void*)&ret);
-	read_info.response_cb = entryReadResponseCB;
+	// Same as entryWrite(), the items' storage is kept for the thread
+	struct element_entry_write_info info;
+	static thread_local std::vector<struct redis_xadd_info> items;
+	static thread_local std::vector<std::string> shm_values;
+	for (auto &group : groups) {
+		redisContext *ctx = getContext(*group.first);
+
+		// Append each of the entries, noting which ones made it into
+		//	the output buffer
+		std::vector<size_t> appended;
+		std::vector<struct element_retention *> retentions_appended;
+		std::vector<std::string> unregistered;
+		appended.reserve(group.second.size());
+		retentions_appended.reserve(group.second.size());
+		for (size_t i : group.second) {
+			StreamBatch::BatchEntry &entry = batch.entries[i];
+
+			getWriteInfo(ctx, entry.stream, entry.data, true, info, items,
+				shm_values, &unregistered);
+
+			enum atom_error_t err = element_entry_write_append(
+				ctx,
+				&info,
+				entry.timestamp,
+				entry.maxlen);
+			if (err != ATOM_NO_ERROR) {
+				batch.errors[i] = err;
+				ret = err;
+			} else {
+				appended.push_back(i);
+				retentions_appended.push_back(info.retention);
+			}
+		}
 
-	// And now call element_entry_read_n
-	redisContext *ctx = getContext();
-	enum atom_error_t err = element_entry_read_n(
-		ctx,
-		elem,
-		&read_info,
-		n);
+		// Send them all and get the replies
+		std::vector<char> id_buffer(appended.size() * STREAM_ID_BUFFLEN);
+		std::vector<enum atom_error_t> errs(appended.size());
+		char (*ids)[STREAM_ID_BUFFLEN] = (char (*)[STREAM_ID_BUFFLEN])id_buffer.data();
+		if (element_entry_write_flush(
+			ctx, appended.size(), ids, errs.data()) != ATOM_NO_ERROR)
+		{
+			ret = ATOM_REDIS_ERROR;
+		}
 
-	// Put the context back
-	releaseContext(ctx);
+		// Now that the replies are in, register any new streams
+		for (auto const &stream : unregistered) {
+			atom_registry_add_stream(ctx, stream.c_str());
+		}
 
-	// And clean up the memory we allocated
-	delete (EntryReadInfo *)read_info.user_data;
-	free(read_info.kv_items);
+		// Return the context
+		releaseContext(*group.first, ctx);
 
-	return err;
+		// And note the results
+		for (size_t i = 0; i < appended.size(); ++i) {
+			batch.errors[appended[i]] = errs[i];
+			if (errs[i] == ATOM_NO_ERROR) {
+				batch.ids[appended[i]] = std::string(ids[i]);
+				if (retentions_appended[i] != NULL) {
+					element_retention_note_id(retentions_appended[i], ids[i]);
+				}
+			}
+		}
+	}
+
+	return ret;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-//  @brief Reads at most N entries from the stream since the passed ID.
-//			Default nonblocking
+//  @brief Makes references from an entry in a stream. The data never
+//			leaves redis
 //
 ////////////////////////////////////////////////////////////////////////////////
-enum atom_error_t Element::entryReadSince(
+enum atom_error_t Element::referenceCreateFromStream(
 	std::string element,
 	std::string stream,
-	std::vector<std::string> &keys,
-	size_t n,
-	std::vector<Entry> &ret,
-	std::string last_id,
-	int timeout)
+	std::map<std::string, std::string> &refs,
+	std::string id,
+	int timeout_ms)
 {
-	struct element_entry_read_info read_info;
-
-	// Fill in the read info
-	read_info.element = (element.size() > 0) ? element.c_str() : NULL;
-	read_info.stream = stream.c_str();
-
-	// Get the keys
-	size_t n_keys = keys.size();
-
-	// Make the KV items
-	read_info.kv_items = (struct redis_xread_kv_item *)
-		malloc(n_keys * sizeof(struct redis_xread_kv_item));
-	assert(read_info.kv_items != NULL);
-	read_info.n_kv_items = n_keys;
+	struct element_reference *c_refs;
+	size_t n_refs;
 
-	// Fill in the kv items
-	for (size_t j = 0; j < n_keys; ++j) {
-		read_info.kv_items[j].key = keys[j].c_str();
-		read_info.kv_items[j].key_len = keys[j].size();
-	}
-
-	// Fill in the handler and response callback
-	read_info.user_data = (void*)new EntryReadInfo(entryCopyCB, (void*)&ret);
-	read_info.response_cb = entryReadResponseCB;
-
-	// And now call element_entry_read_since
 	redisContext *ctx = getContext();
-	enum atom_error_t err = element_entry_read_since(
+	enum atom_error_t err = element_reference_create_from_stream(
 		ctx,
 		elem,
-		&read_info,
-		(last_id.size() > 0) ? last_id.c_str() : NULL,
-		timeout,
-		n);
-
-	// Put the context back
+		element.c_str(),
+		stream.c_str(),
+		id.c_str(),
+		timeout_ms,
+		&c_refs,
+		&n_refs);
 	releaseContext(ctx);
 
-	// And clean up the memory we allocated
-	delete (EntryReadInfo *)read_info.user_data;
-	free(read_info.kv_items);
+	if (err != ATOM_NO_ERROR) {
+		return err;
+	}
+
+	refs.clear();
+	for (size_t i = 0; i < n_refs; ++i) {
+		refs.emplace(c_refs[i].key, c_refs[i].ref);
+	}
+	element_reference_free(c_refs, n_refs);
 
-	return err;
+	return ATOM_NO_ERROR;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-//  @brief Writes an entry to a stream
+//  @brief Hands each MGET reply over to the view
 //
 ////////////////////////////////////////////////////////////////////////////////
-enum atom_error_t Element::entryWrite(
-	std::string stream,
-	entry_data_t &data,
-	int timestamp,
-	int maxlen)
+bool referenceGetReplyCB(
+	redisReply *reply,
+	size_t first,
+	void *user_data)
 {
-	redisContext *ctx = getContext();
-
-	// Try to find the write info for the stream
-	auto exists = streams.find(stream);
-	struct element_entry_write_info *info = NULL;
-
-	// We did not find the write info or the number of keys was off
-	if ((exists == streams.end()) ||
-		(exists->second->n_items != data.size()))
-	{
-		// If the stream info exists we want to clean it up
-		if (exists != streams.end()) {
-			info = exists->second;
-			for (size_t i = 0; i < info->n_items; ++i) {
-				free((char*)info->items[i].key);
-			}
-			element_entry_write_cleanup(ctx, exists->second);
-		}
-
-		// Make the info
-		info = element_entry_write_init(
-			ctx,
-			elem,
-			stream.c_str(),
-			data.size());
-		assert(info != NULL);
-
-		// Fill in the keys in the info
-		int idx = 0;
-		for (auto const &x: data) {
-
-			// Fill in the write info
-			info->items[idx].key = strdup(x.first.c_str());
-			info->items[idx].key_len = x.first.size();
-
-			// Increment the index
-			idx += 1;
-		}
-
-		streams.emplace(stream, info);
+	ReferenceView *view = (ReferenceView *)user_data;
+	view->addReply(reply);
+	return true;
+}
 
-	// We found the write info
-	} else {
-		info = exists->second;
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Gets the values of references
+//
+////////////////////////////////////////////////////////////////////////////////
+enum atom_error_t Element::referenceGet(
+	const std::vector<std::string> &refs,
+	ReferenceView &ret)
+{
+	std::vector<const char *> keys(refs.size());
+	for (size_t i = 0; i < refs.size(); ++i) {
+		keys[i] = refs[i].c_str();
 	}
 
+	ret.clear();
+	redisContext *ctx = getContext();
+	enum atom_error_t err = element_reference_get(
+		ctx,
+		keys.data(),
+		keys.size(),
+		referenceGetReplyCB,
+		(void*)&ret);
+	releaseContext(ctx);
 
-	// Loop over the keys in the info
-	for (size_t idx = 0; idx < info->n_items; ++idx) {
-
-		// Find the item in the input dict
-		auto item = data.find(info->items[idx].key);
-		if (item == data.end()) {
-			std::runtime_error("Invalid key for stream");
-		}
+	// Don't hand back a partial set of values
+	if (err != ATOM_NO_ERROR) {
+		ret.clear();
+	}
+	return err;
+}
 
-		// Fill in the data size and length
-		info->items[idx].data = (const uint8_t*)item->second.c_str();
-		info->items[idx].data_len = item->second.size();
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Deletes references
+//
+////////////////////////////////////////////////////////////////////////////////
+enum atom_error_t Element::referenceDelete(
+	const std::vector<std::string> &refs,
+	size_t *n_deleted)
+{
+	std::vector<const char *> keys(refs.size());
+	for (size_t i = 0; i < refs.size(); ++i) {
+		keys[i] = refs[i].c_str();
 	}
 
-	// Do the write
-	enum atom_error_t err = element_entry_write(
+	redisContext *ctx = getContext();
+	enum atom_error_t err = element_reference_delete(
 		ctx,
-		info,
-		timestamp,
-		maxlen);
-
-	// Return the context
+		keys.data(),
+		keys.size(),
+		n_deleted);
 	releaseContext(ctx);
 
-	// And return the error
 	return err;
 }
 
@@ -1051,9 +2899,8 @@ void Element::log(
 	int level,
 	std::string msg)
 {
-	redisContext *ctx = getContext();
-	enum atom_error_t err = atom_log(ctx, elem, level, msg.c_str(), msg.size());
-	releaseContext(ctx);
+	// Logs are queued and written in the background, no context needed
+	enum atom_error_t err = atom_log(NULL, elem, level, msg.c_str(), msg.size());
 	if (err != ATOM_NO_ERROR) {
 		error("Failed to log", false);
 	}
@@ -1072,12 +2919,23 @@ void Element::log(
 	va_list args;
 	va_start(args, fmt);
 
-	redisContext *ctx = getContext();
-	enum atom_error_t err = atom_vlogf(ctx, elem, level, fmt, args);
-	releaseContext(ctx);
+	enum atom_error_t err = atom_vlogf(NULL, elem, level, fmt, args);
+	va_end(args);
 	if (err != ATOM_NO_ERROR) {
 		error("Failed to log", false);
 	}
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Waits for the logs written so far to make it to the log stream
+//
+////////////////////////////////////////////////////////////////////////////////
+void Element::logFlush()
+{
+	if (atom_log_flush() != ATOM_NO_ERROR) {
+		error("Failed to flush logs", false);
+	}
+}
+
 } // namespace atom
@@ -42,9 +42,28 @@ void ElementReadMap::addHandler(
 	std::string stream,
 	std::vector<std::string> keys,
 	readHandlerFn fn,
-	void *user_data)
+	void *user_data,
+	ReadPolicy policy,
+	HandlerExecutor executor)
 {
-	handlers.emplace_back(std::move(element), std::move(stream), std::move(keys), fn, user_data);
+	handlers.emplace_back(std::move(element), std::move(stream), std::move(keys), fn, user_data, (readViewHandlerFn)NULL, policy, 0, executor, std::make_shared<HandlerQueueStats>());
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Adds a zero-copy handler to an ElementReadMap
+//
+////////////////////////////////////////////////////////////////////////////////
+void ElementReadMap::addHandler(
+	std::string element,
+	std::string stream,
+	std::vector<std::string> keys,
+	readViewHandlerFn fn,
+	void *user_data,
+	ReadPolicy policy,
+	HandlerExecutor executor)
+{
+	handlers.emplace_back(std::move(element), std::move(stream), std::move(keys), (readHandlerFn)NULL, user_data, fn, policy, 0, executor, std::make_shared<HandlerQueueStats>());
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -71,6 +90,50 @@ size_t ElementReadMap::getNumHandlers()
 	return handlers.size();
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Gets the number of entries dropped for the Nth handler
+//
+////////////////////////////////////////////////////////////////////////////////
+size_t ElementReadMap::getNumDropped(
+	int n)
+{
+	return std::get<7>(handlers.at(n));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Gets the number of entries in the Nth handler's queue
+//
+////////////////////////////////////////////////////////////////////////////////
+size_t ElementReadMap::getQueueDepth(
+	int n)
+{
+	return std::get<9>(handlers.at(n))->depth;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Gets the most entries there have been in the Nth handler's queue
+//
+////////////////////////////////////////////////////////////////////////////////
+size_t ElementReadMap::getMaxQueueDepth(
+	int n)
+{
+	return std::get<9>(handlers.at(n))->max_depth;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Gets the number of entries the Nth handler's queue dropped
+//
+////////////////////////////////////////////////////////////////////////////////
+size_t ElementReadMap::getNumQueueDropped(
+	int n)
+{
+	return std::get<9>(handlers.at(n))->dropped;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 //  @brief Gets the tuple of the Nth handler
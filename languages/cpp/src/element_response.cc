@@ -30,7 +30,7 @@ void ElementResponse::setData(
 	size_t l)
 {
 	if (l != 0) {
-		data = std::string((const char *)d, l);
+		data.assign((const char *)d, l);
 	}
 }
 
@@ -45,6 +45,18 @@ void ElementResponse::setData(
 	data = d;
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Resets the response, keeping the memory for its data
+//
+////////////////////////////////////////////////////////////////////////////////
+void ElementResponse::clear()
+{
+	data.clear();
+	err = 0;
+	err_str.clear();
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 //  @brief Checks to see if the response has data
@@ -0,0 +1,156 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @file entry_view.cc
+//
+//  @brief Zero-copy entry implementation
+//
+//  @copy 2018 Elementary Robotics. All rights reserved.
+//
+////////////////////////////////////////////////////////////////////////////////
+#include <stdexcept>
+
+#include "entry_view.h"
+
+namespace atom {
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Constructor. The reply is freed once this and all copies of it
+//			are gone
+//
+////////////////////////////////////////////////////////////////////////////////
+EntryView::EntryView(
+	const char *xread_id,
+	redisReply *r) : id(xread_id), reply(r, freeReplyObject)
+{
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Destructor. Nothing to do, the shared reply takes care of itself
+//
+////////////////////////////////////////////////////////////////////////////////
+EntryView::~EntryView()
+{
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Adds a field pointing into the reply or, for values in shared
+//			memory, into the ring
+//
+////////////////////////////////////////////////////////////////////////////////
+bool EntryView::addField(
+	const redisReply *key,
+	const redisReply *value)
+{
+	if (!ShmDescriptor::isFramed(value->str, value->len)) {
+		fields.emplace_back(
+			EntryField(key->str, key->len),
+			EntryField(value->str, value->len));
+		return true;
+	}
+	if (ShmDescriptor::isStored(value->str, value->len)) {
+		fields.emplace_back(
+			EntryField(key->str, key->len),
+			EntryField(value->str + SHM_FRAME_HEADER_LEN,
+				value->len - SHM_FRAME_HEADER_LEN));
+		return true;
+	}
+
+	ShmDescriptor desc;
+	const char *ptr;
+	if (!ShmDescriptor::decode(value->str, value->len, desc)) {
+		return false;
+	}
+	std::shared_ptr<ShmSegment> seg = ShmSegment::resolve(desc, ptr);
+	if (seg == NULL) {
+		return false;
+	}
+
+	shm_refs.push_back({ seg, desc.pos, desc.len, desc.gen });
+	fields.emplace_back(
+		EntryField(key->str, key->len),
+		EntryField(ptr, desc.len));
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Get ID of an entry
+//
+////////////////////////////////////////////////////////////////////////////////
+const std::string &EntryView::getID() const
+{
+	return id;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Get the fields of an entry
+//
+////////////////////////////////////////////////////////////////////////////////
+const std::vector<std::pair<EntryField, EntryField>> &EntryView::getFields() const
+{
+	return fields;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Get size
+//
+////////////////////////////////////////////////////////////////////////////////
+size_t EntryView::size() const
+{
+	return fields.size();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Checks for a key. Entries only have a handful of keys so a
+//			linear search beats building an index
+//
+////////////////////////////////////////////////////////////////////////////////
+bool EntryView::hasKey(
+	const std::string &key) const
+{
+	for (auto const &x : fields) {
+		if (x.first == key) {
+			return true;
+		}
+	}
+	return false;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Get key in data
+//
+////////////////////////////////////////////////////////////////////////////////
+EntryField EntryView::getKey(
+	const std::string &key) const
+{
+	for (auto const &x : fields) {
+		if (x.first == key) {
+			return x.second;
+		}
+	}
+	throw std::out_of_range("Key " + key + " not in entry");
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Checks the values in shared memory
+//
+////////////////////////////////////////////////////////////////////////////////
+bool EntryView::isValid() const
+{
+	for (auto const &x : shm_refs) {
+		if (!x.segment->intact(x.pos, x.len, x.gen)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+} // namespace atom
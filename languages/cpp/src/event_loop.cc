@@ -0,0 +1,337 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @file event_loop.cc
+//
+//  @brief Epoll event loop implementation
+//
+//  @copy 2018 Elementary Robotics. All rights reserved.
+//
+////////////////////////////////////////////////////////////////////////////////
+#include <errno.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <stdexcept>
+
+#include "event_loop.h"
+
+namespace atom {
+
+// hiredis calls these from the async context to start and stop watching
+//	its socket
+extern "C" {
+
+	void eventLoopRedisAddRead(
+		void *privdata);
+	void eventLoopRedisDelRead(
+		void *privdata);
+	void eventLoopRedisAddWrite(
+		void *privdata);
+	void eventLoopRedisDelWrite(
+		void *privdata);
+	void eventLoopRedisCleanup(
+		void *privdata);
+}
+
+// State for an async context attached to the loop
+struct EventLoopRedisEvents {
+	EventLoop *loop;
+	int fd;
+	uint32_t events;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Async context hooks. Each one updates the events we're waiting
+//			for on the context's socket
+//
+////////////////////////////////////////////////////////////////////////////////
+void eventLoopRedisAddRead(
+	void *privdata)
+{
+	EventLoopRedisEvents *e = (EventLoopRedisEvents *)privdata;
+	e->events |= EPOLLIN;
+	e->loop->modifyFd(e->fd, e->events);
+}
+
+void eventLoopRedisDelRead(
+	void *privdata)
+{
+	EventLoopRedisEvents *e = (EventLoopRedisEvents *)privdata;
+	e->events &= ~EPOLLIN;
+	e->loop->modifyFd(e->fd, e->events);
+}
+
+void eventLoopRedisAddWrite(
+	void *privdata)
+{
+	EventLoopRedisEvents *e = (EventLoopRedisEvents *)privdata;
+	e->events |= EPOLLOUT;
+	e->loop->modifyFd(e->fd, e->events);
+}
+
+void eventLoopRedisDelWrite(
+	void *privdata)
+{
+	EventLoopRedisEvents *e = (EventLoopRedisEvents *)privdata;
+	e->events &= ~EPOLLOUT;
+	e->loop->modifyFd(e->fd, e->events);
+}
+
+void eventLoopRedisCleanup(
+	void *privdata)
+{
+	EventLoopRedisEvents *e = (EventLoopRedisEvents *)privdata;
+	e->loop->removeFd(e->fd);
+	delete e;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Constructor. Makes the epoll fd and the eventfd used to wake
+//			the loop up
+//
+////////////////////////////////////////////////////////////////////////////////
+EventLoop::EventLoop() : stopped(false)
+{
+	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (epoll_fd < 0) {
+		throw std::runtime_error("Failed to create epoll fd");
+	}
+
+	wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (wake_fd < 0) {
+		close(epoll_fd);
+		throw std::runtime_error("Failed to create wake fd");
+	}
+
+	// The wake fd is the only one without a handler
+	struct epoll_event ev;
+	ev.events = EPOLLIN;
+	ev.data.ptr = NULL;
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &ev) < 0) {
+		close(wake_fd);
+		close(epoll_fd);
+		throw std::runtime_error("Failed to add wake fd");
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Destructor. Anything still registered is dropped without being
+//			told about it
+//
+////////////////////////////////////////////////////////////////////////////////
+EventLoop::~EventLoop()
+{
+	for (auto &x : handlers) {
+		delete x.second;
+	}
+	for (auto h : removed) {
+		delete h;
+	}
+	close(wake_fd);
+	close(epoll_fd);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Registers an fd and its handler
+//
+////////////////////////////////////////////////////////////////////////////////
+void EventLoop::addFd(
+	int fd,
+	uint32_t events,
+	eventLoopFdFn fn)
+{
+	if (handlers.find(fd) != handlers.end()) {
+		throw std::runtime_error("fd " + std::to_string(fd) + " already in loop");
+	}
+
+	FdHandler *h = new FdHandler();
+	h->fd = fd;
+	h->events = events;
+	h->fn = std::move(fn);
+	h->removed = false;
+
+	struct epoll_event ev;
+	ev.events = events;
+	ev.data.ptr = h;
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+		delete h;
+		throw std::runtime_error("Failed to add fd " + std::to_string(fd));
+	}
+
+	handlers.emplace(fd, h);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Changes the events we wait for on an fd
+//
+////////////////////////////////////////////////////////////////////////////////
+void EventLoop::modifyFd(
+	int fd,
+	uint32_t events)
+{
+	auto it = handlers.find(fd);
+	if ((it == handlers.end()) || (it->second->events == events)) {
+		return;
+	}
+
+	struct epoll_event ev;
+	ev.events = events;
+	ev.data.ptr = it->second;
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &ev) == 0) {
+		it->second->events = events;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Unregisters an fd. The handler isn't freed until we're done
+//			with the current batch of events since it might be running
+//
+////////////////////////////////////////////////////////////////////////////////
+void EventLoop::removeFd(
+	int fd)
+{
+	auto it = handlers.find(fd);
+	if (it == handlers.end()) {
+		return;
+	}
+
+	epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+	it->second->removed = true;
+	removed.push_back(it->second);
+	handlers.erase(it);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Returns whether the fd is registered
+//
+////////////////////////////////////////////////////////////////////////////////
+bool EventLoop::hasFd(
+	int fd)
+{
+	return handlers.find(fd) != handlers.end();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Attaches an async context to the loop. Starts out not waiting
+//			on anything, hiredis tells us what it wants through the hooks
+//
+////////////////////////////////////////////////////////////////////////////////
+void EventLoop::attach(
+	redisAsyncContext *ac)
+{
+	EventLoopRedisEvents *e = new EventLoopRedisEvents();
+	e->loop = this;
+	e->fd = ac->c.fd;
+	e->events = 0;
+
+	// Reading may free the context, and with it our registration, so
+	//	make sure it's still around before writing
+	int fd = e->fd;
+	addFd(fd, 0, [this, ac, fd](uint32_t events) {
+		if (events & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+			redisAsyncHandleRead(ac);
+		}
+		if ((events & EPOLLOUT) && hasFd(fd)) {
+			redisAsyncHandleWrite(ac);
+		}
+	});
+
+	ac->ev.data = e;
+	ac->ev.addRead = eventLoopRedisAddRead;
+	ac->ev.delRead = eventLoopRedisDelRead;
+	ac->ev.addWrite = eventLoopRedisAddWrite;
+	ac->ev.delWrite = eventLoopRedisDelWrite;
+	ac->ev.cleanup = eventLoopRedisCleanup;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Waits for events and calls the handlers for them
+//
+////////////////////////////////////////////////////////////////////////////////
+int EventLoop::poll(
+	int timeout_ms)
+{
+	struct epoll_event events[EVENT_LOOP_MAX_EVENTS];
+	uint64_t count;
+
+	int n = epoll_wait(epoll_fd, events, EVENT_LOOP_MAX_EVENTS, timeout_ms);
+	if (n < 0) {
+		return (errno == EINTR) ? 0 : -1;
+	}
+
+	for (int i = 0; i < n; ++i) {
+		FdHandler *h = (FdHandler *)events[i].data.ptr;
+
+		// Drain the wake fd. Whoever woke us up will have set whatever
+		//	they wanted us to notice
+		if (h == NULL) {
+			while (read(wake_fd, &count, sizeof(count)) > 0);
+			continue;
+		}
+
+		if (!h->removed) {
+			h->fn(events[i].events);
+		}
+	}
+
+	// Now nothing can be referring to the removed handlers
+	for (auto h : removed) {
+		delete h;
+	}
+	removed.clear();
+
+	return n;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Wakes up the loop. Thread-safe
+//
+////////////////////////////////////////////////////////////////////////////////
+void EventLoop::wake()
+{
+	uint64_t one = 1;
+	while ((write(wake_fd, &one, sizeof(one)) < 0) && (errno == EINTR));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Stops the loop. Thread-safe
+//
+////////////////////////////////////////////////////////////////////////////////
+void EventLoop::stop()
+{
+	stopped = true;
+	wake();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Returns whether the loop has been stopped
+//
+////////////////////////////////////////////////////////////////////////////////
+bool EventLoop::isStopped()
+{
+	return stopped;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Clears the stopped flag
+//
+////////////////////////////////////////////////////////////////////////////////
+void EventLoop::reset()
+{
+	stopped = false;
+}
+
+} // namespace atom
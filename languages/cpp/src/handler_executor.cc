@@ -0,0 +1,264 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @file handler_executor.cc
+//
+//  @brief Queues and threads for running read handlers
+//
+//  @copy 2018 Elementary Robotics. All rights reserved.
+//
+////////////////////////////////////////////////////////////////////////////////
+#include <algorithm>
+
+#include "handler_executor.h"
+
+namespace atom {
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Constructor. Starts the threads
+//
+////////////////////////////////////////////////////////////////////////////////
+HandlerPool::HandlerPool(
+	size_t n_threads) : stopping(false)
+{
+	for (size_t i = 0; i < std::max(n_threads, (size_t)1); ++i) {
+		threads.push_back(std::thread(&HandlerPool::worker, this));
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Destructor. Stops and joins the threads. Every queue using the
+//			pool must be gone by now
+//
+////////////////////////////////////////////////////////////////////////////////
+HandlerPool::~HandlerPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	cv.notify_all();
+	for (auto &t : threads) {
+		t.join();
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Queues up a handler to be run
+//
+////////////////////////////////////////////////////////////////////////////////
+void HandlerPool::schedule(
+	HandlerQueue *queue)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		ready.push_back(queue);
+	}
+	cv.notify_one();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Runs handlers a batch at a time. A handler with more left goes to
+//			the back s.t. a busy stream doesn't starve the others
+//
+////////////////////////////////////////////////////////////////////////////////
+void HandlerPool::worker()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+
+	while (true) {
+		cv.wait(lock, [this]() { return stopping || !ready.empty(); });
+		if (ready.empty()) {
+			break;
+		}
+
+		HandlerQueue *queue = ready.front();
+		ready.pop_front();
+		lock.unlock();
+
+		bool more = queue->runBatch();
+
+		lock.lock();
+		if (more) {
+			ready.push_back(queue);
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Constructor. Starts the handler's thread if it has its own
+//
+////////////////////////////////////////////////////////////////////////////////
+HandlerQueue::HandlerQueue(
+	queuedHandlerFn f,
+	void *data,
+	const HandlerExecutor &e,
+	std::shared_ptr<HandlerQueueStats> s) : fn(f), user_data(data),
+		executor(e), stats(s), busy(false), stopping(false)
+{
+	executor.queue_size = std::max(executor.queue_size, (size_t)1);
+
+	if (executor.type == HANDLER_EXECUTOR_DEDICATED) {
+		thread = std::thread(&HandlerQueue::threadLoop, this);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Destructor. Lets the handler finish what's queued and stops its
+//			thread
+//
+////////////////////////////////////////////////////////////////////////////////
+HandlerQueue::~HandlerQueue()
+{
+	drain();
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	not_empty.notify_all();
+	if (thread.joinable()) {
+		thread.join();
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Takes the entry at the front of the queue and lets anything
+//			waiting for room know
+//
+////////////////////////////////////////////////////////////////////////////////
+EntryView HandlerQueue::pop()
+{
+	EntryView e(std::move(entries.front()));
+	entries.pop_front();
+	stats->depth = entries.size();
+	not_full.notify_one();
+	return e;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Queues up an entry. Runs on the thread reading the streams
+//
+////////////////////////////////////////////////////////////////////////////////
+void HandlerQueue::push(
+	EntryView &&e)
+{
+	bool schedule = false;
+
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+
+		if (entries.size() >= executor.queue_size) {
+			switch (executor.overflow) {
+				case HANDLER_OVERFLOW_DROP_NEWEST:
+					++stats->dropped;
+					return;
+				case HANDLER_OVERFLOW_BLOCK:
+					not_full.wait(lock, [this]() {
+						return entries.size() < executor.queue_size;
+					});
+					break;
+				case HANDLER_OVERFLOW_DROP_OLDEST:
+				default:
+					entries.pop_front();
+					++stats->dropped;
+					break;
+			}
+		}
+
+		entries.push_back(std::move(e));
+		stats->depth = entries.size();
+		if (entries.size() > stats->max_depth) {
+			stats->max_depth = entries.size();
+		}
+
+		// A pool only has the handler scheduled once at a time
+		if ((executor.type == HANDLER_EXECUTOR_SHARED) && !busy) {
+			busy = true;
+			schedule = true;
+		}
+	}
+
+	if (schedule) {
+		executor.handler_pool->schedule(this);
+	} else {
+		not_empty.notify_one();
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Runs entries on the handler's own thread until it's stopped and
+//			the queue is empty
+//
+////////////////////////////////////////////////////////////////////////////////
+void HandlerQueue::threadLoop()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+
+	while (true) {
+		not_empty.wait(lock, [this]() { return stopping || !entries.empty(); });
+		if (entries.empty()) {
+			break;
+		}
+
+		EntryView e = pop();
+		busy = true;
+		lock.unlock();
+
+		fn(e, user_data);
+
+		lock.lock();
+		busy = false;
+		if (entries.empty()) {
+			idle.notify_all();
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Runs up to HANDLER_POOL_BATCH entries on a pool thread
+//
+////////////////////////////////////////////////////////////////////////////////
+bool HandlerQueue::runBatch()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+
+	for (size_t i = 0; (i < HANDLER_POOL_BATCH) && !entries.empty(); ++i) {
+		EntryView e = pop();
+		lock.unlock();
+
+		fn(e, user_data);
+
+		lock.lock();
+	}
+
+	if (!entries.empty()) {
+		return true;
+	}
+
+	busy = false;
+	idle.notify_all();
+	return false;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Waits for the queue to empty out and the handler to return
+//
+////////////////////////////////////////////////////////////////////////////////
+void HandlerQueue::drain()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	idle.wait(lock, [this]() { return entries.empty() && !busy; });
+}
+
+} // namespace atom
@@ -0,0 +1,80 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @file prepared_read.cc
+//
+//  @brief Reads of a stream that are set up once and done over and over
+//
+//  @copy 2018 Elementary Robotics. All rights reserved.
+//
+////////////////////////////////////////////////////////////////////////////////
+#include <stdio.h>
+
+#include "prepared_read.h"
+#include "element.h"
+
+namespace atom {
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Constructor. The read can't be done until set up by
+//			Element::prepareRead()
+//
+////////////////////////////////////////////////////////////////////////////////
+PreparedRead::PreparedRead() :
+	element(NULL),
+	pool(NULL)
+{
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Destructor
+//
+////////////////////////////////////////////////////////////////////////////////
+PreparedRead::~PreparedRead()
+{
+	close();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Gets the ID of the last entry read since
+//
+////////////////////////////////////////////////////////////////////////////////
+std::string PreparedRead::getLastID() const
+{
+	if (element == NULL) {
+		return "";
+	}
+	return std::string(read.stream_info.last_id);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Sets the ID that the next read since reads after
+//
+////////////////////////////////////////////////////////////////////////////////
+void PreparedRead::setLastID(
+	const std::string &id)
+{
+	if (element != NULL) {
+		snprintf(read.stream_info.last_id, sizeof(read.stream_info.last_id),
+			"%s", id.c_str());
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Frees everything the read was prepared with
+//
+////////////////////////////////////////////////////////////////////////////////
+void PreparedRead::close()
+{
+	if (element != NULL) {
+		element->preparedReadClose(*this);
+		element = NULL;
+	}
+}
+
+} // namespace atom
@@ -0,0 +1,79 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @file reference_view.cc
+//
+//  @brief Zero-copy reference values implementation
+//
+//  @copy 2018 Elementary Robotics. All rights reserved.
+//
+////////////////////////////////////////////////////////////////////////////////
+#include <string>
+#include <stdexcept>
+
+#include "reference_view.h"
+
+namespace atom {
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Adds the values in a reply. The reply is freed once this and all
+//			copies of it are gone
+//
+////////////////////////////////////////////////////////////////////////////////
+void ReferenceView::addReply(
+	redisReply *r)
+{
+	replies.emplace_back(r, freeReplyObject);
+	for (size_t i = 0; i < r->elements; ++i) {
+		values.push_back(r->element[i]);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Clears the values
+//
+////////////////////////////////////////////////////////////////////////////////
+void ReferenceView::clear()
+{
+	values.clear();
+	replies.clear();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Get size
+//
+////////////////////////////////////////////////////////////////////////////////
+size_t ReferenceView::size() const
+{
+	return values.size();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Missing references come back as NIL
+//
+////////////////////////////////////////////////////////////////////////////////
+bool ReferenceView::hasValue(
+	size_t idx) const
+{
+	return (idx < values.size()) &&
+		(values[idx]->type == REDIS_REPLY_STRING);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Get a value
+//
+////////////////////////////////////////////////////////////////////////////////
+EntryField ReferenceView::getValue(
+	size_t idx) const
+{
+	if (!hasValue(idx)) {
+		throw std::out_of_range("No value for reference " + std::to_string(idx));
+	}
+	return EntryField(values[idx]->str, values[idx]->len);
+}
+
+} // namespace atom
@@ -0,0 +1,410 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @file shm_ring.cc
+//
+//  @brief Shared-memory transport implementation
+//
+//  @copy 2018 Elementary Robotics. All rights reserved.
+//
+////////////////////////////////////////////////////////////////////////////////
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <chrono>
+#include <fstream>
+#include <stdexcept>
+
+#include "shm_ring.h"
+
+// Space reserved for the header at the start of the ring s.t. the data
+//	starts on its own cache line
+#define SHM_RING_HEADER_SIZE 64
+
+namespace atom {
+
+static_assert(sizeof(ShmRingHeader) <= SHM_RING_HEADER_SIZE,
+	"ring header doesn't fit");
+
+// Mappings of the rings we're reading from, by name
+static std::mutex shm_segments_mutex;
+static std::map<std::string, std::shared_ptr<ShmSegment>> shm_segments;
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Encodes a descriptor. The fields are NUL-separated after the
+//			frame header
+//
+////////////////////////////////////////////////////////////////////////////////
+std::string ShmDescriptor::encode() const
+{
+	std::string ret(SHM_DESCRIPTOR_PREFIX, SHM_DESCRIPTOR_PREFIX_LEN);
+	ret.push_back((char)SHM_FRAME_DESCRIPTOR);
+	ret += segment;
+	ret.push_back('\0');
+	ret += std::to_string(pos);
+	ret.push_back('\0');
+	ret += std::to_string(len);
+	ret.push_back('\0');
+	ret += std::to_string(gen);
+	ret.push_back('\0');
+	ret += host;
+	return ret;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Checks for the descriptor prefix
+//
+////////////////////////////////////////////////////////////////////////////////
+bool ShmDescriptor::isFramed(
+	const char *data,
+	size_t len)
+{
+	return (len >= SHM_FRAME_HEADER_LEN) &&
+		(memcmp(data, SHM_DESCRIPTOR_PREFIX, SHM_DESCRIPTOR_PREFIX_LEN) == 0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Checks the frame type of a framed value
+//
+////////////////////////////////////////////////////////////////////////////////
+bool ShmDescriptor::isStored(
+	const char *data,
+	size_t len)
+{
+	return isFramed(data, len) &&
+		(data[SHM_DESCRIPTOR_PREFIX_LEN] == SHM_FRAME_STORED);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Frames a value as stored s.t. it can't be mistaken for a
+//			descriptor
+//
+////////////////////////////////////////////////////////////////////////////////
+std::string ShmDescriptor::frame(
+	const char *data,
+	size_t len)
+{
+	std::string ret(SHM_DESCRIPTOR_PREFIX, SHM_DESCRIPTOR_PREFIX_LEN);
+	ret.push_back((char)SHM_FRAME_STORED);
+	ret.append(data, len);
+	return ret;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Splits a descriptor into its fields
+//
+////////////////////////////////////////////////////////////////////////////////
+bool ShmDescriptor::decode(
+	const char *data,
+	size_t len,
+	ShmDescriptor &desc)
+{
+	if (!isFramed(data, len) ||
+		(data[SHM_DESCRIPTOR_PREFIX_LEN] != SHM_FRAME_DESCRIPTOR))
+	{
+		return false;
+	}
+
+	std::string fields[5];
+	size_t n = 0;
+	for (size_t i = SHM_FRAME_HEADER_LEN; i < len; ++i) {
+		if (data[i] == '\0') {
+			if (++n == 5) {
+				return false;
+			}
+		} else {
+			fields[n].push_back(data[i]);
+		}
+	}
+	if ((n != 4) || fields[0].empty() || fields[4].empty()) {
+		return false;
+	}
+
+	char *end;
+	uint64_t *nums[3] = { &desc.pos, &desc.len, &desc.gen };
+	for (int i = 0; i < 3; ++i) {
+		*nums[i] = strtoull(fields[i + 1].c_str(), &end, 10);
+		if (fields[i + 1].empty() || (*end != '\0')) {
+			return false;
+		}
+	}
+
+	desc.segment = std::move(fields[0]);
+	desc.host = std::move(fields[4]);
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Gets the host ID. The boot ID is shared by everything on the
+//			host, containers included, and changes on reboot. If we can't
+//			read it then we fall back to the hostname
+//
+////////////////////////////////////////////////////////////////////////////////
+static std::string shmReadHostID()
+{
+	std::string id;
+	std::ifstream boot_id("/proc/sys/kernel/random/boot_id");
+	if (std::getline(boot_id, id) && !id.empty()) {
+		return id;
+	}
+
+	char hostname[256];
+	if (gethostname(hostname, sizeof(hostname)) == 0) {
+		hostname[sizeof(hostname) - 1] = '\0';
+		return std::string(hostname);
+	}
+	return "unknown";
+}
+
+const std::string &shmHostID()
+{
+	static const std::string id = shmReadHostID();
+	return id;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Makes the ring. Anything left over with the same name, i.e. from
+//			a writer that crashed, is replaced
+//
+////////////////////////////////////////////////////////////////////////////////
+ShmRingWriter::ShmRingWriter(
+	const std::string &segment,
+	size_t size) : name(segment), map_size(SHM_RING_HEADER_SIZE + size)
+{
+	if (size == 0) {
+		throw std::runtime_error("Shared memory ring can't be empty");
+	}
+
+	shm_unlink(name.c_str());
+	fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+	if (fd < 0) {
+		throw std::runtime_error("Failed to create shared memory " + name);
+	}
+
+	void *map = MAP_FAILED;
+	if (ftruncate(fd, map_size) == 0) {
+		map = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	}
+	if (map == MAP_FAILED) {
+		close(fd);
+		shm_unlink(name.c_str());
+		throw std::runtime_error("Failed to map shared memory " + name);
+	}
+
+	header = (ShmRingHeader *)map;
+	data = (char *)map + SHM_RING_HEADER_SIZE;
+
+	// Magic goes last, readers won't use the ring until it's there
+	header->generation =
+		(uint64_t)std::chrono::system_clock::now().time_since_epoch().count() ^
+		((uint64_t)getpid() << 48);
+	header->size = size;
+	header->head.store(0, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	header->magic = SHM_RING_MAGIC;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Removes the ring. Readers that still have it mapped keep their
+//			mappings
+//
+////////////////////////////////////////////////////////////////////////////////
+ShmRingWriter::~ShmRingWriter()
+{
+	munmap(header, map_size);
+	close(fd);
+	shm_unlink(name.c_str());
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Writes a value at the head of the ring. The new head is published
+//			before the copy s.t. a reader that checks intact() after
+//			reading will notice that we wrote over it
+//
+////////////////////////////////////////////////////////////////////////////////
+bool ShmRingWriter::write(
+	const char *buf,
+	size_t len,
+	ShmDescriptor &desc)
+{
+	uint64_t size = header->size;
+	if (len > size) {
+		return false;
+	}
+
+	// Values never wrap, skip to the start of the ring if it won't fit.
+	//	The space is claimed with a CAS s.t. writers on other threads each
+	//	get their own
+	uint64_t head = header->head.load(std::memory_order_relaxed);
+	uint64_t pos, offset;
+	do {
+		pos = head;
+		offset = pos % size;
+		if (offset + len > size) {
+			pos += size - offset;
+			offset = 0;
+		}
+	} while (!header->head.compare_exchange_weak(head, pos + len,
+		std::memory_order_relaxed));
+	std::atomic_thread_fence(std::memory_order_release);
+	memcpy(data + offset, buf, len);
+
+	desc.segment = name;
+	desc.pos = pos;
+	desc.len = len;
+	desc.gen = header->generation;
+	desc.host = shmHostID();
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Maps a ring read-only. If it's not there or isn't a ring then
+//			isMapped() will be false
+//
+////////////////////////////////////////////////////////////////////////////////
+ShmSegment::ShmSegment(
+	const std::string &segment) : name(segment), map_size(0), header(NULL),
+		data(NULL)
+{
+	int fd = shm_open(name.c_str(), O_RDONLY, 0);
+	if (fd < 0) {
+		return;
+	}
+
+	struct stat st;
+	if ((fstat(fd, &st) == 0) && (st.st_size > SHM_RING_HEADER_SIZE)) {
+		void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+		if (map != MAP_FAILED) {
+			map_size = st.st_size;
+			header = (const ShmRingHeader *)map;
+			data = (const char *)map + SHM_RING_HEADER_SIZE;
+		}
+	}
+	close(fd);
+
+	// Don't trust a ring that's still being made or the wrong size
+	if (header != NULL) {
+		bool valid = (header->magic == SHM_RING_MAGIC);
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (!valid || (SHM_RING_HEADER_SIZE + header->size != map_size)) {
+			munmap((void *)header, map_size);
+			header = NULL;
+			data = NULL;
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Unmaps the ring
+//
+////////////////////////////////////////////////////////////////////////////////
+ShmSegment::~ShmSegment()
+{
+	if (header != NULL) {
+		munmap((void *)header, map_size);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Returns whether we have the ring mapped
+//
+////////////////////////////////////////////////////////////////////////////////
+bool ShmSegment::isMapped() const
+{
+	return header != NULL;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Checks that the writer hasn't gotten around to the value again.
+//			Any reads of the value are ordered before the check of the head
+//
+////////////////////////////////////////////////////////////////////////////////
+bool ShmSegment::intact(
+	uint64_t pos,
+	uint64_t len,
+	uint64_t gen) const
+{
+	if ((header == NULL) || (header->generation != gen)) {
+		return false;
+	}
+
+	std::atomic_thread_fence(std::memory_order_acquire);
+	uint64_t head = header->head.load(std::memory_order_relaxed);
+	return (pos + len <= head) && (head - pos <= header->size);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Gets the mapping for a descriptor, (re)mapping the ring if we
+//			don't have it or the writer has made a new one since
+//
+////////////////////////////////////////////////////////////////////////////////
+std::shared_ptr<ShmSegment> ShmSegment::resolve(
+	const ShmDescriptor &desc,
+	const char *&ptr)
+{
+	if (desc.host != shmHostID()) {
+		return NULL;
+	}
+
+	std::shared_ptr<ShmSegment> seg;
+	{
+		std::lock_guard<std::mutex> lock(shm_segments_mutex);
+
+		auto it = shm_segments.find(desc.segment);
+		if ((it == shm_segments.end()) || !it->second->isMapped() ||
+			(it->second->header->generation != desc.gen))
+		{
+			seg = std::shared_ptr<ShmSegment>(new ShmSegment(desc.segment));
+			shm_segments[desc.segment] = seg;
+		} else {
+			seg = it->second;
+		}
+	}
+
+	// Values never wrap, so anything that would is garbage
+	if (!seg->intact(desc.pos, desc.len, desc.gen) ||
+		((desc.pos % seg->header->size) + desc.len > seg->header->size))
+	{
+		return NULL;
+	}
+
+	ptr = seg->data + (desc.pos % seg->header->size);
+	return seg;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Copies a value out of its ring
+//
+////////////////////////////////////////////////////////////////////////////////
+bool ShmSegment::copy(
+	const ShmDescriptor &desc,
+	std::string &out)
+{
+	const char *ptr;
+	std::shared_ptr<ShmSegment> seg = resolve(desc, ptr);
+	if (seg == NULL) {
+		return false;
+	}
+
+	out.assign(ptr, desc.len);
+	return seg->intact(desc.pos, desc.len, desc.gen);
+}
+
+} // namespace atom
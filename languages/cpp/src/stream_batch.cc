@@ -0,0 +1,93 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @file stream_batch.cc
+//
+//  @brief Stream batch implementation
+//
+//  @copy 2018 Elementary Robotics. All rights reserved.
+//
+////////////////////////////////////////////////////////////////////////////////
+#include <stdexcept>
+
+#include "stream_batch.h"
+
+namespace atom {
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Adds an entry to the batch. Any results from a previous write
+//			of the batch are no longer valid.
+//
+////////////////////////////////////////////////////////////////////////////////
+size_t StreamBatch::add(
+	std::string stream,
+	entry_data_t data,
+	int timestamp,
+	int maxlen)
+{
+	BatchEntry entry;
+	entry.stream = std::move(stream);
+	entry.data = std::move(data);
+	entry.timestamp = timestamp;
+	entry.maxlen = maxlen;
+	entries.push_back(std::move(entry));
+
+	ids.clear();
+	errors.clear();
+
+	return entries.size() - 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Gets the number of entries in the batch
+//
+////////////////////////////////////////////////////////////////////////////////
+size_t StreamBatch::size()
+{
+	return entries.size();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Clears the batch
+//
+////////////////////////////////////////////////////////////////////////////////
+void StreamBatch::clear()
+{
+	entries.clear();
+	ids.clear();
+	errors.clear();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Gets the ID of the nth entry
+//
+////////////////////////////////////////////////////////////////////////////////
+const std::string &StreamBatch::getID(
+	size_t n)
+{
+	if (n >= ids.size()) {
+		throw std::out_of_range("No ID for batch entry");
+	}
+
+	return ids[n];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Gets the error of the nth entry
+//
+////////////////////////////////////////////////////////////////////////////////
+enum atom_error_t StreamBatch::getError(
+	size_t n)
+{
+	if (n >= errors.size()) {
+		throw std::out_of_range("No error for batch entry");
+	}
+
+	return errors[n];
+}
+
+} // namespace atom
@@ -0,0 +1,115 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @file stream_range.cc
+//
+//  @brief Iterator over a range of a stream
+//
+//  @copy 2018 Elementary Robotics. All rights reserved.
+//
+////////////////////////////////////////////////////////////////////////////////
+#include <stdexcept>
+
+#include "stream_range.h"
+#include "element.h"
+
+namespace atom {
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Constructor. The iterator has no entries until set up by
+//			Element::entryRange()
+//
+////////////////////////////////////////////////////////////////////////////////
+StreamRangeIterator::StreamRangeIterator() :
+	element(NULL),
+	pool(NULL),
+	ctx(NULL),
+	pos(0),
+	n_read(0),
+	err(ATOM_NO_ERROR)
+{
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Destructor
+//
+////////////////////////////////////////////////////////////////////////////////
+StreamRangeIterator::~StreamRangeIterator()
+{
+	close();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Moves to the next entry. When the current page runs out the next
+//			one is read, which has already been requested
+//
+////////////////////////////////////////////////////////////////////////////////
+bool StreamRangeIterator::next()
+{
+	if ((pos + 1) < page.size()) {
+		pos += 1;
+		n_read += 1;
+		return true;
+	}
+
+	page.clear();
+	pos = 0;
+	if ((element == NULL) || !element->entryRangeNext(*this)) {
+		close();
+		return false;
+	}
+
+	n_read += 1;
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Gets the current entry
+//
+////////////////////////////////////////////////////////////////////////////////
+EntryView &StreamRangeIterator::get()
+{
+	if (pos >= page.size()) {
+		throw std::out_of_range("No current entry");
+	}
+	return page[pos];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Gets the error
+//
+////////////////////////////////////////////////////////////////////////////////
+enum atom_error_t StreamRangeIterator::getError() const
+{
+	return err;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Gets the number of entries read
+//
+////////////////////////////////////////////////////////////////////////////////
+size_t StreamRangeIterator::count() const
+{
+	return n_read;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Closes the range, giving the context back to the element
+//
+////////////////////////////////////////////////////////////////////////////////
+void StreamRangeIterator::close()
+{
+	if (element != NULL) {
+		element->entryRangeClose(*this);
+		element = NULL;
+	}
+}
+
+} // namespace atom
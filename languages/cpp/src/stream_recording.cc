@@ -0,0 +1,809 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @file stream_recording.cc
+//
+//  @brief Recording and replaying streams
+//
+//  @copy 2018 Elementary Robotics. All rights reserved.
+//
+////////////////////////////////////////////////////////////////////////////////
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <map>
+#include <chrono>
+#include <thread>
+#include <algorithm>
+#include <stdexcept>
+
+#include "stream_recording.h"
+#include "element.h"
+
+// Space reserved for the header at the start of each file
+#define RECORDING_HEADER_SIZE 64
+
+// Entries and the fields in them start on 8 bytes
+#define RECORDING_ALIGN(x) (((x) + 7) & ~((uint64_t)7))
+
+namespace atom {
+
+static_assert(sizeof(RecordingHeader) <= RECORDING_HEADER_SIZE,
+	"recording header doesn't fit");
+
+// Start of an entry in the segment, followed by its fields
+struct RecordHeader {
+	uint32_t stream;
+	uint32_t n_fields;
+};
+
+// Start of a field, followed by its value. key is the position of the key
+//	in the stream's keys
+struct RecordField {
+	uint32_t key;
+	uint32_t len;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Makes the file and maps its header. Chunks are whole pages s.t.
+//			each one can be mapped on its own
+//
+////////////////////////////////////////////////////////////////////////////////
+RecordingFile::RecordingFile(
+	const std::string &path,
+	size_t chunk) : header(NULL), window(NULL), window_offset(0), window_len(0)
+{
+	size_t page_size = sysconf(_SC_PAGESIZE);
+	chunk_size = std::max(page_size,
+		(chunk + page_size - 1) / page_size * page_size);
+
+	fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		throw std::runtime_error("Couldn't make recording " + path);
+	}
+
+	file_size = chunk_size;
+	void *ptr = MAP_FAILED;
+	if (ftruncate(fd, file_size) == 0) {
+		ptr = mmap(NULL, RECORDING_HEADER_SIZE, PROT_READ | PROT_WRITE,
+			MAP_SHARED, fd, 0);
+	}
+	if (ptr == MAP_FAILED) {
+		close(fd);
+		throw std::runtime_error("Couldn't map recording " + path);
+	}
+
+	header = (RecordingHeader *)ptr;
+	memset(header, 0, sizeof(RecordingHeader));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Unmaps and closes the file
+//
+////////////////////////////////////////////////////////////////////////////////
+RecordingFile::~RecordingFile()
+{
+	if (window != NULL) {
+		munmap(window, window_len);
+	}
+	munmap(header, RECORDING_HEADER_SIZE);
+	close(fd);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Maps the bytes to write, moving the window up to them if they're
+//			not in it. The file grows a chunk at a time and the space that
+//			isn't written yet doesn't take up any disk
+//
+////////////////////////////////////////////////////////////////////////////////
+char *RecordingFile::reserve(
+	uint64_t offset,
+	size_t len)
+{
+	if ((window != NULL) && (offset >= window_offset) &&
+		(offset + len <= window_offset + window_len))
+	{
+		return window + (offset - window_offset);
+	}
+
+	if (window != NULL) {
+		munmap(window, window_len);
+		window = NULL;
+	}
+
+	// The window starts on a chunk and is at least a chunk long
+	window_offset = offset - (offset % chunk_size);
+	window_len = std::max((uint64_t)chunk_size,
+		(offset + len - window_offset + chunk_size - 1) /
+			chunk_size * chunk_size);
+
+	// Mapping past the end of the file would fault when written
+	if (window_offset + window_len > file_size) {
+		if (ftruncate(fd, window_offset + window_len) != 0) {
+			return NULL;
+		}
+		file_size = window_offset + window_len;
+	}
+
+	void *ptr = mmap(NULL, window_len, PROT_READ | PROT_WRITE, MAP_SHARED,
+		fd, window_offset);
+	if (ptr == MAP_FAILED) {
+		return NULL;
+	}
+
+	window = (char *)ptr;
+	return window + (offset - window_offset);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Drops the part of the last chunk that wasn't used
+//
+////////////////////////////////////////////////////////////////////////////////
+void RecordingFile::finish(
+	uint64_t len)
+{
+	if (window != NULL) {
+		munmap(window, window_len);
+		window = NULL;
+	}
+
+	if ((len < file_size) && (ftruncate(fd, len) == 0)) {
+		file_size = len;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Appends a length-prefixed string to the table of streams
+//
+////////////////////////////////////////////////////////////////////////////////
+static void recordingAppendString(
+	std::string &table,
+	const std::string &str)
+{
+	uint32_t len = str.size();
+	table.append((const char *)&len, sizeof(len));
+	table.append(str);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Constructor. Makes both files and writes the table of streams,
+//			i.e. each one's element, name and keys, at the start of the
+//			segment
+//
+////////////////////////////////////////////////////////////////////////////////
+StreamRecorder::StreamRecorder(
+	const std::string &path,
+	const std::vector<RecordedStream> &s,
+	size_t chunk_size) : streams(s), segment(path, chunk_size),
+		index(path + RECORDING_INDEX_SUFFIX, chunk_size), last_time_ms(0),
+		n_dropped(0)
+{
+	std::string table;
+	for (auto const &stream : streams) {
+		recordingAppendString(table, stream.element);
+		recordingAppendString(table, stream.stream);
+		uint32_t n_keys = stream.keys.size();
+		table.append((const char *)&n_keys, sizeof(n_keys));
+		for (auto const &key : stream.keys) {
+			recordingAppendString(table, key);
+		}
+	}
+
+	char *ptr = segment.reserve(RECORDING_HEADER_SIZE, table.size());
+	if (ptr == NULL) {
+		throw std::runtime_error("Couldn't write recording " + path);
+	}
+	memcpy(ptr, table.data(), table.size());
+
+	RecordingHeader *headers[2] = { &segment.getHeader(), &index.getHeader() };
+	for (int i = 0; i < 2; ++i) {
+		headers[i]->version = RECORDING_VERSION;
+		headers[i]->n_streams = streams.size();
+		headers[i]->data_start = RECORDING_HEADER_SIZE;
+		headers[i]->size = 0;
+	}
+	headers[0]->data_start =
+		RECORDING_ALIGN(RECORDING_HEADER_SIZE + table.size());
+
+	// Only a finished header is a recording
+	headers[0]->magic = RECORDING_MAGIC;
+	headers[1]->magic = RECORDING_MAGIC;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Destructor. Trims the files down to what was written
+//
+////////////////////////////////////////////////////////////////////////////////
+StreamRecorder::~StreamRecorder()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	RecordingHeader &seg = segment.getHeader();
+	RecordingHeader &idx = index.getHeader();
+	segment.finish(seg.data_start + seg.size);
+	index.finish(idx.data_start + idx.size * sizeof(RecordingIndexEntry));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Read handler for each stream. Entries that can't be recorded
+//			don't stop the read
+//
+////////////////////////////////////////////////////////////////////////////////
+bool StreamRecorder::viewCB(
+	EntryView &e,
+	void *user_data)
+{
+	Handler *handler = (Handler *)user_data;
+	handler->recorder->record(handler->stream, e);
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Adds the handlers to the read map
+//
+////////////////////////////////////////////////////////////////////////////////
+void StreamRecorder::addTo(
+	ElementReadMap &m)
+{
+	for (size_t i = 0; i < streams.size(); ++i) {
+		handlers.push_back(Handler{ this, i });
+		m.addHandler(streams[i].element, streams[i].stream, streams[i].keys,
+			&StreamRecorder::viewCB, (void *)&handlers.back());
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Appends the entry to the segment and then its place to the
+//			index. The entry's fields are in the order of the stream's keys
+//			so they're matched up in a single pass. Neither file's size is
+//			moved until both are written
+//
+////////////////////////////////////////////////////////////////////////////////
+bool StreamRecorder::record(
+	size_t stream,
+	const EntryView &e)
+{
+	if (stream >= streams.size()) {
+		return false;
+	}
+
+	const std::vector<std::string> &keys = streams[stream].keys;
+	const std::vector<std::pair<EntryField, EntryField>> &fields =
+		e.getFields();
+
+	// Figure out which key each field is and how much room they need
+	std::vector<uint32_t> field_keys;
+	field_keys.reserve(fields.size());
+	uint64_t len = sizeof(RecordHeader);
+	size_t k = 0;
+	for (auto const &field : fields) {
+		while ((k < keys.size()) && (field.first != keys[k])) {
+			++k;
+		}
+		if (k == keys.size()) {
+			break;
+		}
+		field_keys.push_back(k);
+		len += RECORDING_ALIGN(sizeof(RecordField) + field.second.size());
+	}
+
+	std::lock_guard<std::mutex> lock(mutex);
+
+	RecordingHeader &seg = segment.getHeader();
+	RecordingHeader &idx = index.getHeader();
+	uint64_t offset = seg.data_start + seg.size;
+
+	char *ptr = segment.reserve(offset, len);
+	if ((ptr == NULL) || (field_keys.size() != fields.size())) {
+		++n_dropped;
+		return false;
+	}
+
+	RecordHeader *record = (RecordHeader *)ptr;
+	record->stream = stream;
+	record->n_fields = fields.size();
+	ptr += sizeof(RecordHeader);
+	for (size_t i = 0; i < fields.size(); ++i) {
+		RecordField *field = (RecordField *)ptr;
+		field->key = field_keys[i];
+		field->len = fields[i].second.size();
+		memcpy(ptr + sizeof(RecordField), fields[i].second.data(), field->len);
+		ptr += RECORDING_ALIGN(sizeof(RecordField) + field->len);
+	}
+
+	// Values in shared memory might have been overwritten while copying
+	if (!e.isValid()) {
+		++n_dropped;
+		return false;
+	}
+
+	RecordingIndexEntry *entry = (RecordingIndexEntry *)index.reserve(
+		idx.data_start + idx.size * sizeof(RecordingIndexEntry),
+		sizeof(RecordingIndexEntry));
+	if (entry == NULL) {
+		++n_dropped;
+		return false;
+	}
+
+	char *end;
+	entry->offset = offset;
+	entry->id_ms = strtoull(e.getID().c_str(), &end, 10);
+	entry->id_seq = (*end == '-') ? strtoull(end + 1, NULL, 10) : 0;
+	entry->time_ms = std::max(last_time_ms, (int64_t)entry->id_ms);
+	entry->stream = stream;
+	entry->len = len;
+
+	last_time_ms = entry->time_ms;
+	seg.size += len;
+	++idx.size;
+
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Gets the number of entries recorded
+//
+////////////////////////////////////////////////////////////////////////////////
+size_t StreamRecorder::size()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return index.getHeader().size;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Gets the number of entries that couldn't be recorded
+//
+////////////////////////////////////////////////////////////////////////////////
+size_t StreamRecorder::getNumDropped()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return n_dropped;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Maps a whole file read-only. Returns NULL if we can't or it's
+//			too small to have a header
+//
+////////////////////////////////////////////////////////////////////////////////
+static const char *recordingMap(
+	const std::string &path,
+	size_t &len)
+{
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0) {
+		return NULL;
+	}
+
+	struct stat st;
+	void *ptr = MAP_FAILED;
+	if ((fstat(fd, &st) == 0) && (st.st_size >= RECORDING_HEADER_SIZE)) {
+		len = st.st_size;
+		ptr = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, 0);
+	}
+	close(fd);
+
+	if (ptr == MAP_FAILED) {
+		return NULL;
+	}
+
+	// Replays go through in order, so read ahead and drop what's done
+	madvise(ptr, len, MADV_SEQUENTIAL);
+	return (const char *)ptr;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Checks a file's header. Returns the number of units of data that
+//			are done and in the file, or -1 if it's not a recording
+//
+////////////////////////////////////////////////////////////////////////////////
+static int64_t recordingCheckHeader(
+	const RecordingHeader &header,
+	size_t file_len,
+	size_t unit)
+{
+	if ((header.magic != RECORDING_MAGIC) ||
+		(header.version != RECORDING_VERSION) ||
+		(header.data_start > file_len))
+	{
+		return -1;
+	}
+
+	return std::min(header.size, (file_len - header.data_start) / unit);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Constructor. Maps both files and reads the streams
+//
+////////////////////////////////////////////////////////////////////////////////
+StreamReplayer::StreamReplayer(
+	const std::string &p) : path(p), segment(NULL), segment_len(0),
+		index_map(NULL), index_map_len(0), index(NULL), n_entries(0), pos(0)
+{
+	segment = recordingMap(path, segment_len);
+	index_map = recordingMap(path + RECORDING_INDEX_SUFFIX, index_map_len);
+	if ((segment == NULL) || (index_map == NULL)) {
+		unmap();
+		throw std::runtime_error("Couldn't open recording " + path);
+	}
+
+	const RecordingHeader &seg = *(const RecordingHeader *)segment;
+	const RecordingHeader &idx = *(const RecordingHeader *)index_map;
+	int64_t n = recordingCheckHeader(idx, index_map_len,
+		sizeof(RecordingIndexEntry));
+	if ((recordingCheckHeader(seg, segment_len, 1) < 0) || (n < 0) ||
+		(seg.n_streams != idx.n_streams) || !readStreams(seg))
+	{
+		unmap();
+		throw std::runtime_error("Not a recording: " + path);
+	}
+
+	index = (const RecordingIndexEntry *)(index_map + idx.data_start);
+	n_entries = n;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Destructor
+//
+////////////////////////////////////////////////////////////////////////////////
+StreamReplayer::~StreamReplayer()
+{
+	unmap();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Unmaps whatever's mapped
+//
+////////////////////////////////////////////////////////////////////////////////
+void StreamReplayer::unmap()
+{
+	if (segment != NULL) {
+		munmap((void *)segment, segment_len);
+		segment = NULL;
+	}
+	if (index_map != NULL) {
+		munmap((void *)index_map, index_map_len);
+		index_map = NULL;
+	}
+	index = NULL;
+	n_entries = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Reads a length-prefixed string out of the table of streams.
+//			Returns false if it runs past the end
+//
+////////////////////////////////////////////////////////////////////////////////
+static bool recordingReadString(
+	const char *&ptr,
+	const char *end,
+	EntryField &str)
+{
+	uint32_t len;
+
+	if ((size_t)(end - ptr) < sizeof(len)) {
+		return false;
+	}
+	memcpy(&len, ptr, sizeof(len));
+	ptr += sizeof(len);
+	if ((size_t)(end - ptr) < len) {
+		return false;
+	}
+
+	str = EntryField(ptr, len);
+	ptr += len;
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Reads the table of streams, which runs from the end of the
+//			header up to the first entry. The keys point into the segment
+//			s.t. entries can point their fields at them
+//
+////////////////////////////////////////////////////////////////////////////////
+bool StreamReplayer::readStreams(
+	const RecordingHeader &header)
+{
+	const char *ptr = segment + RECORDING_HEADER_SIZE;
+	const char *end = segment + header.data_start;
+
+	if (header.data_start < RECORDING_HEADER_SIZE) {
+		return false;
+	}
+
+	for (uint32_t i = 0; i < header.n_streams; ++i) {
+		EntryField element, stream, key;
+		uint32_t n_keys;
+
+		if (!recordingReadString(ptr, end, element) ||
+			!recordingReadString(ptr, end, stream) ||
+			((size_t)(end - ptr) < sizeof(n_keys)))
+		{
+			return false;
+		}
+		memcpy(&n_keys, ptr, sizeof(n_keys));
+		ptr += sizeof(n_keys);
+
+		streams.push_back(RecordedStream{ element.str(), stream.str(), {} });
+		keys.emplace_back();
+		for (uint32_t k = 0; k < n_keys; ++k) {
+			if (!recordingReadString(ptr, end, key)) {
+				return false;
+			}
+			streams.back().keys.push_back(key.str());
+			keys.back().push_back(key);
+		}
+	}
+
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Moves to the nth entry, or the end if there aren't that many
+//
+////////////////////////////////////////////////////////////////////////////////
+void StreamReplayer::seek(
+	size_t n)
+{
+	pos = std::min(n, n_entries);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Binary searches the index for the time. The index's times never
+//			go down, see RecordingIndexEntry
+//
+////////////////////////////////////////////////////////////////////////////////
+void StreamReplayer::seekTime(
+	int64_t time_ms)
+{
+	const RecordingIndexEntry *it = std::lower_bound(
+		index, index + n_entries, time_ms,
+		[](const RecordingIndexEntry &entry, int64_t t) {
+			return entry.time_ms < t;
+		});
+	pos = it - index;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Finds the first entry of the stream at or after the ID. Every
+//			entry before the first one with a time of at least the ID's can
+//			only have an earlier ID, so start there and look for the stream
+//
+////////////////////////////////////////////////////////////////////////////////
+bool StreamReplayer::seekID(
+	const std::string &element,
+	const std::string &stream,
+	const std::string &id)
+{
+	size_t s;
+	for (s = 0; s < streams.size(); ++s) {
+		if ((streams[s].element == element) && (streams[s].stream == stream)) {
+			break;
+		}
+	}
+
+	char *end;
+	uint64_t id_ms = strtoull(id.c_str(), &end, 10);
+	uint64_t id_seq = (*end == '-') ? strtoull(end + 1, NULL, 10) : 0;
+
+	if (s < streams.size()) {
+		for (seekTime(id_ms); pos < n_entries; ++pos) {
+			const RecordingIndexEntry &entry = index[pos];
+			if ((entry.stream == s) && ((entry.id_ms > id_ms) ||
+				((entry.id_ms == id_ms) && (entry.id_seq >= id_seq))))
+			{
+				return true;
+			}
+		}
+	}
+
+	pos = n_entries;
+	return false;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Reads the next entry, pointing its fields into the segment. An
+//			entry that doesn't fit in the segment or doesn't make sense is
+//			taken to be the end of the recording
+//
+////////////////////////////////////////////////////////////////////////////////
+bool StreamReplayer::next(
+	RecordedEntry &entry)
+{
+	if (pos >= n_entries) {
+		return false;
+	}
+
+	const RecordingHeader &seg = *(const RecordingHeader *)segment;
+	const RecordingIndexEntry &ie = index[pos];
+	uint64_t seg_end = std::min((uint64_t)segment_len, seg.data_start + seg.size);
+
+	if ((ie.stream >= streams.size()) || (ie.offset < seg.data_start) ||
+		(ie.len < sizeof(RecordHeader)) || (ie.offset + ie.len > seg_end))
+	{
+		pos = n_entries;
+		return false;
+	}
+
+	const char *ptr = segment + ie.offset;
+	const char *end = ptr + ie.len;
+	const RecordHeader *record = (const RecordHeader *)ptr;
+	const std::vector<EntryField> &stream_keys = keys[ie.stream];
+	ptr += sizeof(RecordHeader);
+
+	entry.stream = ie.stream;
+	entry.time_ms = ie.time_ms;
+	entry.id_ms = ie.id_ms;
+	entry.id_seq = ie.id_seq;
+	entry.fields.clear();
+	for (uint32_t i = 0; i < record->n_fields; ++i) {
+		const RecordField *field = (const RecordField *)ptr;
+		if (((size_t)(end - ptr) < sizeof(RecordField)) ||
+			(field->key >= stream_keys.size()) ||
+			((size_t)(end - ptr) - sizeof(RecordField) < field->len))
+		{
+			pos = n_entries;
+			return false;
+		}
+		entry.fields.emplace_back(stream_keys[field->key],
+			EntryField(ptr + sizeof(RecordField), field->len));
+		ptr += std::min((uint64_t)(end - ptr),
+			RECORDING_ALIGN(sizeof(RecordField) + field->len));
+	}
+
+	++pos;
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Reads the replies to the XADDs sent on each context. Returns
+//			ATOM_REDIS_ERROR if any of them failed
+//
+////////////////////////////////////////////////////////////////////////////////
+static enum atom_error_t recordingReplayFlush(
+	std::map<ContextPool *, std::pair<redisContext *, size_t>> &pending)
+{
+	enum atom_error_t ret = ATOM_NO_ERROR;
+
+	for (auto &x : pending) {
+		redisContext *ctx = x.second.first;
+		for (size_t i = 0; i < x.second.second; ++i) {
+			if (ctx->err || !redis_xadd_get_reply(ctx, NULL)) {
+				ret = ATOM_REDIS_ERROR;
+			}
+		}
+		x.second.second = 0;
+	}
+
+	return ret;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Replays the entries from here on. The XADDs are appended to a
+//			context on each stream's shard and the replies read a batch at a
+//			time, or before waiting for the next entry to be due when
+//			keeping to the original timing
+//
+////////////////////////////////////////////////////////////////////////////////
+enum atom_error_t StreamReplayer::replay(
+	Element &element,
+	double speed,
+	size_t max_entries,
+	int maxlen)
+{
+	std::vector<ContextPool *> pools;
+	std::vector<std::string> stream_keys;
+	for (auto const &stream : streams) {
+		char key[ATOM_NAME_MAXLEN];
+		atom_get_data_stream_str(stream.element.c_str(), stream.stream.c_str(),
+			key);
+		stream_keys.push_back(key);
+		pools.push_back(&element.getStreamPool(stream.element, stream.stream));
+	}
+
+	std::map<ContextPool *, std::pair<redisContext *, size_t>> pending;
+	std::vector<struct redis_xadd_info> items;
+	enum atom_error_t ret = ATOM_NO_ERROR;
+	RecordedEntry entry;
+	size_t n = 0;
+	size_t n_batch = 0;
+	int64_t first_ms = 0;
+	std::chrono::steady_clock::time_point start;
+
+	while (((max_entries == 0) || (n < max_entries)) && next(entry)) {
+
+		// Wait until the entry is due, sending what's ready first
+		if (speed > 0) {
+			if (n == 0) {
+				first_ms = entry.time_ms;
+				start = std::chrono::steady_clock::now();
+			}
+			std::chrono::steady_clock::time_point due = start +
+				std::chrono::microseconds(
+					(int64_t)((entry.time_ms - first_ms) * 1000 / speed));
+			if (due > std::chrono::steady_clock::now()) {
+				ret = recordingReplayFlush(pending);
+				n_batch = 0;
+				if (ret != ATOM_NO_ERROR) {
+					break;
+				}
+				std::this_thread::sleep_until(due);
+			}
+		}
+
+		items.resize(entry.fields.size());
+		for (size_t i = 0; i < entry.fields.size(); ++i) {
+			items[i].key = entry.fields[i].first.data();
+			items[i].key_len = entry.fields[i].first.size();
+			items[i].data = (const uint8_t *)entry.fields[i].second.data();
+			items[i].data_len = entry.fields[i].second.size();
+		}
+
+		std::pair<redisContext *, size_t> &p = pending[pools[entry.stream]];
+		if (p.first == NULL) {
+			try {
+				p.first = element.getContext(*pools[entry.stream]);
+			} catch (std::runtime_error &e) {
+				pending.erase(pools[entry.stream]);
+				ret = ATOM_REDIS_ERROR;
+				break;
+			}
+		}
+
+		if (!redis_xadd_append(p.first, stream_keys[entry.stream].c_str(),
+			items.data(), items.size(), maxlen, ATOM_DEFAULT_APPROX_MAXLEN))
+		{
+			ret = ATOM_REDIS_ERROR;
+			break;
+		}
+		++p.second;
+		++n;
+
+		if (++n_batch >= RECORDING_REPLAY_BATCH) {
+			ret = recordingReplayFlush(pending);
+			n_batch = 0;
+			if (ret != ATOM_NO_ERROR) {
+				break;
+			}
+		}
+	}
+
+	// Everything that was sent has to be read s.t. the contexts go back
+	//	to their pools in sync
+	if (recordingReplayFlush(pending) != ATOM_NO_ERROR) {
+		ret = ATOM_REDIS_ERROR;
+	}
+	for (auto const &x : pending) {
+		element.releaseContext(*x.first, x.second.first);
+	}
+
+	return ret;
+}
+
+} // namespace atom
@@ -0,0 +1,116 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @file stream_writer.cc
+//
+//  @brief Writer for streams whose keys are fixed at compile time
+//
+//  @copy 2018 Elementary Robotics. All rights reserved.
+//
+////////////////////////////////////////////////////////////////////////////////
+#include <stdexcept>
+
+#include "stream_writer.h"
+#include "element.h"
+
+namespace atom {
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Constructor. Builds the XADD with the keys in it and the values
+//			empty until they're bound
+//
+////////////////////////////////////////////////////////////////////////////////
+StreamWriterBase::StreamWriterBase(
+	Element &e,
+	const std::string &stream,
+	int maxlen,
+	const char *const *keys,
+	const size_t *key_lens,
+	size_t n_fields) :
+		element(e),
+		pool(e.openWriterStream(stream, stream_key)),
+		ctx(NULL)
+{
+	last_id[0] = '\0';
+
+	argv.resize(REDIS_XADD_N_HEADER_ARGS + 2 * n_fields);
+	argvlen.resize(argv.size());
+
+	n_header = redis_xadd_argv_header(stream_key, maxlen,
+		ATOM_DEFAULT_APPROX_MAXLEN, argv.data(), argvlen.data(), maxlen_buffer);
+
+	// The header might be shorter than the most it could be
+	argv.resize(n_header + 2 * n_fields);
+	argvlen.resize(argv.size());
+
+	for (size_t i = 0; i < n_fields; ++i) {
+		argv[n_header + 2 * i] = keys[i];
+		argvlen[n_header + 2 * i] = key_lens[i];
+		argv[n_header + 2 * i + 1] = "";
+		argvlen[n_header + 2 * i + 1] = 0;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Destructor. Gives back the context
+//
+////////////////////////////////////////////////////////////////////////////////
+StreamWriterBase::~StreamWriterBase()
+{
+	if (ctx != NULL) {
+		element.releaseContext(pool, ctx);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  @brief Writes an entry with the bound values. The context is kept from
+//			write to write, and given back s.t. the pool reconnects it if
+//			the connection broke
+//
+////////////////////////////////////////////////////////////////////////////////
+enum atom_error_t StreamWriterBase::write()
+{
+	if (ctx == NULL) {
+		ctx = element.getContext(pool);
+	}
+
+	// Readers would take values that look like descriptors for one, so
+	//	those are framed. That's rare, so only then are the arguments
+	//	copied, leaving the bound values alone
+	const char **send_argv = argv.data();
+	size_t *send_argvlen = argvlen.data();
+	std::vector<const char *> framed_argv;
+	std::vector<size_t> framed_argvlen;
+	std::vector<std::string> framed;
+	for (size_t i = n_header + 1; i < argv.size(); i += 2) {
+		if (!ShmDescriptor::isFramed(argv[i], argvlen[i])) {
+			continue;
+		}
+		if (framed_argv.empty()) {
+			framed_argv = argv;
+			framed_argvlen = argvlen;
+			framed.reserve((argv.size() - n_header) / 2);
+			send_argv = framed_argv.data();
+			send_argvlen = framed_argvlen.data();
+		}
+		framed.push_back(ShmDescriptor::frame(argv[i], argvlen[i]));
+		framed_argv[i] = framed.back().data();
+		framed_argvlen[i] = framed.back().size();
+	}
+
+	if (!redis_xadd_argv(ctx, argv.size(), send_argv, send_argvlen,
+		last_id))
+	{
+		if (ctx->err) {
+			element.releaseContext(pool, ctx);
+			ctx = NULL;
+		}
+		return ATOM_REDIS_ERROR;
+	}
+
+	return ATOM_NO_ERROR;
+}
+
+} // namespace atom
@@ -12,10 +12,12 @@
 #include <list>
 #include <hiredis/hiredis.h>
 #include <thread>
+#include <atomic>
 #include <unistd.h>
 #include <limits.h>
 #include "atom/atom.h"
 #include "atom/redis.h"
+#include "atom/metrics.h"
 #include "element.h"
 #include "element_response.h"
 #include "element_read_map.h"
@@ -197,6 +199,409 @@ TEST_F(ElementTest, multiple_entry_multiple_keys) {
 	}
 }
 
+// Tests reading entries back as views into the redis replies
+TEST_F(ElementTest, entry_views) {
+	entry_data_t data;
+	for (int i = 0; i < 5; ++i) {
+		data["hello"] = "world" + std::to_string(i);
+		data["foo"] = std::string("bar\0", 4) + std::to_string(i);
+		ASSERT_EQ(element->entryWrite("foobar", data), ATOM_NO_ERROR);
+	}
+
+	std::vector<EntryView> ret;
+	std::vector<std::string> keys = {"hello", "foo"};
+	ASSERT_EQ(element->entryReadN("testing", "foobar", keys, 5, ret), ATOM_NO_ERROR);
+	ASSERT_EQ(ret.size(), 5);
+
+	// The views need to hold up after the read has returned
+	for (int i = 0; i < 5; ++i) {
+		ASSERT_EQ(ret[i].size(), 2);
+		ASSERT_EQ(ret[i].hasKey("hello"), true);
+		ASSERT_EQ(ret[i].hasKey("nope"), false);
+		ASSERT_EQ(ret[i].getKey("hello"), "world" + std::to_string(4 - i));
+		ASSERT_EQ(ret[i].getKey("foo").size(), 5);
+		ASSERT_EQ(ret[i].getFields()[0].first, "hello");
+		ASSERT_THROW(ret[i].getKey("nope"), std::out_of_range);
+
+		// And the copying Entry should match
+		Entry e(ret[i]);
+		ASSERT_EQ(e.getID(), ret[i].getID());
+		ASSERT_EQ(e.getKey("hello"), ret[i].getKey("hello").str());
+	}
+
+	// Reading since the oldest should give them oldest first
+	std::vector<EntryView> since;
+	ASSERT_EQ(element->entryReadSince("testing", "foobar", keys, 5, since, "0"), ATOM_NO_ERROR);
+	ASSERT_EQ(since.size(), 5);
+	for (int i = 0; i < 5; ++i) {
+		ASSERT_EQ(since[i].getID(), ret[4 - i].getID());
+		ASSERT_EQ(since[i].getKey("hello"), "world" + std::to_string(i));
+	}
+}
+
+// Tests going through a stream a page at a time in both directions
+TEST_F(ElementTest, stream_range) {
+	entry_data_t data;
+	for (int i = 0; i < 25; ++i) {
+		data["value"] = std::to_string(i);
+		ASSERT_EQ(element->entryWrite("range", data,
+			ELEMENT_DATA_WRITE_DEFAULT_TIMESTAMP, 100), ATOM_NO_ERROR);
+	}
+	std::vector<std::string> keys = {"value"};
+
+	// Oldest first across several pages, the last of which is short
+	std::vector<std::string> ids;
+	StreamRangeIterator it;
+	ASSERT_EQ(element->entryRange("testing", "range", keys, it,
+		false, "", "", REDIS_RANGE_NO_LIMIT, 10), ATOM_NO_ERROR);
+	while (it.next()) {
+		ASSERT_EQ(it.get().getKey("value"), std::to_string(ids.size()));
+		ids.push_back(it.get().getID());
+	}
+	ASSERT_EQ(it.getError(), ATOM_NO_ERROR);
+	ASSERT_EQ(it.count(), 25);
+	ASSERT_EQ(ids.size(), 25);
+
+	// Newest first, limited, starting after an ID
+	ASSERT_EQ(element->entryRange("testing", "range", keys, it,
+		true, "(" + ids[20], "", 7, 3), ATOM_NO_ERROR);
+	for (int i = 19; i > 12; --i) {
+		ASSERT_EQ(it.next(), true);
+		ASSERT_EQ(it.get().getID(), ids[i]);
+	}
+	ASSERT_EQ(it.next(), false);
+	ASSERT_EQ(it.getError(), ATOM_NO_ERROR);
+
+	// Stopping partway through a range gives the context back
+	ASSERT_EQ(element->entryRange("testing", "range", keys, it,
+		false, ids[5], ids[15], REDIS_RANGE_NO_LIMIT, 2), ATOM_NO_ERROR);
+	ASSERT_EQ(it.next(), true);
+	ASSERT_EQ(it.get().getKey("value"), "5");
+	it.close();
+	ASSERT_EQ(it.next(), false);
+
+	// An empty stream has no entries
+	ASSERT_EQ(element->entryRange("testing", "nothing", keys, it), ATOM_NO_ERROR);
+	ASSERT_EQ(it.next(), false);
+	ASSERT_EQ(it.getError(), ATOM_NO_ERROR);
+
+	// And reading more than is there gives back what is there
+	std::vector<Entry> ret;
+	ASSERT_EQ(element->entryReadN("testing", "range", keys, 50, ret), ATOM_NO_ERROR);
+	ASSERT_EQ(ret.size(), 25);
+	ASSERT_EQ(ret[0].getKey("value"), "24");
+
+	ContextPoolStats stats = element->getContextPoolStats();
+	ASSERT_EQ(stats.n_in_use, 0);
+}
+
+// Tests that a prepared read can be done over and over, picking up where
+//	it left off
+TEST_F(ElementTest, prepared_read) {
+	entry_data_t data;
+	std::vector<std::string> keys = {"value"};
+	PreparedRead read;
+
+	ASSERT_EQ(read.isPrepared(), false);
+	data["value"] = "old";
+	ASSERT_EQ(element->entryWrite("prepared", data), ATOM_NO_ERROR);
+
+	// Entries from before the read was prepared aren't read since
+	ASSERT_EQ(element->prepareRead("testing", "prepared", keys, read), ATOM_NO_ERROR);
+	ASSERT_EQ(read.isPrepared(), true);
+
+	// The read starts after the server's time in ms, so let it tick over
+	//	before writing anything else
+	usleep(2000);
+	std::vector<Entry> since;
+	ASSERT_EQ(element->entryReadSince(read, 10, since), ATOM_NO_ERROR);
+	ASSERT_EQ(since.size(), 0);
+
+	// Each poll gets only what's been written since the last one
+	for (int round = 0; round < 3; ++round) {
+		for (int i = 0; i < 4; ++i) {
+			data["value"] = std::to_string(round * 4 + i);
+			ASSERT_EQ(element->entryWrite("prepared", data), ATOM_NO_ERROR);
+		}
+
+		since.clear();
+		ASSERT_EQ(element->entryReadSince(read, 10, since), ATOM_NO_ERROR);
+		ASSERT_EQ(since.size(), 4);
+		for (int i = 0; i < 4; ++i) {
+			ASSERT_EQ(since[i].getKey("value"), std::to_string(round * 4 + i));
+		}
+		ASSERT_EQ(read.getLastID(), since[3].getID());
+	}
+
+	// Reads of the newest entries, as views, don't move the last ID
+	std::string last_id = read.getLastID();
+	std::vector<EntryView> newest;
+	ASSERT_EQ(element->entryReadN(read, 2, newest), ATOM_NO_ERROR);
+	ASSERT_EQ(newest.size(), 2);
+	ASSERT_EQ(newest[0].getKey("value"), "11");
+	ASSERT_EQ(newest[1].getKey("value"), "10");
+	ASSERT_EQ(read.getLastID(), last_id);
+
+	// Going back to the start reads everything
+	read.setLastID("0");
+	std::vector<EntryView> all;
+	ASSERT_EQ(element->entryReadSince(read, 100, all), ATOM_NO_ERROR);
+	ASSERT_EQ(all.size(), 13);
+	ASSERT_EQ(all[0].getKey("value"), "old");
+
+	read.close();
+	ASSERT_EQ(read.isPrepared(), false);
+	ASSERT_EQ(element->entryReadSince(read, 10, since), ATOM_INTERNAL_ERROR);
+
+	ContextPoolStats stats = element->getContextPoolStats();
+	ASSERT_EQ(stats.n_in_use, 0);
+}
+
+// Tests that large values go through shared memory and read back from it
+TEST_F(ElementTest, shm_entries) {
+	element->useSharedMemory("shm", 1024 * 1024, 1024);
+
+	entry_data_t data;
+	data["small"] = "hello";
+	data["large"] = std::string(64 * 1024, 'a');
+	data["large"][100] = '\0';
+	ASSERT_EQ(element->entryWrite("shm", data), ATOM_NO_ERROR);
+
+	// Only the small value should actually be in redis
+	std::vector<Entry> raw;
+	std::vector<std::string> keys = {"small", "large"};
+	ASSERT_EQ(element->entryReadN("testing", "shm", keys, 1, raw), ATOM_NO_ERROR);
+	ASSERT_EQ(raw.size(), 1);
+	ASSERT_EQ(raw[0].getKey("small"), "hello");
+	ASSERT_EQ(raw[0].getKey("large"), data["large"]);
+
+	std::vector<EntryView> views;
+	ASSERT_EQ(element->entryReadN("testing", "shm", keys, 1, views), ATOM_NO_ERROR);
+	ASSERT_EQ(views.size(), 1);
+	ASSERT_EQ(views[0].getKey("small"), "hello");
+	ASSERT_EQ(views[0].getKey("large"), data["large"]);
+	ASSERT_EQ(views[0].isValid(), true);
+
+	// Going around the ring overwrites the value the view points at
+	for (int i = 0; i < 20; ++i) {
+		ASSERT_EQ(element->entryWrite("shm", data), ATOM_NO_ERROR);
+	}
+	ASSERT_EQ(views[0].isValid(), false);
+
+	// A descriptor we can't resolve is treated as a missing key
+	ShmDescriptor desc;
+	desc.segment = "/atom.testing.nope";
+	desc.pos = 0;
+	desc.len = 10;
+	desc.gen = 0;
+	desc.host = shmHostID();
+	const char *ptr;
+	ASSERT_EQ(ShmSegment::resolve(desc, ptr), nullptr);
+	desc.host = "elsewhere";
+	ASSERT_EQ(ShmSegment::resolve(desc, ptr), nullptr);
+}
+
+// Tests that values that happen to look like descriptors read back as
+//	they were written, with and without shared memory on the stream
+TEST_F(ElementTest, shm_framed_values) {
+	element->useSharedMemory("shm", 1024 * 1024, 1024);
+
+	entry_data_t data;
+	data["fake"] = std::string(SHM_DESCRIPTOR_PREFIX, SHM_DESCRIPTOR_PREFIX_LEN) +
+		std::string(1, '\0') + "/atom.testing.nope";
+	data["large"] = data["fake"] + std::string(64 * 1024, 'a');
+	ASSERT_EQ(element->entryWrite("shm", data), ATOM_NO_ERROR);
+	ASSERT_EQ(element->entryWrite("plain", data), ATOM_NO_ERROR);
+
+	std::vector<std::string> keys = {"fake", "large"};
+	for (auto const &stream : {"shm", "plain"}) {
+		std::vector<Entry> raw;
+		ASSERT_EQ(element->entryReadN("testing", stream, keys, 1, raw), ATOM_NO_ERROR);
+		ASSERT_EQ(raw.size(), 1);
+		ASSERT_EQ(raw[0].getKey("fake"), data["fake"]);
+		ASSERT_EQ(raw[0].getKey("large"), data["large"]);
+
+		std::vector<EntryView> views;
+		ASSERT_EQ(element->entryReadN("testing", stream, keys, 1, views), ATOM_NO_ERROR);
+		ASSERT_EQ(views.size(), 1);
+		ASSERT_EQ(views[0].getKey("fake"), data["fake"]);
+		ASSERT_EQ(views[0].getKey("large"), data["large"]);
+	}
+}
+
+// Field for the StreamWriter framing test
+ATOM_STREAM_FIELD(FakeDescriptor, "fake");
+
+// Tests that values bound to a StreamWriter that look like descriptors read
+//	back as they were written
+TEST_F(ElementTest, stream_writer_framed_values) {
+	StreamWriter<FakeDescriptor> writer(*element, "framed");
+
+	std::string fake = std::string(SHM_DESCRIPTOR_PREFIX, SHM_DESCRIPTOR_PREFIX_LEN) +
+		std::string(1, '\0') + "/atom.testing.nope";
+	ASSERT_EQ(writer.write(fake), ATOM_NO_ERROR);
+	ASSERT_EQ(writer.write("plain"), ATOM_NO_ERROR);
+
+	std::vector<Entry> ret;
+	std::vector<std::string> keys = {"fake"};
+	ASSERT_EQ(element->entryReadN("testing", "framed", keys, 2, ret), ATOM_NO_ERROR);
+	ASSERT_EQ(ret.size(), 2);
+	ASSERT_EQ(ret[0].getKey("fake"), "plain");
+	ASSERT_EQ(ret[1].getKey("fake"), fake);
+}
+
+// Tests that compressed values are tagged and read back transparently
+TEST_F(ElementTest, compressed_entries) {
+	enum codec_type codec = codec_available(CODEC_LZ4) ? CODEC_LZ4 :
+		(codec_available(CODEC_ZSTD) ? CODEC_ZSTD : CODEC_NONE);
+	if (codec == CODEC_NONE) {
+		ASSERT_THROW(element->useCompression("cmp", CODEC_LZ4), std::runtime_error);
+		return;
+	}
+	element->useCompression("cmp", codec, 1024);
+
+	// The small value that looks like a frame has to survive as-is
+	entry_data_t data;
+	data["small"] = std::string(CODEC_FRAME_MAGIC) + "hi";
+	data["large"] = std::string(64 * 1024, 'a');
+	data["large"][100] = '\0';
+	ASSERT_EQ(element->entryWrite("cmp", data), ATOM_NO_ERROR);
+
+	// In redis the large value is smaller and the entry has the codec
+	redisContext *ctx = redis_context_init();
+	redisReply *reply = (redisReply *)redisCommand(ctx,
+		"XREVRANGE stream:testing:cmp + - COUNT 1");
+	ASSERT_EQ(reply->type, REDIS_REPLY_ARRAY);
+	ASSERT_EQ(reply->elements, 1);
+	redisReply *fields = reply->element[0]->element[1];
+	bool tagged = false;
+	for (size_t i = 0; i < fields->elements; i += 2) {
+		std::string key(fields->element[i]->str, fields->element[i]->len);
+		if (key == CODEC_KEY_STR) {
+			tagged = true;
+			ASSERT_STREQ(fields->element[i + 1]->str, codec_name(codec));
+		} else if (key == "large") {
+			ASSERT_LT(fields->element[i + 1]->len, data["large"].size());
+		}
+	}
+	ASSERT_EQ(tagged, true);
+	freeReplyObject(reply);
+	redis_context_cleanup(ctx);
+
+	std::vector<std::string> keys = {"small", "large"};
+	std::vector<Entry> entries;
+	ASSERT_EQ(element->entryReadN("testing", "cmp", keys, 1, entries), ATOM_NO_ERROR);
+	ASSERT_EQ(entries.size(), 1);
+	ASSERT_EQ(entries[0].getKey("small"), data["small"]);
+	ASSERT_EQ(entries[0].getKey("large"), data["large"]);
+
+	std::vector<EntryView> views;
+	ASSERT_EQ(element->entryReadN("testing", "cmp", keys, 1, views), ATOM_NO_ERROR);
+	ASSERT_EQ(views.size(), 1);
+	ASSERT_EQ(views[0].getKey("small"), data["small"]);
+	ASSERT_EQ(views[0].getKey("large"), data["large"]);
+
+	// Entries with nothing big enough aren't tagged
+	entry_data_t small;
+	small["small"] = "hello";
+	small["large"] = "world";
+	ASSERT_EQ(element->entryWrite("cmp", small), ATOM_NO_ERROR);
+	entries.clear();
+	ASSERT_EQ(element->entryReadN("testing", "cmp", keys, 1, entries), ATOM_NO_ERROR);
+	ASSERT_EQ(entries[0].getKey("large"), "world");
+}
+
+// Tests that an entry with a codec key of its own reads back as written,
+//	whether or not its stream is compressed
+TEST_F(ElementTest, codec_key_in_entry) {
+	enum codec_type codec = codec_available(CODEC_LZ4) ? CODEC_LZ4 :
+		(codec_available(CODEC_ZSTD) ? CODEC_ZSTD : CODEC_NONE);
+	if (codec != CODEC_NONE) {
+		element->useCompression("cmp", codec, 1024);
+	}
+
+	entry_data_t data;
+	data[CODEC_KEY_STR] = "foo";
+	data["large"] = std::string(64 * 1024, 'a');
+	ASSERT_EQ(element->entryWrite("cmp", data), ATOM_NO_ERROR);
+	ASSERT_EQ(element->entryWrite("plain", data), ATOM_NO_ERROR);
+
+	std::vector<std::string> keys = {CODEC_KEY_STR, "large"};
+	for (auto const &stream : {"cmp", "plain"}) {
+		std::vector<Entry> entries;
+		ASSERT_EQ(element->entryReadN("testing", stream, keys, 1, entries), ATOM_NO_ERROR);
+		ASSERT_EQ(entries.size(), 1);
+		ASSERT_EQ(entries[0].getKey(CODEC_KEY_STR), "foo");
+		ASSERT_EQ(entries[0].getKey("large"), data["large"]);
+	}
+}
+
+// Tests making references from a stream, reading and deleting them
+TEST_F(ElementTest, stream_references) {
+	entry_data_t data;
+	data["hello"] = "world";
+	data["foo"] = std::string("bar\0baz", 7);
+	ASSERT_EQ(element->entryWrite("refs", data), ATOM_NO_ERROR);
+
+	// Do it twice s.t. the second one uses the cached script
+	std::map<std::string, std::string> refs;
+	for (int i = 0; i < 2; ++i) {
+		ASSERT_EQ(element->referenceCreateFromStream("testing", "refs", refs), ATOM_NO_ERROR);
+		ASSERT_EQ(refs.size(), 2);
+	}
+	ASSERT_NE(refs.find("hello"), refs.end());
+	ASSERT_NE(refs.find("foo"), refs.end());
+
+	std::vector<std::string> keys = {refs["hello"], refs["foo"], "reference:testing:nope"};
+	ReferenceView view;
+	ASSERT_EQ(element->referenceGet(keys, view), ATOM_NO_ERROR);
+	ASSERT_EQ(view.size(), 3);
+	ASSERT_EQ(view.getValue(0), "world");
+	ASSERT_EQ(view.getValue(1), data["foo"]);
+	ASSERT_EQ(view.hasValue(2), false);
+	ASSERT_THROW(view.getValue(2), std::out_of_range);
+
+	size_t n_deleted;
+	ASSERT_EQ(element->referenceDelete(keys, &n_deleted), ATOM_NO_ERROR);
+	ASSERT_EQ(n_deleted, 2);
+	ASSERT_EQ(element->referenceGet(keys, view), ATOM_NO_ERROR);
+	ASSERT_EQ(view.hasValue(0), false);
+
+	// No entry to make a reference from
+	ASSERT_NE(element->referenceCreateFromStream("testing", "refs", refs, "1-1"), ATOM_NO_ERROR);
+}
+
+// Tests that timings make it to the metrics redis. Only runs when metrics
+//	are turned on, i.e. ATOM_USE_METRICS is TRUE
+TEST_F(ElementTest, metrics) {
+	if (!metrics_enabled()) {
+		return;
+	}
+
+	entry_data_t data;
+	data["hello"] = "world";
+	for (int i = 0; i < 10; ++i) {
+		ASSERT_EQ(element->entryWrite("metrics", data), ATOM_NO_ERROR);
+	}
+	metrics_flush();
+
+	// Anything recorded before the last flush may have been written by the
+	//	flusher already, so add up all of the samples
+	redisContext *ctx = redis_context_init_local(METRICS_DEFAULT_SOCKET);
+	ASSERT_NE(ctx, (redisContext*)NULL);
+	redisReply *reply = (redisReply *)redisCommand(ctx,
+		"TS.RANGE testing:atom:redis_xadd:count - +");
+	ASSERT_NE(reply, (redisReply*)NULL);
+	ASSERT_EQ(reply->type, REDIS_REPLY_ARRAY);
+	long long count = 0;
+	for (size_t i = 0; i < reply->elements; ++i) {
+		count += atoll(reply->element[i]->element[1]->str);
+	}
+	ASSERT_GE(count, 10);
+	freeReplyObject(reply);
+	redis_context_cleanup(ctx);
+}
+
 // Tests writing data to multiple streams
 TEST_F(ElementTest, multiple_streams) {
 
@@ -241,6 +646,360 @@ TEST_F(ElementTest, multiple_streams) {
 	ASSERT_EQ(ret2[0].getKey("foo"), "bar");
 }
 
+// Tests writing a batch of entries across multiple streams
+TEST_F(ElementTest, batch_write) {
+
+	StreamBatch batch;
+	for (int i = 0; i < 10; ++i) {
+		entry_data_t data;
+		data["value"] = std::to_string(i);
+		ASSERT_EQ(batch.add((i & 0x1) ? "odd" : "even", data), i);
+	}
+	ASSERT_EQ(batch.size(), 10);
+
+	ASSERT_EQ(element->entryWriteBatch(batch), ATOM_NO_ERROR);
+
+	// Each entry should have an ID and IDs on the same stream
+	//	should be increasing
+	for (int i = 0; i < 10; ++i) {
+		ASSERT_EQ(batch.getError(i), ATOM_NO_ERROR);
+		ASSERT_NE(batch.getID(i), "");
+	}
+	ASSERT_NE(batch.getID(0), batch.getID(2));
+
+	// Read back the entries on each stream, newest first
+	std::vector<std::string> keys = {"value"};
+	std::vector<Entry> even;
+	ASSERT_EQ(element->entryReadN(
+		"testing",
+		"even",
+		keys,
+		5,
+		even), ATOM_NO_ERROR);
+	std::vector<Entry> odd;
+	ASSERT_EQ(element->entryReadN(
+		"testing",
+		"odd",
+		keys,
+		5,
+		odd), ATOM_NO_ERROR);
+
+	ASSERT_EQ(even.size(), 5);
+	ASSERT_EQ(odd.size(), 5);
+	for (int i = 0; i < 5; ++i) {
+		ASSERT_EQ(even[i].getKey("value"), std::to_string(8 - 2 * i));
+		ASSERT_EQ(even[i].getID(), batch.getID(8 - 2 * i));
+		ASSERT_EQ(odd[i].getKey("value"), std::to_string(9 - 2 * i));
+	}
+}
+
+// Tests using more threads than the context pool can hold. Threads should
+//	wait for contexts rather than fail
+TEST_F(ElementTest, context_pool_growth) {
+	Element small("small_pool", 1, 2);
+
+	std::vector<std::thread> threads;
+	for (int i = 0; i < 8; ++i) {
+		threads.push_back(std::thread([&small, i]() {
+			for (int j = 0; j < 20; ++j) {
+				entry_data_t data;
+				data["value"] = std::to_string(j);
+				ASSERT_EQ(small.entryWrite("thread_" + std::to_string(i), data), ATOM_NO_ERROR);
+			}
+		}));
+	}
+	for (auto &t : threads) {
+		t.join();
+	}
+
+	ContextPoolStats stats = small.getContextPoolStats();
+	ASSERT_EQ(stats.max_contexts, 2);
+	ASSERT_LE(stats.n_contexts, 2);
+	ASSERT_LE(stats.peak_in_use, 2);
+	ASSERT_EQ(stats.n_in_use, 0);
+	ASSERT_EQ(stats.n_timeouts, 0);
+	ASSERT_GE(stats.n_acquires, 8 * 20);
+}
+
+// Tests that the discovery cache sees elements and streams come and go
+TEST_F(ElementTest, discovery_cache) {
+	element->useDiscoveryCache();
+
+	entry_data_t data;
+	data["hello"] = "world";
+	ASSERT_EQ(element->entryWrite("a", data), ATOM_NO_ERROR);
+
+	std::vector<std::string> stream_list;
+	ASSERT_EQ(element->getAllStreams(stream_list, "testing"), ATOM_NO_ERROR);
+	ASSERT_EQ(stream_list, std::vector<std::string>({"a"}));
+
+	ASSERT_EQ(element->entryWrite("b", data), ATOM_NO_ERROR);
+	stream_list.clear();
+	ASSERT_EQ(element->getAllStreams(stream_list, "testing"), ATOM_NO_ERROR);
+	ASSERT_EQ(stream_list, std::vector<std::string>({"a", "b"}));
+
+	std::vector<std::string> elements;
+	{
+		Element other("other");
+		ASSERT_EQ(element->getAllElements(elements), ATOM_NO_ERROR);
+		ASSERT_EQ(elements, std::vector<std::string>({"other", "testing"}));
+	}
+	elements.clear();
+	ASSERT_EQ(element->getAllElements(elements), ATOM_NO_ERROR);
+	ASSERT_EQ(elements, std::vector<std::string>({"testing"}));
+}
+
+// Fields for the StreamWriter test
+ATOM_STREAM_FIELD(JointPosition, "position");
+ATOM_STREAM_FIELD(JointVelocity, "velocity");
+
+// Tests writing a stream with a StreamWriter, both passing the values and
+//	binding them
+TEST_F(ElementTest, stream_writer) {
+	StreamWriter<JointPosition, JointVelocity> writer(*element, "joints");
+
+	std::string position = "1.0";
+	ASSERT_EQ(writer.write(position, "2.0"), ATOM_NO_ERROR);
+	std::string first_id = writer.getID();
+
+	std::array<char, 3> velocity = {{'4', '.', '0'}};
+	position = "3.0";
+	writer.bind(position, velocity);
+	ASSERT_EQ(writer.write(), ATOM_NO_ERROR);
+	ASSERT_NE(first_id, std::string(writer.getID()));
+
+	std::vector<Entry> ret;
+	std::vector<std::string> keys = {"position", "velocity"};
+	ASSERT_EQ(element->entryReadN("testing", "joints", keys, 2, ret), ATOM_NO_ERROR);
+	ASSERT_EQ(ret.size(), 2);
+	ASSERT_EQ(ret[0].getKey("position"), "3.0");
+	ASSERT_EQ(ret[0].getKey("velocity"), "4.0");
+	ASSERT_EQ(ret[1].getKey("position"), "1.0");
+	ASSERT_EQ(ret[1].getKey("velocity"), "2.0");
+
+	std::vector<std::string> stream_list;
+	ASSERT_EQ(element->getAllStreams(stream_list, "testing"), ATOM_NO_ERROR);
+	ASSERT_EQ(stream_list, std::vector<std::string>({"joints"}));
+}
+
+// Tests that a byte budget trims the stream to about as many entries as fit
+//	in it. Trims are approximate, so it only has to get close
+TEST_F(ElementTest, retention_bytes) {
+	entry_data_t data;
+	data["value"] = std::string(1000, 'x');
+	element->useRetention("retention", RetentionPolicy::bytes(200 * 1005));
+
+	for (int i = 0; i < 1000; ++i) {
+		ASSERT_EQ(element->entryWrite("retention", data), ATOM_NO_ERROR);
+	}
+
+	std::vector<Entry> ret;
+	std::vector<std::string> keys = {"value"};
+	ASSERT_EQ(element->entryReadN("testing", "retention", keys, 1000, ret), ATOM_NO_ERROR);
+	ASSERT_GE(ret.size(), 200);
+	ASSERT_LT(ret.size(), 1000);
+}
+
+// Tests that a time window goes by the server's clock, learned from the IDs
+//	of the entries written, and doesn't trim until it knows it
+TEST_F(ElementTest, retention_time_clock) {
+	struct element_retention retention;
+	retention.type = ELEMENT_RETENTION_TIME;
+	retention.max_age_ms = 1000;
+	retention.deferred = false;
+	retention.clock_offset_ms = 0;
+	retention.clock_known = false;
+
+	struct redis_trim trim;
+	ASSERT_EQ(element_retention_ready(&retention), false);
+	element_retention_get_trim(&retention, &trim);
+	ASSERT_EQ(trim.type, REDIS_TRIM_NONE);
+
+	// A server an hour behind us
+	int64_t server_ms = atom_time_ms() - 3600 * 1000;
+	std::string id = std::to_string(server_ms) + "-0";
+	element_retention_note_id(&retention, id.c_str());
+	ASSERT_EQ(element_retention_ready(&retention), true);
+	element_retention_get_trim(&retention, &trim);
+	ASSERT_EQ(trim.type, REDIS_TRIM_MINID);
+	ASSERT_GE(trim.threshold, server_ms - 1000);
+	ASSERT_LT(trim.threshold, server_ms);
+
+	// And writes with the window keep what's in it
+	element->useRetention("aged", RetentionPolicy::time(60000));
+	entry_data_t data;
+	data["value"] = "x";
+	for (int i = 0; i < 10; ++i) {
+		ASSERT_EQ(element->entryWrite("aged", data), ATOM_NO_ERROR);
+	}
+	std::vector<Entry> ret;
+	std::vector<std::string> keys = {"value"};
+	ASSERT_EQ(element->entryReadN("testing", "aged", keys, 10, ret), ATOM_NO_ERROR);
+	ASSERT_EQ(ret.size(), 10);
+}
+
+// Tests that a deferred policy leaves the writes alone and the stream is
+//	trimmed by the trim thread
+TEST_F(ElementTest, retention_deferred) {
+	entry_data_t data;
+	data["value"] = "x";
+	element->useRetention("deferred", RetentionPolicy::count(100, true));
+
+	for (int i = 0; i < 1000; ++i) {
+		ASSERT_EQ(element->entryWrite("deferred", data), ATOM_NO_ERROR);
+	}
+
+	std::vector<Entry> ret;
+	std::vector<std::string> keys = {"value"};
+	ASSERT_EQ(element->entryReadN("testing", "deferred", keys, 1000, ret), ATOM_NO_ERROR);
+	ASSERT_EQ(ret.size(), 1000);
+
+	std::this_thread::sleep_for(
+		std::chrono::milliseconds(2 * ELEMENT_RETENTION_TRIM_PERIOD_MS));
+
+	ret.clear();
+	ASSERT_EQ(element->entryReadN("testing", "deferred", keys, 1000, ret), ATOM_NO_ERROR);
+	ASSERT_GE(ret.size(), 100);
+	ASSERT_LT(ret.size(), 1000);
+}
+
+// Tests recording a stream, reading the recording back, seeking in it and
+//	replaying it onto the stream
+TEST_F(ElementTest, stream_recording) {
+	std::string path = "/tmp/atom_test_recording";
+	std::vector<std::string> keys = {"a", "b"};
+
+	for (int i = 0; i < 10; ++i) {
+		entry_data_t data;
+		data["a"] = std::to_string(i);
+		data["b"] = std::string(i, 'b');
+		ASSERT_EQ(element->entryWrite("recorded", data), ATOM_NO_ERROR);
+	}
+
+	std::vector<EntryView> views;
+	ASSERT_EQ(element->entryReadN("testing", "recorded", keys, 10, views), ATOM_NO_ERROR);
+	ASSERT_EQ(views.size(), 10);
+	{
+		StreamRecorder recorder(path, {{"testing", "recorded", keys}});
+		for (auto it = views.rbegin(); it != views.rend(); ++it) {
+			ASSERT_TRUE(recorder.record(0, *it));
+		}
+		ASSERT_FALSE(recorder.record(1, views[0]));
+		ASSERT_EQ(recorder.size(), 10);
+	}
+
+	StreamReplayer replayer(path);
+	ASSERT_EQ(replayer.size(), 10);
+	ASSERT_EQ(replayer.getStreams().size(), 1);
+	ASSERT_EQ(replayer.getStreams()[0].keys, keys);
+
+	RecordedEntry entry;
+	for (int i = 0; i < 10; ++i) {
+		ASSERT_TRUE(replayer.next(entry));
+		ASSERT_EQ(entry.stream, 0);
+		ASSERT_EQ(entry.fields.size(), 2);
+		ASSERT_TRUE(entry.fields[0].first == "a");
+		ASSERT_EQ(entry.fields[0].second.str(), std::to_string(i));
+		ASSERT_EQ(entry.fields[1].second.str(), std::string(i, 'b'));
+	}
+	ASSERT_FALSE(replayer.next(entry));
+
+	ASSERT_TRUE(replayer.seekID("testing", "recorded", views[4].getID()));
+	ASSERT_EQ(replayer.tell(), 5);
+	ASSERT_FALSE(replayer.seekID("testing", "missing", views[4].getID()));
+
+	replayer.seek(0);
+	ASSERT_EQ(replayer.replay(*element), ATOM_NO_ERROR);
+	ASSERT_EQ(replayer.tell(), 10);
+
+	std::vector<Entry> ret;
+	ASSERT_EQ(element->entryReadN("testing", "recorded", keys, 20, ret), ATOM_NO_ERROR);
+	ASSERT_EQ(ret.size(), 20);
+	ASSERT_EQ(ret[0].getKey("a"), "9");
+	ASSERT_EQ(ret[9].getKey("a"), "0");
+
+	unlink(path.c_str());
+	unlink((path + RECORDING_INDEX_SUFFIX).c_str());
+}
+
+// Value for the StreamReader test
+struct Pose {
+	double x;
+	std::vector<int> joints;
+	std::string name;
+};
+
+// Sums the x of the poses it gets
+bool pose_fn(
+	Pose &value,
+	EntryView &e,
+	void *user_data)
+{
+	*(double *)user_data += value.x;
+	return true;
+}
+
+// Packs a value with msgpack
+template <typename T>
+std::string pack_value(
+	const T &value)
+{
+	msgpack::sbuffer buffer;
+	msgpack::pack(buffer, value);
+	return std::string(buffer.data(), buffer.size());
+}
+
+// Tests decoding entries with a StreamReader, including one that's
+//	missing a key and one of the wrong type
+TEST_F(ElementTest, stream_reader) {
+	entry_data_t data;
+	data["x"] = pack_value(1.5);
+	data["joints"] = pack_value(std::vector<int>({1, 2, 3}));
+	data["name"] = pack_value(std::string("arm"));
+	data["other"] = "ignored";
+	ASSERT_EQ(element->entryWrite("pose", data), ATOM_NO_ERROR);
+
+	data.erase("joints");
+	data["x"] = pack_value(2.5);
+	ASSERT_EQ(element->entryWrite("pose", data), ATOM_NO_ERROR);
+
+	double sum = 0;
+	StreamReader<Pose> reader(pose_fn, &sum);
+	reader.field("x", &Pose::x).field("joints", &Pose::joints).field("name", &Pose::name);
+	ASSERT_EQ(reader.getKeys(), std::vector<std::string>({"x", "joints", "name"}));
+
+	std::vector<std::string> keys = reader.getKeys();
+	std::vector<EntryView> views;
+	ASSERT_EQ(element->entryReadN("testing", "pose", keys, 2, views), ATOM_NO_ERROR);
+	ASSERT_EQ(views.size(), 2);
+
+	// Oldest first s.t. the second entry keeps the first one's joints
+	ASSERT_TRUE(StreamReader<Pose>::viewCB(views[1], &reader));
+	ASSERT_EQ(reader.get().x, 1.5);
+	ASSERT_EQ(reader.get().joints, std::vector<int>({1, 2, 3}));
+	ASSERT_EQ(reader.get().name, "arm");
+
+	ASSERT_TRUE(StreamReader<Pose>::viewCB(views[0], &reader));
+	ASSERT_EQ(reader.get().x, 2.5);
+	ASSERT_EQ(reader.get().joints, std::vector<int>({1, 2, 3}));
+	ASSERT_EQ(sum, 4.0);
+	ASSERT_EQ(reader.getNumErrors(), 0);
+
+	// A value of the wrong type is counted and doesn't get to the handler
+	data["x"] = pack_value(std::string("not a number"));
+	ASSERT_EQ(element->entryWrite("pose", data), ATOM_NO_ERROR);
+	views.clear();
+	ASSERT_EQ(element->entryReadN("testing", "pose", keys, 1, views), ATOM_NO_ERROR);
+	ASSERT_TRUE(StreamReader<Pose>::viewCB(views[0], &reader));
+	ASSERT_EQ(reader.getNumErrors(), 1);
+	ASSERT_EQ(sum, 4.0);
+
+	// And the read map reads only the bound keys
+	ElementReadMap m;
+	m.addTypedHandler("testing", "pose", reader);
+	ASSERT_EQ(std::get<2>(m.getHandler(0)), keys);
+}
+
 // Tests getAllStreams
 TEST_F(ElementTest, get_all_streams_single_element_all_streams) {
 
@@ -461,6 +1220,20 @@ public:
 	}
 };
 
+// Appends the request to the response. The response should only ever
+//	hold the request of the current call
+class MsgpackAppend : public CommandMsgpack<std::string, std::vector<std::string>> {
+public:
+	using CommandMsgpack<std::string, std::vector<std::string>>::CommandMsgpack;
+
+	virtual bool validate() { return true; }
+
+	virtual bool run() {
+		res_data->push_back(*req_data);
+		return true;
+	}
+};
+
 class MsgpackNoReqNoRes : public CommandMsgpack<std::nullptr_t, std::nullptr_t> {
 public:
 	using CommandMsgpack<std::nullptr_t, std::nullptr_t>::CommandMsgpack;
@@ -496,6 +1269,604 @@ void* command_element(void *data)
 	return NULL;
 }
 
+// Number of commands handled by the counting command element
+std::atomic<int> n_handled_commands;
+
+bool count_hello_callback_fn(
+	const uint8_t *data,
+	size_t data_len,
+	ElementResponse *resp,
+	void *user_data)
+{
+	resp->setData("world");
+	n_handled_commands++;
+	return true;
+}
+
+bool count_err_str_callback_fn(
+	const uint8_t *data,
+	size_t data_len,
+	ElementResponse *resp,
+	void *user_data)
+{
+	resp->setError(2, "this is an error!");
+	n_handled_commands++;
+	return true;
+}
+
+// Thread that creates a command element which handles the number of
+//	commands passed. A single read of the command stream may get multiple
+//	commands so keep reading until we've handled them all
+void* command_element_n(void *data)
+{
+	int n_commands = *(int*)data;
+
+	Element elem("test_cmd");
+	elem.addCommand("hello", "hello, world", count_hello_callback_fn, NULL, 1000);
+	elem.addCommand("test_err_str", "tests an error string", count_err_str_callback_fn, NULL, 1000);
+
+	while (n_handled_commands < n_commands) {
+		elem.commandLoop(1);
+	}
+	return NULL;
+}
+
+// Waits until the element shows up in the system
+void wait_for_element(
+	Element *element,
+	std::string name)
+{
+	while (true) {
+		std::vector<std::string> elements;
+		ASSERT_EQ(element->getAllElements(elements), ATOM_NO_ERROR);
+		if (std::find(elements.begin(), elements.end(), name) != elements.end()) {
+			break;
+		}
+		usleep(100000);
+	}
+}
+
+// Callback for asynchronous commands. Counts the responses
+void async_response_fn(
+	ElementResponse &response,
+	void *user_data)
+{
+	std::pair<std::mutex, int> *count = (std::pair<std::mutex, int> *)user_data;
+	std::lock_guard<std::mutex> lock(count->first);
+	if (!response.isError() && (response.getData() == "world")) {
+		count->second += 1;
+	}
+}
+
+// Tests sending a command to many elements at once, one of which isn't
+//	around to answer
+TEST_F(ElementTest, command_multi) {
+	int n_total = 2;
+	n_handled_commands = 0;
+	pthread_t cmd_thread;
+	ASSERT_EQ(pthread_create(&cmd_thread, NULL, command_element_n, &n_total), 0);
+	wait_for_element(element, "test_cmd");
+
+	std::vector<ElementResponse> responses;
+	auto start = std::chrono::steady_clock::now();
+	ASSERT_EQ(element->sendCommandMulti(responses, {"test_cmd", "test_missing", "test_cmd"}, "hello", NULL, 0, atom_deadline_ms(500)), ATOM_COMMAND_NO_ACK);
+	ASSERT_LT(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(1000));
+
+	ASSERT_EQ(responses.size(), 3);
+	ASSERT_EQ(responses[0].isError(), false);
+	ASSERT_EQ(responses[0].getData(), "world");
+	ASSERT_EQ(responses[1].getError(), ATOM_COMMAND_NO_ACK);
+	ASSERT_EQ(responses[2].isError(), false);
+	ASSERT_EQ(responses[2].getData(), "world");
+
+	void *ret;
+	ASSERT_EQ(pthread_join(cmd_thread, &ret), 0);
+	ASSERT_EQ(n_handled_commands, 2);
+}
+
+// Tests sending many commands at once without waiting for each one
+TEST_F(ElementTest, async_commands) {
+	int n_commands = 10;
+
+	// Start the command thread. One extra for the error command and one
+	//	extra for the callback command
+	int n_total = n_commands + 2;
+	n_handled_commands = 0;
+	pthread_t cmd_thread;
+	ASSERT_EQ(pthread_create(&cmd_thread, NULL, command_element_n, &n_total), 0);
+	wait_for_element(element, "test_cmd");
+
+	// Send all of the commands before waiting on any of them
+	std::vector<std::future<ElementResponse>> futures;
+	for (int i = 0; i < n_commands; ++i) {
+		futures.push_back(element->sendCommandAsync("test_cmd", "hello", NULL, 0));
+	}
+	std::future<ElementResponse> err_future = element->sendCommandAsync(
+		"test_cmd", "test_err_str", NULL, 0);
+
+	std::pair<std::mutex, int> count;
+	count.second = 0;
+	ASSERT_EQ(element->sendCommandAsync("test_cmd", "hello", NULL, 0,
+		async_response_fn, &count), ATOM_NO_ERROR);
+
+	for (auto &f : futures) {
+		ElementResponse resp = f.get();
+		ASSERT_EQ(resp.isError(), false);
+		ASSERT_EQ(resp.getData(), "world");
+	}
+
+	ElementResponse err_resp = err_future.get();
+	ASSERT_EQ(err_resp.getError(), ATOM_USER_ERRORS_BEGIN + 2);
+	ASSERT_EQ(err_resp.getErrorStr(), "this is an error!");
+
+	// Wait for the command thread to finish. It won't exit until it has
+	//	sent the last response
+	void *ret;
+	ASSERT_EQ(pthread_join(cmd_thread, &ret), 0);
+
+	// Give the dispatcher a chance to get the last response
+	for (int i = 0; i < 100; ++i) {
+		{
+			std::lock_guard<std::mutex> lock(count.first);
+			if (count.second == 1) {
+				break;
+			}
+		}
+		usleep(10000);
+	}
+	std::lock_guard<std::mutex> lock(count.first);
+	ASSERT_EQ(count.second, 1);
+}
+
+bool slow_callback_fn(
+	const uint8_t *data,
+	size_t data_len,
+	ElementResponse *resp,
+	void *user_data)
+{
+	usleep(500000);
+	resp->setData("slow");
+	return true;
+}
+
+bool fast_callback_fn(
+	const uint8_t *data,
+	size_t data_len,
+	ElementResponse *resp,
+	void *user_data)
+{
+	resp->setData("fast");
+	return true;
+}
+
+// Thread that creates a command element with a pool of workers. Does
+//	one read of the command stream per command
+void* command_element_workers(void *data)
+{
+	Element elem("test_workers");
+	elem.addCommand("slow", "takes a while", slow_callback_fn, NULL, 1000);
+	elem.addCommand("fast", "doesn't", fast_callback_fn, NULL, 1000);
+
+	elem.commandLoop(2, 2);
+	return NULL;
+}
+
+// Tests that a slow command doesn't hold up a fast one when the element
+//	is using workers
+TEST_F(ElementTest, command_workers) {
+	ElementResponse resp;
+
+	pthread_t cmd_thread;
+	ASSERT_EQ(pthread_create(&cmd_thread, NULL, command_element_workers, NULL), 0);
+	wait_for_element(element, "test_workers");
+
+	// Send the slow command and only wait for the ACK s.t. we know it's
+	//	been picked up on its own
+	ASSERT_EQ(element->sendCommand(resp, "test_workers", "slow", NULL, 0, false), ATOM_NO_ERROR);
+
+	// The fast command should come back while the slow one is running
+	auto start = std::chrono::steady_clock::now();
+	ASSERT_EQ(element->sendCommand(resp, "test_workers", "fast", NULL, 0), ATOM_NO_ERROR);
+	ASSERT_EQ(resp.getData(), "fast");
+	ASSERT_LT(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(400));
+
+	void *ret;
+	ASSERT_EQ(pthread_join(cmd_thread, &ret), 0);
+}
+
+// Typed command that takes a while and echoes its request
+class MsgpackSlowEcho : public CommandMsgpack<std::string, std::string> {
+public:
+	using CommandMsgpack<std::string, std::string>::CommandMsgpack;
+
+	virtual bool validate() { return true; }
+
+	virtual bool run() {
+		usleep(500000);
+		*res_data = *req_data;
+		return true;
+	}
+};
+
+// Thread that creates an element with a typed command and a pool of
+//	workers. Does one read of the command stream per command
+void* command_element_typed_workers(void *data)
+{
+	Element elem("test_typed_workers");
+	elem.addCommand(new MsgpackSlowEcho("echo", "slow echo", 1000));
+
+	elem.commandLoop(2, 2);
+	return NULL;
+}
+
+// Tests that calls of the same typed command run concurrently when the
+//	element is using workers, each with its own request and response
+TEST_F(ElementTest, command_workers_typed) {
+	pthread_t cmd_thread;
+	ASSERT_EQ(pthread_create(&cmd_thread, NULL, command_element_typed_workers, NULL), 0);
+	wait_for_element(element, "test_typed_workers");
+
+	msgpack::sbuffer req_a, req_b, res_a, res_b;
+	msgpack::pack(req_a, std::string("a"));
+	msgpack::pack(req_b, std::string("b"));
+	msgpack::pack(res_a, std::string("a"));
+	msgpack::pack(res_b, std::string("b"));
+
+	// Give the element time to read the first call on its own
+	auto start = std::chrono::steady_clock::now();
+	std::future<ElementResponse> future_a = element->sendCommandAsync(
+		"test_typed_workers", "echo", (const uint8_t *)req_a.data(), req_a.size());
+	usleep(100000);
+	std::future<ElementResponse> future_b = element->sendCommandAsync(
+		"test_typed_workers", "echo", (const uint8_t *)req_b.data(), req_b.size());
+
+	ElementResponse resp_a = future_a.get();
+	ElementResponse resp_b = future_b.get();
+	ASSERT_LT(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(900));
+
+	ASSERT_EQ(resp_a.isError(), false);
+	ASSERT_EQ(resp_a.getData(), std::string(res_a.data(), res_a.size()));
+	ASSERT_EQ(resp_b.isError(), false);
+	ASSERT_EQ(resp_b.getData(), std::string(res_b.data(), res_b.size()));
+
+	void *ret;
+	ASSERT_EQ(pthread_join(cmd_thread, &ret), 0);
+}
+
+// Thread that creates a command element with a slow command. Handles
+//	commands until a hello has been handled
+void* command_element_deadline(void *data)
+{
+	Element elem("test_deadline");
+	elem.addCommand("slow", "takes a while", slow_callback_fn, NULL, 1000);
+	elem.addCommand("hello", "hello, world", count_hello_callback_fn, NULL, 1000);
+
+	while (n_handled_commands < 1) {
+		elem.commandLoop(1);
+	}
+	return NULL;
+}
+
+// Tests that callers give up at their deadline and that the element drops
+//	commands whose deadline has passed by the time it gets to them
+TEST_F(ElementTest, command_deadline) {
+	ElementResponse resp;
+	n_handled_commands = 0;
+
+	pthread_t cmd_thread;
+	ASSERT_EQ(pthread_create(&cmd_thread, NULL, command_element_deadline, NULL), 0);
+	wait_for_element(element, "test_deadline");
+
+	// Nothing is sent if the deadline has already passed
+	ASSERT_EQ(element->sendCommand(resp, "test_deadline", "hello", NULL, 0, true, atom_time_ms() - 1), ATOM_COMMAND_NO_ACK);
+
+	// The slow command gets its ACK but not its response before the
+	//	deadline, even though the element said it would take up to 1 s
+	auto start = std::chrono::steady_clock::now();
+	ElementResponse slow_resp;
+	ASSERT_EQ(element->sendCommand(slow_resp, "test_deadline", "slow", NULL, 0, true, atom_deadline_ms(100)), ATOM_COMMAND_NO_RESPONSE);
+	ASSERT_LT(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(400));
+
+	// The element is still busy with it, so this one doesn't get an ACK
+	//	in time and should be dropped once the element gets to it
+	ElementResponse late_resp;
+	ASSERT_EQ(element->sendCommand(late_resp, "test_deadline", "hello", NULL, 0, true, atom_deadline_ms(100)), ATOM_COMMAND_NO_ACK);
+
+	// And one without a deadline waits for the element to catch up
+	ElementResponse ok_resp;
+	ASSERT_EQ(element->sendCommand(ok_resp, "test_deadline", "hello", NULL, 0), ATOM_NO_ERROR);
+	ASSERT_EQ(ok_resp.getData(), "world");
+
+	void *ret;
+	ASSERT_EQ(pthread_join(cmd_thread, &ret), 0);
+	ASSERT_EQ(n_handled_commands, 1);
+}
+
+// Number of command group replicas that have finished up
+std::atomic<int> n_replicas_done;
+
+struct replica_args {
+	int n_commands;
+	const char *consumer;
+};
+
+// Thread that creates one replica of an element sharing its commands with
+//	the others through a consumer group
+void* command_element_replica(void *data)
+{
+	struct replica_args *args = (struct replica_args *)data;
+
+	Element elem("test_group");
+	elem.useCommandGroup("", args->consumer);
+	elem.addCommand("hello", "hello, world", count_hello_callback_fn, NULL, 1000);
+
+	while (n_handled_commands < args->n_commands) {
+		elem.commandLoop(1);
+	}
+	n_replicas_done++;
+	return NULL;
+}
+
+// Tests that replicas in a command group each handle a share of the
+//	commands and that no command is handled twice
+TEST_F(ElementTest, command_group) {
+	ElementResponse resp;
+	int n_commands = 10;
+	n_handled_commands = 0;
+	n_replicas_done = 0;
+
+	struct replica_args replica_a = { n_commands, "replica_a" };
+	struct replica_args replica_b = { n_commands, "replica_b" };
+	pthread_t thread_a, thread_b;
+	ASSERT_EQ(pthread_create(&thread_a, NULL, command_element_replica, &replica_a), 0);
+	ASSERT_EQ(pthread_create(&thread_b, NULL, command_element_replica, &replica_b), 0);
+	wait_for_element(element, "test_group");
+
+	std::vector<std::future<ElementResponse>> futures;
+	for (int i = 0; i < n_commands; ++i) {
+		futures.push_back(element->sendCommandAsync("test_group", "hello", NULL, 0));
+	}
+	for (auto &f : futures) {
+		ElementResponse f_resp = f.get();
+		ASSERT_EQ(f_resp.isError(), false);
+		ASSERT_EQ(f_resp.getData(), "world");
+	}
+	ASSERT_EQ(n_handled_commands, n_commands);
+
+	// Wake up whichever replicas are still waiting on a command
+	while (n_replicas_done < 2) {
+		ASSERT_EQ(element->sendCommand(resp, "test_group", "hello", NULL, 0, false), ATOM_NO_ERROR);
+	}
+
+	void *ret;
+	ASSERT_EQ(pthread_join(thread_a, &ret), 0);
+	ASSERT_EQ(pthread_join(thread_b, &ret), 0);
+}
+
+// Tests that a command left pending by a consumer that went away is
+//	claimed and handled by another replica
+TEST_F(ElementTest, command_group_claim) {
+	Element replica("test_claim");
+	replica.useCommandGroup("", "alive", 100);
+	replica.addCommand("hello", "hello, world", count_hello_callback_fn, NULL, 1000);
+
+	// Put a command on the stream and have a consumer that never finishes
+	//	it take it
+	redisContext *ctx = redis_context_init();
+	redisReply *reply = (redisReply *)redisCommand(ctx,
+		"XADD command:test_claim * element testing cmd hello");
+	ASSERT_NE(reply, (redisReply*)NULL);
+	freeReplyObject(reply);
+	reply = (redisReply *)redisCommand(ctx,
+		"XREADGROUP GROUP test_claim crashed COUNT 1 STREAMS command:test_claim >");
+	ASSERT_NE(reply, (redisReply*)NULL);
+	ASSERT_EQ(reply->type, REDIS_REPLY_ARRAY);
+	freeReplyObject(reply);
+
+	// Once it's been idle long enough the replica should pick it up
+	usleep(200000);
+	n_handled_commands = 0;
+	ASSERT_EQ(replica.commandLoop(1), ATOM_NO_ERROR);
+	ASSERT_EQ(n_handled_commands, 1);
+	ASSERT_EQ(redis_xpending(ctx, "command:test_claim", "test_claim", "crashed", 1), 0);
+	ASSERT_EQ(redis_xpending(ctx, "command:test_claim", "test_claim", "alive", 1), 0);
+
+	redis_context_cleanup(ctx);
+}
+
+// Thread that creates an element with a fast command. Handles two commands
+void* command_element_fast(void *data)
+{
+	Element elem("test_fast");
+	elem.addCommand("fast", "fast command", fast_callback_fn, NULL, 1000, true);
+
+	elem.commandLoop(2);
+	return NULL;
+}
+
+// Tests calling a fast command both with and without the fast path
+TEST_F(ElementTest, fast_commands) {
+	pthread_t cmd_thread;
+	ASSERT_EQ(pthread_create(&cmd_thread, NULL, command_element_fast, NULL), 0);
+	wait_for_element(element, "test_fast");
+
+	// The fast path only waits on the response
+	ElementResponse fast_resp;
+	ASSERT_EQ(element->sendCommandFast(fast_resp, "test_fast", "fast", NULL, 0, 1000), ATOM_NO_ERROR);
+	ASSERT_EQ(fast_resp.getData(), "fast");
+
+	// And callers that don't know the command is fast still get an ACK
+	ElementResponse resp;
+	ASSERT_EQ(element->sendCommand(resp, "test_fast", "fast", NULL, 0), ATOM_NO_ERROR);
+	ASSERT_EQ(resp.getData(), "fast");
+
+	void *ret;
+	ASSERT_EQ(pthread_join(cmd_thread, &ret), 0);
+}
+
+// Counts the entries read by run()
+bool count_entries_fn(
+	Entry &e,
+	void *user_data)
+{
+	(*(std::atomic<int> *)user_data)++;
+	return true;
+}
+
+// Counts entries slowly
+bool slow_count_entries_fn(
+	Entry &e,
+	void *user_data)
+{
+	usleep(20000);
+	(*(std::atomic<int> *)user_data)++;
+	return true;
+}
+
+// Tests that a slow handler on its own thread with a small queue drops
+//	entries rather than holding up the handler on the pool
+TEST_F(ElementTest, read_loop_executors) {
+	HandlerPool pool(2);
+	std::atomic<int> n_slow(0);
+	std::atomic<int> n_fast(0);
+	int n_entries = 20;
+
+	ElementReadMap m;
+	m.addHandler("testing", "slow", {"hello"}, slow_count_entries_fn, &n_slow,
+		ReadPolicy(), HandlerExecutor::dedicated(2));
+	m.addHandler("testing", "fast", {"hello"}, count_entries_fn, &n_fast,
+		ReadPolicy(), HandlerExecutor::shared(pool));
+
+	std::thread writer([&]() {
+		usleep(100000);
+		entry_data_t data;
+		data["hello"] = "world";
+		for (int i = 0; i < n_entries; ++i) {
+			element->entryWrite("slow", data);
+			element->entryWrite("fast", data);
+			usleep(1000);
+		}
+	});
+	ASSERT_EQ(element->entryReadLoop(m, n_entries), ATOM_NO_ERROR);
+	writer.join();
+
+	// Everything that was queued has been handled once the loop returns
+	ASSERT_EQ(n_fast, n_entries);
+	ASSERT_EQ(m.getNumQueueDropped(1), 0);
+	ASSERT_GT(m.getNumQueueDropped(0), 0);
+	ASSERT_EQ(n_slow + m.getNumQueueDropped(0), n_entries);
+	ASSERT_LE(m.getMaxQueueDepth(0), 2);
+	ASSERT_EQ(m.getQueueDepth(0), 0);
+}
+
+// Tests reading more streams than fit in one XREAD, with entries of more
+//	keys than used to fit in an XADD
+TEST_F(ElementTest, read_loop_many_streams) {
+	std::atomic<int> n_read(0);
+	int n_streams = 3 * ELEMENT_READ_LOOP_MAX_STREAMS + 10;
+	int n_keys = 40;
+
+	std::vector<std::string> keys;
+	entry_data_t data;
+	for (int k = 0; k < n_keys; ++k) {
+		keys.push_back("key" + std::to_string(k));
+		data[keys.back()] = std::to_string(k);
+	}
+
+	ElementReadMap m;
+	for (int i = 0; i < n_streams; ++i) {
+		m.addHandler("testing", "many" + std::to_string(i), keys,
+			count_entries_fn, &n_read);
+	}
+
+	std::thread writer([&]() {
+		usleep(100000);
+		for (int i = 0; i < n_streams; ++i) {
+			element->entryWrite("many" + std::to_string(i), data);
+		}
+	});
+	ASSERT_EQ(element->entryReadLoop(m, 1), ATOM_NO_ERROR);
+	writer.join();
+	ASSERT_EQ(n_read, n_streams);
+
+	std::vector<Entry> ret;
+	ASSERT_EQ(element->entryReadN("testing", "many0", keys, 1, ret), ATOM_NO_ERROR);
+	ASSERT_EQ(ret.size(), 1);
+	ASSERT_EQ(ret[0].size(), n_keys);
+	ASSERT_EQ(ret[0].getKey("key39"), "39");
+
+	ContextPoolStats stats = element->getContextPoolStats();
+	ASSERT_EQ(stats.n_in_use, 0);
+}
+
+// Tests running commands, reads, async commands and a user fd on a single
+//	thread with run()
+TEST_F(ElementTest, run_loop) {
+	Element *reactor = new Element("test_run");
+	reactor->addCommand("hello", "hello, world", hello_callback_fn, NULL, 1000);
+
+	std::atomic<int> n_entries(0);
+	ElementReadMap m;
+	m.addHandler("testing", "run_stream", {"hello"}, count_entries_fn, &n_entries);
+
+	int fds[2];
+	ASSERT_EQ(pipe(fds), 0);
+	std::atomic<bool> fd_read(false);
+	reactor->getEventLoop().addFd(fds[0], EPOLLIN, [&](uint32_t events) {
+		char c;
+		ASSERT_EQ(read(fds[0], &c, 1), 1);
+		fd_read = true;
+	});
+
+	enum atom_error_t run_err = ATOM_INTERNAL_ERROR;
+	std::thread run_thread([&]() { run_err = reactor->run(m); });
+
+	// Commands are handled once the loop is up
+	ElementResponse resp;
+	ASSERT_EQ(element->sendCommand(resp, "test_run", "hello", NULL, 0), ATOM_NO_ERROR);
+	ASSERT_EQ(resp.getData(), "world");
+
+	// Entries on the stream go to the handler
+	entry_data_t data;
+	data["hello"] = "world";
+	for (int i = 0; i < 5; ++i) {
+		ASSERT_EQ(element->entryWrite("run_stream", data), ATOM_NO_ERROR);
+	}
+
+	// Async commands from the reactor get their responses through it
+	int n_total = 1;
+	n_handled_commands = 0;
+	pthread_t cmd_thread;
+	ASSERT_EQ(pthread_create(&cmd_thread, NULL, command_element_n, &n_total), 0);
+	wait_for_element(element, "test_cmd");
+	std::future<ElementResponse> future = reactor->sendCommandAsync("test_cmd", "hello", NULL, 0);
+	ElementResponse async_resp = future.get();
+	ASSERT_EQ(async_resp.getData(), "world");
+	void *ret;
+	ASSERT_EQ(pthread_join(cmd_thread, &ret), 0);
+
+	// And so do user fds
+	ASSERT_EQ(write(fds[1], "x", 1), 1);
+
+	for (int i = 0; i < 100; ++i) {
+		if ((n_entries == 5) && fd_read) {
+			break;
+		}
+		usleep(10000);
+	}
+	ASSERT_EQ(n_entries.load(), 5);
+	ASSERT_EQ(fd_read.load(), true);
+
+	reactor->stop();
+	run_thread.join();
+	ASSERT_EQ(run_err, ATOM_NO_ERROR);
+
+	reactor->getEventLoop().removeFd(fds[0]);
+	close(fds[0]);
+	close(fds[1]);
+	delete reactor;
+}
+
 // Tests sendCommand and commandLoop
 TEST_F(ElementTest, basic_commands) {
 	ElementResponse resp;
@@ -554,6 +1925,108 @@ TEST_F(ElementTest, msgpack_command) {
 	ASSERT_EQ(pthread_join(cmd_thread, &ret), 0);
 }
 
+// Thread that creates an element with a single msgpack command and
+//	handles three calls of it, plus two calls of a command that builds up
+//	its response
+void* command_element_msgpack_reuse(void *data)
+{
+	Element elem("test_reuse");
+	elem.addCommand(
+		new MsgpackHello("hello_msgpack", "tests msgpack hello world", 1000));
+	elem.addCommand(
+		new MsgpackAppend("append", "appends the request to the response", 1000));
+
+	elem.commandLoop(5);
+	return NULL;
+}
+
+// Tests that the recycled state of a msgpack command doesn't leak from one
+//	call into the next
+TEST_F(ElementTest, msgpack_command_reuse) {
+	pthread_t cmd_thread;
+	ASSERT_EQ(pthread_create(&cmd_thread, NULL, command_element_msgpack_reuse, NULL), 0);
+	wait_for_element(element, "test_reuse");
+
+	ElementResponse resp;
+	std::string req = "hello";
+	std::string res;
+	ASSERT_EQ((element->sendCommand<std::string, std::string>(resp, "test_reuse", "hello_msgpack", req, res)), ATOM_NO_ERROR);
+	ASSERT_EQ(res, "world");
+
+	// A call that fails validation
+	ElementResponse err_resp;
+	std::string bad_req = "goodbye";
+	ASSERT_EQ((element->sendCommand<std::string, std::string>(err_resp, "test_reuse", "hello_msgpack", bad_req, res)), ATOM_USER_ERRORS_BEGIN + COMMAND_ERROR_VALIDATE);
+
+	// And the next call should succeed as if it were the first
+	ElementResponse ok_resp;
+	res = "";
+	ASSERT_EQ((element->sendCommand<std::string, std::string>(ok_resp, "test_reuse", "hello_msgpack", req, res)), ATOM_NO_ERROR);
+	ASSERT_EQ(ok_resp.isError(), false);
+	ASSERT_EQ(res, "world");
+
+	// Two calls in a row should each only see their own request
+	ElementResponse append_resp;
+	std::string append_req = "a";
+	std::vector<std::string> append_res;
+	ASSERT_EQ((element->sendCommand<std::string, std::vector<std::string>>(append_resp, "test_reuse", "append", append_req, append_res)), ATOM_NO_ERROR);
+	ASSERT_EQ(append_res, std::vector<std::string>({"a"}));
+
+	ElementResponse next_resp;
+	append_req = "b";
+	append_res.clear();
+	ASSERT_EQ((element->sendCommand<std::string, std::vector<std::string>>(next_resp, "test_reuse", "append", append_req, append_res)), ATOM_NO_ERROR);
+	ASSERT_EQ(append_res, std::vector<std::string>({"b"}));
+
+	void *ret;
+	ASSERT_EQ(pthread_join(cmd_thread, &ret), 0);
+}
+
+// Number of calls to the hooks of the counting callback command
+std::atomic<int> n_callback_init;
+std::atomic<int> n_callback_cleanup;
+
+// Callback command that counts the calls to its hooks
+class CountingCallback : public CommandUserCallback {
+public:
+	using CommandUserCallback::CommandUserCallback;
+
+	virtual void init() { n_callback_init++; }
+	virtual void cleanup() { n_callback_cleanup++; }
+};
+
+// Thread that creates an element with a counting callback command and
+//	handles two calls of it
+void* command_element_callback_hooks(void *data)
+{
+	Element elem("test_hooks");
+	elem.addCommand(new CountingCallback(
+		"hello", "hello, world", hello_callback_fn, NULL, 1000));
+
+	elem.commandLoop(2);
+	return NULL;
+}
+
+// Tests that callback commands go through init() and cleanup() on each call
+TEST_F(ElementTest, callback_command_hooks) {
+	n_callback_init = 0;
+	n_callback_cleanup = 0;
+	pthread_t cmd_thread;
+	ASSERT_EQ(pthread_create(&cmd_thread, NULL, command_element_callback_hooks, NULL), 0);
+	wait_for_element(element, "test_hooks");
+
+	for (int i = 0; i < 2; ++i) {
+		ElementResponse resp;
+		ASSERT_EQ(element->sendCommand(resp, "test_hooks", "hello", NULL, 0), ATOM_NO_ERROR);
+		ASSERT_EQ(resp.getData(), "world");
+	}
+
+	void *ret;
+	ASSERT_EQ(pthread_join(cmd_thread, &ret), 0);
+	ASSERT_EQ(n_callback_init, 2);
+	ASSERT_EQ(n_callback_cleanup, 2);
+}
+
 // Tests no request
 TEST_F(ElementTest, msgpack_noreq) {
 	ElementResponse resp;
@@ -715,6 +2188,26 @@ TEST_F(ElementTest, invalid_logs) {
 	ASSERT_THROW(element->log(8, "testing: 1, 2, 3"), std::runtime_error);
 }
 
+// Tests that logs more verbose than the log level aren't sent
+TEST_F(ElementTest, log_level) {
+	ASSERT_EQ(atom_log_set_level(LOG_INFO), ATOM_NO_ERROR);
+	ASSERT_EQ(atom_log_get_level(), LOG_INFO);
+	ASSERT_FALSE(ATOM_LOG_ENABLED(LOG_DEBUG));
+	ASSERT_TRUE(ATOM_LOG_ENABLED(LOG_INFO));
+
+	element->log(LOG_DEBUG, "dropped");
+	element->log(LOG_INFO, "kept");
+	ASSERT_EQ(atom_log_set_level(LOG_DEBUG), ATOM_NO_ERROR);
+	ASSERT_EQ(atom_log_set_level(LOG_DEBUG + 1), ATOM_COMMAND_INVALID_DATA);
+	element->logFlush();
+
+	std::vector<Entry> ret;
+	std::vector<std::string> keys = {"level", "msg"};
+	ASSERT_EQ(element->entryReadN("", "log", keys, 10, ret), ATOM_NO_ERROR);
+	ASSERT_EQ(ret.size(), 1);
+	ASSERT_EQ(ret[0].getKey("msg"), "kept");
+}
+
 // Tests readSince API
 TEST_F(ElementTest, readSinceLog) {
 	char hostname[HOST_NAME_MAX + 1];
@@ -726,6 +2219,9 @@ TEST_F(ElementTest, readSinceLog) {
 		element->log(0, "%d", i);
 	}
 
+	// Logs are written in the background
+	element->logFlush();
+
 	// Do the read back
 	std::vector<Entry> ret;
 	std::vector<std::string> keys = {"level", "element", "msg", "host"};
@@ -12,6 +12,12 @@ REDIS_PIPELINE_POOL_SIZE = 20
 DEFAULT_REDIS_SOCKET = "/shared/redis.sock"
 DEFAULT_METRICS_SOCKET = "/shared/metrics.sock"
 
+# Registry of elements and "element:stream" data streams, kept in sync with
+#   the C library s.t. they can be found without scanning the keyspace
+REGISTRY_ELEMENTS = "registry:elements"
+REGISTRY_STREAMS = "registry:streams"
+REGISTRY_VERSION = "registry:version"
+
 # Error codes
 ATOM_NO_ERROR = 0
 ATOM_INTERNAL_ERROR = 1
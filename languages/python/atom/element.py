@@ -54,6 +54,9 @@ from atom.config import (
     METRICS_TYPE_LABEL,
     OVERRIDE_PARAM_FIELD,
     REDIS_PIPELINE_POOL_SIZE,
+    REGISTRY_ELEMENTS,
+    REGISTRY_STREAMS,
+    REGISTRY_VERSION,
     RESERVED_COMMANDS,
     RESERVED_PARAM_FIELDS,
     RESPONSE_TIMEOUT,
@@ -432,6 +435,10 @@ class Element:
         # increment global element ref counter
         self._increment_command_group_counter(_pipe)
 
+        # register s.t. we can be found without a scan
+        _pipe.zadd(REGISTRY_ELEMENTS, {self.name: 0})
+        _pipe.incr(REGISTRY_VERSION)
+
         _pipe.xadd(
             self._make_response_id(self.name),
             {"language": LANG, "version": VERSION},
@@ -525,6 +532,7 @@ class Element:
                 )
 
             self.streams.remove(stream)
+            self._registry_update(REGISTRY_STREAMS, f"{element_name}:{stream}", False)
 
         self._rclient.unlink(self._make_stream_id(element_name, stream))
 
@@ -571,6 +579,7 @@ class Element:
             self._rclient.unlink(self._make_response_id(self.name))
             self._rclient.unlink(self._make_command_id(self.name))
             self._rclient.unlink(self._make_consumer_group_counter(self.name))
+            self._registry_update(REGISTRY_ELEMENTS, self.name, False)
         except redis.exceptions.RedisError:
             raise Exception("Could not connect to nucleus!")
 
@@ -864,6 +873,24 @@ class Element:
 
         return serialization
 
+    def _registry_update(self, key: str, member: str, add: bool) -> None:
+        """
+        Adds or removes a member of a registry and bumps the registry version
+        s.t. anyone caching it knows to read it again.
+
+        Args:
+            key: Registry to update
+            member: Element or "element:stream" to add or remove
+            add: Whether to add or remove the member
+        """
+        with RedisPipeline(self) as redis_pipeline:
+            if add:
+                redis_pipeline.zadd(key, {member: 0})
+            else:
+                redis_pipeline.zrem(key, member)
+            redis_pipeline.incr(REGISTRY_VERSION)
+            redis_pipeline.execute()
+
     def _redis_scan_keys(self, pattern: str) -> list[str]:
         """
         Scan redis for all keys matching the pattern. Will use redis SCAN under
@@ -1462,6 +1489,19 @@ class Element:
                     )
                     continue
 
+                # Callers can send along when they'll give up on the command,
+                #   in milliseconds since the epoch. If that's passed then no
+                #   one is waiting on it anymore, so don't bother
+                deadline = cmd.get(b"deadline")
+                if deadline is not None and time.time() * 1000 >= int(deadline):
+                    self.logger.warning(
+                        "Dropping command %s past its deadline" % (cmd_id,)
+                    )
+                    self.metrics_add(
+                        f"atom:command_loop:worker{worker_num}:expired", 1
+                    )
+                    continue
+
                 # Send acknowledge to caller
                 if cmd_name not in self.timeouts.keys():
                     timeout = RESPONSE_TIMEOUT
@@ -2311,8 +2351,11 @@ class Element:
             # Assign default element name if not specified
             element_name = element_name if element_name else self.name
 
-            if element_name == self.name:
+            if element_name == self.name and stream_name not in self.streams:
                 self.streams.add(stream_name)
+                self._registry_update(
+                    REGISTRY_STREAMS, f"{element_name}:{stream_name}", True
+                )
 
             field_data_map = format_redis_py(field_data_map)
 
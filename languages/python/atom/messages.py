@@ -6,10 +6,11 @@ from typing import Any, Callable, Optional, Union, cast, overload
 import atom.serialization as atom_ser
 from typing_extensions import Literal
 
-CMD_RESERVED_KEYS = ("data", "cmd", "element", "ser")
+CMD_RESERVED_KEYS = ("data", "cmd", "element", "ser", "cmp")
 RES_RESERVED_KEYS = ("data", "err_code", "err_str", "element", "cmd", "cmd_id", "ser")
-# "ser" overwritten on write; "id" overwritten on read; "meta" maybe overwritten
-ENTRY_RESERVED_KEYS = ("ser", "id", "meta")
+# "ser" overwritten on write; "id" overwritten on read; "meta" maybe overwritten;
+# "cmp" marks values compressed by the C/C++ clients
+ENTRY_RESERVED_KEYS = ("ser", "id", "meta", "cmp")
 
 
 @overload